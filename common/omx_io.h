@@ -40,7 +40,7 @@
  * or modified, or when the user-mapped driver- and endpoint-descriptors
  * are modified.
  */
-#define OMX_DRIVER_ABI_VERSION		0x20f
+#define OMX_DRIVER_ABI_VERSION		0x219
 
 /************************
  * Common parameters or IOCTL subtypes
@@ -84,6 +84,13 @@ typedef uint32_t omx_eventq_index_t;
 #endif
 #define OMX_EXP_EVENTQ_SIZE		(OMX_EVENTQ_ENTRY_SIZE * OMX_EXP_EVENTQ_ENTRY_NR)
 #define OMX_UNEXP_EVENTQ_SIZE		(OMX_EVENTQ_ENTRY_SIZE * OMX_UNEXP_EVENTQ_ENTRY_NR)
+/* cmdq: where tiny, notify and liback commands are submitted, one struct omx_cmd_send_batch_entry each */
+#define OMX_CMDQ_ENTRY_NR	256UL
+#define OMX_CMDQ_ENTRY_SHIFT	6
+#define OMX_CMDQ_ENTRY_SIZE	(1UL << OMX_CMDQ_ENTRY_SHIFT)
+#define OMX_CMDQ_SIZE		(OMX_CMDQ_ENTRY_NR << OMX_CMDQ_ENTRY_SHIFT)
+
+/* maximal number of event slots that user-space processes before releasing them */
 #define OMX_EXP_RELEASE_SLOTS_BATCH_NR		(OMX_EXP_EVENTQ_ENTRY_NR/4)
 #define OMX_UNEXP_RELEASE_SLOTS_BATCH_NR	(OMX_UNEXP_EVENTQ_ENTRY_NR/4)
 
@@ -160,6 +167,19 @@ struct omx_endpoint_desc {
 	uint32_t session_id;
 	uint32_t user_event_index;
 	/* 24 */
+	/* next event slots that user-space will process, the previous ones are released */
+	uint32_t exp_eventq_index;
+	uint32_t unexp_eventq_index;
+	/* 32 */
+	/* cmdq entries before the submitted index were written by user-space,
+	 * the ones before the consumed index were processed by the driver
+	 */
+	uint32_t cmdq_submitted_index;
+	uint32_t cmdq_consumed_index;
+	/* 40 */
+	uint32_t cmdq_flags;
+	uint32_t pad;
+	/* 48 */
 };
 
 #define OMX_ENDPOINT_DESC_SIZE	sizeof(struct omx_endpoint_desc)
@@ -180,6 +200,7 @@ struct omx_endpoint_desc {
 #define OMX_UNEXP_EVENTQ_FILE_OFFSET	(4*4096)
 #define OMX_DRIVER_DESC_FILE_OFFSET	(5*4096)
 #define OMX_ENDPOINT_DESC_FILE_OFFSET	(6*4096)
+#define OMX_CMDQ_FILE_OFFSET		(7*4096)
 
 #define OMX_NO_WAKEUP_JIFFIES 0
 
@@ -190,6 +211,11 @@ struct omx_endpoint_desc {
 #define OMX_ENDPOINT_DESC_STATUS_IFACE_REMOVED (1ULL << 4)
 #define OMX_ENDPOINT_DESC_STATUS_IFACE_HIGH_INTRCOAL (1ULL << 5)
 
+/* a kernel thread drains the cmdq without any doorbell */
+#define OMX_ENDPOINT_DESC_CMDQ_POLLED (1U << 0)
+/* the polling thread is idle, the next submission must ring the doorbell */
+#define OMX_ENDPOINT_DESC_CMDQ_NEED_WAKEUP (1U << 1)
+
 #define OMX_BOARD_INFO_STATUS_DOWN (1ULL << 0)
 #define OMX_BOARD_INFO_STATUS_BAD_MTU (1ULL << 1)
 #define OMX_BOARD_INFO_STATUS_HIGH_INTRCOAL (1ULL << 2)
@@ -376,6 +402,30 @@ struct omx_cmd_send_mediumsq_frag {
 	/* 40 */
 };
 
+/* maximal number of sendq frags described by a single OMX_CMD_SEND_MEDIUMSQ */
+#define OMX_SEND_MEDIUMSQ_FRAGS_NR_MAX	32
+
+struct omx_cmd_send_mediumsq {
+	uint16_t peer_index;
+	uint8_t dest_endpoint;
+	uint8_t shared;
+	uint32_t session_id;
+	/* 8 */
+	uint16_t seqnum;
+	uint16_t piggyack;
+	uint32_t msg_length;
+	/* 16 */
+	uint16_t checksum;
+	uint8_t frags_nr;
+	uint8_t frag_pipeline;
+	uint32_t pad;
+	/* 24 */
+	uint64_t match_info;
+	/* 32 */
+	uint16_t sendq_index[OMX_SEND_MEDIUMSQ_FRAGS_NR_MAX]; /* sendq entry of each frag, in order */
+	/* 96 */
+};
+
 struct omx_cmd_send_mediumva {
 	uint16_t peer_index;
 	uint8_t dest_endpoint;
@@ -500,6 +550,30 @@ struct omx_cmd_send_liback {
 	/* 24 */
 };
 
+/* one tiny, notify or liback command in a OMX_CMD_XEN_SEND_BATCH array or in the cmdq */
+struct omx_cmd_send_batch_entry {
+	uint32_t cmd; /* OMX_CMD_SEND_TINY, OMX_CMD_SEND_NOTIFY or OMX_CMD_SEND_LIBACK */
+	int16_t status; /* filled by the driver or the backend */
+	uint16_t pad;
+	/* 8 */
+	union {
+		struct omx_cmd_send_tiny tiny;
+		struct omx_cmd_send_notify notify;
+		struct omx_cmd_send_liback liback;
+	} u;
+	/* 64 */
+};
+
+#define OMX_SEND_BATCH_ENTRY_NR_MAX	16
+
+struct omx_cmd_send_batch {
+	uint32_t nr_entries;
+	uint32_t pad;
+	/* 8 */
+	uint64_t entries; /* array of struct omx_cmd_send_batch_entry */
+	/* 16 */
+};
+
 struct omx_cmd_create_user_region {
 	uint32_t nr_segments;
 	uint32_t id;
@@ -539,11 +613,14 @@ struct omx_cmd_wait_event {
 	/* 16 */
 	uint64_t jiffies_expire; /* absolute jiffies where to wakeup, or OMX_CMD_WAIT_EVENT_TIMEOUT_INFINITE */
 	/* 24 */
+	uint32_t waiter_id; /* non-zero, lets the wakeup command target this waiter only */
+	uint32_t pad2;
+	/* 32 */
 };
 
 struct omx_cmd_wakeup {
 	uint32_t status;
-	uint32_t pad;
+	uint32_t waiter_id; /* 0 to wakeup all waiters */
 	/* 8 */
 };
 
@@ -575,6 +652,8 @@ struct omx_cmd_wakeup {
 #define OMX_CMD_RECV_MEDIUM_FRAG		0xe0
 #define OMX_CMD_XEN_SEND_MEDIUMSQ_DONE          0xe1
 #define OMX_CMD_XEN_DUMMY                       0xe2
+#define OMX_CMD_XEN_RECV_WAKEUP                 0xe3
+#define OMX_CMD_XEN_FORGET_USER_SEGMENT         0xe4
 
 struct omx_cmd_bench {
 	struct omx_cmd_bench_hdr {
@@ -636,21 +715,25 @@ struct omx_cmd_bench {
 #define OMX_EPCMD_WAKEUP		0xe
 #define OMX_EPCMD_RELEASE_EXP_SLOTS	0xf
 #define OMX_EPCMD_RELEASE_UNEXP_SLOTS	0x10
-#define OMX_EPCMD_XEN_OPEN_ENDPOINT	0x11
-#define OMX_EPCMD_XEN_CLOSE_ENDPOINT	0x12
-#define OMX_EPCMD_XEN_CREATE_USER_REGION	0x13
-#define OMX_EPCMD_XEN_DESTROY_USER_REGION	0x14
-#define OMX_EPCMD_XEN_GET_BOARD_INFO		0x15
-#define OMX_EPCMD_XEN_SEND_NOTIFY		0x16
-#define OMX_EPCMD_XEN_SEND_CONNECT_REQUEST	0x17
-#define OMX_EPCMD_XEN_SEND_CONNECT_REPLY	0x18
-#define OMX_EPCMD_XEN_SEND_LIBACK		0x19
-#define OMX_EPCMD_XEN_SEND_RNDV			0x1a
-#define OMX_EPCMD_XEN_SEND_TINY			0x1b
-#define OMX_EPCMD_XEN_PULL			0x1c
-#define OMX_EPCMD_XEN_SEND_SMALL		0x1d
-#define OMX_EPCMD_XEN_SEND_MEDIUMVA		0x1e
-#define OMX_EPCMD_XEN_SEND_MEDIUMSQ_FRAG	0x1f
+#define OMX_EPCMD_SEND_MEDIUMSQ		0x11
+#define OMX_EPCMD_CMDQ_DOORBELL		0x12
+#define OMX_EPCMD_XEN_OPEN_ENDPOINT	0x13
+#define OMX_EPCMD_XEN_CLOSE_ENDPOINT	0x14
+#define OMX_EPCMD_XEN_CREATE_USER_REGION	0x15
+#define OMX_EPCMD_XEN_DESTROY_USER_REGION	0x16
+#define OMX_EPCMD_XEN_GET_BOARD_INFO		0x17
+#define OMX_EPCMD_XEN_SEND_NOTIFY		0x18
+#define OMX_EPCMD_XEN_SEND_CONNECT_REQUEST	0x19
+#define OMX_EPCMD_XEN_SEND_CONNECT_REPLY	0x1a
+#define OMX_EPCMD_XEN_SEND_LIBACK		0x1b
+#define OMX_EPCMD_XEN_SEND_RNDV			0x1c
+#define OMX_EPCMD_XEN_SEND_TINY			0x1d
+#define OMX_EPCMD_XEN_PULL			0x1e
+#define OMX_EPCMD_XEN_SEND_SMALL		0x1f
+#define OMX_EPCMD_XEN_SEND_MEDIUMVA		0x20
+#define OMX_EPCMD_XEN_SEND_MEDIUMSQ_FRAG	0x21
+#define OMX_EPCMD_XEN_SEND_BATCH		0x22
+#define OMX_EPCMD_XEN_SEND_MEDIUMSQ		0x23
 #define OMX_CMD_BENCH			_IOR(OMX_CMD_MAGIC, 0x80 + OMX_EPCMD_BENCH, struct omx_cmd_bench)
 #define OMX_CMD_SEND_TINY		_IOR(OMX_CMD_MAGIC, 0x80 + OMX_EPCMD_SEND_TINY, struct omx_cmd_send_tiny)
 #define OMX_CMD_SEND_SMALL		_IOR(OMX_CMD_MAGIC, 0x80 + OMX_EPCMD_SEND_SMALL, struct omx_cmd_send_small)
@@ -668,6 +751,8 @@ struct omx_cmd_bench {
 #define OMX_CMD_WAKEUP			_IOR(OMX_CMD_MAGIC, 0x80 + OMX_EPCMD_WAKEUP, struct omx_cmd_wakeup)
 #define OMX_CMD_RELEASE_EXP_SLOTS	_IO(OMX_CMD_MAGIC, 0x80 + OMX_EPCMD_RELEASE_EXP_SLOTS)
 #define OMX_CMD_RELEASE_UNEXP_SLOTS	_IO(OMX_CMD_MAGIC, 0x80 + OMX_EPCMD_RELEASE_UNEXP_SLOTS)
+#define OMX_CMD_SEND_MEDIUMSQ		_IOR(OMX_CMD_MAGIC, 0x80 + OMX_EPCMD_SEND_MEDIUMSQ, struct omx_cmd_send_mediumsq)
+#define OMX_CMD_CMDQ_DOORBELL		_IO(OMX_CMD_MAGIC, 0x80 + OMX_EPCMD_CMDQ_DOORBELL)
 #define OMX_CMD_XEN_OPEN_ENDPOINT	_IOR(OMX_CMD_MAGIC, 0x80 + OMX_EPCMD_XEN_OPEN_ENDPOINT, struct omx_cmd_open_endpoint)
 #define OMX_CMD_XEN_CLOSE_ENDPOINT	_IOR(OMX_CMD_MAGIC, 0x80 + OMX_EPCMD_XEN_CLOSE_ENDPOINT, struct omx_cmd_open_endpoint)
 #define OMX_CMD_XEN_CREATE_USER_REGION  _IOR(OMX_CMD_MAGIC, 0x80 + OMX_EPCMD_XEN_CREATE_USER_REGION, struct omx_cmd_create_user_region)
@@ -683,6 +768,8 @@ struct omx_cmd_bench {
 #define OMX_CMD_XEN_SEND_SMALL		_IOR(OMX_CMD_MAGIC, 0x80 + OMX_EPCMD_XEN_SEND_SMALL, struct omx_cmd_send_small)
 #define OMX_CMD_XEN_SEND_MEDIUMVA	_IOR(OMX_CMD_MAGIC, 0x80 + OMX_EPCMD_XEN_SEND_MEDIUMVA, struct omx_cmd_send_mediumva)
 #define OMX_CMD_XEN_SEND_MEDIUMSQ_FRAG	_IOR(OMX_CMD_MAGIC, 0x80 + OMX_EPCMD_XEN_SEND_MEDIUMSQ_FRAG, struct omx_cmd_send_mediumsq_frag)
+#define OMX_CMD_XEN_SEND_BATCH		_IOR(OMX_CMD_MAGIC, 0x80 + OMX_EPCMD_XEN_SEND_BATCH, struct omx_cmd_send_batch)
+#define OMX_CMD_XEN_SEND_MEDIUMSQ	_IOR(OMX_CMD_MAGIC, 0x80 + OMX_EPCMD_XEN_SEND_MEDIUMSQ, struct omx_cmd_send_mediumsq)
 
 
 static inline __pure const char *
@@ -757,6 +844,10 @@ omx_strcmd(unsigned cmd)
 		return "Release Expected Event Slots";
 	case OMX_CMD_RELEASE_UNEXP_SLOTS:
 		return "Release Unexpected Event Slots";
+	case OMX_CMD_SEND_MEDIUMSQ:
+		return "Send MediumSQ";
+	case OMX_CMD_CMDQ_DOORBELL:
+		return "Cmdq Doorbell";
 	case OMX_CMD_XEN_OPEN_ENDPOINT:
 		return "Xen Open Endpoint";
 	case OMX_CMD_XEN_CLOSE_ENDPOINT:
@@ -765,6 +856,10 @@ omx_strcmd(unsigned cmd)
 		return "Xen Create User Region";
 	case OMX_CMD_XEN_DESTROY_USER_REGION:
 		return "Xen Destroy User Region";
+	case OMX_CMD_XEN_SEND_BATCH:
+		return "Xen Send Batch";
+	case OMX_CMD_XEN_SEND_MEDIUMSQ:
+		return "Xen Send Mediumsq";
 	default:
 		return "** Unknown **";
 	}
@@ -787,6 +882,8 @@ omx_strcmd(unsigned cmd)
 #define OMX_EVT_RECV_NACK_LIB		0x19
 #define OMX_EVT_SEND_MEDIUMSQ_FRAG_DONE	0x20
 #define OMX_EVT_PULL_DONE		0x21
+#define OMX_EVT_SEND_ERROR		0x22
+#define OMX_EVT_SEND_MEDIUMSQ_DONE	0x23
 
 #define OMX_EVT_NACK_LIB_BAD_ENDPT	0x01
 #define OMX_EVT_NACK_LIB_ENDPT_CLOSED	0x02
@@ -833,6 +930,10 @@ omx_strevt(unsigned type)
 		return "Send MediumSQ Fragment Done";
 	case OMX_EVT_PULL_DONE:
 		return "Pull Done";
+	case OMX_EVT_SEND_ERROR:
+		return "Send Error";
+	case OMX_EVT_SEND_MEDIUMSQ_DONE:
+		return "Send MediumSQ Done";
 	default:
 		return "** Unknown **";
 	}
@@ -860,6 +961,14 @@ union omx_evt {
 		/* 64 */
 	} send_mediumsq_frag_done;
 
+	struct omx_evt_send_mediumsq_done {
+		uint32_t sendq_offset; /* of the first frag */
+		uint8_t pad[58];
+		uint8_t type;
+		uint8_t id;
+		/* 64 */
+	} send_mediumsq_done;
+
 	struct omx_evt_pull_done {
 		uint64_t lib_cookie;
 		/* 8 */
@@ -873,6 +982,21 @@ union omx_evt {
 		/* 64 */
 	} pull_done;
 
+	/* asynchronous send failure, reported by the Xen frontend and the cmdq polling thread */
+	struct omx_evt_send_error {
+		uint32_t command;
+		int32_t error;
+		/* 8 */
+		uint16_t peer_index;
+		uint8_t dest_endpoint;
+		uint8_t pad1[5];
+		/* 16 */
+		uint8_t pad2[46];
+		uint8_t type;
+		uint8_t id;
+		/* 64 */
+	} send_error;
+
 	struct omx_evt_recv_connect_request {
 		uint16_t peer_index;
 		uint8_t src_endpoint;
@@ -1063,6 +1187,8 @@ enum omx_counter_index {
 	OMX_COUNTER_EXP_EVENTQ_FULL,
 	OMX_COUNTER_UNEXP_EVENTQ_FULL,
 	OMX_COUNTER_SEND_NOMEM_SKB,
+	OMX_COUNTER_SEND_SKB_POOL_HIT,
+	OMX_COUNTER_SEND_SKB_POOL_MISS,
 	OMX_COUNTER_SEND_NOMEM_MEDIUM_DEFEVENT,
 	OMX_COUNTER_MEDIUMSQ_FRAG_SEND_LINEAR,
 	OMX_COUNTER_PULL_NONFIRST_BLOCK_DONE_EARLY,
@@ -1199,6 +1325,10 @@ omx_strcounter(enum omx_counter_index index)
 		return "Unexpected Event Queue Full";
 	case OMX_COUNTER_SEND_NOMEM_SKB:
 		return "Send Skbuff Alloc Failed";
+	case OMX_COUNTER_SEND_SKB_POOL_HIT:
+		return "Send Skbuff Reused from Pool";
+	case OMX_COUNTER_SEND_SKB_POOL_MISS:
+		return "Send Skbuff Pool Empty or Busy";
 	case OMX_COUNTER_SEND_NOMEM_MEDIUM_DEFEVENT:
 		return "Send Medium Deferred Event Alloc Failed";
 	case OMX_COUNTER_MEDIUMSQ_FRAG_SEND_LINEAR:
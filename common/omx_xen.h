@@ -51,6 +51,10 @@
  */
 //#define OMX_XEN_FE_SHORTCUT
 
+/*
+ * OMX_CMD_XEN_SEND_MEDIUMSQ_DONE also carries the OMX_EVT_SEND_MEDIUMSQ_DONE
+ * of whole mediumsq messages, both events share the same layout.
+ */
 struct omx_cmd_xen_send_mediumsq_frag_done {
 	struct omx_evt_send_mediumsq_frag_done sq_frag_done;
 } __attribute__ ((__packed__));
@@ -59,9 +63,18 @@ struct omx_cmd_xen_send_mediumsq_frag {
 	struct omx_cmd_send_mediumsq_frag mediumsq_frag;
 } __attribute__ ((__packed__));
 
+/*
+ * Mediumva payloads are copied into pages the frontend keeps granted
+ * to the backend, which keeps them mapped until it disconnects. At most
+ * OMX_XEN_PERSISTENT_GRANTS_MAX such pages exist per frontend; when they
+ * are all busy the frontend grants the user pages for this message only.
+ */
+#define OMX_XEN_PERSISTENT_GRANTS_MAX 256
+
 struct omx_cmd_xen_send_mediumva {
 	uint8_t nr_pages;
 	uint16_t first_page_offset;
+	uint8_t persistent;	/* grefs are persistent grants */
 	struct omx_cmd_send_mediumva mediumva;
 	grant_ref_t grefs[9];
 } __attribute__ ((__packed__));
@@ -113,9 +126,9 @@ struct omx_cmd_xen_send_rndv {
 	struct omx_cmd_send_rndv rndv;
 } __attribute__ ((__packed__));
 
+/* the data is in the slot payload */
 struct omx_cmd_xen_send_small {
 	struct omx_cmd_send_small small;
-	char data[OMX_SMALL_MSG_LENGTH_MAX];
 } __attribute__ ((__packed__));
 
 struct omx_cmd_xen_send_tiny {
@@ -138,6 +151,12 @@ struct omx_cmd_xen_send_liback {
 	struct omx_cmd_send_liback liback;
 } __attribute__ ((__packed__));
 
+/* several tiny/notify/liback commands, stored in the slot payload */
+struct omx_cmd_xen_send_batch {
+	uint8_t nr_entries;
+	uint8_t pad[7];
+} __attribute__ ((__packed__));
+
 struct omx_cmd_xen_get_board_info {
 	struct omx_board_info info;
 } __attribute__ ((__packed__));
@@ -214,6 +233,16 @@ struct omx_ring_msg_deregister_user_segment {
 	/* 32 */
 	uint16_t gref_offset;
 	uint8_t nr_parts;
+	uint8_t keep_mapped;	/* the frontend keeps the segment granted */
+} __attribute__ ((__packed__));
+
+/*
+ * Drop the backend mapping of a segment kept with keep_mapped, before the
+ * frontend ungrants it. gref is the grant of the first gref list page.
+ */
+struct omx_ring_msg_forget_user_segment {
+	uint32_t gref;
+	uint32_t pad;
 } __attribute__ ((__packed__));
 
 struct omx_ring_msg_create_user_region {
@@ -248,6 +277,20 @@ struct omx_ring_msg_destroy_user_region {
 	struct omx_ring_msg_deregister_user_segment segs[2];
 } __attribute__ ((__packed__));
 
+/*
+ * Page that each frontend endpoint shares with the backend, listing the
+ * grants of its unexpected event queue. The backend writes received
+ * small and medium events there directly instead of sending a recv_ring
+ * response, and only pokes the frontend when somebody sleeps on events.
+ */
+#define OMX_XEN_UNEXP_EVENTQ_PAGES (OMX_UNEXP_EVENTQ_SIZE >> PAGE_SHIFT)
+
+struct omx_xen_endpoint_shared {
+	grant_ref_t unexp_eventq_gref[OMX_XEN_UNEXP_EVENTQ_PAGES];
+	/* number of frontend threads sleeping in wait_event */
+	atomic_t waiters;
+};
+
 struct omx_ring_msg_endpoint {
 	struct omx_endpoint *endpoint;
 	uint32_t session_id;
@@ -259,6 +302,30 @@ struct omx_ring_msg_endpoint {
 	grant_ref_t recvq_gref;
 	grant_ref_t endpoint_gref;
 	uint16_t endpoint_offset;
+	grant_ref_t shared_gref;	/* 0 if the backend should not write events */
+} __attribute__ ((__packed__));
+
+/*
+ * Ring slots are sized for the data-path commands only. The few bulky
+ * messages (small send data, send batches, board info, user region
+ * creation and destruction) go to the payload of their slot instead:
+ * a fixed-size area in the pages that the frontend grants next to the
+ * ring, indexed like the ring slot, and thus valid until the response
+ * is consumed.
+ */
+#define OMX_XEN_RING_PAYLOAD_SIZE 256
+#define OMX_XEN_SEND_BATCH_SLOT_ENTRIES \
+	(OMX_XEN_RING_PAYLOAD_SIZE / sizeof(struct omx_cmd_send_batch_entry))
+
+union omx_xenif_payload {
+	char small_data[OMX_SMALL_MSG_LENGTH_MAX];
+	struct omx_cmd_send_batch_entry batch[OMX_XEN_RING_PAYLOAD_SIZE /
+					      sizeof(struct omx_cmd_send_batch_entry)];
+	struct omx_cmd_send_mediumsq mediumsq;
+	struct omx_ring_msg_create_user_region cur;
+	struct omx_ring_msg_destroy_user_region dur;
+	struct omx_cmd_xen_get_board_info gbi;
+	char pad[OMX_XEN_RING_PAYLOAD_SIZE];
 } __attribute__ ((__packed__));
 
 struct omx_xenif_request {
@@ -268,12 +335,7 @@ struct omx_xenif_request {
 	uint32_t request_id;
 	int ret;
 	union {
-		struct omx_ring_msg_register_user_segment cus;
-		struct omx_ring_msg_deregister_user_segment dus;
-		struct omx_ring_msg_create_user_region cur;
-		struct omx_ring_msg_destroy_user_region dur;
 		struct omx_ring_msg_endpoint endpoint;
-		struct omx_cmd_xen_get_board_info gbi;
 		struct omx_cmd_xen_get_endpoint_info gei;
 		struct omx_cmd_xen_get_counters gc;
 		struct omx_cmd_xen_set_hostname sh;
@@ -299,6 +361,8 @@ struct omx_xenif_request {
 		    send_mediumsq_frag_done;
 		struct omx_cmd_xen_send_mediumva send_mediumva;
 		struct omx_cmd_xen_pull pull;
+		struct omx_cmd_xen_send_batch send_batch;
+		struct omx_ring_msg_forget_user_segment forget_segment;
 	} data;
 } __attribute__ ((__packed__));
 
@@ -309,12 +373,7 @@ struct omx_xenif_response {
 	uint32_t request_id;
 	int ret;
 	union {
-		struct omx_ring_msg_register_user_segment cus;
-		struct omx_ring_msg_deregister_user_segment dus;
-		struct omx_ring_msg_create_user_region cur;
-		struct omx_ring_msg_destroy_user_region dur;
 		struct omx_ring_msg_endpoint endpoint;
-		struct omx_cmd_xen_get_board_info gbi;
 		struct omx_cmd_xen_get_endpoint_info gei;
 		struct omx_cmd_xen_get_counters gc;
 		struct omx_cmd_xen_set_hostname sh;
@@ -340,12 +399,56 @@ struct omx_xenif_response {
 		    send_mediumsq_frag_done;
 		struct omx_cmd_xen_send_mediumva send_mediumva;
 		struct omx_cmd_xen_pull pull;
+		struct omx_cmd_xen_send_batch send_batch;
+		struct omx_ring_msg_forget_user_segment forget_segment;
 	} data;
 } __attribute__ ((__packed__));
 
 DEFINE_RING_TYPES(omx_xenif, struct omx_xenif_request,
 		  struct omx_xenif_response);
 
+/* keep data-path slots within two cache lines */
+#define OMX_XEN_RING_SLOT_SIZE_MAX 128
+#define OMX_XEN_RING_SIZE __CONST_RING_SIZE(omx_xenif, PAGE_SIZE)
+#define OMX_XEN_RING_PAYLOADS_PER_PAGE (PAGE_SIZE / OMX_XEN_RING_PAYLOAD_SIZE)
+#define OMX_XEN_RING_PAYLOAD_PAGES \
+	DIV_ROUND_UP(OMX_XEN_RING_SIZE, OMX_XEN_RING_PAYLOADS_PER_PAGE)
+
+/* payload of the ring slot that holds a request or its response */
+static inline union omx_xenif_payload *
+omx_xenif_slot_payload(void **payload_pages, struct omx_xenif_sring *sring,
+		       void *slot)
+{
+	unsigned idx = (union omx_xenif_sring_entry *) slot - sring->ring;
+
+	BUILD_BUG_ON(sizeof(union omx_xenif_sring_entry) >
+		     OMX_XEN_RING_SLOT_SIZE_MAX);
+	BUILD_BUG_ON(sizeof(union omx_xenif_payload) !=
+		     OMX_XEN_RING_PAYLOAD_SIZE);
+
+	return (union omx_xenif_payload *)
+	    payload_pages[idx / OMX_XEN_RING_PAYLOADS_PER_PAGE]
+	    + idx % OMX_XEN_RING_PAYLOADS_PER_PAGE;
+}
+
+/*
+ * Each frontend may use several request rings (queues), each with its
+ * own payload pages, event channel and backend worker. The backend
+ * advertises how many it supports in multi-queue-max-queues, the frontend
+ * replies with multi-queue-num-queues. Queue 0 keeps the historical
+ * xenstore keys, the others append -q<index> to them.
+ */
+#define OMX_XEN_QUEUES_MAX 8
+
+static inline void
+omx_xen_queue_node(char *node, size_t size, unsigned queue, const char *name)
+{
+	if (queue)
+		snprintf(node, size, "%s-q%u", name, queue);
+	else
+		snprintf(node, size, "%s", name);
+}
+
 enum omx_xenif_state {
 	OMXIF_STATE_DISCONNECTED,
 	OMXIF_STATE_CONNECTED,
@@ -23,6 +23,7 @@ typedef struct timers {
 	unsigned long long total;
 	unsigned long long val;
 	unsigned long cnt;
+	unsigned long long ops;	/* operations issued by batched timers */
 } timers_t;
 
 
@@ -33,9 +34,11 @@ typedef struct timers {
 
 #define TIMER_START(tp)	do {( tp)->val = get_cycles(); } while (0)
 #define TIMER_STOP(tp)	do { (tp)->total += get_cycles() - (tp)->val; ++(tp)->cnt; } while (0)
-#define TIMER_RESET(tp)	do { (tp)->total = (tp)->val = 0; (tp)->cnt = 0; } while (0)
+#define TIMER_STOP_BATCH(tp, n)	do { TIMER_STOP(tp); (tp)->ops += (n); } while (0)
+#define TIMER_RESET(tp)	do { (tp)->total = (tp)->val = 0; (tp)->cnt = 0; (tp)->ops = 0; } while (0)
 #define TIMER_TOTAL(tp)	((tp)->total)
 #define TIMER_COUNT(tp)	((tp)->cnt)
+#define TIMER_OPS(tp)	((tp)->ops)
 #define TIMER_AVG(tp)	((tp)->cnt ? ((tp)->total / (tp)->cnt) : -1)
 
 #define TICKS_TO_USEC(t)	(1000 * t/CYCLES_PER_SEC)
@@ -44,8 +47,10 @@ typedef struct timers {
 
 #define TIMER_START(a)
 #define TIMER_STOP(a)
+#define TIMER_STOP_BATCH(a, n)
 #define TIMER_TOTAL(a) 0ULL
 #define TIMER_COUNT(a) 0UL
+#define TIMER_OPS(a) 0ULL
 #define TIMER_RESET(a)
 #define TICKS_TO_USEC(a) 0ULL
 
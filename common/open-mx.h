@@ -132,7 +132,8 @@ enum omx_endpoint_param_key
 {
   OMX_ENDPOINT_PARAM_ERROR_HANDLER = 0,
   OMX_ENDPOINT_PARAM_UNEXP_QUEUE_MAX = 1,
-  OMX_ENDPOINT_PARAM_CONTEXT_ID = 2
+  OMX_ENDPOINT_PARAM_CONTEXT_ID = 2,
+  OMX_ENDPOINT_PARAM_PROGRESS_THREAD = 3
 };
 typedef enum omx_endpoint_param_key omx_endpoint_param_key_t;
 
@@ -155,6 +156,7 @@ typedef struct {
       uint8_t bits;
       uint8_t shift;
     } context_id;
+    uint32_t progress_thread; /* non-zero to progress in the background */
   } val;
 } omx_endpoint_param_t;
 
@@ -279,6 +281,11 @@ omx_wait_any(omx_endpoint_t ep,
 	     omx_status_t *status, uint32_t *result,
 	     uint32_t timeout);
 
+omx_return_t
+omx_test_many(omx_endpoint_t ep,
+	      omx_status_t *statuses, uint32_t count,
+	      uint32_t *result);
+
 omx_return_t
 omx_ipeek(omx_endpoint_t ep, omx_request_t * request,
 	  uint32_t *result);
@@ -425,6 +425,25 @@ omx_miscdev_release(struct inode * inode, struct file * file)
 	return 0;
 }
 
+/* the cmdq is only mapped and drained by the native driver */
+static int
+omx_ioctl_cmdq_doorbell(struct omx_endpoint * endpoint, void __user * uparam)
+{
+	return -ENOSYS;
+}
+
+void
+omx_iface_sqpoll_start(struct omx_iface * iface)
+{
+	iface->sqpoll_task = NULL;
+	iface->sqpoll_idle = 0;
+}
+
+void
+omx_iface_sqpoll_stop(struct omx_iface * iface)
+{
+}
+
 /*
  * Common command handlers.
  * Use OMX_CMD_INDEX() to only keep the 8 latest bits of the 32bits command flags.
@@ -453,6 +472,8 @@ static int (*omx_ioctl_with_endpoint_handlers[])(struct omx_endpoint * endpoint,
 	[OMX_EPCMD_WAKEUP]			= omx_ioctl_wakeup,
 	[OMX_EPCMD_RELEASE_EXP_SLOTS]		= omx_ioctl_release_exp_slots,
 	[OMX_EPCMD_RELEASE_UNEXP_SLOTS]		= omx_ioctl_release_unexp_slots,
+	[OMX_EPCMD_SEND_MEDIUMSQ]		= omx_ioctl_send_mediumsq,
+	[OMX_EPCMD_CMDQ_DOORBELL]		= omx_ioctl_cmdq_doorbell,
 };
 
 /*
@@ -161,6 +161,13 @@ struct omx_endpoint {
 	omx_eventq_index_t xen_nextreserved_unexp_eventq_index;
 	omx_eventq_index_t xen_nextreleased_unexp_eventq_index;
 
+	/* frontend unexp eventq, NULL if events go through recv_ring */
+	struct omx_xen_endpoint_shared *xen_shared;
+	struct vm_struct *xen_shared_vm;
+	uint32_t xen_shared_handle;
+	struct page **xen_unexp_eventq_pages;
+	struct gnttab_unmap_grant_ref *unexp_eventq_unmap;
+
 	struct omx_xen_user_region __rcu * xen_regions[OMX_USER_REGION_MAX];
 
 
@@ -106,6 +106,7 @@ struct omx_event_waiter {
 	struct list_head list_elt;
 	struct task_struct *task;
 	struct rcu_head rcu_head;
+	uint32_t id;
 	uint8_t status;
 };
 
@@ -126,6 +127,49 @@ omx_wakeup_waiter_list(struct omx_endpoint *endpoint,
 	dprintk_out();
 }
 
+/*
+ * Any waiter processes all pending events once back in user-space, and the
+ * library then wakes up the other ones whose requests completed, so only
+ * wake up a single waiter that is not already being woken up.
+ */
+static INLINE void
+omx_wakeup_one_waiter(struct omx_endpoint *endpoint)
+{
+	struct omx_event_waiter *waiter;
+
+	dprintk_in();
+	rcu_read_lock();
+	list_for_each_entry_rcu(waiter, &endpoint->waiters, list_elt) {
+		if (waiter->status == OMX_CMD_WAIT_EVENT_STATUS_NONE) {
+			waiter->status = OMX_CMD_WAIT_EVENT_STATUS_EVENT;
+			wake_up_process(waiter->task);
+			break;
+		}
+	}
+	rcu_read_unlock();
+	dprintk_out();
+}
+
+/* targeted wakeup from the library, the id is chosen by the library */
+static INLINE void
+omx_wakeup_waiter_by_id(struct omx_endpoint *endpoint,
+			uint32_t id, uint32_t status)
+{
+	struct omx_event_waiter *waiter;
+
+	dprintk_in();
+	rcu_read_lock();
+	list_for_each_entry_rcu(waiter, &endpoint->waiters, list_elt) {
+		if (waiter->id == id) {
+			waiter->status = status;
+			wake_up_process(waiter->task);
+			break;
+		}
+	}
+	rcu_read_unlock();
+	dprintk_out();
+}
+
 static void
 omx_wakeup_on_timeout_handler(unsigned long data)
 {
@@ -201,6 +245,66 @@ omx_endpoint_queues_init(struct omx_endpoint *endpoint)
 	dprintk_out();
 }
 
+/*
+ * User-space does not release event slots with ioctls, it publishes
+ * the index of the next slot it will process in its endpoint descriptor.
+ * The descriptor is writable by user-space, so never release slots that
+ * were not given to it.
+ */
+void
+omx_endpoint_release_consumed_slots(struct omx_endpoint *endpoint)
+{
+	struct omx_endpoint_desc *userdesc = endpoint->userdesc;
+	omx_eventq_index_t index;
+
+	/* xen endpoints get their slots released by the frontend */
+	if (endpoint->xen)
+		return;
+
+	index = ACCESS_ONCE(userdesc->exp_eventq_index);
+	if (index != endpoint->nextreleased_exp_eventq_index) {
+		spin_lock_bh(&endpoint->release_exp_lock);
+		if ((omx_eventq_index_t) (index - endpoint->nextreleased_exp_eventq_index)
+		    <= (omx_eventq_index_t) (endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index))
+			endpoint->nextreleased_exp_eventq_index = index;
+		spin_unlock_bh(&endpoint->release_exp_lock);
+	}
+
+	index = ACCESS_ONCE(userdesc->unexp_eventq_index);
+	if (index != endpoint->nextreleased_unexp_eventq_index) {
+		spin_lock_bh(&endpoint->release_unexp_lock);
+		if ((omx_eventq_index_t) (index - endpoint->nextreleased_unexp_eventq_index)
+		    <= (omx_eventq_index_t) (endpoint->nextreserved_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index))
+			endpoint->nextreleased_unexp_eventq_index = index;
+		spin_unlock_bh(&endpoint->release_unexp_lock);
+	}
+}
+
+/* only look at the slots released by user-space when a queue looks full */
+static INLINE int
+omx_exp_eventq_overflow(struct omx_endpoint *endpoint)
+{
+	if (likely(endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index
+		   <= OMX_EXP_EVENTQ_ENTRY_NR))
+		return 0;
+
+	omx_endpoint_release_consumed_slots(endpoint);
+	return endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index
+		> OMX_EXP_EVENTQ_ENTRY_NR;
+}
+
+static INLINE int
+omx_unexp_eventq_overflow(struct omx_endpoint *endpoint)
+{
+	if (likely(endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
+		   <= OMX_UNEXP_EVENTQ_ENTRY_NR))
+		return 0;
+
+	omx_endpoint_release_consumed_slots(endpoint);
+	return endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
+		> OMX_UNEXP_EVENTQ_ENTRY_NR;
+}
+
 /******************************************
  * Report an expected event to users-space
  */
@@ -216,8 +320,7 @@ omx_notify_exp_event(struct omx_endpoint *endpoint, const void *event, int lengt
 	/* take the next slot and update the queue */
 	index = atomic_inc_return((atomic_t *) &endpoint->nextfree_exp_eventq_index) - 1;
 
-	if (unlikely(endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index
-		     > OMX_EXP_EVENTQ_ENTRY_NR)) {
+	if (unlikely(omx_exp_eventq_overflow(endpoint))) {
 		/* we went too far, rollback */
 		atomic_dec((atomic_t *) &endpoint->nextfree_exp_eventq_index);
 		/* the application sucks, it did not check
@@ -240,9 +343,9 @@ omx_notify_exp_event(struct omx_endpoint *endpoint, const void *event, int lengt
 	((struct omx_evt_generic *) slot)->id = 1 + (index % OMX_EVENT_ID_MAX);
 
 	/* wake up waiters */
-	dprintk(EVENT, "notify_exp waking up everybody\n");
+	dprintk(EVENT, "notify_exp waking up one waiter\n");
 
-	omx_wakeup_waiter_list(endpoint, OMX_CMD_WAIT_EVENT_STATUS_EVENT);
+	omx_wakeup_one_waiter(endpoint);
 	ret = 0;
 	goto out;
 
@@ -270,8 +373,7 @@ omx_notify_unexp_event(struct omx_endpoint *endpoint, const void *event, int len
 	index = endpoint->nextreserved_unexp_eventq_index++;
 	spin_unlock_bh(&endpoint->unexp_lock);
 
-	if (unlikely(endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
-		     > OMX_UNEXP_EVENTQ_ENTRY_NR)) {
+	if (unlikely(omx_unexp_eventq_overflow(endpoint))) {
 		/* we went too far, rollback */
 		spin_lock_bh(&endpoint->unexp_lock);
 		endpoint->nextfree_unexp_eventq_index--;
@@ -295,9 +397,9 @@ omx_notify_unexp_event(struct omx_endpoint *endpoint, const void *event, int len
 	((struct omx_evt_generic *) slot)->id = 1 + (index % OMX_EVENT_ID_MAX);
 
 	/* wake up waiters */
-	dprintk(EVENT, "notify_unexp waking up everybody\n");
+	dprintk(EVENT, "notify_unexp waking up one waiter\n");
 
-	omx_wakeup_waiter_list(endpoint, OMX_CMD_WAIT_EVENT_STATUS_EVENT);
+	omx_wakeup_one_waiter(endpoint);
 
 out:
 	dprintk_out();
@@ -330,9 +432,8 @@ omx_prepare_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint,
 		spin_lock_bh(&endpoint->unexp_lock);
 		/* reserve the next slot and update the queue */
 		//endpoint->nextfree_unexp_eventq_index++;
-		rmb();
-		frontend_endpoint->nextfree_unexp_eventq_index++;
-		wmb();
+		/* the frontend reserves slots of this queue too, use atomics */
+		atomic_inc((atomic_t *) &frontend_endpoint->nextfree_unexp_eventq_index);
 		/* take the next recvq slot and return it now */
 		//recvq_index = endpoint->next_recvq_index++;
 		rmb();
@@ -343,8 +444,8 @@ omx_prepare_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint,
 		if (unlikely(frontend_endpoint->nextfree_unexp_eventq_index - frontend_endpoint->nextreleased_unexp_eventq_index > OMX_UNEXP_EVENTQ_ENTRY_NR)) {
 			/* we went too far, rollback */
 			spin_lock_bh(&endpoint->unexp_lock);
+			atomic_dec((atomic_t *) &frontend_endpoint->nextfree_unexp_eventq_index);
 			rmb();
-			frontend_endpoint->nextfree_unexp_eventq_index--;
 			recvq_index = frontend_endpoint->next_recvq_index--;
 			wmb();
 			spin_unlock_bh(&endpoint->unexp_lock);
@@ -382,8 +483,7 @@ omx_prepare_notify_unexp_events_with_recvq(struct omx_endpoint *endpoint,
 	endpoint->next_recvq_index += nr;
 	spin_unlock_bh(&endpoint->unexp_lock);
 
-	if (unlikely(endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
-		     > OMX_UNEXP_EVENTQ_ENTRY_NR)) {
+	if (unlikely(omx_unexp_eventq_overflow(endpoint))) {
 		/* we went too far, rollback */
 		spin_lock_bh(&endpoint->unexp_lock);
 		endpoint->nextfree_unexp_eventq_index -= nr;
@@ -439,13 +539,70 @@ omx_commit_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint,
 	((struct omx_evt_generic *) slot)->id = 1 + (index % OMX_EVENT_ID_MAX);
 
 	/* wake up waiters */
-	dprintk(EVENT, "commit_notify_unexp waking up everybody\n");
+	dprintk(EVENT, "commit_notify_unexp waking up one waiter\n");
 
-	omx_wakeup_waiter_list(endpoint, OMX_CMD_WAIT_EVENT_STATUS_EVENT);
+	omx_wakeup_one_waiter(endpoint);
 
 	dprintk_out();
 }
 
+/*
+ * Store the event of a xen endpoint in the next reserved slot of the
+ * frontend unexp eventq, which we mapped at open, and only poke the
+ * frontend if somebody sleeps there. Returns -ENODEV if the eventq is
+ * not mapped, the caller must then send the event through the recv_ring.
+ */
+int
+omx_xen_notify_unexp_event(struct omx_endpoint *endpoint,
+			   const void *event, int length)
+{
+	struct omx_xen_endpoint_shared *shared = ACCESS_ONCE(endpoint->xen_shared);
+	struct omx_endpoint *frontend_endpoint = endpoint->fe_endpoint;
+	struct omx_xenif_response *ring_resp;
+	omx_xenif_t *omx_xenif;
+	union omx_evt *slot;
+	omx_eventq_index_t index;
+	unsigned long offset;
+	int ret = 0;
+
+	dprintk_in();
+
+	if (!shared) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	/* the caller should have called prepare() earlier */
+	index = atomic_inc_return((atomic_t *) &frontend_endpoint->nextreserved_unexp_eventq_index) - 1;
+
+	offset = (index % OMX_UNEXP_EVENTQ_ENTRY_NR) * OMX_EVENTQ_ENTRY_SIZE;
+	slot = pfn_to_kaddr(page_to_pfn(endpoint->xen_unexp_eventq_pages[offset >> PAGE_SHIFT]))
+		+ (offset & ~PAGE_MASK);
+	/* store the event without setting the id first */
+	memcpy(slot, event, length);
+	wmb();
+	/* write the actual id now that the whole event has been written to memory */
+	((struct omx_evt_generic *) slot)->id = 1 + (index % OMX_EVENT_ID_MAX);
+
+	/* pairs with the barrier after the frontend registers a waiter */
+	smp_mb();
+	if (!atomic_read(&shared->waiters))
+		goto out;
+
+	dprintk(EVENT, "xen_notify_unexp waking up the frontend\n");
+
+	omx_xenif = endpoint->be->omx_xenif;
+	ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
+	ring_resp->func = OMX_CMD_XEN_RECV_WAKEUP;
+	ring_resp->board_index = endpoint->board_index;
+	ring_resp->eid = endpoint->endpoint_index;
+	omx_poke_domU(omx_xenif, ring_resp);
+
+out:
+	dprintk_out();
+	return ret;
+}
+
 /*
  * Store an dummy "ignored" event in the next reserved slot
  * (not always the one reserved during omx_commit_notify_unexp_event()
@@ -531,11 +688,10 @@ omx_ioctl_wait_event(struct omx_endpoint * endpoint, void __user * uparam)
 		goto out;
 	}
 
-	/* FIXME: wait on some event type only */
-
 	/* queue ourself on the wait queue first, in case a packet arrives in the meantime */
 	waiter->status = OMX_CMD_WAIT_EVENT_STATUS_NONE;
 	waiter->task = current;
+	waiter->id = cmd.waiter_id;
 	set_current_state(TASK_INTERRUPTIBLE);
 	spin_lock(&endpoint->waiters_lock);
 	list_add_tail_rcu(&waiter->list_elt, &endpoint->waiters);
@@ -646,13 +802,13 @@ omx_ioctl_release_exp_slots(struct omx_endpoint *endpoint, void __user *uparam)
 {
 	int err = 0;
 	dprintk_in();
-	spin_lock(&endpoint->release_exp_lock);
+	spin_lock_bh(&endpoint->release_exp_lock);
 	if (endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index
 	    < OMX_EXP_RELEASE_SLOTS_BATCH_NR)
 		err = -EINVAL;
 	else
 		endpoint->nextreleased_exp_eventq_index += OMX_EXP_RELEASE_SLOTS_BATCH_NR;
-	spin_unlock(&endpoint->release_exp_lock);
+	spin_unlock_bh(&endpoint->release_exp_lock);
 	dprintk_out();
 	return err;
 }
@@ -662,13 +818,13 @@ omx_ioctl_release_unexp_slots(struct omx_endpoint *endpoint, void __user *uparam
 {
 	int err = 0;
 	dprintk_in();
-	spin_lock(&endpoint->release_unexp_lock);
+	spin_lock_bh(&endpoint->release_unexp_lock);
 	if (endpoint->nextreserved_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
 	    < OMX_UNEXP_RELEASE_SLOTS_BATCH_NR)
 		err = -EINVAL;
 	else
 		endpoint->nextreleased_unexp_eventq_index += OMX_UNEXP_RELEASE_SLOTS_BATCH_NR;
-	spin_unlock(&endpoint->release_unexp_lock);
+	spin_unlock_bh(&endpoint->release_unexp_lock);
 	dprintk_out();
 	return err;
 }
@@ -678,13 +834,13 @@ omx_ioctl_xen_release_unexp_slots(struct omx_endpoint *endpoint, void __user *up
 {
 	int err = 0;
 	dprintk_in();
-	spin_lock(&endpoint->release_unexp_lock);
+	spin_lock_bh(&endpoint->release_unexp_lock);
 	if (endpoint->xen_nextreserved_unexp_eventq_index - endpoint->xen_nextreleased_unexp_eventq_index
 	    < OMX_UNEXP_RELEASE_SLOTS_BATCH_NR)
 		err = -EINVAL;
 	else
 		endpoint->xen_nextreleased_unexp_eventq_index += OMX_UNEXP_RELEASE_SLOTS_BATCH_NR;
-	spin_unlock(&endpoint->release_unexp_lock);
+	spin_unlock_bh(&endpoint->release_unexp_lock);
 	dprintk_out();
 	return err;
 }
@@ -703,7 +859,10 @@ omx_ioctl_wakeup(struct omx_endpoint * endpoint, void __user * uparam)
 		goto out;
 	}
 
-	omx_wakeup_waiter_list(endpoint, cmd.status);
+	if (cmd.waiter_id)
+		omx_wakeup_waiter_by_id(endpoint, cmd.waiter_id, cmd.status);
+	else
+		omx_wakeup_waiter_list(endpoint, cmd.status);
 
  out:
 	dprintk_in();
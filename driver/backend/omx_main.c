@@ -89,6 +89,14 @@ int omx_skb_copy_max = 0;
 module_param_named(skbcopy, omx_skb_copy_max, uint, S_IRUGO|S_IWUSR);
 MODULE_PARM_DESC(skbcopy, "Maximum length of data to copy in linear skb instead of attaching pages");
 
+int omx_xmit_batch_max = 32;
+module_param_named(xmitbatch, omx_xmit_batch_max, uint, S_IRUGO); /* not writable, batches must begin and end with the same value */
+MODULE_PARM_DESC(xmitbatch, "Maximal number of skbs to transmit at once at the end of a command batch or pull block");
+
+int omx_skb_pool_max = 16;
+module_param_named(skbpool, omx_skb_pool_max, uint, S_IRUGO); /* not writable, pooled skbs must be sent as clones */
+MODULE_PARM_DESC(skbpool, "Number of header-only skbs to keep across transmission for reuse per cpu and interface");
+
 int omx_pin_synchronous = 1;
 module_param_named(pinsync, omx_pin_synchronous, uint, S_IRUGO); /* not writable to simplify things */
 MODULE_PARM_DESC(pinsync, "Pin user regions synchronously on register");
@@ -133,6 +141,13 @@ omx_unavail_module_param(dmaasyncmin, "kernel has " OMX_DMA_ENGINE_CONFIG_STR);
 omx_unavail_module_param(dmasyncmin, "kernel has " OMX_DMA_ENGINE_CONFIG_STR);
 #endif /* !OMX_HAVE_DMA_ENGINE */
 
+unsigned long omx_xen_poll_usecs = OMX_XEN_BACKEND_POLL_USECS_DEFAULT;
+module_param_named(xenpollusecs, omx_xen_poll_usecs, ulong, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(xenpollusecs, "Default time (in microseconds) to poll an idle frontend ring before waiting for events");
+int omx_xen_grant_copy = 0;
+module_param_named(xengrantcopy, omx_xen_grant_copy, int, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(xengrantcopy, "Default to grant copies instead of mapping frontend pages for pull replies and mediumva");
+
 #ifdef OMX_DRIVER_DEBUG
 unsigned long omx_debug = 0xfff;
 module_param_named(debug, omx_debug, ulong, S_IRUGO|S_IWUSR);
@@ -300,8 +315,9 @@ omx_get_driver_string(unsigned int *lenp)
 	buflen += len;
 
 	len = snprintf(tmp, OMX_DRIVER_STRING_LEN-buflen,
-		       " SkBuff: <=%d frags%s, ForcedCopy <=%dB\n",
-		       omx_skb_frags, omx_skb_frags ? "" : " (always linear)", omx_skb_copy_max);
+		       " SkBuff: <=%d frags%s, ForcedCopy <=%dB, XmitBatch <=%d, Pool %d/cpu\n",
+		       omx_skb_frags, omx_skb_frags ? "" : " (always linear)", omx_skb_copy_max,
+		       omx_xmit_batch_max, omx_skb_pool_max);
 	tmp += len;
 	buflen += len;
 
@@ -1426,6 +1426,8 @@ omx_recv_pull_request(struct omx_iface * iface,
 			goto xen_out;
 		}
 
+		/* transmit all replies at once */
+		omx_iface_xmit_batch_begin(iface);
 
 		/* send all replies */
 		for(i=0; i<replies; i++) {
@@ -1438,9 +1440,11 @@ omx_recv_pull_request(struct omx_iface * iface,
 			if (block_remaining_length < frame_length)
 				frame_length = block_remaining_length;
 
+			/* grant copy regions have no pages to attach */
 			if (unlikely(frame_length <= omx_skb_copy_max
 				     || reply_hdr_len + frame_length < ETH_ZLEN
-				     || !omx_skb_frags)) {
+				     || !omx_skb_frags
+				     || xregion->grant_copy)) {
 				dprintk(PULL, "will not append pages to pull reply, instead, we'll use a linear skb\n");
 				goto linear_xen;
 			}
@@ -1452,6 +1456,7 @@ omx_recv_pull_request(struct omx_iface * iface,
 				omx_counter_inc(iface, SEND_NOMEM_SKB);
 				omx_drop_dprintk(pull_eh, "PULL packet due to failure to create pull reply skb");
 				err = -ENOMEM;
+				omx_iface_xmit_batch_end(iface);
 				omx_xen_user_region_release(xregion);
 				omx_endpoint_release(endpoint);
 				goto out;
@@ -1489,6 +1494,7 @@ linear_xen:
 					omx_counter_inc(iface, SEND_NOMEM_SKB);
 					omx_drop_dprintk(pull_eh, "PULL packet due to failure to create pull reply linear skb");
 					err = -ENOMEM;
+					omx_iface_xmit_batch_end(iface);
 					goto out_with_region;
 				}
 
@@ -1530,6 +1536,7 @@ linear_xen:
 			current_msg_offset += frame_length;
 			block_remaining_length -= frame_length;
 		}
+		omx_iface_xmit_batch_end(iface);
 		omx_xen_user_region_release(xregion);
 
 		goto xen_out;
@@ -1563,6 +1570,9 @@ linear_xen:
 		goto out_with_region;
 	}
 
+	/* transmit all replies at once */
+	omx_iface_xmit_batch_begin(iface);
+
 	/* send all replies */
 	for(i=0; i<replies; i++) {
 		struct sk_buff *skb;
@@ -1580,13 +1590,13 @@ linear_xen:
 			goto linear;
 
 		/* allocate a skb */
-		skb = omx_new_skb(/* only allocate space for the header now, we'll attach pages later */
-				  reply_hdr_len);
+		skb = omx_iface_new_skb(iface, /* only allocate space for the header now, we'll attach pages later */
+					reply_hdr_len);
 		if (unlikely(skb == NULL)) {
 			omx_counter_inc(iface, SEND_NOMEM_SKB);
 			omx_drop_dprintk(pull_eh, "PULL packet due to failure to create pull reply skb");
 			err = -ENOMEM;
-			goto out_with_region;
+			goto out_with_batch;
 		}
 
 		/* append segment pages */
@@ -1594,6 +1604,15 @@ linear_xen:
 		if (likely(!err)) {
 			/* successfully appended frags */
 
+			/* keep the skb for reuse and send a clone of it */
+			skb = omx_iface_pool_skb(iface, skb);
+			if (unlikely(skb == NULL)) {
+				omx_counter_inc(iface, SEND_NOMEM_SKB);
+				omx_drop_dprintk(pull_eh, "PULL packet due to failure to clone pull reply skb");
+				err = -ENOMEM;
+				goto out_with_batch;
+			}
+
 			/* reacquire the region and keep the reference for the destructor */
 			omx_user_region_reacquire(region);
 			omx_set_skb_destructor(skb, omx_send_pull_reply_skb_destructor, region);
@@ -1620,7 +1639,7 @@ linear_xen:
 				omx_counter_inc(iface, SEND_NOMEM_SKB);
 				omx_drop_dprintk(pull_eh, "PULL packet due to failure to create pull reply linear skb");
 				err = -ENOMEM;
-				goto out_with_region;
+				goto out_with_batch;
 			}
 
 			/* locate new headers */
@@ -1663,6 +1682,8 @@ linear_xen:
 		block_remaining_length -= frame_length;
 	}
 
+	omx_iface_xmit_batch_end(iface);
+
 	/* release the main reference on the region */
 	omx_user_region_release(region);
 xen_out:
@@ -1670,6 +1691,8 @@ xen_out:
 	dev_kfree_skb(orig_skb);
 	goto real_out;
 
+ out_with_batch:
+	omx_iface_xmit_batch_end(iface);
  out_with_region:
 	/* release the main reference on the region */
 	omx_user_region_release(region);
@@ -2223,7 +2246,9 @@ omx_recv_pull_reply(struct omx_iface * iface,
 	    && handle->total_length >= omx_dma_async_min) {
 		if (handle->xen) {
 			dprintk(PULL, "XEN REGION!!!\n");
-			remaining_copy = omx_xen_pull_handle_reply_try_dma_copy(iface, handle, skb, msg_offset, frame_length);
+			/* grant copy regions are filled by the hypervisor */
+			if (!handle->xregion->grant_copy)
+				remaining_copy = omx_xen_pull_handle_reply_try_dma_copy(iface, handle, skb, msg_offset, frame_length);
 		}
 		else
 		{
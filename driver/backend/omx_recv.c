@@ -494,11 +494,6 @@ omx_recv_small(struct omx_iface * iface,
 			goto out_with_endpoint;
 		}
 
-		ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
-		ring_resp->func = OMX_CMD_RECV_SMALL;
-		ring_resp->board_index = endpoint->board_index;
-		ring_resp->eid = endpoint->endpoint_index;
-
 		/* fill event */
 		event.id = 0;
 		event.type = OMX_EVT_RECV_SMALL;
@@ -508,17 +503,11 @@ omx_recv_small(struct omx_iface * iface,
 		event.seqnum = lib_seqnum;
 		event.piggyack = lib_piggyack;
 		event.specific.small.length = length;
-
+		event.specific.small.recvq_offset = recvq_offset;
 		event.specific.small.checksum = OMX_NTOH_16(small_n->checksum);
 
 		omx_recv_dprintk(eh, "SMALL length %ld", (unsigned long) length);
-
-		memcpy(&ring_resp->data.recv_msg.msg, &event, sizeof(event));
-
-		event.specific.small.recvq_offset = recvq_offset;
 		dprintk_deb("%s: recvq_offset = %#x\n", __func__, recvq_offset);
-
-		memcpy(&ring_resp->data.recv_msg.msg.specific.small, &event.specific.small, sizeof(event.specific.small));
 #if 1
 		offset = recvq_offset &~PAGE_MASK;
 		if (offset)
@@ -529,6 +518,16 @@ omx_recv_small(struct omx_iface * iface,
 		BUG_ON(err < 0);
 #endif
 
+		/* write the event in the frontend eventq if it is mapped */
+		if (!omx_xen_notify_unexp_event(endpoint, &event, sizeof(event)))
+			goto xen_out;
+
+		ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
+		ring_resp->func = OMX_CMD_RECV_SMALL;
+		ring_resp->board_index = endpoint->board_index;
+		ring_resp->eid = endpoint->endpoint_index;
+		memcpy(&ring_resp->data.recv_msg.msg, &event, sizeof(event));
+
                 omx_poke_domU(omx_xenif, ring_resp);
                 goto xen_out;
         }
@@ -689,11 +688,6 @@ omx_recv_medium_frag(struct omx_iface * iface,
 			goto out_with_endpoint;
 		}
 
-		ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
-		ring_resp->func = OMX_CMD_RECV_MEDIUM_FRAG;
-		ring_resp->board_index = endpoint->board_index;
-		ring_resp->eid = endpoint->endpoint_index;
-
 		/* fill event */
 		event.id = 0;
 		event.type = OMX_EVT_RECV_MEDIUM_FRAG;
@@ -716,8 +710,6 @@ omx_recv_medium_frag(struct omx_iface * iface,
 
 		//dprintk_inf("%s: recvq_offset = %#x\n", __func__, recvq_offset);
 		omx_recv_dprintk(eh, "MEDIUM_FRAG length %ld", (unsigned long) frag_length);
-		memcpy(&ring_resp->data.recv_msg.msg, &event, sizeof(event));
-		memcpy(&ring_resp->data.recv_msg.msg.specific.medium_frag, &event.specific.medium_frag, sizeof(event.specific.medium_frag));
 
 #if 1
 		/* copy what's remaining */
@@ -745,6 +737,17 @@ omx_recv_medium_frag(struct omx_iface * iface,
 		}
 		kfree(staging);
 #endif
+
+		/* write the event in the frontend eventq if it is mapped */
+		if (!omx_xen_notify_unexp_event(endpoint, &event, sizeof(event)))
+			goto xen_out;
+
+		ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
+		ring_resp->func = OMX_CMD_RECV_MEDIUM_FRAG;
+		ring_resp->board_index = endpoint->board_index;
+		ring_resp->eid = endpoint->endpoint_index;
+		memcpy(&ring_resp->data.recv_msg.msg, &event, sizeof(event));
+
                 omx_poke_domU(omx_xenif, ring_resp);
 		goto xen_out;
 
@@ -45,6 +45,7 @@
 #include "omx_xen.h"
 #include "omx_xenback.h"
 #include "omx_xenback_reg.h"
+#include "omx_xenback_gcopy.h"
 /******************************
  * Add and Destroying segments
  */
@@ -1525,6 +1526,7 @@ omx_user_region_fill_pages(const struct omx_user_region * region, const struct o
 	int iseg;
 	int ret = 0;
 	uint8_t xen = 0;
+	struct omx_xen_gcopy gcopy;
 
 	dprintk_in();
 
@@ -1554,6 +1556,10 @@ omx_user_region_fill_pages(const struct omx_user_region * region, const struct o
 
 	if (xen) {
 
+		/* grant copy regions are filled through batched GNTTABOP_copy */
+		if (xregion->grant_copy)
+			omx_xen_gcopy_init(&gcopy, xregion->endpoint->be->omx_xenif);
+
 		for(iseg=0; iseg<xregion->nr_segments; iseg++) {
 			const struct omx_xen_user_region_segment * segment = &xregion->segments[iseg];
 			dprintk(REG,
@@ -1574,9 +1580,14 @@ omx_user_region_fill_pages(const struct omx_user_region * region, const struct o
 				dprintk(REG,
 					"XEN filling pages from segment #%d offset %ld length %ld\n",
 					iseg, segment_offset, chunk);
-				omx__xen_user_region_segment_fill_pages(segment, segment_offset,
-								    skb, skb_offset,
-								    chunk);
+				if (xregion->grant_copy)
+					omx_xen_gcopy_skb_to_segment(&gcopy, skb, skb_offset,
+								     segment, segment_offset,
+								     chunk);
+				else
+					omx__xen_user_region_segment_fill_pages(segment, segment_offset,
+										skb, skb_offset,
+										chunk);
 				copied += chunk;
 				skb_offset += chunk;
 				remaining -= chunk;
@@ -1588,14 +1599,22 @@ omx_user_region_fill_pages(const struct omx_user_region * region, const struct o
 				dprintk(REG,
 					"XEN last filling pages from segment #%d offset %ld length %ld\n",
 					iseg, segment_offset, remaining);
-				omx__xen_user_region_segment_fill_pages(segment, segment_offset,
-								    skb, skb_offset,
-								    remaining);
+				if (xregion->grant_copy)
+					omx_xen_gcopy_skb_to_segment(&gcopy, skb, skb_offset,
+								     segment, segment_offset,
+								     remaining);
+				else
+					omx__xen_user_region_segment_fill_pages(segment, segment_offset,
+										skb, skb_offset,
+										remaining);
 				copied += remaining;
 				remaining = 0;
 				break;
 			}
 		}
+
+		if (xregion->grant_copy)
+			ret = omx_xen_gcopy_flush(&gcopy);
 	}
 	else
 	{
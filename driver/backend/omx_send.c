@@ -80,19 +80,8 @@ omx_new_skb(unsigned long len)
 
 	dprintk_in();
 	skb = alloc_skb(len, GFP_ATOMIC);
-	if (likely(skb != NULL)) {
-		omx_skb_reset_mac_header(skb);
-		omx_skb_reset_network_header(skb);
-		skb->protocol = __constant_htons(ETH_P_OMX);
-		skb->priority = 0;
-		skb_put(skb, len);
-		skb->next = skb->prev = NULL;
-
-		/* tell the network layer not to perform IP checksums
-		 * or to get the NIC to do it
-		 */
-		skb->ip_summed = CHECKSUM_NONE;
-	}
+	if (likely(skb != NULL))
+		omx_skb_init(skb, len);
 	dprintk_out();
 	return skb;
 }
@@ -109,6 +98,34 @@ struct omx_deferred_event {
 	struct omx_evt_send_mediumsq_frag_done evt;
 };
 
+/*
+ * Report a mediumsq frag or message completion to user-space,
+ * Xen guests get it through the ring since their eventq is not ours.
+ */
+static void
+omx_notify_mediumsq_event(struct omx_endpoint * endpoint,
+			  const void * evt, unsigned length)
+{
+	if (endpoint->xen) {
+		omx_xenif_t * omx_xenif = endpoint->be->omx_xenif;
+		struct omx_xenif_response *ring_resp;
+		dprintk(PULL, "XEN ENDPOINT! MEDIUMSQ DONE!@%#lx\n", (unsigned long) omx_xenif);
+
+		BUILD_BUG_ON(sizeof(struct omx_evt_send_mediumsq_done)
+			     != sizeof(struct omx_evt_send_mediumsq_frag_done));
+
+		ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
+		ring_resp->func = OMX_CMD_XEN_SEND_MEDIUMSQ_DONE;
+		ring_resp->board_index = endpoint->board_index;
+		ring_resp->eid = endpoint->endpoint_index;
+		memcpy(&ring_resp->data.send_mediumsq_frag_done.sq_frag_done, evt, length);
+
+		omx_poke_domU(omx_xenif, ring_resp);
+	} else {
+		omx_notify_exp_event(endpoint, evt, length);
+	}
+}
+
 /* medium frag skb destructor to release sendq pages */
 static void
 omx_medium_frag_skb_destructor(struct sk_buff *skb)
@@ -118,28 +135,47 @@ omx_medium_frag_skb_destructor(struct sk_buff *skb)
 
 	/* report the event to user-space */
 	dprintk_in();
-	if (endpoint->xen) {
-			omx_xenif_t * omx_xenif = endpoint->be->omx_xenif;
-			struct omx_xenif_response *ring_resp;
-			dprintk(PULL, "XEN ENDPOINT! Linear MEDIUMSQ DONE!@%#lx\n", (unsigned long) omx_xenif);
+	omx_notify_mediumsq_event(endpoint,
+				  &defevent->evt, sizeof(defevent->evt));
 
-			ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
-			ring_resp->func = OMX_CMD_XEN_SEND_MEDIUMSQ_DONE;
-			ring_resp->board_index = endpoint->board_index;
-			ring_resp->eid = endpoint->endpoint_index;
-			memcpy(&ring_resp->data.send_mediumsq_frag_done.sq_frag_done, &defevent->evt, sizeof(defevent->evt));
+	/* release objects now */
+	omx_endpoint_release(endpoint);
+	kfree(defevent);
+	dprintk_out();
+}
 
-			omx_poke_domU(omx_xenif, ring_resp);
-	}
-	else {
-		omx_notify_exp_event(endpoint,
-				     &defevent->evt, sizeof(defevent->evt));
-	}
+/*
+ * A whole mediumsq message only notifies a single event once all its frag skbs
+ * have been released. The ioctl keeps one reference until all frags are queued.
+ */
+struct omx_mediumsq_deferred_event {
+	struct omx_endpoint *endpoint;
+	atomic_t refcount;
+	struct omx_evt_send_mediumsq_done evt;
+};
+
+static void
+omx_mediumsq_deferred_event_put(struct omx_mediumsq_deferred_event * defevent)
+{
+	struct omx_endpoint * endpoint = defevent->endpoint;
+
+	if (!atomic_dec_and_test(&defevent->refcount))
+		return;
+
+	/* report the event to user-space */
+	omx_notify_mediumsq_event(endpoint,
+				  &defevent->evt, sizeof(defevent->evt));
 
 	/* release objects now */
 	omx_endpoint_release(endpoint);
 	kfree(defevent);
-	dprintk_out();
+}
+
+/* mediumsq skb destructor to release sendq pages */
+static void
+omx_mediumsq_skb_destructor(struct sk_buff *skb)
+{
+	omx_mediumsq_deferred_event_put(omx_get_skb_destructor_data(skb));
 }
 
 /*********************
@@ -379,12 +415,20 @@ omx_ioctl_send_tiny(struct omx_endpoint * endpoint,
 
 	if (endpoint->xen) {
 		if (unlikely(cmd_xen->shared)) {
-			ret = omx_shared_send_tiny(endpoint, cmd_xen, &((struct omx_cmd_send_tiny __user *) uparam)->data);
+			ret = omx_shared_send_tiny(endpoint, cmd_xen, ((struct omx_cmd_send_tiny *) uparam)->data);
 			goto out;
 		}
 	} else {
 		if (unlikely(cmd.shared)) {
-			ret = omx_shared_send_tiny(endpoint, &cmd, &((struct omx_cmd_send_tiny __user *) uparam)->data);
+			char shared_data[OMX_TINY_MSG_LENGTH_MAX];
+
+			ret = copy_from_user(shared_data, &((struct omx_cmd_send_tiny __user *) uparam)->data, length);
+			if (unlikely(ret != 0)) {
+				printk(KERN_ERR "Open-MX: Failed to read shared send tiny cmd data\n");
+				ret = -EFAULT;
+				goto out;
+			}
+			ret = omx_shared_send_tiny(endpoint, &cmd, shared_data);
 			goto out;
 		}
 	}
@@ -627,8 +671,13 @@ omx_ioctl_send_mediumsq_frag(struct omx_endpoint * endpoint,
 		struct omx_deferred_event * defevent;
 		unsigned int current_sendq_offset, remaining, desc;
 
-		skb = omx_new_skb(/* only allocate space for the header now, we'll attach pages later */
-				   hdr_len);
+		/* skbs kept for reuse would still reference guest pages after they are unmapped */
+		if (endpoint->xen)
+			skb = omx_new_skb(/* only allocate space for the header now, we'll attach pages later */
+					  hdr_len);
+		else
+			skb = omx_iface_new_skb(iface, /* only allocate space for the header now, we'll attach pages later */
+						 hdr_len);
 		if (unlikely(skb == NULL)) {
 			omx_counter_inc(iface, SEND_NOMEM_SKB);
 			printk(KERN_INFO "Open-MX: Failed to create mediumsq frag skb\n");
@@ -680,6 +729,18 @@ omx_ioctl_send_mediumsq_frag(struct omx_endpoint * endpoint,
 		skb->len += frag_length;
 		skb->data_len = frag_length;
 
+		/* keep the skb for reuse and send a clone of it */
+		if (!endpoint->xen) {
+			skb = omx_iface_pool_skb(iface, skb);
+			if (unlikely(skb == NULL)) {
+				omx_counter_inc(iface, SEND_NOMEM_SKB);
+				printk(KERN_INFO "Open-MX: Failed to clone mediumsq frag skb\n");
+				kfree(defevent);
+				ret = -ENOMEM;
+				goto out;
+			}
+		}
+
 		/* prepare the deferred event now that we cannot fail anymore */
 		omx_endpoint_reacquire(endpoint); /* keep a reference in the defevent */
 		defevent->endpoint = endpoint;
@@ -741,24 +802,8 @@ omx_ioctl_send_mediumsq_frag(struct omx_endpoint * endpoint,
 		evt.id = 0;
 		evt.type = OMX_EVT_SEND_MEDIUMSQ_FRAG_DONE;
 		evt.sendq_offset = cmd.sendq_offset;
-
-		if (endpoint->xen) {
-			omx_xenif_t * omx_xenif = endpoint->be->omx_xenif;
-			struct omx_xenif_response *ring_resp;
-			dprintk(PULL, "XEN ENDPOINT! Linear MEDIUMSQ DONE!@%#lx\n", (unsigned long) omx_xenif);
-
-			ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
-			ring_resp->func = OMX_CMD_XEN_SEND_MEDIUMSQ_DONE;
-			ring_resp->board_index = endpoint->board_index;
-			ring_resp->eid = endpoint->endpoint_index;
-			memcpy(&ring_resp->data.send_mediumsq_frag_done.sq_frag_done, &evt, sizeof(evt));
-
-			omx_poke_domU(omx_xenif, ring_resp);
-
-		} else {
-			omx_notify_exp_event(endpoint,
-					     &evt, sizeof(evt));
-		}
+		omx_notify_mediumsq_event(endpoint,
+					  &evt, sizeof(evt));
 	}
 
 	/* fill ethernet header */
@@ -798,6 +843,282 @@ omx_ioctl_send_mediumsq_frag(struct omx_endpoint * endpoint,
 	return ret;
 }
 
+/* queue one frag of a whole mediumsq message, allocate the deferred event if needed */
+static int
+omx_queue_mediumsq_frag(struct omx_endpoint * endpoint,
+			const struct omx_cmd_send_mediumsq * cmd,
+			unsigned frag_seqnum, uint32_t frag_length,
+			struct omx_mediumsq_deferred_event ** defeventp)
+{
+	struct sk_buff *skb;
+	struct omx_hdr *mh;
+	struct omx_pkt_head *ph;
+	struct ethhdr *eh;
+	struct omx_pkt_medium_frag *medium_n;
+	struct omx_iface * iface = endpoint->iface;
+	struct net_device * ifp = iface->eth_ifp;
+	uint32_t sendq_offset = cmd->sendq_index[frag_seqnum] << OMX_SENDQ_ENTRY_SHIFT;
+	struct page * page;
+	size_t hdr_len = sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_medium_frag);
+	int ret;
+
+	if (unlikely(frag_length > omx_skb_copy_max
+		     && hdr_len + frag_length >= ETH_ZLEN
+		     && omx_skb_frags >= (frag_length >> OMX_SENDQ_ENTRY_SHIFT))) {
+		/* use skb with frags */
+
+		struct omx_mediumsq_deferred_event * defevent = *defeventp;
+		unsigned int current_sendq_offset, remaining, desc;
+
+		/* skbs kept for reuse would still reference guest pages after they are unmapped */
+		if (endpoint->xen)
+			skb = omx_new_skb(/* only allocate space for the header now, we'll attach pages later */
+					  hdr_len);
+		else
+			skb = omx_iface_new_skb(iface, /* only allocate space for the header now, we'll attach pages later */
+						 hdr_len);
+		if (unlikely(skb == NULL)) {
+			omx_counter_inc(iface, SEND_NOMEM_SKB);
+			printk(KERN_INFO "Open-MX: Failed to create mediumsq frag skb\n");
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		if (!defevent) {
+			/* first frag skb of this message, prepare the deferred event */
+			defevent = kmalloc(sizeof(*defevent), GFP_KERNEL);
+			if (unlikely(!defevent)) {
+				omx_counter_inc(iface, SEND_NOMEM_MEDIUM_DEFEVENT);
+				printk(KERN_INFO "Open-MX: Failed to allocate mediumsq deferred event\n");
+				ret = -ENOMEM;
+				goto out_with_skb;
+			}
+
+			omx_endpoint_reacquire(endpoint); /* keep a reference in the defevent */
+			defevent->endpoint = endpoint;
+			atomic_set(&defevent->refcount, 1); /* for the caller */
+			defevent->evt.id = 0;
+			defevent->evt.type = OMX_EVT_SEND_MEDIUMSQ_DONE;
+			defevent->evt.sendq_offset = cmd->sendq_index[0] << OMX_SENDQ_ENTRY_SHIFT;
+			*defeventp = defevent;
+		}
+
+		/* locate headers */
+		mh = omx_skb_mac_header(skb);
+		ph = &mh->head;
+		eh = &ph->eth;
+		medium_n = (struct omx_pkt_medium_frag *) (ph + 1);
+
+		/* set destination peer */
+		ret = omx_set_target_peer(ph, iface, cmd->peer_index);
+		if (ret < 0) {
+			printk(KERN_INFO "Open-MX: Failed to fill target peer in mediumsq frag header\n");
+			goto out_with_skb;
+		}
+
+		/* attach the sendq page */
+		current_sendq_offset = sendq_offset;
+		remaining = frag_length;
+		desc = 0;
+		while (remaining) {
+			unsigned int chunk = remaining;
+			if (chunk > PAGE_SIZE)
+				chunk = PAGE_SIZE;
+			if (endpoint->xen)
+				page = endpoint->xen_sendq_pages[current_sendq_offset >> PAGE_SHIFT];
+			else
+				page = endpoint->sendq_pages[current_sendq_offset >> PAGE_SHIFT];
+			get_page(page);
+			skb_fill_page_desc(skb, desc, page, current_sendq_offset & (~PAGE_MASK), chunk);
+			desc++;
+			remaining -= chunk;
+			current_sendq_offset += chunk;
+		}
+		skb->len += frag_length;
+		skb->data_len = frag_length;
+
+		/* keep the skb for reuse and send a clone of it */
+		if (!endpoint->xen) {
+			skb = omx_iface_pool_skb(iface, skb);
+			if (unlikely(skb == NULL)) {
+				omx_counter_inc(iface, SEND_NOMEM_SKB);
+				printk(KERN_INFO "Open-MX: Failed to clone mediumsq frag skb\n");
+				ret = -ENOMEM;
+				goto out;
+			}
+		}
+
+		/* the skb keeps a reference on the deferred event now that we cannot fail anymore */
+		atomic_inc(&defevent->refcount);
+		omx_set_skb_destructor(skb, omx_mediumsq_skb_destructor, defevent);
+
+	} else {
+		/* use a linear skb */
+		void *data;
+
+		omx_counter_inc(iface, MEDIUMSQ_FRAG_SEND_LINEAR);
+
+		skb = omx_new_skb(/* pad to ETH_ZLEN */
+				  max_t(unsigned long, hdr_len + frag_length, ETH_ZLEN));
+		if (unlikely(skb == NULL)) {
+			omx_counter_inc(iface, SEND_NOMEM_SKB);
+			printk(KERN_INFO "Open-MX: Failed to create linear mediumsq frag skb\n");
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		/* locate headers */
+		mh = omx_skb_mac_header(skb);
+		ph = &mh->head;
+		eh = &ph->eth;
+		medium_n = (struct omx_pkt_medium_frag *) (ph + 1);
+		data = (char*) (medium_n + 1);
+
+		/* set destination peer */
+		ret = omx_set_target_peer(ph, iface, cmd->peer_index);
+		if (ret < 0) {
+			printk(KERN_INFO "Open-MX: Failed to fill target peer in mediumsq frag header\n");
+			goto out_with_skb;
+		}
+
+		if (endpoint->xen) {
+			/* the granted guest sendq is not virtually contiguous, copy page by page */
+			uint32_t current_sendq_offset = sendq_offset;
+			uint32_t remaining = frag_length;
+			while (remaining) {
+				unsigned int chunk = PAGE_SIZE - (current_sendq_offset & (~PAGE_MASK));
+				if (chunk > remaining)
+					chunk = remaining;
+				page = endpoint->xen_sendq_pages[current_sendq_offset >> PAGE_SHIFT];
+				memcpy(data, page_address(page) + (current_sendq_offset & (~PAGE_MASK)), chunk);
+				data += chunk;
+				remaining -= chunk;
+				current_sendq_offset += chunk;
+			}
+		} else {
+			/* copy the data in the linear skb */
+			memcpy(data, endpoint->sendq + sendq_offset, frag_length);
+		}
+	}
+
+	/* fill ethernet header */
+	eh->h_proto = __constant_cpu_to_be16(ETH_P_OMX);
+	memcpy(eh->h_source, ifp->dev_addr, sizeof (eh->h_source));
+
+	/* fill omx header */
+	OMX_HTON_8(medium_n->src_endpoint, endpoint->endpoint_index);
+	OMX_HTON_8(medium_n->dst_endpoint, cmd->dest_endpoint);
+	OMX_HTON_8(medium_n->ptype, OMX_PKT_TYPE_MEDIUM);
+#ifdef OMX_MX_WIRE_COMPAT
+	OMX_HTON_16(medium_n->length, cmd->msg_length);
+	OMX_HTON_8(medium_n->frag_pipeline, cmd->frag_pipeline);
+#else
+	OMX_HTON_32(medium_n->length, cmd->msg_length);
+#endif
+	OMX_HTON_16(medium_n->lib_seqnum, cmd->seqnum);
+	OMX_HTON_16(medium_n->lib_piggyack, cmd->piggyack);
+	OMX_HTON_32(medium_n->session, cmd->session_id);
+	OMX_HTON_MATCH_INFO(medium_n, cmd->match_info);
+	OMX_HTON_16(medium_n->frag_length, frag_length);
+	OMX_HTON_8(medium_n->frag_seqnum, frag_seqnum);
+	OMX_HTON_16(medium_n->checksum, cmd->checksum);
+
+	omx_send_dprintk(eh, "MEDIUMSQ FRAG length %ld", (unsigned long) frag_length);
+
+	_omx_queue_xmit(iface, skb, MEDIUM_FRAG, MEDIUMSQ_FRAG);
+
+	return 0;
+
+ out_with_skb:
+	kfree_skb(skb);
+ out:
+	return ret;
+}
+
+int
+omx_ioctl_send_mediumsq(struct omx_endpoint * endpoint,
+			void __user * uparam)
+{
+	struct omx_cmd_send_mediumsq cmd;
+	struct omx_mediumsq_deferred_event * defevent = NULL;
+	uint32_t msg_length, remaining;
+	unsigned frags_nr;
+	int ret;
+	int i;
+
+	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read send mediumsq cmd hdr\n");
+		ret = -EFAULT;
+		goto out;
+	}
+
+	BUILD_BUG_ON(OMX_MEDIUM_FRAG_LENGTH_MAX > OMX_SENDQ_ENTRY_SIZE);
+	BUILD_BUG_ON(OMX_MEDIUM_FRAG_PACKET_SIZE_OF_PAYLOAD(OMX_MEDIUM_FRAG_LENGTH_MAX) > OMX_MTU);
+
+	/* all frags but the last one are full */
+	frags_nr = cmd.frags_nr;
+	msg_length = cmd.msg_length;
+	if (unlikely(!frags_nr || frags_nr > OMX_SEND_MEDIUMSQ_FRAGS_NR_MAX
+		     || msg_length > frags_nr * OMX_MEDIUM_FRAG_LENGTH_MAX
+		     || msg_length <= (frags_nr-1) * OMX_MEDIUM_FRAG_LENGTH_MAX)) {
+		printk(KERN_ERR "Open-MX: Cannot send mediumsq message of length %ld in %d frags\n",
+		       (unsigned long) msg_length, frags_nr);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	for(i=0; i<frags_nr; i++)
+		if (unlikely(cmd.sendq_index[i] >= OMX_SENDQ_ENTRY_NR)) {
+			printk(KERN_ERR "Open-MX: Cannot send mediumsq fragment from sendq entry %ld (max %ld)\n",
+			       (unsigned long) cmd.sendq_index[i], (unsigned long) OMX_SENDQ_ENTRY_NR);
+			ret = -EINVAL;
+			goto out;
+		}
+
+	if (unlikely(cmd.shared))
+		return omx_shared_send_mediumsq(endpoint, &cmd);
+
+	remaining = msg_length;
+	for(i=0; i<frags_nr; i++) {
+		uint32_t frag_length = remaining > OMX_MEDIUM_FRAG_LENGTH_MAX ? OMX_MEDIUM_FRAG_LENGTH_MAX : remaining;
+
+		ret = omx_queue_mediumsq_frag(endpoint, &cmd, i, frag_length, &defevent);
+		if (unlikely(ret < 0)) {
+			if (!i)
+				goto out_with_defevent;
+			/* some frags are gone, the other ones will look lost and get resent later */
+			break;
+		}
+
+		remaining -= frag_length;
+	}
+
+	if (defevent) {
+		/* the event will be notified once all frag skbs are released */
+		omx_mediumsq_deferred_event_put(defevent);
+	} else {
+		/* all frags were copied in linear skbs, notify the event right now */
+		struct omx_evt_send_mediumsq_done evt;
+
+		evt.id = 0;
+		evt.type = OMX_EVT_SEND_MEDIUMSQ_DONE;
+		evt.sendq_offset = cmd.sendq_index[0] << OMX_SENDQ_ENTRY_SHIFT;
+		omx_notify_mediumsq_event(endpoint,
+					  &evt, sizeof(evt));
+	}
+
+	return 0;
+
+ out_with_defevent:
+	if (defevent) {
+		omx_endpoint_release(endpoint);
+		kfree(defevent);
+	}
+ out:
+	return ret;
+}
+
 int
 omx_ioctl_send_mediumva(struct omx_endpoint * endpoint,
 			void __user * uparam)
@@ -40,6 +40,91 @@
 #include "omx_xenback.h"
 #include "omx_endpoint.h"
 
+/* per-frontend polling tunables, in the xenbus device directory */
+static ssize_t omx_xenback_poll_usecs_show(struct device *dev,
+					   struct device_attribute *attr,
+					   char *buf)
+{
+	struct backend_info *be = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%lu\n", be->omx_xenif->poll_usecs);
+}
+
+static ssize_t omx_xenback_poll_usecs_store(struct device *dev,
+					    struct device_attribute *attr,
+					    const char *buf, size_t count)
+{
+	struct backend_info *be = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 0, &val);
+	if (ret)
+		return ret;
+	be->omx_xenif->poll_usecs = val;
+	return count;
+}
+
+/* only regions created after a change use the new data path */
+static ssize_t omx_xenback_grant_copy_show(struct device *dev,
+					   struct device_attribute *attr,
+					   char *buf)
+{
+	struct backend_info *be = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%d\n", be->omx_xenif->grant_copy);
+}
+
+static ssize_t omx_xenback_grant_copy_store(struct device *dev,
+					    struct device_attribute *attr,
+					    const char *buf, size_t count)
+{
+	struct backend_info *be = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 0, &val);
+	if (ret)
+		return ret;
+	be->omx_xenif->grant_copy = !!val;
+	return count;
+}
+
+static ssize_t omx_xenback_req_gap_ns_show(struct device *dev,
+					   struct device_attribute *attr,
+					   char *buf)
+{
+	struct backend_info *be = dev_get_drvdata(dev);
+	omx_xenif_t *omx_xenif = be->omx_xenif;
+	ssize_t len = 0;
+	int i;
+
+	/* one average per request queue */
+	for (i = 0; i < omx_xenif->nr_queues; i++)
+		len += sprintf(buf + len, "%s%lu", i ? " " : "",
+			       omx_xenif->queues[i].req_gap_ns);
+	len += sprintf(buf + len, "\n");
+	return len;
+}
+
+static DEVICE_ATTR(poll_usecs, S_IRUGO | S_IWUSR,
+		   omx_xenback_poll_usecs_show, omx_xenback_poll_usecs_store);
+static DEVICE_ATTR(grant_copy, S_IRUGO | S_IWUSR,
+		   omx_xenback_grant_copy_show, omx_xenback_grant_copy_store);
+static DEVICE_ATTR(req_gap_ns, S_IRUGO, omx_xenback_req_gap_ns_show, NULL);
+
+static struct attribute *omx_xenback_attrs[] = {
+	&dev_attr_poll_usecs.attr,
+	&dev_attr_grant_copy.attr,
+	&dev_attr_req_gap_ns.attr,
+	NULL
+};
+
+static struct attribute_group omx_xenback_attr_group = {
+	.name = "omx",
+	.attrs = omx_xenback_attrs,
+};
+
 static int omx_xenback_probe(struct xenbus_device *dev,
 			     const struct xenbus_device_id *id)
 {
@@ -56,6 +141,12 @@ static int omx_xenback_probe(struct xenbus_device *dev,
 
 	be = dev_get_drvdata(&dev->dev);
 
+	ret = sysfs_create_group(&dev->dev.kobj, &omx_xenback_attr_group);
+	if (ret) {
+		xenbus_dev_fatal(dev, ret, "creating sysfs entries");
+		goto out;
+	}
+
 	ret = omx_xenback_setup_evtchn(dev, be);
 	if (ret < 0) {
 		xenbus_dev_fatal(dev, ret, "setup event channel");
@@ -86,6 +177,7 @@ static int omx_xenback_remove(struct xenbus_device *dev)
 	dprintk_in();
 
 	if (be->omx_xenif) {
+		sysfs_remove_group(&dev->dev.kobj, &omx_xenback_attr_group);
 		kobject_uevent(&dev->dev.kobj, KOBJ_OFFLINE);
 		omx_xenif_disconnect(be->omx_xenif);
 		be->omx_xenif = NULL;
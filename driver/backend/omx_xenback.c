@@ -20,6 +20,7 @@
 #include <linux/scatterlist.h>
 #include <linux/workqueue.h>
 #include <linux/spinlock.h>
+#include <linux/ktime.h>
 #include <linux/cdev.h>
 
 #include <xen/page.h>
@@ -47,6 +48,8 @@
 #include "omx_xenback_reg.h"
 #include "omx_xenback_endpoint.h"
 #include "omx_xenback_event.h"
+#include "omx_xenback_pgrant.h"
+#include "omx_xenback_gcopy.h"
 
 
 //timers_t t1,t2,t3,t4,t5,t6,t7,t8;
@@ -93,6 +96,7 @@ static void omx_xen_timers_reset(void)
 	omx_xen_timer_reset(&t_release_grants);
 	omx_xen_timer_reset(&t_release_gref_list);
 	omx_xen_timer_reset(&t_free_pages);
+	omx_xen_timer_reset(&t_gcopy);
 }
 
 static void printk_timer(timers_t * timer, char *name)
@@ -104,6 +108,12 @@ static void printk_timer(timers_t * timer, char *name)
 			    TICKS_TO_USEC(TIMER_TOTAL(timer)),
 			    TICKS_TO_USEC(TIMER_TOTAL(timer) /
 					  TIMER_COUNT(timer)));
+		/* batched hypercalls, e.g. grant maps of a whole segment */
+		if (TIMER_OPS(timer))
+			dprintk_inf("%s ops=%llu ops_per_batch=%llu ticks_per_op=%llu\n",
+				    name, TIMER_OPS(timer),
+				    TIMER_OPS(timer) / TIMER_COUNT(timer),
+				    TIMER_TOTAL(timer) / TIMER_OPS(timer));
 	}
 
 }
@@ -150,13 +160,13 @@ static void printk_timers(void)
 	printk_timer(&t_release_grants, var_name(t_release_grants));
 	printk_timer(&t_release_gref_list, var_name(t_release_gref_list));
 	printk_timer(&t_free_pages, var_name(t_free_pages));
+	printk_timer(&t_gcopy, var_name(t_gcopy));
 }
 
 int omx_xen_process_incoming_response(omx_xenif_t * omx_xenif,
 				      struct omx_xenif_back_ring *ring,
 				      RING_IDX * cons_idx, RING_IDX * prod_idx);
-int omx_xen_process_message(omx_xenif_t * omx_xenif,
-			    struct omx_xenif_back_ring *ring);
+int omx_xen_process_message(struct omx_xenif_queue *queue);
 
 static int omx_xen_setup_and_send_mediumsq_frag(struct omx_endpoint *endpoint, struct omx_cmd_xen_send_mediumsq_frag
 						*cmd)
@@ -177,74 +187,38 @@ static int omx_xen_setup_and_send_mediumsq_frag(struct omx_endpoint *endpoint, s
 }
 
 #define MEDIUMVA_FAKE 0
-/* don't use this one for now. It's completely broken. */
+/*
+ * Send a mediumva straight from the frontend pages. Persistent grants
+ * stay mapped once seen, other grefs are only mapped for this message,
+ * or grant copied into bounce pages when the interface asks for it.
+ */
 static int omx_xen_setup_and_send_mediumva(struct omx_endpoint *endpoint, struct omx_cmd_xen_send_mediumva
 					   *cmd)
 {
-	int ret = 0, i;
-	uint16_t first_page_offset = cmd->first_page_offset;
+	omx_xenif_t *omx_xenif = endpoint->be->omx_xenif;
 	struct omx_cmd_send_mediumva *cmd_mediumva = &cmd->mediumva;
-#if MEDIUMVA_FAKE
-	struct omx_cmd_send_small *cmd_small = &cmd->mediumva;
-#endif
-	grant_ref_t *grefs = cmd->grefs;
+	struct omx_xen_pgrant transient[ARRAY_SIZE(cmd->grefs)];
+	struct page *bounce[ARRAY_SIZE(cmd->grefs)];
+	struct omx_xen_gcopy gcopy;
+	struct omx_cmd_user_segment *usegs;
+	uint16_t offset = cmd->first_page_offset;
+	uint8_t nr_pages = cmd->nr_pages;
+	uint32_t length = cmd_mediumva->length;
+	int ret = 0, i, nr_mapped = 0, nr_bounce = 0;
 	void *vaddr;
-	unsigned long vaddrs[9], flags;
-	grant_handle_t handles[9];
-#ifdef OMX_XEN_COOKIES
-	struct omx_xen_page_cookie *cookies[9];
-#endif
-	uint8_t nr_pages = 0;
-	struct omx_cmd_user_segment *usegs, *cur_useg;
-	struct page **pages;
-	uint32_t length;
-	struct page *page;
 
 	dprintk_in();
 
-	/* don't use this one for now. It's completely broken. */
-	BUG();
-
-#if 0
-	spin_lock_irqsave(&endpoint->be->omx_xenif->omx_send_lock, flags);
-	nr_pages = cmd->nr_pages;
-
-	pages = kmalloc(nr_pages * sizeof(struct page *), GFP_KERNEL);
-	if (!pages) {
-		printk_err("pages allocation failed\n");
-		ret = -ENOMEM;
-		goto out;
-	}
+	omx_xen_gcopy_init(&gcopy, omx_xenif);
 
-	for (i = 0; i < nr_pages; i++) {
-		pages[i] = NULL;
-		ret =
-		    omx_xen_map_page(endpoint->be, grefs[i], &vaddr,
-				     &handles[i], &page,
-#ifdef OMX_XEN_COOKIES
-				     &cookies[i]);
-#else
-				     NULL);
-#endif
-		if (ret) {
-			printk_err("cannot map page ret = %d\n", ret);
-			goto out;
-		}
-		dprintk_deb("vaddr=%p, handle[%d] = %#x, page=%#x\n", vaddr, i,
-			    handles[i], page);
-		vaddrs[i] = (unsigned long)vaddr;
-		pages[i] = page;
-	}
-
-#if 0
-	vaddr = vmap(pages, nr_pages, VM_IOREMAP, PAGE_KERNEL);
-	if (!vaddr) {
-		printk_err("vaddr is NULL\n");
-		ret = -EFAULT;
+	if (nr_pages > ARRAY_SIZE(cmd->grefs) || offset >= PAGE_SIZE) {
+		printk_err("bogus mediumva, %u pages at offset %u\n",
+			   nr_pages, offset);
+		ret = -EINVAL;
 		goto out;
 	}
-#endif
 
+	/* omx_ioctl_send_mediumva() frees them */
 	usegs =
 	    kmalloc(nr_pages * sizeof(struct omx_cmd_user_segment), GFP_KERNEL);
 	if (!usegs) {
@@ -252,65 +226,68 @@ static int omx_xen_setup_and_send_mediumva(struct omx_endpoint *endpoint, struct
 		ret = -ENOMEM;
 		goto out;
 	}
-/* FIXME: are we doing correct address/page calculations ? Maybe this is the source of corruption */
-//      usegs->vaddr = (unsigned long) vaddr; //vaddrs[0] + first_page_offset;
-	length = cmd_mediumva->length;
-	for (i = 0; i < nr_pages; i++) {
-		uint32_t rem = length > PAGE_SIZE ? PAGE_SIZE : length;
-		cur_useg = &usegs[i];
-		cur_useg->vaddr = vaddrs[i];
-		cur_useg->len = rem;
-		dprintk_deb("usegs=%#lx, usegs.len = %d, vaddr = %p\n",
-			    cur_useg, cur_useg->len, cur_useg->vaddr);
-
-		if (first_page_offset && i == 0) {
-			if (length + first_page_offset > PAGE_SIZE) {
-				rem -= first_page_offset;
-				cur_useg->len = rem;
+
+	for (i = 0; i < nr_pages && length; i++) {
+		uint32_t len = min_t(uint32_t, length, PAGE_SIZE - offset);
+
+		if (cmd->persistent) {
+			vaddr = omx_xen_pgrant_get(omx_xenif, cmd->grefs[i]);
+			if (IS_ERR(vaddr)) {
+				ret = PTR_ERR(vaddr);
+				goto out_with_usegs;
+			}
+		} else if (omx_xenif->grant_copy) {
+			bounce[i] = alloc_page(GFP_KERNEL);
+			if (!bounce[i]) {
+				ret = -ENOMEM;
+				goto out_with_usegs;
 			}
-			cur_useg->vaddr += first_page_offset;
+			nr_bounce++;
+			omx_xen_gcopy_from_guest(&gcopy, cmd->grefs[i], offset,
+						 bounce[i], offset, len);
+			vaddr = page_address(bounce[i]);
+		} else {
+			transient[i].gref = cmd->grefs[i];
+			ret = omx_xen_pgrant_map(omx_xenif, &transient[i]);
+			if (ret)
+				goto out_with_usegs;
+			nr_mapped++;
+			vaddr = omx_xen_pgrant_vaddr(&transient[i]);
 		}
-		dprintk_deb
-		    ("after_offset usegs=%#lx, usegs.len = %d, vaddr = %p\n",
-		     cur_useg, cur_useg->len, cur_useg->vaddr);
-		length -= rem;
+		usegs[i].vaddr = (unsigned long)vaddr + offset;
+		usegs[i].len = len;
+		dprintk_deb("usegs[%d] vaddr = %#llx, len = %llu\n", i,
+			    (unsigned long long)usegs[i].vaddr,
+			    (unsigned long long)usegs[i].len);
+		length -= len;
+		offset = 0;
 	}
-	cmd_mediumva->segments = (uint64_t) & usegs[0];
-	cmd_mediumva->nr_segments = nr_pages;
-	spin_unlock_irqrestore(&endpoint->be->omx_xenif->omx_send_lock, flags);
-
-#if MEDIUMVA_FAKE
-	{
-		uint32_t checksum = cmd_mediumva->seqnum;
-		cmd_small->length = 128;
-		cmd_small->checksum = checksum;
-		cmd_small->vaddr = (uint64_t) cmd;
-		ret = omx_ioctl_send_small(endpoint, cmd_small);
+	if (length) {
+		printk_err("mediumva pages too short, %u bytes left\n",
+			   length);
+		ret = -EINVAL;
+		goto out_with_usegs;
 	}
-#else
+	ret = omx_xen_gcopy_flush(&gcopy);
+	if (ret)
+		goto out_with_usegs;
+
+	cmd_mediumva->segments = (uint64_t) (unsigned long)usegs;
+	cmd_mediumva->nr_segments = i;
+	cmd_mediumva->shared = 0;
 	ret = omx_ioctl_send_mediumva(endpoint, cmd_mediumva);
-#endif
 	if (ret) {
 		printk_err("send_mediumva failed\n");
 	}
-#if 0
-	vunmap(vaddr);
-#endif
-	for (i = 0; i < nr_pages; i++) {
-		dprintk_deb("gref[%d] = %#x\n", i, grefs[i]);
-		ret = omx_xen_unmap_page(handles[i], pages[i]);
-		if (ret) {
-			printk_err("cannot unmap page ret = %d\n", ret);
-			goto out;
-		}
-#ifdef OMX_XEN_COOKIES
-		omx_xen_page_put_cookie(endpoint->be->omx_xenif, cookies[i]);
-#endif
-	}
-
-	kfree(pages);
-#endif
-
+	goto out_with_mapped;
+
+out_with_usegs:
+	kfree(usegs);
+out_with_mapped:
+	for (i = 0; i < nr_mapped; i++)
+		omx_xen_pgrant_unmap(omx_xenif, &transient[i]);
+	for (i = 0; i < nr_bounce; i++)
+		__free_page(bounce[i]);
 out:
 	dprintk_out();
 	return ret;
@@ -318,7 +295,8 @@ out:
 
 /* Function to poke the guest with a filled response.
  * We only use recv_ring, as this is the only ring
- * we can use to notify the guest */
+ * we can use to notify the guest. It is signalled
+ * on the event channel of the first queue */
 int omx_poke_domU(omx_xenif_t * omx_xenif, struct omx_xenif_response *ring_resp)
 {
 	int err = 0;
@@ -346,7 +324,7 @@ int omx_poke_domU(omx_xenif_t * omx_xenif, struct omx_xenif_response *ring_resp)
 
 	RING_PUSH_RESPONSES_AND_CHECK_NOTIFY(ring, notify);
 	if (notify) {
-		event.port = omx_xenif->be->evtchn.port;
+		event.port = omx_xenif->queues[0].evtchn.port;
 		err = HYPERVISOR_event_channel_op(EVTCHNOP_send, &event);
 		if (err) {
 			printk_err("Failed to send event, err = %d", err);
@@ -362,7 +340,8 @@ out:
 /* Our soft interrupt handler */
 irqreturn_t omx_xenif_be_int(int irq, void *data)
 {
-	omx_xenif_t *omx_xenif = (omx_xenif_t *) data;
+	struct omx_xenif_queue *queue = (struct omx_xenif_queue *)data;
+	omx_xenif_t *omx_xenif = queue->omx_xenif;
 	//struct backend_info *be = omx_xenif->be;
 	unsigned long flags;
 
@@ -370,12 +349,14 @@ irqreturn_t omx_xenif_be_int(int irq, void *data)
 	spin_lock_irqsave(&omx_xenif->omx_be_lock, flags);
 
 	//dprintk_deb("event_ptr=%p info=%#lx\n", data, (unsigned long)be);
-	if (RING_HAS_UNCONSUMED_REQUESTS(&omx_xenif->ring)) {
-		queue_work(omx_xenif->msg_workq, &omx_xenif->msg_workq_task);
-		//msg_workq_handler(&omx_xenif->msg_workq_task);
+	/* a polling handler sees the requests anyway */
+	if (!atomic_read(&queue->polling)
+	    && RING_HAS_UNCONSUMED_REQUESTS(&queue->ring)) {
+		queue_work(queue->msg_workq, &queue->msg_workq_task);
+		//msg_workq_handler(&queue->msg_workq_task);
 	}
 
-	if (RING_HAS_UNCONSUMED_REQUESTS(&omx_xenif->recv_ring)) {
+	if (!queue->id && RING_HAS_UNCONSUMED_REQUESTS(&omx_xenif->recv_ring)) {
 		/* Since we don't really do anythine else than
 		 * keeping a balance on the ring, we just call the
 		 * function, without the workqueue */
@@ -444,9 +425,47 @@ out:
 
 }
 
-/* something like the "bottom half" for requests (ring) */
+/*
+ * Account the requests about to be processed in the average
+ * inter-arrival time of the queue. Samples are bounded so that
+ * a single long idle period doesn't disable polling for too long.
+ */
+static void omx_xenback_account_requests(struct omx_xenif_queue *queue,
+					 s64 now, unsigned nr)
+{
+	unsigned long gap, max_gap;
+
+	gap = div_u64(now - queue->last_req, nr);
+	max_gap = 4 * queue->omx_xenif->poll_usecs * NSEC_PER_USEC;
+	if (gap > max_gap)
+		gap = max_gap;
+	queue->req_gap_ns = (7 * queue->req_gap_ns + gap) / 8;
+	queue->last_req = now;
+}
+
+/*
+ * How long to keep polling after the last request: twice the average
+ * inter-arrival time while traffic is flowing, nothing if requests come
+ * slower than the budget allows to wait for.
+ */
+static s64 omx_xenback_poll_window_ns(struct omx_xenif_queue *queue)
+{
+	unsigned long budget = queue->omx_xenif->poll_usecs * NSEC_PER_USEC;
+
+	if (queue->req_gap_ns >= budget)
+		return 0;
+	return min(budget, 2 * queue->req_gap_ns);
+}
+
+/*
+ * something like the "bottom half" for requests (ring).
+ * Poll the ring while traffic is flowing, then go back to event channel
+ * notifications. The frontend does not notify while we poll since we
+ * only move req_event forward in RING_FINAL_CHECK_FOR_REQUESTS.
+ */
 void msg_workq_handler(struct work_struct *work)
 {
+	struct omx_xenif_queue *queue;
 	omx_xenif_t *omx_xenif;
 	struct evtchn_send event;
 	struct backend_info *be;
@@ -455,14 +474,16 @@ void msg_workq_handler(struct work_struct *work)
 	int ret = 0;
 	struct omx_xenif_back_ring *ring;
 	int notify;
-	int i = 0;
+	s64 now, deadline;
+	unsigned nr;
 
 	dprintk_in();
 
 	dprintk_deb("%s: started\n", current->comm);
 
-	omx_xenif = container_of(work, omx_xenif_t, msg_workq_task);
-	spin_lock_irqsave(&omx_xenif->omx_ring_lock, flags);
+	queue = container_of(work, struct omx_xenif_queue, msg_workq_task);
+	omx_xenif = queue->omx_xenif;
+	spin_lock_irqsave(&queue->ring_lock, flags);
 	if (unlikely(!omx_xenif)) {
 		printk_err("Got NULL for omx_xenif, aborting!\n");
 		goto out;
@@ -473,44 +494,53 @@ void msg_workq_handler(struct work_struct *work)
 		goto out;
 	}
 
-	spin_unlock_irqrestore(&omx_xenif->omx_ring_lock, flags);
+	spin_unlock_irqrestore(&queue->ring_lock, flags);
 
 again:
+	atomic_set(&queue->polling, 1);
+	deadline = ktime_to_ns(ktime_get());
 	while (1) {
-		//spin_lock_irqrestore(&omx_xenif->omx_ring_lock, flags);
-		ring = &omx_xenif->ring;
-		if (RING_HAS_UNCONSUMED_REQUESTS(ring)) {
+		//spin_lock_irqrestore(&queue->ring_lock, flags);
+		ring = &queue->ring;
+		nr = RING_HAS_UNCONSUMED_REQUESTS(ring);
+		if (nr) {
+			now = ktime_to_ns(ktime_get());
+			omx_xenback_account_requests(queue, now, nr);
+
 			/* FIXME: We have to find a way to properly lock
 			 * when calling process_incoming_response */
-			//spin_unlock_irqrestore(&omx_xenif->omx_ring_lock, flags);
-			ret = omx_xen_process_message(omx_xenif, ring);
-			//spin_lock_irqsave(&omx_xenif->omx_ring_lock, flags);
+			//spin_unlock_irqrestore(&queue->ring_lock, flags);
+			ret = omx_xen_process_message(queue);
+			//spin_lock_irqsave(&queue->ring_lock, flags);
 
 			RING_PUSH_RESPONSES_AND_CHECK_NOTIFY(ring, notify);
 			if (notify) {
-				event.port = omx_xenif->be->evtchn.port;
+				event.port = queue->evtchn.port;
 				if (HYPERVISOR_event_channel_op(EVTCHNOP_send, &event) != 0) {
 					printk_err("error sending response\n");
 				}
 			}
+			deadline = now + omx_xenback_poll_window_ns(queue);
 		} else {
-			//spin_unlock_irqsave(&omx_xenif->omx_ring_lock, flags);
-			i++;
-			if (i> OMX_XEN_BACKEND_TIMEOUT) {
+			//spin_unlock_irqsave(&queue->ring_lock, flags);
+			if (ktime_to_ns(ktime_get()) >= deadline)
 				break;
-			}
-			//cpu_relax();
+			cond_resched();
+			cpu_relax();
 		}
 
 	}
 
+	/* idle, let the next request notify us */
+	atomic_set(&queue->polling, 0);
+	smp_mb();
 	RING_FINAL_CHECK_FOR_REQUESTS(ring, more_to_do);
 	if (more_to_do) {
 		goto again;
 	}
 
 out:
-	//spin_unlock_irqrestore(&omx_xenif->omx_ring_lock, flags);
+	//spin_unlock_irqrestore(&queue->ring_lock, flags);
 	dprintk_out();
 
 }
@@ -631,10 +661,11 @@ static void omx_xenback_prepare_response(struct omx_endpoint *endpoint,
 
 }
 
-int omx_xenback_process_misc(omx_xenif_t * omx_xenif, uint32_t func, struct
-				 omx_xenif_request *req,
-				 struct omx_xenif_response *resp)
+int omx_xenback_process_misc(struct omx_xenif_queue *queue, uint32_t func,
+			     struct omx_xenif_request *req,
+			     struct omx_xenif_response *resp)
 {
+	omx_xenif_t *omx_xenif = queue->omx_xenif;
 	struct backend_info *be = omx_xenif->be;
 	unsigned long flags;
 	int ret = 0;
@@ -822,6 +853,10 @@ int omx_xenback_process_misc(omx_xenif_t * omx_xenif, uint32_t func, struct
 	case OMX_CMD_GET_BOARD_INFO:{
 			struct omx_endpoint *endpoint;
 			struct omx_board_info get_board_info;
+			struct omx_cmd_xen_get_board_info *gbi =
+			    &omx_xenif_slot_payload(queue->ring_payload,
+						    queue->ring.sring,
+						    req)->gbi;
 			dprintk_deb
 			    ("received frontend request: OMX_CMD_GET_BOARD_INFO, param=%lx\n",
 			     sizeof(struct omx_cmd_xen_get_board_info));
@@ -837,8 +872,8 @@ int omx_xenback_process_misc(omx_xenif_t * omx_xenif, uint32_t func, struct
 				    ("Failed to execute cmd=%lx\n",
 				     (unsigned long)func);
 			} else {
-				//memset(&resp->data.gbi, 0, sizeof(resp->data.gbi));
-				memcpy(&resp->data.gbi.info, &get_board_info,
+				//memset(gbi, 0, sizeof(*gbi));
+				memcpy(&gbi->info, &get_board_info,
 				       sizeof(struct omx_board_info));
 			}
 
@@ -895,16 +930,20 @@ int omx_xenback_process_misc(omx_xenif_t * omx_xenif, uint32_t func, struct
 			uint64_t vaddr;
 			int i;
 			struct omx_endpoint *endpoint;
+			struct omx_ring_msg_create_user_region *cur =
+			    &omx_xenif_slot_payload(queue->ring_payload,
+						    queue->ring.sring,
+						    req)->cur;
 			dprintk_deb
 			    ("received frontend request: OMX_CMD_XEN_CREATE_USER_REGION, param=%lx\n",
 			     sizeof(struct omx_ring_msg_create_user_region));
-			spin_lock_irqsave(&omx_xenif->omx_ring_lock, flags);
-			id = req->data.cur.id;
-			eid = req->data.cur.eid;
-			vaddr = req->data.cur.vaddr;
-			nr_grefs = req->data.cur.nr_grefs;
-			nr_pages = req->data.cur.nr_pages;
-			nr_segments = req->data.cur.nr_segments;
+			spin_lock_irqsave(&queue->ring_lock, flags);
+			id = cur->id;
+			eid = cur->eid;
+			vaddr = cur->vaddr;
+			nr_grefs = cur->nr_grefs;
+			nr_pages = cur->nr_pages;
+			nr_segments = cur->nr_segments;
 			endpoint = omx_xenif->be->omxdev->endpoints[eid];
 
 			dprintk_deb("reg id=%u, nr_segments=%u, eid=%u"
@@ -925,7 +964,7 @@ int omx_xenback_process_misc(omx_xenif_t * omx_xenif, uint32_t func, struct
 
 			for (i = 0; i < nr_segments; i++) {
 				struct omx_ring_msg_register_user_segment *seg;
-				seg = &req->data.cur.segs[i];
+				seg = &cur->segs[i];
 
 				sid = seg->sid;
 				id = seg->rid;
@@ -943,15 +982,16 @@ int omx_xenback_process_misc(omx_xenif_t * omx_xenif, uint32_t func, struct
 			resp->func = OMX_CMD_XEN_CREATE_USER_REGION;
 			resp->eid = eid;
 			resp->request_id = req->request_id;
-			resp->data.cur.id = id;
-			resp->data.cur.eid = eid;
+			/* the response shares the slot, and thus the payload */
+			cur->id = id;
+			cur->eid = eid;
 
 			if (ret < 0) {
 				printk_err("Failed to reg\n");
-				resp->data.cur.status = 0x1;
+				cur->status = 0x1;
 			}
 			else
-				resp->data.cur.status = 0x0;
+				cur->status = 0x0;
 #ifdef OMX_XEN_FE_SHORTCUT
 			rmb();
 			/* FIXME: Really buggy/experimental stuff!!
@@ -970,7 +1010,7 @@ int omx_xenback_process_misc(omx_xenif_t * omx_xenif, uint32_t func, struct
 
 			wmb();
 #endif
-			spin_unlock_irqrestore(&omx_xenif->omx_ring_lock, flags);
+			spin_unlock_irqrestore(&queue->ring_lock, flags);
 			break;
 		}
 	case OMX_CMD_XEN_DESTROY_USER_REGION:{
@@ -979,20 +1019,24 @@ int omx_xenback_process_misc(omx_xenif_t * omx_xenif, uint32_t func, struct
 			uint32_t sid;
 			int i;
 			struct omx_endpoint *endpoint;
+			struct omx_ring_msg_destroy_user_region *dur =
+			    &omx_xenif_slot_payload(queue->ring_payload,
+						    queue->ring.sring,
+						    req)->dur;
 
-			spin_lock_irqsave(&omx_xenif->omx_ring_lock, flags);
+			spin_lock_irqsave(&queue->ring_lock, flags);
 			dprintk_deb
 			    ("received frontend request: OMX_CMD_XEN_DESTROY_USER_REGION, param=%lx\n",
 			     sizeof(struct omx_ring_msg_destroy_user_region));
-			id = req->data.dur.id;
-			seqnum = req->data.dur.seqnum;
-			eid = req->data.dur.eid;
+			id = dur->id;
+			seqnum = dur->seqnum;
+			eid = dur->eid;
 			endpoint = omx_xenif->be->omxdev->endpoints[eid];
 
-			for (i = 0; i < req->data.dur.nr_segments; i++) {
+			for (i = 0; i < dur->nr_segments; i++) {
 				struct omx_ring_msg_deregister_user_segment
 				*seg;
-				seg = &req->data.dur.segs[i];
+				seg = &dur->segs[i];
 
 				sid = seg->sid;
 				id = seg->rid;
@@ -1002,7 +1046,8 @@ int omx_xenback_process_misc(omx_xenif_t * omx_xenif, uint32_t func, struct
 				ret =
 				    omx_xen_deregister_user_segment(omx_xenif,
 								    id, sid,
-								    eid);
+								    eid,
+								    seg->keep_mapped);
 
 				if (ret)
 					printk_err
@@ -1017,19 +1062,18 @@ int omx_xenback_process_misc(omx_xenif_t * omx_xenif, uint32_t func, struct
 			ret =
 			    omx_xen_destroy_user_region(omx_xenif, id,
 							seqnum, eid);
-			//memset(&resp->data.dur, 0, sizeof(resp->data.dur));
+			/* the response shares the slot, and thus the payload */
 			resp->func = OMX_CMD_XEN_DESTROY_USER_REGION;
 			resp->eid = eid;
 			resp->request_id = req->request_id;
-			resp->data.dur.id = id;
-			resp->data.dur.eid = eid;
-			resp->data.dur.region = req->data.dur.region;
+			dur->id = id;
+			dur->eid = eid;
 			if (ret < 0) {
 				printk_err("Failed to dereg\n");
-				resp->data.dur.status = 0x1;
+				dur->status = 0x1;
 			}
 			else
-				resp->data.dur.status = 0x0;
+				dur->status = 0x0;
 
 #ifdef OMX_XEN_FE_SHORTCUT
 			rmb();
@@ -1050,7 +1094,19 @@ int omx_xenback_process_misc(omx_xenif_t * omx_xenif, uint32_t func, struct
 			wmb();
 #endif
 
-			spin_unlock_irqrestore(&omx_xenif->omx_ring_lock, flags);
+			spin_unlock_irqrestore(&queue->ring_lock, flags);
+			break;
+		}
+	case OMX_CMD_XEN_FORGET_USER_SEGMENT:{
+			dprintk_deb
+			    ("received frontend request: OMX_CMD_XEN_FORGET_USER_SEGMENT, param=%lx\n",
+			     sizeof(struct omx_ring_msg_forget_user_segment));
+
+			ret =
+			    omx_xen_forget_user_segment(omx_xenif,
+							req->data.forget_segment.gref);
+			resp->func = OMX_CMD_XEN_FORGET_USER_SEGMENT;
+			resp->ret = ret;
 			break;
 		}
 	default:{
@@ -1064,20 +1120,21 @@ out:
 	return ret;
 }
 
-int omx_xenback_process_specific(omx_xenif_t * omx_xenif, uint32_t func, struct
-				 omx_xenif_request *req,
+int omx_xenback_process_specific(struct omx_xenif_queue *queue, uint32_t func,
+				 struct omx_xenif_request *req,
 				 struct omx_xenif_response *resp)
 {
+	omx_xenif_t *omx_xenif = queue->omx_xenif;
 	struct backend_info *be = omx_xenif->be;
 	struct omx_endpoint *endpoint;
 	unsigned long flags;
 	int ret = 0;
 
 	dprintk_in();
-	spin_lock_irqsave(&omx_xenif->omx_ring_lock, flags);
+	spin_lock_irqsave(&queue->ring_lock, flags);
 	endpoint = omx_xenback_get_endpoint(be, req);
 	BUG_ON(!endpoint);
-	spin_unlock_irqrestore(&omx_xenif->omx_ring_lock, flags);
+	spin_unlock_irqrestore(&queue->ring_lock, flags);
 
 	switch (func) {
 	case OMX_CMD_PULL:{
@@ -1085,7 +1142,7 @@ int omx_xenback_process_specific(omx_xenif_t * omx_xenif, uint32_t func, struct
 			dprintk_deb
 			    ("received frontend request: OMX_CMD_PULL, param=%lx\n",
 			     sizeof(struct omx_cmd_xen_pull));
-			spin_lock_irqsave(&omx_xenif->omx_ring_lock, flags);
+			spin_lock_irqsave(&queue->ring_lock, flags);
 
 			/* getting connect request structure */
 			memcpy(&pull, &req->data.pull.pull,
@@ -1093,7 +1150,7 @@ int omx_xenback_process_specific(omx_xenif_t * omx_xenif, uint32_t func, struct
 
 			//ret = omx_ioctl_send_rndv(endpoint, &req->data.send_rndv.rndv);
 			spin_unlock_irqrestore
-			    (&omx_xenif->omx_ring_lock, flags);
+			    (&queue->ring_lock, flags);
 			ret = omx_ioctl_pull(endpoint, &pull);
 
 			break;
@@ -1103,7 +1160,7 @@ int omx_xenback_process_specific(omx_xenif_t * omx_xenif, uint32_t func, struct
 			dprintk_deb
 			    ("received frontend request: OMX_CMD_SEND_RNDV, param=%lx\n",
 			     sizeof(struct omx_cmd_xen_send_rndv));
-			spin_lock_irqsave(&omx_xenif->omx_ring_lock, flags);
+			spin_lock_irqsave(&queue->ring_lock, flags);
 
 			/* getting connect request structure */
 			memcpy(&send_rndv, &req->data.send_rndv.rndv,
@@ -1111,7 +1168,7 @@ int omx_xenback_process_specific(omx_xenif_t * omx_xenif, uint32_t func, struct
 
 			//ret = omx_ioctl_send_rndv(endpoint, &req->data.send_rndv.rndv);
 			spin_unlock_irqrestore
-			    (&omx_xenif->omx_ring_lock, flags);
+			    (&queue->ring_lock, flags);
 			ret = omx_ioctl_send_rndv(endpoint, &send_rndv);
 
 			//memset(&resp->data.send_rndv, 0, sizeof(resp->data.send_rndv));
@@ -1140,6 +1197,22 @@ int omx_xenback_process_specific(omx_xenif_t * omx_xenif, uint32_t func, struct
 			}
 			//memset(&resp->data.send_small, 0, sizeof(resp->data.send_small));
 
+			break;
+		}
+	case OMX_CMD_XEN_SEND_MEDIUMSQ:{
+			struct omx_cmd_send_mediumsq *mediumsq =
+			    &omx_xenif_slot_payload(queue->ring_payload,
+						    queue->ring.sring,
+						    req)->mediumsq;
+			dprintk_deb
+			    ("received frontend request: OMX_CMD_XEN_SEND_MEDIUMSQ, %d frags\n",
+			     mediumsq->frags_nr);
+
+			/* the granted sendq pages are used just like the native ones */
+			ret = omx_ioctl_send_mediumsq(endpoint, mediumsq);
+			if (ret) {
+				printk_err("Medium SQ error\n");
+			}
 			break;
 		}
 	case OMX_CMD_SEND_MEDIUMVA:{
@@ -1163,8 +1236,10 @@ int omx_xenback_process_specific(omx_xenif_t * omx_xenif, uint32_t func, struct
 			checksum = req->data.send_mediumva.mediumva.checksum;
 			req->data.send_small.small.length = 128;
 			req->data.send_small.small.checksum = checksum;
-			req->data.send_small.small.vaddr =
-			    (uint64_t) req->data.send_small.data;
+			req->data.send_small.small.vaddr = (uint64_t)
+			    omx_xenif_slot_payload(queue->ring_payload,
+						   queue->ring.sring,
+						   req)->small_data;
 			ret =
 			    omx_ioctl_send_small(endpoint,
 						 &req->data.send_small.small);
@@ -1181,11 +1256,13 @@ int omx_xenback_process_specific(omx_xenif_t * omx_xenif, uint32_t func, struct
 			dprintk_deb
 			    ("received frontend request: OMX_CMD_SEND_SMALL, param=%lx\n",
 			     sizeof(struct omx_cmd_xen_send_small));
-			spin_lock_irqsave(&omx_xenif->omx_ring_lock, flags);
-			req->data.send_small.small.vaddr =
-			    (uint64_t) req->data.send_small.data;
+			spin_lock_irqsave(&queue->ring_lock, flags);
+			req->data.send_small.small.vaddr = (uint64_t)
+			    omx_xenif_slot_payload(queue->ring_payload,
+						   queue->ring.sring,
+						   req)->small_data;
 			spin_unlock_irqrestore
-			    (&omx_xenif->omx_ring_lock, flags);
+			    (&queue->ring_lock, flags);
 			//dump_xen_send_small(&req->data.send_small);
 			ret =
 			    omx_ioctl_send_small(endpoint,
@@ -1229,6 +1306,49 @@ int omx_xenback_process_specific(omx_xenif_t * omx_xenif, uint32_t func, struct
 
 			//memset(&resp->data.send_liback, 0, sizeof(resp->data.send_liback));
 
+			break;
+		}
+	case OMX_CMD_XEN_SEND_BATCH:{
+			struct omx_cmd_xen_send_batch *batch =
+			    &req->data.send_batch;
+			struct omx_cmd_send_batch_entry *entries =
+			    omx_xenif_slot_payload(queue->ring_payload,
+						   queue->ring.sring,
+						   req)->batch;
+			struct omx_cmd_send_batch_entry *entry;
+			int i, err;
+			dprintk_deb
+			    ("received frontend request: OMX_CMD_XEN_SEND_BATCH, %d commands\n",
+			     batch->nr_entries);
+
+			/* keep going after a failure, each command has its own status */
+			omx_iface_xmit_batch_begin(endpoint->iface);
+			for (i = 0; i < batch->nr_entries
+			     && i < OMX_XEN_SEND_BATCH_SLOT_ENTRIES; i++) {
+				entry = &entries[i];
+				switch (entry->cmd) {
+				case OMX_CMD_SEND_TINY:
+					err = omx_ioctl_send_tiny(endpoint,
+								  &entry->u.tiny);
+					break;
+				case OMX_CMD_SEND_NOTIFY:
+					err = omx_ioctl_send_notify(endpoint,
+								    &entry->u.notify);
+					break;
+				case OMX_CMD_SEND_LIBACK:
+					err = omx_ioctl_send_liback(endpoint,
+								    &entry->u.liback);
+					break;
+				default:
+					printk_err("Cannot batch command %x\n",
+						   entry->cmd);
+					err = -EINVAL;
+				}
+				entry->status = err;
+				if (err && !ret)
+					ret = err;
+			}
+			omx_iface_xmit_batch_end(endpoint->iface);
 			break;
 		}
 	case OMX_CMD_SEND_CONNECT_REQUEST:{
@@ -1236,13 +1356,13 @@ int omx_xenback_process_specific(omx_xenif_t * omx_xenif, uint32_t func, struct
 			dprintk_deb
 			    ("received frontend request: OMX_CMD_SEND_CONNECT_REQUEST, param=%lx\n",
 			     sizeof(struct omx_cmd_xen_send_connect_request));
-			spin_lock_irqsave(&omx_xenif->omx_ring_lock, flags);
+			spin_lock_irqsave(&queue->ring_lock, flags);
 			/* getting connect request structure */
 			//dump_xen_send_connect_request(&req-> data.send_connect_request);
 			memcpy(&connect,
 			       &req->data.send_connect_request.request,
 			       sizeof(connect));
-			spin_unlock_irqrestore(&omx_xenif->omx_ring_lock,
+			spin_unlock_irqrestore(&queue->ring_lock,
 					       flags);
 			ret =
 			    omx_ioctl_send_connect_request(endpoint, &connect);
@@ -1254,14 +1374,14 @@ int omx_xenback_process_specific(omx_xenif_t * omx_xenif, uint32_t func, struct
 			dprintk_deb
 			    ("received frontend request: OMX_CMD_SEND_CONNECT_REPLY, param=%lx\n",
 			     sizeof(struct omx_cmd_xen_send_connect_reply));
-			spin_lock_irqsave(&omx_xenif->omx_ring_lock, flags);
+			spin_lock_irqsave(&queue->ring_lock, flags);
 			/* getting connect request structure */
 			//dump_xen_send_connect_reply(&req->data.send_connect_reply);
 			memcpy(&reply,
 			       &req->data.send_connect_reply.reply,
 			       sizeof(reply));
 			spin_unlock_irqrestore
-			    (&omx_xenif->omx_ring_lock, flags);
+			    (&queue->ring_lock, flags);
 			ret = omx_ioctl_send_connect_reply(endpoint, &reply);
 			break;
 		}
@@ -1273,9 +1393,9 @@ int omx_xenback_process_specific(omx_xenif_t * omx_xenif, uint32_t func, struct
 	}
 
 
-	spin_lock_irqsave(&omx_xenif->omx_ring_lock, flags);
+	spin_lock_irqsave(&queue->ring_lock, flags);
 	omx_xenback_prepare_response(endpoint, req, resp, ret);
-	spin_unlock_irqrestore(&omx_xenif->omx_ring_lock, flags);
+	spin_unlock_irqrestore(&queue->ring_lock, flags);
 	if (ret) {
 		printk_err("Something bad happened!, ret = %d\n");
 	}
@@ -1285,9 +1405,10 @@ out:
 	return ret;
 
 }
-int omx_xen_process_message(omx_xenif_t * omx_xenif,
-			    struct omx_xenif_back_ring *ring)
+int omx_xen_process_message(struct omx_xenif_queue *queue)
 {
+	omx_xenif_t *omx_xenif = queue->omx_xenif;
+	struct omx_xenif_back_ring *ring = &queue->ring;
 	RING_IDX cons;
 	RING_IDX prod;
 	struct omx_xenif_request *req;
@@ -1322,11 +1443,11 @@ int omx_xen_process_message(omx_xenif_t * omx_xenif,
 	     ring, cons, ring->rsp_prod_pvt, prod);
 	rmb();
 	while (cons != prod) {
-		dprintk_deb("omx_xenif->ring.req_cons=%d, i=%d, rp=%d\n",
-			    omx_xenif->ring.req_cons, omx_xenif->ring.req_cons,
-			    omx_xenif->ring.sring->req_prod);
+		dprintk_deb("queue->ring.req_cons=%d, i=%d, rp=%d\n",
+			    queue->ring.req_cons, queue->ring.req_cons,
+			    queue->ring.sring->req_prod);
 
-		spin_lock_irqsave(&omx_xenif->omx_ring_lock, flags);
+		spin_lock_irqsave(&queue->ring_lock, flags);
 		if (RING_REQUEST_CONS_OVERFLOW(ring, cons)) {
 			printk_err("Overflow!\n");
 			dprintk_inf
@@ -1346,17 +1467,17 @@ int omx_xen_process_message(omx_xenif_t * omx_xenif,
 			goto out_with_lock;
 		}
 		dprintk_deb(KERN_INFO "func = %#x, requests_produced= %d\n",
-			    func, omx_xenif->ring.sring->req_prod);
+			    func, queue->ring.sring->req_prod);
 
 		resp =
-		    RING_GET_RESPONSE(&(omx_xenif->ring),
-				      omx_xenif->ring.rsp_prod_pvt++);
+		    RING_GET_RESPONSE(&(queue->ring),
+				      queue->ring.rsp_prod_pvt++);
 		if (unlikely(!resp)) {
 			printk_err("Got NULL for resp, aborting!\n");
 			goto out_with_lock;
 		}
 
-		spin_unlock_irqrestore(&omx_xenif->omx_ring_lock, flags);
+		spin_unlock_irqrestore(&queue->ring_lock, flags);
 		switch (func) {
 			case OMX_CMD_PEER_FROM_INDEX:
 			case OMX_CMD_PEER_FROM_ADDR:
@@ -1371,10 +1492,11 @@ int omx_xen_process_message(omx_xenif_t * omx_xenif,
 			case OMX_CMD_XEN_CLOSE_ENDPOINT:
 			case OMX_CMD_XEN_CREATE_USER_REGION:
 			case OMX_CMD_XEN_DESTROY_USER_REGION:
-				ret = omx_xenback_process_misc(omx_xenif, func, req, resp);
+			case OMX_CMD_XEN_FORGET_USER_SEGMENT:
+				ret = omx_xenback_process_misc(queue, func, req, resp);
 				break;
 			default:
-				ret = omx_xenback_process_specific(omx_xenif, func, req, resp);
+				ret = omx_xenback_process_specific(queue, func, req, resp);
 		}
 		if (ret) {
 			printk_err("Failed, ret = %d\n", ret);
@@ -1382,7 +1504,7 @@ int omx_xen_process_message(omx_xenif_t * omx_xenif,
 
 		dprintk_deb("response ready (%#llx), id=%#x sending to %u\n",
 			    (unsigned long long)resp, resp->func,
-			    omx_xenif->be->evtchn.port);
+			    queue->evtchn.port);
 
 	}
 	ring->req_cons = cons;
@@ -1390,7 +1512,7 @@ int omx_xen_process_message(omx_xenif_t * omx_xenif,
 	goto out;
 
 out_with_lock:
-	spin_unlock_irqrestore(&omx_xenif->omx_ring_lock, flags);
+	spin_unlock_irqrestore(&queue->ring_lock, flags);
 out:
 	dprintk_out();
 	return ret;
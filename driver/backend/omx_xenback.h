@@ -22,6 +22,7 @@
 #include <linux/scatterlist.h>
 #include <linux/workqueue.h>
 #include <linux/spinlock.h>
+#include <linux/rbtree.h>
 #include <xen/interface/io/xenbus.h>
 #include <xen/interface/io/ring.h>
 #include <linux/cdev.h>
@@ -29,7 +30,10 @@
 #include <xen/events.h>
 #include "omx_reg.h"
 
-#define OMX_XEN_BACKEND_TIMEOUT 1000 * 1000
+/* default time to keep polling the request ring once it went idle */
+#define OMX_XEN_BACKEND_POLL_USECS_DEFAULT 50
+extern unsigned long omx_xen_poll_usecs;
+extern int omx_xen_grant_copy;
 
 #include "omx_xen_timers.h"
 #include "omx_xen.h"
@@ -40,6 +44,34 @@ enum backend_status {
         OMX_XEN_BACKEND_STATUS_FAILED,
 };
 
+struct omx_xenif_st;
+
+/* one request ring, with its own event channel and worker */
+struct omx_xenif_queue {
+	struct omx_xenif_st *omx_xenif;
+	unsigned int id;
+	struct evtchn_alloc_unbound evtchn;
+	int irq;
+
+	spinlock_t ring_lock;
+	struct omx_xenif_back_ring ring;
+	struct vm_struct *ring_area;
+	grant_handle_t ring_handle;
+	grant_ref_t ring_ref;
+	void *ring_payload[OMX_XEN_RING_PAYLOAD_PAGES];
+	struct vm_struct *ring_payload_area[OMX_XEN_RING_PAYLOAD_PAGES];
+	grant_handle_t ring_payload_handle[OMX_XEN_RING_PAYLOAD_PAGES];
+	grant_ref_t ring_payload_ref[OMX_XEN_RING_PAYLOAD_PAGES];
+
+	struct workqueue_struct *msg_workq;
+	struct work_struct msg_workq_task;
+
+	/* adaptive polling of the request ring */
+	atomic_t polling;	/* the interrupt does not need to queue work */
+	unsigned long req_gap_ns;	/* average request inter-arrival time */
+	s64 last_req;		/* in ns */
+};
+
 typedef struct omx_xenif_st {
 	/* Unique identifier for this interface. */
 	domid_t domid;
@@ -53,32 +85,37 @@ typedef struct omx_xenif_st {
 	spinlock_t omx_send_lock;
 	spinlock_t omx_resp_lock;
 	spinlock_t omx_recv_ring_lock;
-	spinlock_t omx_ring_lock;
 	atomic_t refcnt;
 
+	unsigned long poll_usecs;	/* spin budget, tunable in sysfs */
+	int grant_copy;			/* new regions use GNTTABOP_copy */
+
 	wait_queue_head_t wq;
 	wait_queue_head_t resp_wq;
 	wait_queue_head_t waiting_to_free;
 
 	struct task_struct *task;
-	struct workqueue_struct *msg_workq;
-	struct work_struct msg_workq_task;
 	struct workqueue_struct *response_msg_workq;
 	struct work_struct response_workq_task;
 	struct completion completion;
 
 	grant_handle_t recv_handle;
 	grant_ref_t recv_ref;
-	grant_handle_t shmem_handle;
-	grant_ref_t shmem_ref;
 
 	unsigned long st_print;
 
 	unsigned int card_index;
-	struct omx_xenif_back_ring ring;
-	struct vm_struct *omx_xenif_ring_area;
+	/* request rings, the first one also signals recv_ring */
+	struct omx_xenif_queue queues[OMX_XEN_QUEUES_MAX];
+	unsigned int nr_queues;	/* allocated ports until connected */
 	struct omx_xenif_back_ring recv_ring;
 	struct vm_struct *recv_ring_area;
+	/* persistent grants of the frontend, by gref */
+	struct rb_root pgrants;
+	unsigned int nr_pgrants;
+	spinlock_t pgrants_lock; /* also protects psegs */
+	/* segments kept mapped for the frontend registration cache */
+	struct rb_root psegs;
         enum backend_status status;
         spinlock_t status_lock;
 	uint32_t recvq_offset;
@@ -100,6 +137,7 @@ struct omx_xen_user_region {
 	uint32_t eid;
 
         unsigned dirty : 1;
+        unsigned grant_copy : 1; /* segments keep grefs, pages are not mapped */
         struct kref refcount;
         struct omx_endpoint *endpoint;
 
@@ -135,6 +173,7 @@ struct omx_xen_user_region {
 #endif
 		uint16_t gref_offset;
 		struct page **pages;
+		grant_ref_t *grefs;	/* grant copy regions only */
 	} segments[0];
 };
 
@@ -157,8 +196,6 @@ struct backend_info {
 	int remoteDomain;
 	int gref;
 	unsigned long all_gref;
-	int irq;
-	struct evtchn_alloc_unbound evtchn;
 	//struct omx_xenif_back_ring ring;
 	char *frontpath;
 };
@@ -177,6 +214,7 @@ extern timers_t t_recv, t_rndv, t_notify, t_small, t_tiny, t_medium, t_connect,
 extern timers_t t_pull_request, t_pull_reply, t_pull, t_handle, t_try_dma, t_rem_copy, t_bh_notify, t_progress, t_fill_bl, t_other_bl, t_first_bl, t_handle_completed, t_reschedule, t_push_pending, t_poll_dma;
 extern timers_t t_send_tiny, t_send_small, t_send_medium, t_send_connect, t_send_notify, t_send_connect_reply, t_send_rndv, t_send_liback;
 extern timers_t t_reg_seg, t_create_reg, t_dereg_seg, t_destroy_reg, t_alloc_pages, t_accept_grants, t_accept_gref_list, t_release_grants, t_release_gref_list, t_free_pages;
+extern timers_t t_gcopy;
 
 #endif				/* __omx_xenback_h__ */
 
@@ -241,6 +241,158 @@ out:
 	return ret;
 }
 
+static void omx_xen_release_shared_page(struct omx_endpoint *endpoint)
+{
+	struct gnttab_unmap_grant_ref ops;
+	unsigned int level;
+
+	dprintk_in();
+
+	gnttab_set_unmap_op(&ops, (unsigned long)endpoint->xen_shared_vm->addr,
+			    GNTMAP_host_map | GNTMAP_contains_pte,
+			    endpoint->xen_shared_handle);
+	ops.host_addr =
+	    arbitrary_virt_to_machine(lookup_address
+				      ((unsigned long)(endpoint->xen_shared_vm->
+						       addr), &level)).maddr;
+
+	if (HYPERVISOR_grant_table_op(GNTTABOP_unmap_grant_ref, &ops, 1))
+		printk_err("hypervisor command failed:S\n");
+	if (ops.status)
+		printk_err
+		    ("HYPERVISOR unmap shared grant ref failed status = %d",
+		     ops.status);
+
+	free_vm_area(endpoint->xen_shared_vm);
+	endpoint->xen_shared_vm = NULL;
+
+	dprintk_out();
+}
+
+static void omx_xen_release_unexp_eventq(struct omx_endpoint *endpoint)
+{
+	dprintk_in();
+
+	if (!endpoint->xen_shared)
+		goto out;
+
+	/* make sure no receive path still writes into the eventq */
+	endpoint->xen_shared = NULL;
+	synchronize_rcu();
+
+	gnttab_unmap_refs(endpoint->unexp_eventq_unmap, NULL,
+			  endpoint->xen_unexp_eventq_pages,
+			  OMX_XEN_UNEXP_EVENTQ_PAGES);
+	free_xenballooned_pages(OMX_XEN_UNEXP_EVENTQ_PAGES,
+				endpoint->xen_unexp_eventq_pages);
+	kfree(endpoint->xen_unexp_eventq_pages);
+	kfree(endpoint->unexp_eventq_unmap);
+	endpoint->xen_unexp_eventq_pages = NULL;
+	endpoint->unexp_eventq_unmap = NULL;
+
+	omx_xen_release_shared_page(endpoint);
+
+out:
+	dprintk_out();
+}
+
+/*
+ * Map the page listing the frontend unexp eventq grants and the eventq
+ * itself so that the receive path may write events there directly.
+ * On failure, events keep going through the recv_ring.
+ */
+static int omx_xen_accept_unexp_eventq(struct omx_endpoint *endpoint,
+				       grant_ref_t shared_gref)
+{
+	struct backend_info *be = endpoint->be;
+	struct omx_xen_endpoint_shared *shared;
+	struct gnttab_map_grant_ref *map = NULL;
+	struct gnttab_unmap_grant_ref *unmap = NULL;
+	struct page **pages = NULL;
+	void *void_vaddr;
+	int ret, i;
+
+	dprintk_in();
+
+	ret = omx_xen_accept_queue_grefs(be->omx_xenif, endpoint, shared_gref,
+					 &endpoint->xen_shared_vm, &void_vaddr,
+					 &endpoint->xen_shared_handle, 0);
+	if (ret < 0) {
+		printk_err("Failed to accept shared page ret = %d\n", ret);
+		goto out;
+	}
+	shared = (struct omx_xen_endpoint_shared *)void_vaddr;
+
+	pages = kmalloc(sizeof(struct page *) * OMX_XEN_UNEXP_EVENTQ_PAGES,
+			GFP_KERNEL);
+	map = kzalloc(sizeof(struct gnttab_map_grant_ref) *
+		      OMX_XEN_UNEXP_EVENTQ_PAGES, GFP_KERNEL);
+	unmap = kzalloc(sizeof(struct gnttab_unmap_grant_ref) *
+			OMX_XEN_UNEXP_EVENTQ_PAGES, GFP_KERNEL);
+	if (!pages || !map || !unmap) {
+		ret = -ENOMEM;
+		printk_err("unexp eventq map is NULL, ENOMEM!!!\n");
+		goto out_with_shared;
+	}
+
+	ret = alloc_xenballooned_pages(OMX_XEN_UNEXP_EVENTQ_PAGES, pages,
+				       false /* lowmem */);
+	if (ret) {
+		printk_err("cannot allocate xenballooned_pages\n");
+		goto out_with_shared;
+	}
+
+	for (i = 0; i < OMX_XEN_UNEXP_EVENTQ_PAGES; i++) {
+		unsigned long addr =
+		    (unsigned long)pfn_to_kaddr(page_to_pfn(pages[i]));
+
+		gnttab_set_map_op(&map[i], addr, GNTMAP_host_map,
+				  shared->unexp_eventq_gref[i],
+				  be->remoteDomain);
+		gnttab_set_unmap_op(&unmap[i], addr, GNTMAP_host_map,
+				    -1 /* handle */ );
+	}
+
+	ret = gnttab_map_refs(map, NULL, pages, OMX_XEN_UNEXP_EVENTQ_PAGES);
+	if (ret) {
+		printk_err("Error mapping unexp eventq, ret= %d\n", ret);
+		goto out_with_pages;
+	}
+
+	for (i = 0; i < OMX_XEN_UNEXP_EVENTQ_PAGES; i++) {
+		if (map[i].status) {
+			printk_err("idx %d, status =%d\n", i, map[i].status);
+			ret = -EINVAL;
+		}
+		unmap[i].handle = map[i].handle;
+	}
+	if (ret) {
+		for (i = 0; i < OMX_XEN_UNEXP_EVENTQ_PAGES; i++)
+			if (!map[i].status)
+				gnttab_unmap_refs(&unmap[i], NULL, &pages[i], 1);
+		goto out_with_pages;
+	}
+
+	kfree(map);
+	endpoint->xen_unexp_eventq_pages = pages;
+	endpoint->unexp_eventq_unmap = unmap;
+	/* publish last, the receive path only checks xen_shared */
+	wmb();
+	endpoint->xen_shared = shared;
+	goto out;
+
+out_with_pages:
+	free_xenballooned_pages(OMX_XEN_UNEXP_EVENTQ_PAGES, pages);
+out_with_shared:
+	kfree(pages);
+	kfree(map);
+	kfree(unmap);
+	omx_xen_release_shared_page(endpoint);
+out:
+	dprintk_out();
+	return ret;
+}
+
 int omx_xen_endpoint_accept_resources(struct omx_endpoint *endpoint,
 				      struct omx_xenif_request *req)
 {
@@ -266,6 +418,8 @@ int omx_xen_endpoint_accept_resources(struct omx_endpoint *endpoint,
 
 	dprintk_in();
 
+	endpoint->xen_shared = NULL;
+
 	sendq_gref_size = req->data.endpoint.sendq_gref_size;
 	recvq_gref_size = req->data.endpoint.recvq_gref_size;
 	egref_sendq_offset = req->data.endpoint.egref_sendq_offset;
@@ -477,6 +631,13 @@ int omx_xen_endpoint_accept_resources(struct omx_endpoint *endpoint,
 	    vmap(recvq_page_list, recvq_gref_size, VM_MAP, PAGE_KERNEL);
 #endif
 
+	/* not fatal, events will go through the recv_ring */
+	if (req->data.endpoint.shared_gref &&
+	    omx_xen_accept_unexp_eventq(endpoint,
+					req->data.endpoint.shared_gref) < 0)
+		printk_inf("writing events through the recv_ring\n");
+	ret = 0;
+
 out:
 	dprintk_out();
 	return ret;
@@ -503,6 +664,8 @@ int omx_xen_endpoint_release_resources(struct omx_endpoint *endpoint,
 		ret = -EINVAL;
 		goto out;
 	}
+
+	omx_xen_release_unexp_eventq(endpoint);
 #if 0
 	if (!endpoint->xen_sendq) {
 		printk_err("vmap'd space is NULL\n");
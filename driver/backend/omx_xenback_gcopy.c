@@ -0,0 +1,244 @@
+/*
+ * Xen2MX
+ * Copyright © Anastassios Nanos 2012
+ * (see AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License in COPYING.GPL for more details.
+ */
+
+#include <linux/kernel.h>
+#include <linux/skbuff.h>
+#include <asm/xen/hypervisor.h>
+#include <asm/xen/hypercall.h>
+#include <xen/grant_table.h>
+#include <xen/interface/grant_table.h>
+#include <xen/page.h>
+
+//#define TIMERS_ENABLED
+#include "omx_xen_timers.h"
+
+//#define EXTRA_DEBUG_OMX
+#include "omx_xen_debug.h"
+#include "omx_xen.h"
+#include "omx_xenback.h"
+#include "omx_xenback_gcopy.h"
+
+timers_t t_gcopy;
+
+/*
+ * Grant copy: instead of mapping the frontend pages in dom0 (and paying
+ * for the unmap TLB flush), let Xen copy between the frontend grants and
+ * our own pages. Each op must stay within one page on both sides; the
+ * callers split on the frontend side, we split on the local side.
+ */
+
+static void
+omx_xen_gcopy_add(struct omx_xen_gcopy *gcopy, grant_ref_t gref,
+		  unsigned int goff, struct page *page, unsigned int pageoff,
+		  unsigned int len, int to_guest)
+{
+	domid_t domid = gcopy->omx_xenif->domid;
+
+	/* skb frags may live in compound pages */
+	page += pageoff >> PAGE_SHIFT;
+	pageoff &= ~PAGE_MASK;
+
+	while (len) {
+		struct gnttab_copy *op;
+		unsigned int chunk = min_t(unsigned int, len, PAGE_SIZE - pageoff);
+
+		if (gcopy->nr == OMX_XEN_GCOPY_BATCH)
+			omx_xen_gcopy_flush(gcopy);
+
+		op = &gcopy->ops[gcopy->nr++];
+		if (to_guest) {
+			op->source.u.gmfn = pfn_to_mfn(page_to_pfn(page));
+			op->source.domid = DOMID_SELF;
+			op->source.offset = pageoff;
+			op->dest.u.ref = gref;
+			op->dest.domid = domid;
+			op->dest.offset = goff;
+			op->flags = GNTCOPY_dest_gref;
+		} else {
+			op->source.u.ref = gref;
+			op->source.domid = domid;
+			op->source.offset = goff;
+			op->dest.u.gmfn = pfn_to_mfn(page_to_pfn(page));
+			op->dest.domid = DOMID_SELF;
+			op->dest.offset = pageoff;
+			op->flags = GNTCOPY_source_gref;
+		}
+		op->len = chunk;
+
+		len -= chunk;
+		goff += chunk;
+		page++;
+		pageoff = 0;
+	}
+}
+
+void omx_xen_gcopy_from_guest(struct omx_xen_gcopy *gcopy, grant_ref_t gref,
+			      unsigned int goff, struct page *page,
+			      unsigned int pageoff, unsigned int len)
+{
+	omx_xen_gcopy_add(gcopy, gref, goff, page, pageoff, len, 0);
+}
+
+void omx_xen_gcopy_to_guest(struct omx_xen_gcopy *gcopy, grant_ref_t gref,
+			    unsigned int goff, struct page *page,
+			    unsigned int pageoff, unsigned int len)
+{
+	omx_xen_gcopy_add(gcopy, gref, goff, page, pageoff, len, 1);
+}
+
+/* issue the queued ops, returns the first error seen in this batch */
+int omx_xen_gcopy_flush(struct omx_xen_gcopy *gcopy)
+{
+	int i;
+
+	dprintk_in();
+
+	if (!gcopy->nr)
+		goto out;
+
+	TIMER_START(&t_gcopy);
+	if (HYPERVISOR_grant_table_op(GNTTABOP_copy, gcopy->ops, gcopy->nr)) {
+		printk_err("HYPERVISOR grant copy failed\n");
+		gcopy->err = -EFAULT;
+	} else {
+		for (i = 0; i < gcopy->nr; i++) {
+			if (unlikely(gcopy->ops[i].status != GNTST_okay)) {
+				printk_err("grant copy op %d failed, status = %d\n",
+					   i, gcopy->ops[i].status);
+				gcopy->err = -EFAULT;
+			}
+		}
+	}
+	TIMER_STOP_BATCH(&t_gcopy, gcopy->nr);
+	gcopy->nr = 0;
+
+out:
+	dprintk_out();
+	return gcopy->err;
+}
+
+/* copy length bytes at segoff of a grant copy segment into buffer */
+void omx_xen_gcopy_segment_to_buf(struct omx_xen_gcopy *gcopy,
+				  const struct omx_xen_user_region_segment *seg,
+				  unsigned long segoff, void *buffer,
+				  unsigned long length)
+{
+	unsigned long i = (segoff + seg->first_page_offset) >> PAGE_SHIFT;
+	unsigned int goff = (segoff + seg->first_page_offset) & ~PAGE_MASK;
+
+	while (length) {
+		unsigned int chunk = min_t(unsigned long, length, PAGE_SIZE - goff);
+
+		omx_xen_gcopy_from_guest(gcopy, seg->grefs[i], goff,
+					 virt_to_page(buffer),
+					 offset_in_page(buffer), chunk);
+		length -= chunk;
+		buffer += chunk;
+		goff = 0;
+		i++;
+	}
+}
+
+static void
+omx_xen_gcopy_page_to_segment(struct omx_xen_gcopy *gcopy,
+			      struct page *page, unsigned int pageoff,
+			      const struct omx_xen_user_region_segment *seg,
+			      unsigned long segoff, unsigned long length)
+{
+	unsigned long i = (segoff + seg->first_page_offset) >> PAGE_SHIFT;
+	unsigned int goff = (segoff + seg->first_page_offset) & ~PAGE_MASK;
+
+	while (length) {
+		unsigned int chunk = min_t(unsigned long, length, PAGE_SIZE - goff);
+
+		omx_xen_gcopy_to_guest(gcopy, seg->grefs[i], goff, page,
+				       pageoff, chunk);
+		length -= chunk;
+		pageoff += chunk;
+		goff = 0;
+		i++;
+	}
+}
+
+/* the grant copy counterpart of skb_copy_bits() into a segment */
+void omx_xen_gcopy_skb_to_segment(struct omx_xen_gcopy *gcopy,
+				  const struct sk_buff *skb,
+				  unsigned long skboff,
+				  const struct omx_xen_user_region_segment *seg,
+				  unsigned long segoff, unsigned long length)
+{
+	unsigned long start = skb_headlen(skb);
+	struct sk_buff *list;
+	int i;
+
+	if (skboff < start) {
+		unsigned long chunk = min(length, start - skboff);
+		void *data = skb->data + skboff;
+
+		omx_xen_gcopy_page_to_segment(gcopy, virt_to_page(data),
+					      offset_in_page(data), seg,
+					      segoff, chunk);
+		length -= chunk;
+		skboff += chunk;
+		segoff += chunk;
+	}
+
+	for (i = 0; length && i < skb_shinfo(skb)->nr_frags; i++) {
+		skb_frag_t *frag = &skb_shinfo(skb)->frags[i];
+		unsigned long end = start + frag->size;
+
+		if (skboff < end) {
+			unsigned long chunk = min(length, end - skboff);
+
+			omx_xen_gcopy_page_to_segment(gcopy, skb_frag_page(frag),
+						      frag->page_offset + skboff - start,
+						      seg, segoff, chunk);
+			length -= chunk;
+			skboff += chunk;
+			segoff += chunk;
+		}
+		start = end;
+	}
+
+	for (list = skb_shinfo(skb)->frag_list; length && list; list = list->next) {
+		unsigned long end = start + list->len;
+
+		if (skboff < end) {
+			unsigned long chunk = min(length, end - skboff);
+
+			omx_xen_gcopy_skb_to_segment(gcopy, list, skboff - start,
+						     seg, segoff, chunk);
+			length -= chunk;
+			skboff += chunk;
+			segoff += chunk;
+		}
+		start = end;
+	}
+
+#ifdef EXTRA_DEBUG_OMX
+	if (length)
+		printk_err("skb too short, %lu bytes left\n", length);
+#endif
+}
+
+/*
+ * Local variables:
+ *  tab-width: 8
+ *  c-basic-offset: 8
+ *  c-indent-level: 8
+ * End:
+ */
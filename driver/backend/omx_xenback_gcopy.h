@@ -0,0 +1,73 @@
+/*
+ * Xen2MX
+ * Copyright © Anastassios Nanos 2012
+ * (see AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License in COPYING.GPL for more details.
+ */
+
+#ifndef __omx_xenback_gcopy_h__
+#define __omx_xenback_gcopy_h__
+
+#include <linux/skbuff.h>
+#include <xen/grant_table.h>
+#include <xen/interface/grant_table.h>
+
+#include "omx_xen.h"
+#include "omx_xenback.h"
+
+/* copy ops queued before we trap into the hypervisor */
+#define OMX_XEN_GCOPY_BATCH 16
+
+/* a batch of GNTTABOP_copy between frontend grants and local pages */
+struct omx_xen_gcopy {
+	omx_xenif_t *omx_xenif;
+	unsigned int nr;
+	int err;
+	struct gnttab_copy ops[OMX_XEN_GCOPY_BATCH];
+};
+
+static inline void omx_xen_gcopy_init(struct omx_xen_gcopy *gcopy,
+				      omx_xenif_t * omx_xenif)
+{
+	gcopy->omx_xenif = omx_xenif;
+	gcopy->nr = 0;
+	gcopy->err = 0;
+}
+
+void omx_xen_gcopy_from_guest(struct omx_xen_gcopy *gcopy, grant_ref_t gref,
+			      unsigned int goff, struct page *page,
+			      unsigned int pageoff, unsigned int len);
+void omx_xen_gcopy_to_guest(struct omx_xen_gcopy *gcopy, grant_ref_t gref,
+			    unsigned int goff, struct page *page,
+			    unsigned int pageoff, unsigned int len);
+int omx_xen_gcopy_flush(struct omx_xen_gcopy *gcopy);
+
+void omx_xen_gcopy_segment_to_buf(struct omx_xen_gcopy *gcopy,
+				  const struct omx_xen_user_region_segment *seg,
+				  unsigned long segoff, void *buffer,
+				  unsigned long length);
+void omx_xen_gcopy_skb_to_segment(struct omx_xen_gcopy *gcopy,
+				  const struct sk_buff *skb,
+				  unsigned long skboff,
+				  const struct omx_xen_user_region_segment *seg,
+				  unsigned long segoff, unsigned long length);
+
+#endif				/* __omx_xenback_gcopy_h__ */
+
+/*
+ * Local variables:
+ *  tab-width: 8
+ *  c-basic-offset: 8
+ *  c-indent-level: 8
+ * End:
+ */
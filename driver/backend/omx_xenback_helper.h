@@ -34,6 +34,8 @@
 #include "omx_xen.h"
 #include "omx_xenback.h"
 #include "omx_xenback_event.h"
+#include "omx_xenback_pgrant.h"
+#include "omx_xenback_reg.h"
 
 static int map_frontend_page(omx_xenif_t * omx_xenif, struct vm_struct *vm_area,
 			     grant_handle_t * handle, grant_ref_t * gref)
@@ -175,29 +177,108 @@ out:
 	return err;
 }
 
+/* map the per-slot payload pages of a request ring */
+static int omx_xenif_map_payload(struct omx_xenif_queue *queue)
+{
+	omx_xenif_t *omx_xenif = queue->omx_xenif;
+	struct xenbus_device *dev = omx_xenif->be->dev;
+	char node[32], name[32];
+	int err = 0, i;
+
+	dprintk_in();
+
+	for (i = 0; i < OMX_XEN_RING_PAYLOAD_PAGES; i++) {
+		snprintf(name, sizeof(name), "ring-payload-ref-%d", i);
+		omx_xen_queue_node(node, sizeof(node), queue->id, name);
+		err = xenbus_scanf(XBT_NIL, dev->otherend, node, "%u",
+				   &queue->ring_payload_ref[i]);
+		if (err != 1) {
+			err = err < 0 ? err : -EINVAL;
+			xenbus_dev_fatal(dev, err, "reading %s/%s",
+					 dev->otherend, node);
+			goto out;
+		}
+
+		queue->ring_payload_area[i] = alloc_vm_area(PAGE_SIZE, NULL);
+		if (!queue->ring_payload_area[i]) {
+			err = -ENOMEM;
+			goto out;
+		}
+
+		err = map_frontend_page(omx_xenif,
+					queue->ring_payload_area[i],
+					&queue->ring_payload_handle[i],
+					&queue->ring_payload_ref[i]);
+		if (err < 0) {
+			free_vm_area(queue->ring_payload_area[i]);
+			queue->ring_payload_area[i] = NULL;
+			printk_err("failed to map ring payload %d, err=%d\n",
+				   i, err);
+			goto out;
+		}
+		queue->ring_payload[i] = queue->ring_payload_area[i]->addr;
+	}
+	err = 0;
+
+out:
+	dprintk_out();
+	return err;
+}
+
+static void omx_xenif_disconnect_queue(struct omx_xenif_queue *queue)
+{
+	omx_xenif_t *omx_xenif = queue->omx_xenif;
+	int i;
+
+	dprintk_in();
+
+	if (queue->irq > 0)
+		unbind_from_irqhandler(queue->irq, queue);
+	queue->irq = 0;
+
+	if (queue->msg_workq)
+		destroy_workqueue(queue->msg_workq);
+	queue->msg_workq = NULL;
+
+	if (queue->ring.sring) {
+		dprintk_deb("%s: queue %u rspvt = %d, rc = %d, rp = %d\n",
+			    __func__, queue->id, queue->ring.rsp_prod_pvt,
+			    queue->ring.req_cons, queue->ring.sring->req_prod);
+		unmap_frontend_page(omx_xenif, queue->ring_area,
+				    queue->ring_handle);
+		free_vm_area(queue->ring_area);
+		queue->ring.sring = NULL;
+	}
+	for (i = 0; i < OMX_XEN_RING_PAYLOAD_PAGES; i++)
+		if (queue->ring_payload[i]) {
+			unmap_frontend_page(omx_xenif,
+					    queue->ring_payload_area[i],
+					    queue->ring_payload_handle[i]);
+			free_vm_area(queue->ring_payload_area[i]);
+			queue->ring_payload[i] = NULL;
+		}
+
+	dprintk_out();
+}
+
 void omx_xenif_disconnect(omx_xenif_t * omx_xenif)
 {
+	int i;
 
 	dprintk_in();
 	//atomic_dec(&omx_xenif->refcnt);
 	//wait_event(omx_xenif->waiting_to_free, atomic_read(&omx_xenif->refcnt) == 0);
 	//atomic_inc(&omx_xenif->refcnt);
 
-	dprintk_deb("%s: rspvt = %d, rc = %d, rp = %d\n", __func__,
-		    omx_xenif->ring.rsp_prod_pvt, omx_xenif->ring.req_cons,
-		    omx_xenif->ring.sring->req_prod);
 	if (omx_xenif->irq) {
 		unbind_from_irqhandler(omx_xenif->irq, omx_xenif);
 		omx_xenif->irq = 0;
 	}
 
-	if (omx_xenif->ring.sring) {
-		unmap_frontend_page(omx_xenif, omx_xenif->omx_xenif_ring_area,
-				    omx_xenif->shmem_handle);
-		free_vm_area(omx_xenif->omx_xenif_ring_area);
-		omx_xenif->ring.sring = NULL;
-	}
-	destroy_workqueue(omx_xenif->msg_workq);
+	for (i = 0; i < omx_xenif->nr_queues; i++)
+		omx_xenif_disconnect_queue(&omx_xenif->queues[i]);
+	omx_xen_pgrants_free(omx_xenif);
+	omx_xen_psegs_free(omx_xenif);
 	if (omx_xenif->recv_ring.sring) {
 		unmap_frontend_page(omx_xenif, omx_xenif->recv_ring_area,
 				    omx_xenif->recv_handle);
@@ -222,72 +303,147 @@ void omx_xenif_free(omx_xenif_t * omx_xenif)
 	dprintk_out();
 }
 
-static int connect_ring(struct backend_info *be)
+/* map a request ring of the frontend and start serving it */
+static int connect_queue(struct backend_info *be, struct omx_xenif_queue *queue)
 {
 	struct xenbus_device *dev = be->dev;
 	omx_xenif_t *omx_xenif = be->omx_xenif;
 	unsigned int evtchn;
 	int err;
+	char node[32];
 	char omx_xenif_backend_name[20];
+	char omx_xenback_workqueue_name[20];
 
 	dprintk_in();
 
-	err =
-	    xenbus_gather(XBT_NIL, dev->otherend, "ring-ref", "%lu",
-			  &omx_xenif->shmem_ref, "event-channel", "%u", &evtchn,
-			  "recv-ring-ref", "%lu", &omx_xenif->recv_ref, NULL);
-	if (err) {
-		xenbus_dev_fatal(dev, err,
-				 "reading %s/ring-ref and event-channel",
-				 dev->otherend);
+	omx_xen_queue_node(node, sizeof(node), queue->id, "ring-ref");
+	err = xenbus_scanf(XBT_NIL, dev->otherend, node, "%u",
+			   &queue->ring_ref);
+	if (err != 1) {
+		err = err < 0 ? err : -EINVAL;
+		xenbus_dev_fatal(dev, err, "reading %s/%s", dev->otherend,
+				 node);
+		goto out;
+	}
+	omx_xen_queue_node(node, sizeof(node), queue->id, "event-channel");
+	err = xenbus_scanf(XBT_NIL, dev->otherend, node, "%u", &evtchn);
+	if (err != 1) {
+		err = err < 0 ? err : -EINVAL;
+		xenbus_dev_fatal(dev, err, "reading %s/%s", dev->otherend,
+				 node);
 		goto out;
 	}
 
-	dprintk_deb("ring-ref %ld, event-channel %d, recv_ring_ref %lu\n",
-		    omx_xenif->shmem_ref, evtchn, omx_xenif->recv_ref);
+	dprintk_deb("queue %u: ring-ref %u, event-channel %d\n",
+		    queue->id, queue->ring_ref, evtchn);
 
 	/* Map the shared frame */
 	err =
-	    omx_xenif_map(omx_xenif, &omx_xenif->omx_xenif_ring_area,
-			  &omx_xenif->ring, &omx_xenif->shmem_ref,
-			  &omx_xenif->shmem_handle);
+	    omx_xenif_map(omx_xenif, &queue->ring_area, &queue->ring,
+			  &queue->ring_ref, &queue->ring_handle);
 	if (err) {
 		xenbus_dev_fatal(dev, err, "mapping ring-ref %#x port %#x",
-				 omx_xenif->shmem_ref, evtchn);
+				 queue->ring_ref, evtchn);
 		printk_err("Unable to map ring-ref (%#x) and port (%#x), %d\n",
-			   omx_xenif->shmem_ref, evtchn, err);
+			   queue->ring_ref, evtchn, err);
 		goto out;
 	}
 
-	/* Map the shared frame */
-	err =
-	    omx_xenif_map(omx_xenif, &omx_xenif->recv_ring_area,
-			  &omx_xenif->recv_ring, &omx_xenif->recv_ref,
-			  &omx_xenif->recv_handle);
-	if (err) {
-		xenbus_dev_fatal(dev, err, "mapping recv_ring-ref %#x port %#x",
-				 omx_xenif->recv_ref, evtchn);
-		printk_err("Unable to map ring-ref (%#x) and port (%#x), %d\n",
-			   omx_xenif->recv_ref, evtchn, err);
+	err = omx_xenif_map_payload(queue);
+	if (err)
+		goto out;
+
+	sprintf(omx_xenback_workqueue_name, "ReqWQ-%d-%u", omx_xenif->domid,
+		queue->id);
+	queue->msg_workq =
+	    create_singlethread_workqueue(omx_xenback_workqueue_name);
+	if (unlikely(!queue->msg_workq)) {
+		printk_err("Couldn't create msg_workq!\n");
+		err = -ENOMEM;
 		goto out;
 	}
 
 	/* end grant */
 	dprintk_inf("Will bind otherend_id = %u port = %#lx\n",
-		    dev->otherend_id, (unsigned long)be->evtchn.port);
+		    dev->otherend_id, (unsigned long)queue->evtchn.port);
 	sprintf(omx_xenif_backend_name, "xenifbe%x_%lu",
-		omx_xenif->shmem_handle, (unsigned long)be->evtchn.port);
+		queue->ring_handle, (unsigned long)queue->evtchn.port);
 
 	err =
-	    bind_evtchn_to_irqhandler(be->evtchn.port, omx_xenif_be_int,
+	    bind_evtchn_to_irqhandler(queue->evtchn.port, omx_xenif_be_int,
 				      IRQF_SHARED,
-				      omx_xenif_backend_name, omx_xenif);
-	be->irq = err;
+				      omx_xenif_backend_name, queue);
 	if (err < 0) {
 		printk_err("failed binding evtchn to irqhandler!, err = %d\n",
 			   err);
 		goto out;
 	}
+	queue->irq = err;
+	err = 0;
+
+out:
+	dprintk_out();
+	return err;
+}
+
+static int connect_ring(struct backend_info *be)
+{
+	struct xenbus_device *dev = be->dev;
+	omx_xenif_t *omx_xenif = be->omx_xenif;
+	struct evtchn_close close;
+	unsigned int nr_queues;
+	int err, i;
+
+	dprintk_in();
+
+	err =
+	    xenbus_gather(XBT_NIL, dev->otherend,
+			  "recv-ring-ref", "%u", &omx_xenif->recv_ref, NULL);
+	if (err) {
+		xenbus_dev_fatal(dev, err, "reading %s/recv-ring-ref",
+				 dev->otherend);
+		goto out;
+	}
+
+	/* frontends that predate multiple queues only use the first one */
+	if (xenbus_scanf(XBT_NIL, dev->otherend, "multi-queue-num-queues",
+			 "%u", &nr_queues) != 1)
+		nr_queues = 1;
+	if (!nr_queues || nr_queues > omx_xenif->nr_queues) {
+		err = -EINVAL;
+		xenbus_dev_fatal(dev, err, "%u queues requested, %u offered",
+				 nr_queues, omx_xenif->nr_queues);
+		goto out;
+	}
+
+	/* give back the event channels of the queues left unused */
+	for (i = nr_queues; i < omx_xenif->nr_queues; i++) {
+		close.port = omx_xenif->queues[i].evtchn.port;
+		HYPERVISOR_event_channel_op(EVTCHNOP_close, &close);
+	}
+	omx_xenif->nr_queues = nr_queues;
+
+	dprintk_deb("%u queues, recv_ring_ref %u\n", nr_queues,
+		    omx_xenif->recv_ref);
+
+	/* Map the shared frame */
+	err =
+	    omx_xenif_map(omx_xenif, &omx_xenif->recv_ring_area,
+			  &omx_xenif->recv_ring, &omx_xenif->recv_ref,
+			  &omx_xenif->recv_handle);
+	if (err) {
+		xenbus_dev_fatal(dev, err, "mapping recv_ring-ref %#x",
+				 omx_xenif->recv_ref);
+		printk_err("Unable to map ring-ref (%#x), %d\n",
+			   omx_xenif->recv_ref, err);
+		goto out;
+	}
+
+	for (i = 0; i < nr_queues; i++) {
+		err = connect_queue(be, &omx_xenif->queues[i]);
+		if (err)
+			goto out;
+	}
 
 #ifdef OMX_XEN_COOKIES
 	INIT_LIST_HEAD(&omx_xenif->page_cookies_free);
@@ -309,8 +465,7 @@ out:
 omx_xenif_t *omx_xenif_alloc(domid_t domid)
 {
 	omx_xenif_t *omx_xenif;
-	int err;
-	char omx_xenback_workqueue_name[20];
+	int err, i;
 	char omx_xenback_workqueue_name_2[20];
 
 	dprintk_in();
@@ -320,24 +475,27 @@ omx_xenif_t *omx_xenif_alloc(domid_t domid)
 
 	dprintk_deb("omx_xenif is @ %#llx\n", (unsigned long long)omx_xenif);
 	omx_xenif->domid = domid;
-	sprintf(omx_xenback_workqueue_name, "ReqWQ-%d", domid);
 	sprintf(omx_xenback_workqueue_name_2, "RespWQ-%d", domid);
 	spin_lock_init(&omx_xenif->omx_resp_lock);
-	spin_lock_init(&omx_xenif->omx_ring_lock);
 	spin_lock_init(&omx_xenif->omx_be_lock);
 	init_waitqueue_head(&omx_xenif->wq);
 	atomic_set(&omx_xenif->refcnt, 1);
 	init_waitqueue_head(&omx_xenif->waiting_to_free);
-	omx_xenif->msg_workq =
-	    create_singlethread_workqueue(omx_xenback_workqueue_name);
-	if (unlikely(!omx_xenif->msg_workq)) {
-		printk_err("Couldn't create msg_workq!\n");
-		err = -ENOMEM;
-		return (void *)0;
+	omx_xenif->poll_usecs = omx_xen_poll_usecs;
+	omx_xenif->grant_copy = omx_xen_grant_copy;
+	omx_xenif->pgrants = RB_ROOT;
+	omx_xenif->psegs = RB_ROOT;
+	spin_lock_init(&omx_xenif->pgrants_lock);
+	for (i = 0; i < OMX_XEN_QUEUES_MAX; i++) {
+		struct omx_xenif_queue *queue = &omx_xenif->queues[i];
+
+		queue->omx_xenif = omx_xenif;
+		queue->id = i;
+		spin_lock_init(&queue->ring_lock);
+		atomic_set(&queue->polling, 0);
+		INIT_WORK(&queue->msg_workq_task, msg_workq_handler);
 	}
 
-	INIT_WORK(&omx_xenif->msg_workq_task, msg_workq_handler);
-
 	omx_xenif->response_msg_workq =
 	    create_singlethread_workqueue(omx_xenback_workqueue_name_2);
 	if (unlikely(!omx_xenif->response_msg_workq)) {
@@ -387,7 +545,9 @@ out:
 static int omx_xenback_setup_evtchn(struct xenbus_device *dev,
 				    struct backend_info *be)
 {
-
+	omx_xenif_t *omx_xenif = be->omx_xenif;
+	struct omx_xenif_queue *queue;
+	unsigned int nr_queues;
 	int ret = 0;
 	dprintk_in();
 
@@ -396,14 +556,22 @@ static int omx_xenback_setup_evtchn(struct xenbus_device *dev,
 	dprintk_deb("be is @ %#lx\n", (unsigned long)be);
 	dprintk_deb("omx_xenif->be is @ %#lx\n",
 		    (unsigned long)be->omx_xenif->be);
-	be->evtchn.dom = 0;
-	be->evtchn.remote_dom = dev->otherend_id;
-	ret = HYPERVISOR_event_channel_op(EVTCHNOP_alloc_unbound, &be->evtchn);
-	if (ret) {
-		printk_err("Failed to allocate evtchn!\n");
-		goto out;
+	/* offer a request ring per backend CPU, the frontend picks */
+	nr_queues = min_t(unsigned int, num_online_cpus(), OMX_XEN_QUEUES_MAX);
+	for (omx_xenif->nr_queues = 0; omx_xenif->nr_queues < nr_queues;
+	     omx_xenif->nr_queues++) {
+		queue = &omx_xenif->queues[omx_xenif->nr_queues];
+		queue->evtchn.dom = 0;
+		queue->evtchn.remote_dom = dev->otherend_id;
+		ret = HYPERVISOR_event_channel_op(EVTCHNOP_alloc_unbound,
+						  &queue->evtchn);
+		if (ret) {
+			printk_err("Failed to allocate evtchn!\n");
+			goto out;
+		}
 	}
-	dprintk_deb("Allocated Event Channel to %d\n", dev->otherend_id);
+	dprintk_deb("Allocated %u Event Channels to %d\n", nr_queues,
+		    dev->otherend_id);
 out:
 	dprintk_out();
 	return ret;
@@ -415,6 +583,9 @@ static int omx_xenback_setup_xenbus(struct xenbus_device *dev,
 	int ret = 0;
 	const char *message;
 	struct xenbus_transaction xbt;
+	omx_xenif_t *omx_xenif = be->omx_xenif;
+	char node[32];
+	int i;
 	dprintk_in();
 
 	do {
@@ -431,18 +602,30 @@ static int omx_xenback_setup_xenbus(struct xenbus_device *dev,
 		}
 
 		ret =
-		    xenbus_printf(xbt, dev->otherend, "port", "%d",
-				  be->evtchn.port);
+		    xenbus_printf(xbt, dev->otherend,
+				  "multi-queue-max-queues", "%u",
+				  omx_xenif->nr_queues);
 		if (ret) {
-			message = "writing port";
+			message = "writing multi-queue-max-queues";
 			goto abort_transaction;
 		}
 
+		for (i = 0; i < omx_xenif->nr_queues; i++) {
+			omx_xen_queue_node(node, sizeof(node), i, "port");
+			ret =
+			    xenbus_printf(xbt, dev->otherend, node, "%d",
+					  omx_xenif->queues[i].evtchn.port);
+			if (ret) {
+				message = "writing port";
+				goto abort_transaction;
+			}
+		}
+
 		ret = xenbus_transaction_end(xbt, 0);
 	} while (ret == -EAGAIN);
 
-	dprintk_deb("Wrote port %d to %s/%s\n", be->evtchn.port,
-		    dev->nodename, "port");
+	dprintk_deb("Wrote %u ports to %s\n", omx_xenif->nr_queues,
+		    dev->otherend);
 	if (ret) {
 		xenbus_dev_fatal(dev, ret, "completing transaction");
 		goto out;
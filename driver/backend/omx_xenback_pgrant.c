@@ -0,0 +1,201 @@
+/*
+ * Xen2MX
+ * Copyright © Anastassios Nanos 2012
+ * (see AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License in COPYING.GPL for more details.
+ */
+
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/rbtree.h>
+#include <xen/interface/io/xenbus.h>
+#include <xen/xenbus.h>
+#include <xen/grant_table.h>
+#include <xen/balloon.h>
+#include <xen/page.h>
+
+//#define EXTRA_DEBUG_OMX
+#include "omx_xen_debug.h"
+#include "omx_xen.h"
+#include "omx_xenback.h"
+#include "omx_xenback_pgrant.h"
+
+/*
+ * Persistent grants: pages the frontend keeps granted to us (see
+ * OMX_XEN_PERSISTENT_GRANTS_MAX). They are mapped the first time we see
+ * their gref and stay mapped until the interface disconnects.
+ */
+
+int omx_xen_pgrant_map(omx_xenif_t * omx_xenif, struct omx_xen_pgrant *pgrant)
+{
+	struct gnttab_map_grant_ref map;
+	unsigned long addr;
+	int ret = 0;
+
+	dprintk_in();
+
+	ret = alloc_xenballooned_pages(1, &pgrant->page, false /* lowmem */);
+	if (ret) {
+		printk_err("cannot allocate xenballooned_pages\n");
+		goto out;
+	}
+
+	addr = (unsigned long)omx_xen_pgrant_vaddr(pgrant);
+	gnttab_set_map_op(&map, addr, GNTMAP_host_map, pgrant->gref,
+			  omx_xenif->domid);
+	ret = gnttab_map_refs(&map, NULL, &pgrant->page, 1);
+	if (ret || map.status) {
+		printk_err("Error mapping gref %u, ret = %d, status = %d\n",
+			   pgrant->gref, ret, map.status);
+		free_xenballooned_pages(1, &pgrant->page);
+		ret = -EINVAL;
+		goto out;
+	}
+	pgrant->handle = map.handle;
+
+out:
+	dprintk_out();
+	return ret;
+}
+
+void omx_xen_pgrant_unmap(omx_xenif_t * omx_xenif,
+			  struct omx_xen_pgrant *pgrant)
+{
+	struct gnttab_unmap_grant_ref unmap;
+
+	dprintk_in();
+
+	gnttab_set_unmap_op(&unmap, (unsigned long)omx_xen_pgrant_vaddr(pgrant),
+			    GNTMAP_host_map, pgrant->handle);
+	if (gnttab_unmap_refs(&unmap, NULL, &pgrant->page, 1) || unmap.status)
+		printk_err("Error unmapping gref %u\n", pgrant->gref);
+	free_xenballooned_pages(1, &pgrant->page);
+
+	dprintk_out();
+}
+
+static struct omx_xen_pgrant *omx_xen_pgrant_lookup(omx_xenif_t * omx_xenif,
+						    grant_ref_t gref)
+{
+	struct rb_node *node = omx_xenif->pgrants.rb_node;
+	struct omx_xen_pgrant *pgrant;
+
+	while (node) {
+		pgrant = rb_entry(node, struct omx_xen_pgrant, node);
+		if (gref < pgrant->gref)
+			node = node->rb_left;
+		else if (gref > pgrant->gref)
+			node = node->rb_right;
+		else
+			return pgrant;
+	}
+	return NULL;
+}
+
+static void omx_xen_pgrant_insert(omx_xenif_t * omx_xenif,
+				  struct omx_xen_pgrant *new)
+{
+	struct rb_node **link = &omx_xenif->pgrants.rb_node, *parent = NULL;
+	struct omx_xen_pgrant *pgrant;
+
+	while (*link) {
+		parent = *link;
+		pgrant = rb_entry(parent, struct omx_xen_pgrant, node);
+		if (new->gref < pgrant->gref)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(&new->node, parent, link);
+	rb_insert_color(&new->node, &omx_xenif->pgrants);
+	omx_xenif->nr_pgrants++;
+}
+
+/* address of a persistent grant, mapping it on first use */
+void *omx_xen_pgrant_get(omx_xenif_t * omx_xenif, grant_ref_t gref)
+{
+	struct omx_xen_pgrant *pgrant, *other;
+	unsigned long flags;
+	int ret;
+
+	dprintk_in();
+
+	spin_lock_irqsave(&omx_xenif->pgrants_lock, flags);
+	pgrant = omx_xen_pgrant_lookup(omx_xenif, gref);
+	if (pgrant || omx_xenif->nr_pgrants >= OMX_XEN_PERSISTENT_GRANTS_MAX) {
+		spin_unlock_irqrestore(&omx_xenif->pgrants_lock, flags);
+		if (!pgrant) {
+			printk_err("too many persistent grants\n");
+			pgrant = ERR_PTR(-ENOSPC);
+		}
+		goto out;
+	}
+	spin_unlock_irqrestore(&omx_xenif->pgrants_lock, flags);
+
+	/* mapping may sleep, do it unlocked */
+	pgrant = kzalloc(sizeof(*pgrant), GFP_KERNEL);
+	if (!pgrant) {
+		pgrant = ERR_PTR(-ENOMEM);
+		goto out;
+	}
+	pgrant->gref = gref;
+	ret = omx_xen_pgrant_map(omx_xenif, pgrant);
+	if (ret) {
+		kfree(pgrant);
+		pgrant = ERR_PTR(ret);
+		goto out;
+	}
+	dprintk_deb("mapped persistent grant %u\n", gref);
+
+	/* another queue may have mapped it meanwhile */
+	spin_lock_irqsave(&omx_xenif->pgrants_lock, flags);
+	other = omx_xen_pgrant_lookup(omx_xenif, gref);
+	if (!other)
+		omx_xen_pgrant_insert(omx_xenif, pgrant);
+	spin_unlock_irqrestore(&omx_xenif->pgrants_lock, flags);
+	if (other) {
+		omx_xen_pgrant_unmap(omx_xenif, pgrant);
+		kfree(pgrant);
+		pgrant = other;
+	}
+
+out:
+	dprintk_out();
+	return IS_ERR(pgrant) ? (void *)pgrant : omx_xen_pgrant_vaddr(pgrant);
+}
+
+void omx_xen_pgrants_free(omx_xenif_t * omx_xenif)
+{
+	struct rb_node *node;
+	struct omx_xen_pgrant *pgrant;
+
+	dprintk_in();
+
+	while ((node = rb_first(&omx_xenif->pgrants))) {
+		pgrant = rb_entry(node, struct omx_xen_pgrant, node);
+		rb_erase(node, &omx_xenif->pgrants);
+		omx_xen_pgrant_unmap(omx_xenif, pgrant);
+		kfree(pgrant);
+	}
+	omx_xenif->nr_pgrants = 0;
+
+	dprintk_out();
+}
+
+/*
+ * Local variables:
+ *  tab-width: 8
+ *  c-basic-offset: 8
+ *  c-indent-level: 8
+ * End:
+ */
@@ -0,0 +1,54 @@
+/*
+ * Xen2MX
+ * Copyright © Anastassios Nanos 2012
+ * (see AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License in COPYING.GPL for more details.
+ */
+
+#ifndef __omx_xenback_pgrant_h__
+#define __omx_xenback_pgrant_h__
+
+#include <linux/rbtree.h>
+#include <xen/grant_table.h>
+
+#include "omx_xen.h"
+#include "omx_xenback.h"
+
+/* a frontend page mapped in the backend */
+struct omx_xen_pgrant {
+	struct rb_node node;
+	grant_ref_t gref;
+	grant_handle_t handle;
+	struct page *page;
+};
+
+static inline void *omx_xen_pgrant_vaddr(struct omx_xen_pgrant *pgrant)
+{
+	return pfn_to_kaddr(page_to_pfn(pgrant->page));
+}
+
+int omx_xen_pgrant_map(omx_xenif_t * omx_xenif, struct omx_xen_pgrant *pgrant);
+void omx_xen_pgrant_unmap(omx_xenif_t * omx_xenif,
+			  struct omx_xen_pgrant *pgrant);
+void *omx_xen_pgrant_get(omx_xenif_t * omx_xenif, grant_ref_t gref);
+void omx_xen_pgrants_free(omx_xenif_t * omx_xenif);
+
+#endif				/* __omx_xenback_pgrant_h__ */
+
+/*
+ * Local variables:
+ *  tab-width: 8
+ *  c-basic-offset: 8
+ *  c-indent-level: 8
+ * End:
+ */
@@ -20,6 +20,7 @@
 #include <linux/scatterlist.h>
 #include <linux/workqueue.h>
 #include <linux/spinlock.h>
+#include <linux/rbtree.h>
 #include <linux/cdev.h>
 
 #include <asm/xen/hypervisor.h>
@@ -58,52 +59,32 @@
 #include "omx_xenback.h"
 #include "omx_xenback_reg.h"
 #include "omx_xenback_event.h"
+#include "omx_xenback_gcopy.h"
 
 timers_t t_reg_seg, t_create_reg, t_dereg_seg, t_destroy_reg, t_alloc_pages, t_accept_grants, t_accept_gref_list, t_release_grants, t_release_gref_list, t_free_pages;
 
-int omx_xen_deregister_user_segment(omx_xenif_t * omx_xenif, uint32_t id,
-				    uint32_t sid, uint8_t eid)
+/* unmap the gref list and the pages of a segment, and free them */
+static int omx_xen_unmap_user_segment(omx_xenif_t * omx_xenif,
+				      struct omx_xen_user_region_segment *seg)
 {
-	struct gnttab_unmap_grant_ref ops;
-	struct backend_info *be = omx_xenif->be;
-	struct omxback_dev *dev = be->omxdev;
-	struct omx_endpoint *endpoint = dev->endpoints[eid];
-	struct omx_xen_user_region *region;
-	struct omx_xen_user_region_segment *seg;
-	int i, k, ret = 0;
+	struct gnttab_unmap_grant_ref ops[OMX_XEN_GRANT_PAGES_MAX];
+	int k, ret = 0;
 	unsigned int level;
 
 	dprintk_in();
 
-	TIMER_START(&t_dereg_seg);
-	if (eid < 0 && eid >= 255) {
-		printk_err
-		    ("Wrong endpoint number (%u) check your frontend/backend communication!\n",
-		     eid);
-		ret = -EINVAL;
-		goto out;
-	}
-
-	region = rcu_dereference_protected(endpoint->xen_regions[id], 1);
-	if (unlikely(!region)) {
-		printk_err(
-		       "%s: Cannot access non-existing region %d\n", __func__, id);
-		//ret = -EINVAL;
-		goto out;
-	}
-	seg = &region->segments[sid];
-
-
-	TIMER_START(&t_release_grants);
-	if (!seg->unmap) {
+	if (!seg->grefs && !seg->unmap) {
 		printk_err("seg->unmap is NULL\n");
 		ret = -EINVAL;
 		goto out;
 	}
-	gnttab_unmap_refs(seg->unmap, NULL, seg->pages, seg->nr_pages);
-	TIMER_STOP(&t_release_grants);
+	/* grant copy segments have nothing mapped but the gref list */
+	if (!seg->grefs) {
+		TIMER_START(&t_release_grants);
+		gnttab_unmap_refs(seg->unmap, NULL, seg->pages, seg->nr_pages);
+		TIMER_STOP_BATCH(&t_release_grants, seg->nr_pages);
+	}
 
-	TIMER_START(&t_release_gref_list);
 	for (k = 0; k < seg->nr_parts; k++) {
 #ifdef EXTRA_DEBUG_OMX
 		if (!seg->vm_gref) {
@@ -127,10 +108,10 @@ int omx_xen_deregister_user_segment(omx_xenif_t * omx_xenif, uint32_t id,
 			goto out;
 		}
 #endif
-		gnttab_set_unmap_op(&ops, (unsigned long)seg->vm_gref[k]->addr,
+		gnttab_set_unmap_op(&ops[k], (unsigned long)seg->vm_gref[k]->addr,
 				    GNTMAP_host_map | GNTMAP_contains_pte,
 				    seg->all_handle[k]);
-		ops.host_addr =
+		ops[k].host_addr =
 		    arbitrary_virt_to_machine(lookup_address
 					      ((unsigned long)(seg->vm_gref[k]->
 							       addr),
@@ -138,38 +119,266 @@ int omx_xen_deregister_user_segment(omx_xenif_t * omx_xenif, uint32_t id,
 
 		dprintk_deb("putting vm_area[%d] %#lx, handle = %#x \n", k,
 			    (unsigned long)seg->vm_gref[k], seg->all_handle[k]);
-		if (HYPERVISOR_grant_table_op
-		    (GNTTABOP_unmap_grant_ref, &ops, 1)){
-			printk_err
-				("HYPERVISOR operation failed\n");
-			//BUG();
-		}
-		if (ops.status) {
+	}
+
+	/* all parts of the gref list in one go */
+	TIMER_START(&t_release_gref_list);
+	if (HYPERVISOR_grant_table_op
+	    (GNTTABOP_unmap_grant_ref, ops, seg->nr_parts)) {
+		printk_err
+			("HYPERVISOR operation failed\n");
+		//BUG();
+	}
+	TIMER_STOP_BATCH(&t_release_gref_list, seg->nr_parts);
+
+	TIMER_START(&t_free_pages);
+	for (k = 0; k < seg->nr_parts; k++) {
+		if (ops[k].status) {
 			printk_err
 				("HYPERVISOR unmap grant ref[%d]=%#lx failed status = %d",
-				 k, seg->all_handle[k], ops.status);
-			ret = ops.status;
-			goto out;
+				 k, seg->all_handle[k], ops[k].status);
+			ret = ops[k].status;
+			continue;
 		}
+		free_vm_area(seg->vm_gref[k]);
 	}
-	TIMER_STOP(&t_release_gref_list);
-
-	TIMER_START(&t_free_pages);
-	for (k=0;k<seg->nr_parts;k++)
-		if (ops.status == GNTST_okay)
-			free_vm_area(seg->vm_gref[k]);
+	if (ret)
+		goto out;
 
 	kfree(seg->map);
 	kfree(seg->unmap);
 	kfree(seg->gref_list);
+	if (seg->grefs) {
+		kfree(seg->grefs);
+		seg->grefs = NULL;
+	} else {
 #ifdef OMX_XEN_COOKIES
-	omx_xen_page_put_cookie(omx_xenif, seg->cookie);
+		omx_xen_page_put_cookie(omx_xenif, seg->cookie);
 #else
-	free_xenballooned_pages(seg->nr_pages, seg->pages);
-	kfree(seg->pages);
+		free_xenballooned_pages(seg->nr_pages, seg->pages);
+		kfree(seg->pages);
 #endif
+	}
 	TIMER_STOP(&t_free_pages);
 
+out:
+	dprintk_out();
+	return ret;
+}
+
+/*
+ * Segments that the frontend keeps granted in its registration cache
+ * after destroying their region stay mapped here, by the gref of their
+ * first gref list page, until the frontend registers the same grants
+ * again or tells us to forget them. Like persistent grants, they live
+ * in an rbtree of the interface.
+ */
+struct omx_xen_pseg {
+	struct rb_node node;
+	grant_ref_t gref;
+	struct omx_xen_user_region_segment seg;
+};
+
+static struct omx_xen_pseg *omx_xen_pseg_lookup(omx_xenif_t * omx_xenif,
+						grant_ref_t gref)
+{
+	struct rb_node *node = omx_xenif->psegs.rb_node;
+	struct omx_xen_pseg *pseg;
+
+	while (node) {
+		pseg = rb_entry(node, struct omx_xen_pseg, node);
+		if (gref < pseg->gref)
+			node = node->rb_left;
+		else if (gref > pseg->gref)
+			node = node->rb_right;
+		else
+			return pseg;
+	}
+	return NULL;
+}
+
+static void omx_xen_pseg_insert(omx_xenif_t * omx_xenif,
+				struct omx_xen_pseg *new)
+{
+	struct rb_node **link = &omx_xenif->psegs.rb_node, *parent = NULL;
+	struct omx_xen_pseg *pseg;
+
+	while (*link) {
+		parent = *link;
+		pseg = rb_entry(parent, struct omx_xen_pseg, node);
+		if (new->gref < pseg->gref)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(&new->node, parent, link);
+	rb_insert_color(&new->node, &omx_xenif->psegs);
+}
+
+/* remove a kept segment from the tree, the caller owns it then */
+static struct omx_xen_pseg *omx_xen_pseg_remove(omx_xenif_t * omx_xenif,
+						grant_ref_t gref)
+{
+	struct omx_xen_pseg *pseg;
+	unsigned long flags;
+
+	spin_lock_irqsave(&omx_xenif->pgrants_lock, flags);
+	pseg = omx_xen_pseg_lookup(omx_xenif, gref);
+	if (pseg)
+		rb_erase(&pseg->node, &omx_xenif->psegs);
+	spin_unlock_irqrestore(&omx_xenif->pgrants_lock, flags);
+
+	return pseg;
+}
+
+/* keep the mapping of a deregistered segment, unmap it if we cannot */
+static int omx_xen_pseg_keep(omx_xenif_t * omx_xenif,
+			     struct omx_xen_user_region_segment *seg)
+{
+	struct omx_xen_pseg *pseg, *stale;
+	unsigned long flags;
+
+	dprintk_in();
+
+	pseg = kmalloc(sizeof(*pseg), GFP_ATOMIC);
+	if (!pseg) {
+		dprintk_out();
+		return omx_xen_unmap_user_segment(omx_xenif, seg);
+	}
+	pseg->gref = seg->all_gref[0];
+	memcpy(&pseg->seg, seg, sizeof(*seg));
+
+	spin_lock_irqsave(&omx_xenif->pgrants_lock, flags);
+	stale = omx_xen_pseg_lookup(omx_xenif, pseg->gref);
+	if (stale)
+		rb_erase(&stale->node, &omx_xenif->psegs);
+	omx_xen_pseg_insert(omx_xenif, pseg);
+	spin_unlock_irqrestore(&omx_xenif->pgrants_lock, flags);
+
+	if (stale) {
+		printk_err("segment gref %u was kept twice\n", pseg->gref);
+		omx_xen_unmap_user_segment(omx_xenif, &stale->seg);
+		kfree(stale);
+	}
+
+	dprintk_deb("keeping segment gref %u mapped, %lu pages\n",
+		    pseg->gref, seg->nr_pages);
+	dprintk_out();
+	return 0;
+}
+
+/*
+ * Reuse the mapping of a kept segment if the frontend registers the same
+ * grants again. Returns 1 if the segment is ready.
+ */
+static int omx_xen_pseg_reuse(omx_xenif_t * omx_xenif,
+			      struct omx_xen_user_region_segment *seg,
+			      struct omx_ring_msg_register_user_segment *req,
+			      int grant_copy)
+{
+	struct omx_xen_pseg *pseg;
+	int k;
+
+	pseg = omx_xen_pseg_remove(omx_xenif, req->gref[0]);
+	if (!pseg)
+		return 0;
+
+	if (pseg->seg.nr_parts != req->nr_parts
+	    || pseg->seg.gref_offset != req->gref_offset
+	    || pseg->seg.nr_pages != req->nr_pages
+	    || pseg->seg.first_page_offset != req->first_page_offset
+	    || !pseg->seg.grefs != !grant_copy)
+		goto out_with_stale;
+	for (k = 0; k < req->nr_parts; k++)
+		if (pseg->seg.all_gref[k] != req->gref[k])
+			goto out_with_stale;
+
+	memcpy(seg, &pseg->seg, sizeof(*seg));
+	kfree(pseg);
+	dprintk_deb("reusing kept segment gref %u\n", req->gref[0]);
+	return 1;
+
+out_with_stale:
+	printk_err("kept segment gref %u does not match, remapping\n",
+		   req->gref[0]);
+	omx_xen_unmap_user_segment(omx_xenif, &pseg->seg);
+	kfree(pseg);
+	return 0;
+}
+
+int omx_xen_forget_user_segment(omx_xenif_t * omx_xenif, uint32_t gref)
+{
+	struct omx_xen_pseg *pseg;
+	int ret = 0;
+
+	dprintk_in();
+
+	pseg = omx_xen_pseg_remove(omx_xenif, gref);
+	if (!pseg) {
+		printk_err("Cannot forget unknown segment gref %u\n", gref);
+		ret = -EINVAL;
+		goto out;
+	}
+	ret = omx_xen_unmap_user_segment(omx_xenif, &pseg->seg);
+	kfree(pseg);
+
+out:
+	dprintk_out();
+	return ret;
+}
+
+void omx_xen_psegs_free(omx_xenif_t * omx_xenif)
+{
+	struct rb_node *node;
+	struct omx_xen_pseg *pseg;
+
+	dprintk_in();
+
+	while ((node = rb_first(&omx_xenif->psegs))) {
+		pseg = rb_entry(node, struct omx_xen_pseg, node);
+		rb_erase(node, &omx_xenif->psegs);
+		omx_xen_unmap_user_segment(omx_xenif, &pseg->seg);
+		kfree(pseg);
+	}
+
+	dprintk_out();
+}
+
+int omx_xen_deregister_user_segment(omx_xenif_t * omx_xenif, uint32_t id,
+				    uint32_t sid, uint8_t eid, int keep)
+{
+	struct backend_info *be = omx_xenif->be;
+	struct omxback_dev *dev = be->omxdev;
+	struct omx_endpoint *endpoint = dev->endpoints[eid];
+	struct omx_xen_user_region *region;
+	struct omx_xen_user_region_segment *seg;
+	int ret = 0;
+
+	dprintk_in();
+
+	TIMER_START(&t_dereg_seg);
+	if (eid < 0 && eid >= 255) {
+		printk_err
+		    ("Wrong endpoint number (%u) check your frontend/backend communication!\n",
+		     eid);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	region = rcu_dereference_protected(endpoint->xen_regions[id], 1);
+	if (unlikely(!region)) {
+		printk_err(
+		       "%s: Cannot access non-existing region %d\n", __func__, id);
+		//ret = -EINVAL;
+		goto out;
+	}
+	seg = &region->segments[sid];
+
+	if (keep && seg->nr_parts)
+		ret = omx_xen_pseg_keep(omx_xenif, seg);
+	else
+		ret = omx_xen_unmap_user_segment(omx_xenif, seg);
+
 out:
 	TIMER_STOP(&t_dereg_seg);
 	dprintk_out();
@@ -217,64 +426,80 @@ out:
 
 }
 
+/*
+ * Map the pages holding the gref list of a segment, all parts in a
+ * single hypercall. Each part gets its own vm area since the frontend
+ * list starts at gref_offset in every part.
+ */
 static int omx_xen_accept_gref_list(omx_xenif_t * omx_xenif,
 				    struct omx_xen_user_region_segment *seg,
-				    uint32_t gref, void **vaddr, uint8_t part)
+				    uint32_t * gref, uint32_t ** gref_list,
+				    uint8_t nr_parts)
 {
 	int ret = 0;
+	int k, nr_areas = 0;
 	struct backend_info *be = omx_xenif->be;
 	struct vm_struct *area;
 	pte_t *pte;
-	struct gnttab_map_grant_ref ops = {
-		.flags = GNTMAP_host_map | GNTMAP_contains_pte,
-		//.flags = GNTMAP_host_map,
-		.ref = gref,
-		.dom = be->remoteDomain,
-	};
+	struct gnttab_map_grant_ref ops[OMX_XEN_GRANT_PAGES_MAX];
 
 	dprintk_in();
 
-	area = alloc_vm_area(PAGE_SIZE, &pte);
-	if (!area) {
-		ret = -ENOMEM;
-		goto out;
-	}
-
-	seg->vm_gref[part] = area;
+	for (k = 0; k < nr_parts; k++) {
+		area = alloc_vm_area(PAGE_SIZE, &pte);
+		if (!area) {
+			ret = -ENOMEM;
+			goto out_with_areas;
+		}
+		seg->vm_gref[k] = area;
+		nr_areas++;
 
-	ops.host_addr = arbitrary_virt_to_machine(pte).maddr;
+		gnttab_set_map_op(&ops[k], arbitrary_virt_to_machine(pte).maddr,
+				  GNTMAP_host_map | GNTMAP_contains_pte,
+				  gref[k], be->remoteDomain);
+	}
 
-	if (HYPERVISOR_grant_table_op(GNTTABOP_map_grant_ref, &ops, 1)) {
+	TIMER_START(&t_accept_gref_list);
+	if (HYPERVISOR_grant_table_op(GNTTABOP_map_grant_ref, ops, nr_parts)) {
 		printk_err("HYPERVISOR map grant ref failed");
 		ret = -ENOSYS;
-		goto out;
+		goto out_with_areas;
 	}
-	dprintk_deb("addr=%#lx, mfn=%#lx, kaddr=%#lx\n",
-		    (unsigned long)area->addr, ops.dev_bus_addr >> PAGE_SHIFT,
-		    ops.host_addr);
-	if (ops.status) {
-		printk_err("HYPERVISOR map grant ref failed status = %d",
-			   ops.status);
+	TIMER_STOP_BATCH(&t_accept_gref_list, nr_parts);
 
-		ret = ops.status;
-		goto out;
+	for (k = 0; k < nr_parts; k++) {
+		if (ops[k].status) {
+			printk_err("HYPERVISOR map grant ref[%d] failed status = %d",
+				   k, ops[k].status);
+			ret = ops[k].status;
+		}
 	}
+	if (ret)
+		goto out_with_mapped;
 
-	dprintk_deb("gref_offset = %#x\n", seg->gref_offset);
-	*vaddr = (area->addr + seg->gref_offset);
-
-	ret = ops.handle;
-#if 0
-	for (i = 0; i < (size + 2); i++) {
-		dprintk_deb("gref_list[%d] = %u\n", i,
-			    *(((uint32_t *) * vaddr) + i));
+	for (k = 0; k < nr_parts; k++) {
+		seg->all_handle[k] = ops[k].handle;
+		gref_list[k] = (uint32_t *) (seg->vm_gref[k]->addr + seg->gref_offset);
+		dprintk_deb("gref_list[%d] = %p, handle = %d\n", k,
+			    gref_list[k], seg->all_handle[k]);
 	}
-#endif
+	goto out;
 
-	seg->all_handle[part] = ops.handle;
-	dprintk_deb("vaddr = %p, area->addr=%p, handle[%d]=%d\n", vaddr,
-		    area->addr, part, seg->all_handle[part]);
+out_with_mapped:
+	/* put back the parts that did map */
+	for (k = 0; k < nr_parts; k++) {
+		struct gnttab_unmap_grant_ref unmap;
 
+		if (ops[k].status)
+			continue;
+		gnttab_set_unmap_op(&unmap, ops[k].host_addr,
+				    GNTMAP_host_map | GNTMAP_contains_pte,
+				    ops[k].handle);
+		HYPERVISOR_grant_table_op(GNTTABOP_unmap_grant_ref, &unmap, 1);
+	}
+out_with_areas:
+	for (k = 0; k < nr_areas; k++)
+		free_vm_area(seg->vm_gref[k]);
 out:
 	dprintk_out();
 	return ret;
@@ -285,7 +510,6 @@ int omx_xen_register_user_segment(omx_xenif_t * omx_xenif,
 {
 
 	struct backend_info *be = omx_xenif->be;
-	void *vaddr = NULL;
 	uint32_t **gref_list;
 	struct page **page_list;
 	struct omxback_dev *omxdev = be->omxdev;
@@ -302,6 +526,7 @@ int omx_xen_register_user_segment(omx_xenif_t * omx_xenif,
 	int idx = 0, sidx = 0;
 	struct gnttab_map_grant_ref *map;
 	struct gnttab_unmap_grant_ref *unmap;
+	grant_ref_t *grefs = NULL;
 
 	dprintk_in();
 
@@ -340,6 +565,12 @@ int omx_xen_register_user_segment(omx_xenif_t * omx_xenif,
 	}
 	dprintk_deb("Got segment @%#lx id=%u\n", (unsigned long)seg, sid);
 
+	/* the frontend registers a segment that we kept mapped */
+	if (omx_xen_pseg_reuse(omx_xenif, seg, req, region->grant_copy)) {
+		page_list = seg->pages;
+		goto segment_ready;
+	}
+
 	seg->gref_offset = gref_offset;
 	dprintk_deb
 	    ("Offset of actual list of grant references (in the frontend) = %#x\n",
@@ -361,6 +592,18 @@ int omx_xen_register_user_segment(omx_xenif_t * omx_xenif,
 		goto out;
 	}
 
+	if (region->grant_copy) {
+		/* the frontend pages are grant copied, only keep their grefs */
+		grefs = kmalloc(sizeof(grant_ref_t) * nr_pages, GFP_ATOMIC);
+		if (!grefs) {
+			ret = -ENOMEM;
+			printk_err(" grefs is NULL, ENOMEM!!!\n");
+			goto out;
+		}
+		TIMER_STOP(&t_alloc_pages);
+		goto accept_gref_list;
+	}
+
 	map =
 	    kzalloc(sizeof(struct gnttab_map_grant_ref) * nr_pages,
 		    GFP_ATOMIC);
@@ -401,29 +644,26 @@ int omx_xen_register_user_segment(omx_xenif_t * omx_xenif,
 #endif
 	TIMER_STOP(&t_alloc_pages);
 
-	TIMER_START(&t_accept_gref_list);
-	for (k = 0; k < nr_parts; k++) {
-		ret =
-		    omx_xen_accept_gref_list(omx_xenif, seg, gref[k], &vaddr,
-					     k);
-		if (ret < 0) {
-			printk_err("Cannot accept gref list, = %d\n", ret);
-			goto out;
-		}
-
-		gref_list[k] = (uint32_t *) vaddr;
-		if (!gref_list) {
-			printk_err("gref_list is NULL!!!, = %p\n", gref_list);
-			ret = -ENOSYS;
-			goto out;
-		}
+accept_gref_list:
+	ret = omx_xen_accept_gref_list(omx_xenif, seg, gref, gref_list,
+				       nr_parts);
+	if (ret) {
+		printk_err("Cannot accept gref list, = %d\n", ret);
+		goto out;
 	}
-	TIMER_STOP(&t_accept_gref_list);
 	seg->gref_list = gref_list;
 
 	seg->nr_pages = nr_pages;
 	seg->first_page_offset = first_page_offset;
 
+	if (region->grant_copy) {
+		for (i = 0; i < nr_pages; i++)
+			grefs[i] = gref_list[i / nr_grefs][i % nr_grefs];
+		seg->grefs = grefs;
+		page_list = NULL;
+		goto segment_ready;
+	}
+
 	i = 0;
 	idx = 0;
 	sidx = 0;
@@ -455,7 +695,7 @@ int omx_xen_register_user_segment(omx_xenif_t * omx_xenif,
 		printk_err("Error mapping, ret= %d\n", ret);
                 goto out;
 	}
-	TIMER_STOP(&t_accept_grants);
+	TIMER_STOP_BATCH(&t_accept_grants, nr_pages);
 
         for (i = 0; i < nr_pages; i++) {
                 if (map[i].status) {
@@ -470,6 +710,7 @@ int omx_xen_register_user_segment(omx_xenif_t * omx_xenif,
                 }
         }
 
+segment_ready:
 	seg->pages = page_list;
 	seg->nr_pages = nr_pages;
 	seg->length = length;
@@ -527,6 +768,7 @@ int omx_xen_create_user_region(omx_xenif_t * omx_xenif, uint32_t id,
 
 	region->endpoint = endpoint;
 	region->dirty = 0;
+	region->grant_copy = !!omx_xenif->grant_copy;
 
 	if (unlikely(rcu_access_pointer(endpoint->xen_regions[id]) != NULL)) {
 		printk(KERN_ERR "Cannot create busy region %d\n", id);
@@ -558,7 +800,7 @@ omx_xen_user_region_destroy_segments(struct omx_xen_user_region *region,
 	for (i = 0; i < region->nr_segments; i++)
 		omx_xen_deregister_user_segment(endpoint->be->omx_xenif,
 						region->id, i,
-						endpoint->endpoint_index);
+						endpoint->endpoint_index, 0);
 
 	dprintk_out();
 }
@@ -639,6 +881,35 @@ out:
 	return NULL;
 }
 
+/* grant copy regions have no pages to attach, pull replies go linear */
+static int
+omx_xen_user_region_offset_cache_gcopy_append_callback(struct
+						       omx_user_region_offset_cache
+						       *cache, struct sk_buff *skb,
+						       unsigned long length)
+{
+	return -EINVAL;
+}
+
+static void
+omx_xen_user_region_offset_cache_gcopy_copy_callback(struct
+						     omx_user_region_offset_cache
+						     *cache, void *buffer,
+						     unsigned long length)
+{
+	struct omx_xen_gcopy gcopy;
+
+	omx_xen_gcopy_init(&gcopy, cache->xregion->endpoint->be->omx_xenif);
+	omx_xen_gcopy_segment_to_buf(&gcopy, cache->xseg, cache->segoff,
+				     buffer, length);
+	omx_xen_gcopy_flush(&gcopy);
+	cache->segoff += length;
+
+#ifdef OMX_DRIVER_DEBUG
+	cache->current_offset += length;
+#endif
+}
+
 int
 omx_xen_user_region_offset_cache_init(struct omx_xen_user_region *region,
 				      struct omx_user_region_offset_cache
@@ -711,6 +982,21 @@ omx_xen_user_region_offset_cache_init(struct omx_xen_user_region *region,
 	cache->xseg = seg;
 	cache->segoff = segoff;
 
+	if (region->grant_copy) {
+		/* nothing is mapped, copy from the grefs at segoff */
+		cache->append_pages_to_skb =
+		    omx_xen_user_region_offset_cache_gcopy_append_callback;
+		cache->copy_pages_to_buf =
+		    omx_xen_user_region_offset_cache_gcopy_copy_callback;
+#ifdef OMX_HAVE_DMA_ENGINE
+		cache->dma_memcpy_from_pg = NULL;
+		cache->dma_memcpy_from_buf = NULL;
+#endif
+		cache->page = NULL;
+		cache->pageoff = 0;
+		goto out_with_offset;
+	}
+
 	dprintk_deb("seg->pages@%#lx \n", (unsigned long)seg->pages);
 	dprintk_deb("seg@%#lx, segoff = %#lx, first_page_offset=%#x\n",
 		    (unsigned long)seg, segoff, seg->first_page_offset);
@@ -746,6 +1032,7 @@ omx_xen_user_region_offset_cache_init(struct omx_xen_user_region *region,
 	}
 #endif
 
+out_with_offset:
 #ifdef OMX_DRIVER_DEBUG
 	cache->current_offset = offset;
 	cache->max_offset = offset + length;
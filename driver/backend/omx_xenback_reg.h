@@ -57,7 +57,9 @@ int omx_xen_register_user_segment(omx_xenif_t * omx_xenif,
 				  struct omx_ring_msg_register_user_segment *req);
 
 int omx_xen_deregister_user_segment(omx_xenif_t * omx_xenif, uint32_t id,
-				    uint32_t sid, uint8_t eid);
+				    uint32_t sid, uint8_t eid, int keep);
+int omx_xen_forget_user_segment(omx_xenif_t * omx_xenif, uint32_t gref);
+void omx_xen_psegs_free(omx_xenif_t * omx_xenif);
 void omx_xen_user_region_destroy_segments(struct omx_xen_user_region *region,
 					  struct omx_endpoint *endpoint);
 
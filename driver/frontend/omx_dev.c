@@ -434,6 +434,7 @@ static int omx_miscdev_open(struct inode *inode, struct file *file)
 	file->private_data = endpoint;
 	endpoint->fe = __omx_xen_frontend;
 	endpoint->xen = 0;
+	endpoint->xen_shared = NULL;
 out:
 	dprintk_out();
 	return ret;
@@ -457,6 +458,25 @@ static int omx_miscdev_release(struct inode *inode, struct file *file)
 	return 0;
 }
 
+/* the cmdq is only mapped and drained by the native driver */
+static int
+omx_ioctl_cmdq_doorbell(struct omx_endpoint * endpoint, void __user * uparam)
+{
+	return -ENOSYS;
+}
+
+void
+omx_iface_sqpoll_start(struct omx_iface * iface)
+{
+	iface->sqpoll_task = NULL;
+	iface->sqpoll_idle = 0;
+}
+
+void
+omx_iface_sqpoll_stop(struct omx_iface * iface)
+{
+}
+
 /*
  * Common command handlers.
  * Use OMX_CMD_INDEX() to only keep the 8 latest bits of the 32bits command flags.
@@ -485,6 +505,8 @@ static int (*omx_ioctl_with_endpoint_handlers[])(struct omx_endpoint * endpoint,
        [OMX_EPCMD_WAKEUP]                      = omx_ioctl_wakeup,
        [OMX_EPCMD_RELEASE_EXP_SLOTS]           = omx_ioctl_release_exp_slots,
        [OMX_EPCMD_RELEASE_UNEXP_SLOTS]         = omx_ioctl_release_unexp_slots,
+       [OMX_EPCMD_SEND_MEDIUMSQ]               = omx_ioctl_send_mediumsq,
+       [OMX_EPCMD_CMDQ_DOORBELL]               = omx_ioctl_cmdq_doorbell,
        [OMX_EPCMD_XEN_OPEN_ENDPOINT]           = omx_ioctl_xen_open_endpoint,
        [OMX_EPCMD_XEN_CLOSE_ENDPOINT]          = omx_ioctl_xen_close_endpoint,
        [OMX_EPCMD_XEN_CREATE_USER_REGION]      = omx_ioctl_xen_user_region_create,
@@ -500,6 +522,8 @@ static int (*omx_ioctl_with_endpoint_handlers[])(struct omx_endpoint * endpoint,
        [OMX_EPCMD_XEN_PULL]                    = omx_ioctl_xen_pull,
        [OMX_EPCMD_XEN_SEND_MEDIUMVA]           = omx_ioctl_xen_send_mediumva,
        [OMX_EPCMD_XEN_SEND_MEDIUMSQ_FRAG]           = omx_ioctl_xen_send_mediumsq_frag,
+       [OMX_EPCMD_XEN_SEND_BATCH]              = omx_ioctl_xen_send_batch,
+       [OMX_EPCMD_XEN_SEND_MEDIUMSQ]           = omx_ioctl_xen_send_mediumsq,
 };
 
 /*
@@ -546,6 +570,13 @@ omx_miscdev_ioctl(struct file *file, unsigned cmd, unsigned long arg)
 			//goto out;
 		}
 
+		/*
+		 * the backend writes events directly to our queues and only looks
+		 * at the slots that we released, do it on behalf of user-space
+		 */
+		if (likely(endpoint->status == OMX_ENDPOINT_STATUS_OK))
+			omx_endpoint_release_consumed_slots(endpoint);
+
 		/* omx_dev_init() takes care fo checking that the handler isn't NULL */
 		dprintk_deb("will call the relevant handler\n");
 		ret =
@@ -149,6 +149,20 @@ struct omx_endpoint {
 	uint16_t egref_recvq_offset;
 	grant_ref_t recvq_gref;
 
+	/* granted with the unexp eventq, NULL if events go through recv_ring */
+	struct omx_xen_endpoint_shared *xen_shared;
+	grant_ref_t xen_shared_gref;
+
+	/* registration cache: segments that stay granted after being destroyed */
+	spinlock_t xen_rcache_lock;
+	struct list_head xen_rcache_list; /* idle, least recently used first */
+	struct list_head xen_rcache_inuse_list; /* backing a registered region */
+	struct list_head xen_rcache_dead_list; /* invalidated, to be ungranted */
+	unsigned int xen_rcache_nr;
+#ifdef CONFIG_MMU_NOTIFIER
+	struct mmu_notifier xen_rcache_mmu_notifier;
+#endif
+	uint8_t xen_rcache_enabled:1;
 };
 
 extern int omx_iface_attach_endpoint(struct omx_endpoint * endpoint);
@@ -104,6 +104,7 @@ struct omx_event_waiter {
 	struct list_head list_elt;
 	struct task_struct *task;
 	struct rcu_head rcu_head;
+	uint32_t id;
 	uint8_t status;
 };
 
@@ -124,6 +125,49 @@ omx_wakeup_waiter_list(struct omx_endpoint *endpoint,
 	dprintk_out();
 }
 
+/*
+ * Any waiter processes all pending events once back in user-space, and the
+ * library then wakes up the other ones whose requests completed, so only
+ * wake up a single waiter that is not already being woken up.
+ */
+static INLINE void
+omx_wakeup_one_waiter(struct omx_endpoint *endpoint)
+{
+	struct omx_event_waiter *waiter;
+
+	dprintk_in();
+	rcu_read_lock();
+	list_for_each_entry_rcu(waiter, &endpoint->waiters, list_elt) {
+		if (waiter->status == OMX_CMD_WAIT_EVENT_STATUS_NONE) {
+			waiter->status = OMX_CMD_WAIT_EVENT_STATUS_EVENT;
+			wake_up_process(waiter->task);
+			break;
+		}
+	}
+	rcu_read_unlock();
+	dprintk_out();
+}
+
+/* targeted wakeup from the library, the id is chosen by the library */
+static INLINE void
+omx_wakeup_waiter_by_id(struct omx_endpoint *endpoint,
+			uint32_t id, uint32_t status)
+{
+	struct omx_event_waiter *waiter;
+
+	dprintk_in();
+	rcu_read_lock();
+	list_for_each_entry_rcu(waiter, &endpoint->waiters, list_elt) {
+		if (waiter->id == id) {
+			waiter->status = status;
+			wake_up_process(waiter->task);
+			break;
+		}
+	}
+	rcu_read_unlock();
+	dprintk_out();
+}
+
 static void
 omx_wakeup_on_timeout_handler(unsigned long data)
 {
@@ -199,6 +243,62 @@ omx_endpoint_queues_init(struct omx_endpoint *endpoint)
 	dprintk_out();
 }
 
+/*
+ * User-space does not release event slots with ioctls, it publishes
+ * the index of the next slot it will process in its endpoint descriptor.
+ * The descriptor is writable by user-space, so never release slots that
+ * were not given to it.
+ */
+void
+omx_endpoint_release_consumed_slots(struct omx_endpoint *endpoint)
+{
+	struct omx_endpoint_desc *userdesc = endpoint->userdesc;
+	omx_eventq_index_t index;
+
+	index = ACCESS_ONCE(userdesc->exp_eventq_index);
+	if (index != endpoint->nextreleased_exp_eventq_index) {
+		spin_lock_bh(&endpoint->release_exp_lock);
+		if ((omx_eventq_index_t) (index - endpoint->nextreleased_exp_eventq_index)
+		    <= (omx_eventq_index_t) (endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index))
+			endpoint->nextreleased_exp_eventq_index = index;
+		spin_unlock_bh(&endpoint->release_exp_lock);
+	}
+
+	index = ACCESS_ONCE(userdesc->unexp_eventq_index);
+	if (index != endpoint->nextreleased_unexp_eventq_index) {
+		spin_lock_bh(&endpoint->release_unexp_lock);
+		if ((omx_eventq_index_t) (index - endpoint->nextreleased_unexp_eventq_index)
+		    <= (omx_eventq_index_t) (endpoint->nextreserved_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index))
+			endpoint->nextreleased_unexp_eventq_index = index;
+		spin_unlock_bh(&endpoint->release_unexp_lock);
+	}
+}
+
+/* only look at the slots released by user-space when a queue looks full */
+static INLINE int
+omx_exp_eventq_overflow(struct omx_endpoint *endpoint)
+{
+	if (likely(endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index
+		   <= OMX_EXP_EVENTQ_ENTRY_NR))
+		return 0;
+
+	omx_endpoint_release_consumed_slots(endpoint);
+	return endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index
+		> OMX_EXP_EVENTQ_ENTRY_NR;
+}
+
+static INLINE int
+omx_unexp_eventq_overflow(struct omx_endpoint *endpoint)
+{
+	if (likely(endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
+		   <= OMX_UNEXP_EVENTQ_ENTRY_NR))
+		return 0;
+
+	omx_endpoint_release_consumed_slots(endpoint);
+	return endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
+		> OMX_UNEXP_EVENTQ_ENTRY_NR;
+}
+
 /******************************************
  * Report an expected event to users-space
  */
@@ -214,8 +314,7 @@ omx_notify_exp_event(struct omx_endpoint *endpoint, const void *event, int lengt
 	/* take the next slot and update the queue */
 	index = atomic_inc_return((atomic_t *) &endpoint->nextfree_exp_eventq_index) - 1;
 
-	if (unlikely(endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index
-		     > OMX_EXP_EVENTQ_ENTRY_NR)) {
+	if (unlikely(omx_exp_eventq_overflow(endpoint))) {
 		/* we went too far, rollback */
 		atomic_dec((atomic_t *) &endpoint->nextfree_exp_eventq_index);
 		/* the application sucks, it did not check
@@ -238,9 +337,9 @@ omx_notify_exp_event(struct omx_endpoint *endpoint, const void *event, int lengt
 	((struct omx_evt_generic *) slot)->id = 1 + (index % OMX_EVENT_ID_MAX);
 
 	/* wake up waiters */
-	dprintk(EVENT, "notify_exp waking up everybody\n");
+	dprintk(EVENT, "notify_exp waking up one waiter\n");
 
-	omx_wakeup_waiter_list(endpoint, OMX_CMD_WAIT_EVENT_STATUS_EVENT);
+	omx_wakeup_one_waiter(endpoint);
 	ret = 0;
 	goto out;
 
@@ -264,18 +363,15 @@ omx_notify_unexp_event(struct omx_endpoint *endpoint, const void *event, int len
 	dprintk_in();
 	/* take the next slot and update the queue */
 	/* FIXME:ananos what are you doing ????? */
-	//spin_lock_bh(&endpoint->unexp_lock);
-	endpoint->nextfree_unexp_eventq_index++;
-	index = endpoint->nextreserved_unexp_eventq_index++;
-	//spin_unlock_bh(&endpoint->unexp_lock);
+	/* the backend reserves slots of this queue too (without our locks),
+	 * when it writes received events directly, so use atomics */
+	atomic_inc((atomic_t *) &endpoint->nextfree_unexp_eventq_index);
+	index = atomic_inc_return((atomic_t *) &endpoint->nextreserved_unexp_eventq_index) - 1;
 
-	if (unlikely(endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
-		     > OMX_UNEXP_EVENTQ_ENTRY_NR)) {
+	if (unlikely(omx_unexp_eventq_overflow(endpoint))) {
 		/* we went too far, rollback */
-		spin_lock_bh(&endpoint->unexp_lock);
-		endpoint->nextfree_unexp_eventq_index--;
-		index = endpoint->nextreserved_unexp_eventq_index--;
-		spin_unlock_bh(&endpoint->unexp_lock);
+		atomic_dec((atomic_t *) &endpoint->nextfree_unexp_eventq_index);
+		atomic_dec((atomic_t *) &endpoint->nextreserved_unexp_eventq_index);
 		/* the application did not process the unexpected queue and release slots fast enough */
 		dprintk(EVENT,
 			"Open-MX: Unexpected event queue full, no event slot available for endpoint %d\n",
@@ -294,9 +390,9 @@ omx_notify_unexp_event(struct omx_endpoint *endpoint, const void *event, int len
 	((struct omx_evt_generic *) slot)->id = 1 + (index % OMX_EVENT_ID_MAX);
 
 	/* wake up waiters */
-	dprintk(EVENT, "notify_unexp waking up everybody\n");
+	dprintk(EVENT, "notify_unexp waking up one waiter\n");
 
-	omx_wakeup_waiter_list(endpoint, OMX_CMD_WAIT_EVENT_STATUS_EVENT);
+	omx_wakeup_one_waiter(endpoint);
 
 out:
 	dprintk_out();
@@ -331,8 +427,7 @@ omx_prepare_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint,
 	recvq_index = endpoint->next_recvq_index++;
 	spin_unlock_bh(&endpoint->unexp_lock);
 
-	if (unlikely(endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
-		     > OMX_UNEXP_EVENTQ_ENTRY_NR)) {
+	if (unlikely(omx_unexp_eventq_overflow(endpoint))) {
 		/* we went too far, rollback */
 		spin_lock_bh(&endpoint->unexp_lock);
 		endpoint->nextfree_unexp_eventq_index--;
@@ -370,8 +465,7 @@ omx_prepare_notify_unexp_events_with_recvq(struct omx_endpoint *endpoint,
 	endpoint->next_recvq_index += nr;
 //	spin_unlock_bh(&endpoint->unexp_lock);
 
-	if (unlikely(endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
-		     > OMX_UNEXP_EVENTQ_ENTRY_NR)) {
+	if (unlikely(omx_unexp_eventq_overflow(endpoint))) {
 		/* we went too far, rollback */
 		printk_err("Event queue FULL, no slot available\n");
 		spin_lock_bh(&endpoint->unexp_lock);
@@ -416,7 +510,7 @@ omx_commit_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint,
 	       >= endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index);
 
 	/* update the next reserved slot in the queue */
-	index = endpoint->nextreserved_unexp_eventq_index++;
+	index = atomic_inc_return((atomic_t *) &endpoint->nextreserved_unexp_eventq_index) - 1;
 
 	//spin_unlock_bh(&endpoint->unexp_lock);
 
@@ -428,9 +522,9 @@ omx_commit_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint,
 	((struct omx_evt_generic *) slot)->id = 1 + (index % OMX_EVENT_ID_MAX);
 
 	/* wake up waiters */
-	dprintk(EVENT, "commit_notify_unexp waking up everybody\n");
+	dprintk(EVENT, "commit_notify_unexp waking up one waiter\n");
 
-	omx_wakeup_waiter_list(endpoint, OMX_CMD_WAIT_EVENT_STATUS_EVENT);
+	omx_wakeup_one_waiter(endpoint);
 
 	dprintk_out();
 }
@@ -455,7 +549,7 @@ omx_cancel_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint)
 	       >= endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index);
 
 	/* update the next reserved slot in the queue */
-	index = endpoint->nextreserved_unexp_eventq_index++;
+	index = atomic_inc_return((atomic_t *) &endpoint->nextreserved_unexp_eventq_index) - 1;
 
 	spin_unlock_bh(&endpoint->unexp_lock);
 
@@ -520,16 +614,21 @@ omx_ioctl_wait_event(struct omx_endpoint * endpoint, void __user * uparam)
 		goto out;
 	}
 
-	/* FIXME: wait on some event type only */
-
 	/* queue ourself on the wait queue first, in case a packet arrives in the meantime */
 	waiter->status = OMX_CMD_WAIT_EVENT_STATUS_NONE;
 	waiter->task = current;
+	waiter->id = cmd.waiter_id;
 	set_current_state(TASK_INTERRUPTIBLE);
 	spin_lock(&endpoint->waiters_lock);
 	list_add_tail_rcu(&waiter->list_elt, &endpoint->waiters);
 	spin_unlock(&endpoint->waiters_lock);
 
+	/* the backend only pokes us after writing events if somebody sleeps */
+	if (endpoint->xen_shared) {
+		atomic_inc(&endpoint->xen_shared->waiters);
+		smp_mb();
+	}
+
 	/* did we deposit an event before the lib decided to go to sleep ? */
 	BUILD_BUG_ON(sizeof(cmd.next_exp_event_index) != sizeof(endpoint->nextfree_exp_eventq_index));
 	BUILD_BUG_ON(sizeof(cmd.next_unexp_event_index) != sizeof(endpoint->nextreserved_unexp_eventq_index));
@@ -603,6 +702,9 @@ omx_ioctl_wait_event(struct omx_endpoint * endpoint, void __user * uparam)
 	list_del_rcu(&waiter->list_elt);
 	spin_unlock(&endpoint->waiters_lock);
 
+	if (endpoint->xen_shared)
+		atomic_dec(&endpoint->xen_shared->waiters);
+
 	if (waiter->status == OMX_CMD_WAIT_EVENT_STATUS_NONE) {
 		/* status didn't changed, we have been interrupted */
 		waiter->status = OMX_CMD_WAIT_EVENT_STATUS_INTR;
@@ -635,13 +737,13 @@ omx_ioctl_release_exp_slots(struct omx_endpoint *endpoint, void __user *uparam)
 {
 	int err = 0;
 	dprintk_in();
-	spin_lock(&endpoint->release_exp_lock);
+	spin_lock_bh(&endpoint->release_exp_lock);
 	if (endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index
 	    < OMX_EXP_RELEASE_SLOTS_BATCH_NR)
 		err = -EINVAL;
 	else
 		endpoint->nextreleased_exp_eventq_index += OMX_EXP_RELEASE_SLOTS_BATCH_NR;
-	spin_unlock(&endpoint->release_exp_lock);
+	spin_unlock_bh(&endpoint->release_exp_lock);
 	dprintk_out();
 	return err;
 }
@@ -651,13 +753,13 @@ omx_ioctl_release_unexp_slots(struct omx_endpoint *endpoint, void __user *uparam
 {
 	int err = 0;
 	dprintk_in();
-	spin_lock(&endpoint->release_unexp_lock);
+	spin_lock_bh(&endpoint->release_unexp_lock);
 	if (endpoint->nextreserved_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
 	    < OMX_UNEXP_RELEASE_SLOTS_BATCH_NR)
 		err = -EINVAL;
 	else
 		endpoint->nextreleased_unexp_eventq_index += OMX_UNEXP_RELEASE_SLOTS_BATCH_NR;
-	spin_unlock(&endpoint->release_unexp_lock);
+	spin_unlock_bh(&endpoint->release_unexp_lock);
 	dprintk_out();
 	return err;
 }
@@ -676,7 +778,10 @@ omx_ioctl_wakeup(struct omx_endpoint * endpoint, void __user * uparam)
 		goto out;
 	}
 
-	omx_wakeup_waiter_list(endpoint, cmd.status);
+	if (cmd.waiter_id)
+		omx_wakeup_waiter_by_id(endpoint, cmd.waiter_id, cmd.status);
+	else
+		omx_wakeup_waiter_list(endpoint, cmd.status);
 
  out:
 	dprintk_in();
@@ -691,6 +796,15 @@ omx_wakeup_endpoint_on_close(struct omx_endpoint * endpoint)
 	dprintk_out();
 }
 
+/* the backend wrote events in the unexp eventq on its own */
+void
+omx_wakeup_endpoint_on_event(struct omx_endpoint * endpoint)
+{
+	dprintk_in();
+	omx_wakeup_one_waiter(endpoint);
+	dprintk_out();
+}
+
 /*
  * Local variables:
  *  tab-width: 8
@@ -86,6 +86,14 @@ int omx_skb_copy_max = 0;
 module_param_named(skbcopy, omx_skb_copy_max, uint, S_IRUGO|S_IWUSR);
 MODULE_PARM_DESC(skbcopy, "Maximum length of data to copy in linear skb instead of attaching pages");
 
+int omx_xmit_batch_max = 32;
+module_param_named(xmitbatch, omx_xmit_batch_max, uint, S_IRUGO); /* not writable, batches must begin and end with the same value */
+MODULE_PARM_DESC(xmitbatch, "Maximal number of skbs to transmit at once at the end of a command batch or pull block");
+
+int omx_skb_pool_max = 16;
+module_param_named(skbpool, omx_skb_pool_max, uint, S_IRUGO); /* not writable, pooled skbs must be sent as clones */
+MODULE_PARM_DESC(skbpool, "Number of header-only skbs to keep across transmission for reuse per cpu and interface");
+
 int omx_pin_synchronous = 1;
 module_param_named(pinsync, omx_pin_synchronous, uint, S_IRUGO); /* not writable to simplify things */
 MODULE_PARM_DESC(pinsync, "Pin user regions synchronously on register");
@@ -110,6 +118,19 @@ unsigned long omx_user_rights = 0;
 module_param_named(userrights, omx_user_rights, ulong, S_IRUGO|S_IWUSR);
 MODULE_PARM_DESC(userrights, "Mask of privileged operation rights that are granted regular users");
 
+int omx_xen_async_send = 0;
+module_param_named(xenasync, omx_xen_async_send, uint, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(xenasync, "Return from send commands once queued on the ring and report failures as events");
+int omx_xen_queues = 0;
+module_param_named(xenqueues, omx_xen_queues, uint, S_IRUGO);
+MODULE_PARM_DESC(xenqueues, "Number of request rings to use (default is one per vCPU, within what the backend supports)");
+int omx_xen_direct_recv = 1;
+module_param_named(xendirectrecv, omx_xen_direct_recv, uint, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(xendirectrecv, "Let the backend write received small and medium events into the event queue directly");
+int omx_xen_rcache = 32;
+module_param_named(xenrcache, omx_xen_rcache, uint, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(xenrcache, "Number of destroyed regions each endpoint keeps granted for reuse (0 disables)");
+
 #ifdef OMX_HAVE_DMA_ENGINE
 int omx_dmaengine = 0; /* disabled by default for now */
 module_param_named(dmaengine, omx_dmaengine, uint, S_IRUGO|S_IWUSR);
@@ -297,8 +318,9 @@ omx_get_driver_string(unsigned int *lenp)
 	buflen += len;
 
 	len = snprintf(tmp, OMX_DRIVER_STRING_LEN-buflen,
-		       " SkBuff: <=%d frags%s, ForcedCopy <=%dB\n",
-		       omx_skb_frags, omx_skb_frags ? "" : " (always linear)", omx_skb_copy_max);
+		       " SkBuff: <=%d frags%s, ForcedCopy <=%dB, XmitBatch <=%d, Pool %d/cpu\n",
+		       omx_skb_frags, omx_skb_frags ? "" : " (always linear)", omx_skb_copy_max,
+		       omx_xmit_batch_max, omx_skb_pool_max);
 	tmp += len;
 	buflen += len;
 
@@ -1307,6 +1307,9 @@ omx_recv_pull_request(struct omx_iface * iface,
 		goto out_with_region;
 	}
 
+	/* transmit all replies at once */
+	omx_iface_xmit_batch_begin(iface);
+
 	/* send all replies */
 	for(i=0; i<replies; i++) {
 		struct sk_buff *skb;
@@ -1330,7 +1333,7 @@ omx_recv_pull_request(struct omx_iface * iface,
 			omx_counter_inc(iface, SEND_NOMEM_SKB);
 			omx_drop_dprintk(pull_eh, "PULL packet due to failure to create pull reply skb");
 			err = -ENOMEM;
-			goto out_with_region;
+			goto out_with_batch;
 		}
 
 		/* append segment pages */
@@ -1364,7 +1367,7 @@ omx_recv_pull_request(struct omx_iface * iface,
 				omx_counter_inc(iface, SEND_NOMEM_SKB);
 				omx_drop_dprintk(pull_eh, "PULL packet due to failure to create pull reply linear skb");
 				err = -ENOMEM;
-				goto out_with_region;
+				goto out_with_batch;
 			}
 
 			/* locate new headers */
@@ -1407,6 +1410,8 @@ omx_recv_pull_request(struct omx_iface * iface,
 		block_remaining_length -= frame_length;
 	}
 
+	omx_iface_xmit_batch_end(iface);
+
 	/* release the main reference on the region */
 	omx_user_region_release(region);
 	omx_endpoint_release(endpoint);
@@ -1414,6 +1419,8 @@ omx_recv_pull_request(struct omx_iface * iface,
 	err = 0;
 	goto real_out;
 
+ out_with_batch:
+	omx_iface_xmit_batch_end(iface);
  out_with_region:
 	/* release the main reference on the region */
 	omx_user_region_release(region);
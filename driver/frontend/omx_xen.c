@@ -43,6 +43,7 @@
 #include "omx_xenfront.h"
 #include "omx_xenfront_helper.h"
 #include "omx_xenfront_endpoint.h"
+#include "omx_xenfront_send.h"
 
 /* FIXME: Do we really need this global var ? */
 struct omx_xenfront_info *__omx_xen_frontend;
@@ -51,7 +52,7 @@ static int omx_xenfront_probe(struct xenbus_device *dev,
 			      const struct xenbus_device_id *id)
 {
 	struct omx_xenfront_info *fe;
-	struct omx_xenif_sring *sring, *recv_sring;
+	struct omx_xenif_sring *recv_sring;
 	int err = 0;
 	int i = 0;
 
@@ -87,35 +88,17 @@ static int omx_xenfront_probe(struct xenbus_device *dev,
                 goto out;
         }
 
-        INIT_WORK(&fe->msg_workq_task, omx_xenif_interrupt);
+        INIT_WORK(&fe->msg_workq_task, omx_xenif_interrupt_recv);
 
 
 	spin_lock_init(&fe->lock);
+	omx_xenfront_pgrants_init(fe);
 	dprintk_deb("Setting up shared ring\n");
 
-	sring =
-	    (struct omx_xenif_sring *)get_zeroed_page(GFP_NOIO | __GFP_HIGH);
-	if (!sring) {
-		xenbus_dev_fatal(dev, -ENOMEM, "allocating shared ring");
-		err = -ENOMEM;
-		goto out;
-	}
-	SHARED_RING_INIT(sring);
-	FRONT_RING_INIT(&fe->ring, sring, PAGE_SIZE);
-
-	err = xenbus_grant_ring(dev, virt_to_mfn(fe->ring.sring));
-	if (err < 0) {
-		free_page((unsigned long)sring);
-		fe->ring.sring = NULL;
-		printk_err("Failed to grant ring\n");
-		goto out;
-	}
-	fe->ring_ref = err;
-
-
+	/* request rings are set up once the backend told how many it takes */
 	recv_sring =
 	    (struct omx_xenif_sring *)get_zeroed_page(GFP_NOIO | __GFP_HIGH);
-	if (!sring) {
+	if (!recv_sring) {
 		xenbus_dev_fatal(dev, -ENOMEM, "allocating shared ring");
 		err = -ENOMEM;
 		goto out;
@@ -149,17 +132,18 @@ out:
 static int omx_xenfront_remove(struct xenbus_device *dev)
 {
 	struct omx_xenfront_info *fe = dev_get_drvdata(&dev->dev);
+	int i;
 
 	dprintk_in();
 	dprintk_deb("frontend_remove: %s removed\n", dev->nodename);
-        /* This frees the page as a side-effect */
-        if (fe->ring_ref)
-                gnttab_end_foreign_access(fe->ring_ref, 0, (unsigned long)fe->ring.sring);
+	for (i = 0; i < fe->nr_queues; i++)
+		omx_xenfront_free_queue(&fe->queues[i]);
 
         /* This frees the page as a side-effect */
         if (fe->recv_ring_ref)
                 gnttab_end_foreign_access(fe->recv_ring_ref, 0, (unsigned long)fe->recv_ring.sring);
 
+	omx_xenfront_pgrants_free(fe);
 	omx_xenif_free(fe, 0);
 
 	xenbus_switch_state(fe->xbdev, XenbusStateClosing);
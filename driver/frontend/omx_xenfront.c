@@ -43,6 +43,8 @@
 
 #define OMX_XEN_DELAY	1
 #define OMX_XEN_POLL_HARD_LIMIT OMX_XEN_DELAY * 1000 * 1000 * 1000 // wait for 1s
+/* give up waiting for a free ring slot after about one second */
+#define OMX_XEN_RING_WAIT_US	(1000UL * 1000)
 //#define EXTRA_DEBUG_OMX
 #include "omx_xen_debug.h"
 #include "omx_xen.h"
@@ -77,24 +79,74 @@ void dump_ring_req(struct omx_xenif_request *req)
 
 /*
  * We keep track of each request to handle backend's notifications and release
- * IOCTL calls from user-space.
+ * IOCTL calls from user-space. The request id is set in the returned slot.
  *
- * WARNING: We can handle up to OMX_MAX_INFLIGHT_REQUESTS at the same time.
+ * WARNING: We can handle up to OMX_XEN_QUEUE_INFLIGHT_REQUESTS per queue
+ * at the same time.
+ *
+ * Return NULL if the backend did not free any slot for OMX_XEN_RING_WAIT_US.
+ * Data path callers then fail with -ENOMEM so that the library resends later,
+ * other callers fail with -EBUSY.
  */
-struct omx_xenif_request *omx_ring_get_request(struct omx_xenfront_info
-						      *fe)
+struct omx_xenif_request *omx_ring_get_request(struct omx_xenfront_queue *queue)
 {
+	struct omx_xenfront_info *fe = queue->fe;
 	struct omx_xenif_request *ring_req;
+	uint32_t request_id;
+	unsigned long flags;
+	unsigned long i = 0;
 	dprintk_in();
 
-	ring_req = RING_GET_REQUEST(&fe->ring, fe->ring.req_prod_pvt++);
-	fe->requests[(fe->ring.req_prod_pvt - 1) % OMX_MAX_INFLIGHT_REQUESTS] =
-	    OMX_XEN_FRONTEND_STATUS_DOING;
+	/* with asynchronous submission, nobody guarantees that the backend
+	 * consumed our previous requests, so make sure we don't overwrite them */
+	spin_lock_irqsave(&queue->lock, flags);
+	while (unlikely(RING_FULL(&queue->ring))) {
+		spin_unlock_irqrestore(&queue->lock, flags);
+		if (++i > OMX_XEN_RING_WAIT_US) {
+			printk_err("no free ring slot after %lums, giving up\n",
+				   OMX_XEN_RING_WAIT_US / 1000);
+			dprintk_out();
+			return NULL;
+		}
+		udelay(1);
+		spin_lock_irqsave(&queue->lock, flags);
+	}
+
+	request_id = queue->id * OMX_XEN_QUEUE_INFLIGHT_REQUESTS
+	    + queue->ring.req_prod_pvt % OMX_XEN_QUEUE_INFLIGHT_REQUESTS;
+	ring_req = RING_GET_REQUEST(&queue->ring, queue->ring.req_prod_pvt++);
+	spin_unlock_irqrestore(&queue->lock, flags);
+
+	ring_req->request_id = request_id;
+	fe->requests[request_id] = OMX_XEN_FRONTEND_STATUS_DOING;
 
 	dprintk_out();
 	return ring_req;
 }
 
+/* keep the requests of an endpoint ordered on a single queue */
+struct omx_xenfront_queue *omx_xenfront_endpoint_queue(struct omx_endpoint
+						       *endpoint)
+{
+	struct omx_xenfront_info *fe = endpoint->fe;
+
+	return &fe->queues[endpoint->endpoint_index % fe->nr_queues];
+}
+
+/* find the queue whose ring holds a request slot */
+static struct omx_xenfront_queue *
+omx_xenfront_request_queue(struct omx_xenfront_info *fe,
+			   struct omx_xenif_request *ring_req)
+{
+	int i;
+
+	for (i = 0; i < fe->nr_queues; i++)
+		if ((unsigned long)ring_req -
+		    (unsigned long)fe->queues[i].ring.sring < PAGE_SIZE)
+			return &fe->queues[i];
+	return NULL;
+}
+
 int wait_for_backend_response(unsigned int *poll_var, unsigned int status,
 			      spinlock_t * spin)
 {
@@ -128,6 +180,52 @@ out:
 	return ret;
 }
 
+/*
+ * Push a data-path request to the backend.
+ *
+ * In synchronous mode, wait for the backend to process it and return its
+ * status. In asynchronous mode (xenasync module parameter), return as soon
+ * as the request is on the ring; omx_xenfront_request_done() reports
+ * failures later as events.
+ */
+int omx_xenfront_submit_request(struct omx_xenfront_info *fe,
+				struct omx_xenif_request *ring_req,
+				const char *what)
+{
+	uint32_t request_id = ring_req->request_id;
+	int ret = 0;
+
+	dprintk_in();
+
+	if (omx_xen_async_send) {
+		/* mark before pushing, the response may come back right away */
+		fe->requests[request_id] = OMX_XEN_FRONTEND_STATUS_ASYNC;
+		ret = omx_poke_dom0(fe, ring_req);
+		goto out;
+	}
+
+	omx_poke_dom0(fe, ring_req);
+	if ((ret = wait_for_backend_response
+	     (&fe->requests[request_id], OMX_XEN_FRONTEND_STATUS_DOING,
+	      NULL)) < 0) {
+		printk_err("Failed to wait\n");
+		ret = -EINVAL;
+		goto out;
+	}
+	dprintk_deb("ret %s = %d\n", what, ret);
+
+	if (fe->requests[request_id] == OMX_XEN_FRONTEND_STATUS_DONE)
+		ret = 0;
+	else {
+		ret = -EFAULT;
+		printk_err("Backend failed to ACK %s\n", what);
+	}
+
+out:
+	dprintk_out();
+	return ret;
+}
+
 /* Xen related stuff */
 int
 omx_poke_dom0(struct omx_xenfront_info *fe, struct omx_xenif_request *ring_req)
@@ -138,11 +236,12 @@ omx_poke_dom0(struct omx_xenfront_info *fe, struct omx_xenif_request *ring_req)
 	unsigned long flags;
 	struct evtchn_send event;
 	struct omx_xenif_front_ring *ring;
+	struct omx_xenfront_queue *queue;
+	spinlock_t *lock;
 
 	dprintk_in();
 
 	TIMER_START(&t_poke_dom0);
-	spin_lock_irqsave(&fe->lock, flags);
 	if (unlikely(!ring_req)) {
 		/* If our ring buffer is null, then we fail ungracefully */
 		printk_err("Null ring_resp\n");
@@ -161,14 +260,25 @@ omx_poke_dom0(struct omx_xenfront_info *fe, struct omx_xenif_request *ring_req)
 	case OMX_CMD_RECV_MEDIUM_FRAG:
 	case OMX_CMD_RECV_SMALL:
 	case OMX_CMD_RECV_TINY:{
+			/* recv_ring notifications go through queue 0 */
+			queue = &fe->queues[0];
 			ring = &fe->recv_ring;
+			lock = &fe->lock;
 			break;
 		}
 	default:{
-			ring = &fe->ring;
+			queue = omx_xenfront_request_queue(fe, ring_req);
+			if (unlikely(!queue)) {
+				printk_err("Request is not on any ring\n");
+				err = -EINVAL;
+				goto out;
+			}
+			ring = &queue->ring;
+			lock = &queue->lock;
 			break;
 		}
 	}
+	spin_lock_irqsave(lock, flags);
 	//RING_PUSH_REQUESTS(&(fe->recv_ring));
 	RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(ring, notify);
 	dprintk_deb
@@ -176,15 +286,16 @@ omx_poke_dom0(struct omx_xenfront_info *fe, struct omx_xenif_request *ring_req)
 	     "requests_produced = %d\n",
 	     ring_req->func, ring->req_prod_pvt, ring->sring->req_prod);
 
+	spin_unlock_irqrestore(lock, flags);
+
 	if (notify) {
-		event.port = fe->evtchn.local_port;
+		event.port = queue->evtchn.local_port;
 		if (HYPERVISOR_event_channel_op(EVTCHNOP_send, &event) != 0) {
 			dprintk_deb("Failed to send event!\n");
 			goto out;
 		}
 	}
 out:
-	spin_unlock_irqrestore(&fe->lock, flags);
 	TIMER_STOP(&t_poke_dom0);
 	dprintk_out();
 	return err;
@@ -232,6 +343,164 @@ static struct omx_endpoint *omx_xenfront_get_endpoint(struct omx_xenfront_info *
 	return endpoint;
 }
 
+/*
+ * Report the failure of an asynchronously submitted request to user-space.
+ * Mediumsq frags and messages and pulls already own an expected event slot,
+ * so complete them the usual way and let the library retransmit or fail the request.
+ * Other sends have no slot reserved, use the unexpected queue for them.
+ */
+static void omx_xenfront_notify_async_error(struct omx_endpoint *endpoint,
+					    struct omx_xenif_response *resp)
+{
+	dprintk_in();
+
+	switch (resp->func) {
+	case OMX_CMD_SEND_MEDIUMSQ_FRAG:{
+			struct omx_evt_send_mediumsq_frag_done evt;
+
+			evt.id = 0;
+			evt.type = OMX_EVT_SEND_MEDIUMSQ_FRAG_DONE;
+			evt.sendq_offset =
+			    resp->data.send_mediumsq_frag.mediumsq_frag.sendq_offset;
+			omx_notify_exp_event(endpoint, &evt, sizeof(evt));
+			break;
+		}
+	case OMX_CMD_XEN_SEND_MEDIUMSQ:{
+			struct omx_cmd_send_mediumsq *mediumsq =
+			    &omx_xenfront_slot_payload
+			    (omx_xenfront_endpoint_queue(endpoint), resp)->mediumsq;
+			struct omx_evt_send_mediumsq_done evt;
+
+			evt.id = 0;
+			evt.type = OMX_EVT_SEND_MEDIUMSQ_DONE;
+			evt.sendq_offset =
+			    mediumsq->sendq_index[0] << OMX_SENDQ_ENTRY_SHIFT;
+			omx_notify_exp_event(endpoint, &evt, sizeof(evt));
+			break;
+		}
+	case OMX_CMD_PULL:{
+			struct omx_evt_pull_done evt;
+
+			evt.id = 0;
+			evt.type = OMX_EVT_PULL_DONE;
+			evt.status = OMX_EVT_PULL_DONE_ABORTED;
+			evt.lib_cookie = resp->data.pull.pull.lib_cookie;
+			evt.puller_rdma_id = resp->data.pull.pull.puller_rdma_id;
+			omx_notify_exp_event(endpoint, &evt, sizeof(evt));
+			break;
+		}
+	case OMX_CMD_XEN_SEND_BATCH:{
+			struct omx_cmd_xen_send_batch *batch =
+			    &resp->data.send_batch;
+			struct omx_cmd_send_batch_entry *entries =
+			    omx_xenfront_slot_payload
+			    (omx_xenfront_endpoint_queue(endpoint), resp)->batch;
+			struct omx_cmd_send_batch_entry *entry;
+			struct omx_evt_send_error evt;
+			int i;
+
+			/* one event per failed command of the batch */
+			for (i = 0; i < batch->nr_entries; i++) {
+				entry = &entries[i];
+				if (!entry->status)
+					continue;
+
+				memset(&evt, 0, sizeof(evt));
+				evt.type = OMX_EVT_SEND_ERROR;
+				evt.command = entry->cmd;
+				evt.error = entry->status;
+				switch (entry->cmd) {
+				case OMX_CMD_SEND_TINY:
+					evt.peer_index = entry->u.tiny.hdr.peer_index;
+					evt.dest_endpoint = entry->u.tiny.hdr.dest_endpoint;
+					break;
+				case OMX_CMD_SEND_NOTIFY:
+					evt.peer_index = entry->u.notify.peer_index;
+					evt.dest_endpoint = entry->u.notify.dest_endpoint;
+					break;
+				case OMX_CMD_SEND_LIBACK:
+					evt.peer_index = entry->u.liback.peer_index;
+					evt.dest_endpoint = entry->u.liback.dest_endpoint;
+					break;
+				}
+				omx_notify_unexp_event(endpoint, &evt, sizeof(evt));
+			}
+			break;
+		}
+	default:{
+			struct omx_evt_send_error evt;
+
+			/* the ring slot still holds the original command */
+			memset(&evt, 0, sizeof(evt));
+			evt.type = OMX_EVT_SEND_ERROR;
+			evt.command = resp->func;
+			evt.error = resp->ret;
+			switch (resp->func) {
+			case OMX_CMD_SEND_TINY:
+				evt.peer_index = resp->data.send_tiny.tiny.hdr.peer_index;
+				evt.dest_endpoint = resp->data.send_tiny.tiny.hdr.dest_endpoint;
+				break;
+			case OMX_CMD_SEND_SMALL:
+				evt.peer_index = resp->data.send_small.small.peer_index;
+				evt.dest_endpoint = resp->data.send_small.small.dest_endpoint;
+				break;
+			case OMX_CMD_SEND_RNDV:
+				evt.peer_index = resp->data.send_rndv.rndv.peer_index;
+				evt.dest_endpoint = resp->data.send_rndv.rndv.dest_endpoint;
+				break;
+			case OMX_CMD_SEND_NOTIFY:
+				evt.peer_index = resp->data.send_notify.notify.peer_index;
+				evt.dest_endpoint = resp->data.send_notify.notify.dest_endpoint;
+				break;
+			case OMX_CMD_SEND_LIBACK:
+				evt.peer_index = resp->data.send_liback.liback.peer_index;
+				evt.dest_endpoint = resp->data.send_liback.liback.dest_endpoint;
+				break;
+			case OMX_CMD_SEND_CONNECT_REQUEST:
+				evt.peer_index = resp->data.send_connect_request.request.peer_index;
+				evt.dest_endpoint = resp->data.send_connect_request.request.dest_endpoint;
+				break;
+			case OMX_CMD_SEND_CONNECT_REPLY:
+				evt.peer_index = resp->data.send_connect_reply.reply.peer_index;
+				evt.dest_endpoint = resp->data.send_connect_reply.reply.dest_endpoint;
+				break;
+			}
+			omx_notify_unexp_event(endpoint, &evt, sizeof(evt));
+			break;
+		}
+	}
+
+	dprintk_out();
+}
+
+/*
+ * Record the backend status of a data-path request, turning the failure
+ * of asynchronously submitted requests into events since nobody waits
+ * for them.
+ */
+static void omx_xenfront_request_done(struct omx_xenfront_info *fe,
+				      struct omx_endpoint *endpoint,
+				      struct omx_xenif_response *resp)
+{
+	uint32_t request_id = resp->request_id;
+
+	dprintk_in();
+
+	if (unlikely(resp->ret)
+	    && fe->requests[request_id] == OMX_XEN_FRONTEND_STATUS_ASYNC) {
+		dprintk_deb("async %s failed, ret = %d\n",
+			    omx_strcmd(resp->func), resp->ret);
+		omx_xenfront_notify_async_error(endpoint, resp);
+	}
+
+	if (!resp->ret)
+		fe->requests[request_id] = OMX_XEN_FRONTEND_STATUS_DONE;
+	else
+		fe->requests[request_id] = OMX_XEN_FRONTEND_STATUS_FAILED;
+
+	dprintk_out();
+}
+
 static void omx_xenfront_ack(struct omx_endpoint *endpoint, uint32_t func)
 {
 	struct omx_xenfront_info *fe = endpoint->fe;
@@ -281,9 +550,6 @@ again_recv:
 
 	rmb(); /* Ensure we see queued responses up to 'rp'. */
 	while (cons != prod) {
-		dprintk_deb("omx_xenif->ring.req_cons=%d, i=%d, rp=%d\n",
-			    fe->ring.rsp_cons, fe->ring.rsp_cons,
-			    fe->ring.sring->rsp_prod);
 		dprintk_deb("omx_xenif->recv_ring.req_cons=%d, i=%d, rp=%d\n",
 			    fe->recv_ring.rsp_cons, fe->recv_ring.rsp_cons,
 			    fe->recv_ring.sring->rsp_prod);
@@ -293,8 +559,8 @@ again_recv:
 		id = resp->func;
 		dprintk_deb
 		    ("func =%#x, responses_produced= %d, requests_produced = %d\n",
-		     resp->func, fe->ring.sring->rsp_prod,
-		     fe->ring.sring->req_prod);
+		     resp->func, fe->recv_ring.sring->rsp_prod,
+		     fe->recv_ring.sring->req_prod);
 
 		switch (resp->func) {
 		case OMX_CMD_XEN_RECV_PULL_DONE:{
@@ -326,6 +592,20 @@ again_recv:
 				//omx_xen_user_region_release(endpoint, rid);
 				TIMER_STOP(&t_pull_done);
 
+				omx_xenfront_ack(endpoint, OMX_CMD_XEN_DUMMY);
+				break;
+			}
+		case OMX_CMD_XEN_RECV_WAKEUP:{
+				struct omx_endpoint *endpoint;
+
+				/* events are already in the unexp eventq */
+				endpoint = omx_xenfront_get_endpoint(fe, resp);
+				if (!endpoint) {
+					printk_err("Endpoint is null:S\n");
+					break;
+				}
+
+				omx_wakeup_endpoint_on_event(endpoint);
 				omx_xenfront_ack(endpoint, OMX_CMD_XEN_DUMMY);
 				break;
 			}
@@ -612,8 +892,8 @@ again_recv:
 			printk_err("Unknown event came in, %d\n", resp->func);
 			dprintk_inf
 			    ("resp_consumed=%d, responses_produced= %d, requests_produced = %d\n",
-			     cons, fe->ring.sring->rsp_prod,
-			     fe->ring.sring->req_prod);
+			     cons, fe->recv_ring.sring->rsp_prod,
+			     fe->recv_ring.sring->req_prod);
 			break;
 		}
 	}
@@ -636,6 +916,7 @@ out:
 
 void omx_xenif_interrupt(struct work_struct *work)
 {
+	struct omx_xenfront_queue *queue;
 	struct omx_xenfront_info *fe;
 	struct omx_xenif_response *resp;
 	//struct omx_xenif_request *ring_req;
@@ -647,7 +928,8 @@ void omx_xenif_interrupt(struct work_struct *work)
 	struct omx_xenif_front_ring *ring;
 
 	dprintk_in();
-	fe = container_of(work, struct omx_xenfront_info, msg_workq_task);
+	queue = container_of(work, struct omx_xenfront_queue, msg_workq_task);
+	fe = queue->fe;
 
 	//spin_lock_irqsave(&fe->msg_handler_lock, flags);
 	if (unlikely(fe->connected != OMXIF_STATE_CONNECTED)) {
@@ -656,24 +938,24 @@ void omx_xenif_interrupt(struct work_struct *work)
 	}
 	/* dprintk_deb("ev_id %#lx omxbe=%#lx\n", (unsigned long)data, (unsigned long)fe); */
 
-	if (RING_HAS_UNCONSUMED_RESPONSES(&fe->ring)) {
+	if (RING_HAS_UNCONSUMED_RESPONSES(&queue->ring)) {
 again_send:
 		dprintk_deb("responses_produced= %d, requests_produced = %d\n",
-			    fe->ring.sring->rsp_prod, fe->ring.sring->req_prod);
+			    queue->ring.sring->rsp_prod, queue->ring.sring->req_prod);
 		dprintk_deb("RING_FREE_REQUESTS() = %#x, RING_FULL=%#x \n",
-			    RING_FREE_REQUESTS((&fe->ring)),
-			    RING_FULL(&fe->ring));
-		ring = &fe->ring;
-		cons = fe->ring.rsp_cons;
-		prod = fe->ring.sring->rsp_prod;
+			    RING_FREE_REQUESTS((&queue->ring)),
+			    RING_FULL(&queue->ring));
+		ring = &queue->ring;
+		cons = queue->ring.rsp_cons;
+		prod = queue->ring.sring->rsp_prod;
 	} else
 		goto out;
 
 	rmb(); /* Ensure we see queued responses up to 'rp'. */
 	while (cons != prod) {
 		dprintk_deb("omx_xenif->ring.req_cons=%d, i=%d, rp=%d\n",
-			    fe->ring.rsp_cons, fe->ring.rsp_cons,
-			    fe->ring.sring->rsp_prod);
+			    queue->ring.rsp_cons, queue->ring.rsp_cons,
+			    queue->ring.sring->rsp_prod);
 		dprintk_deb("omx_xenif->recv_ring.req_cons=%d, i=%d, rp=%d\n",
 			    fe->recv_ring.rsp_cons, fe->recv_ring.rsp_cons,
 			    fe->recv_ring.sring->rsp_prod);
@@ -683,8 +965,8 @@ again_send:
 		id = resp->func;
 		dprintk_deb
 		    ("func =%#x, responses_produced= %d, requests_produced = %d\n",
-		     resp->func, fe->ring.sring->rsp_prod,
-		     fe->ring.sring->req_prod);
+		     resp->func, queue->ring.sring->rsp_prod,
+		     queue->ring.sring->req_prod);
 
 		switch (resp->func) {
 		case OMX_CMD_SEND_MEDIUMSQ_FRAG:{
@@ -706,12 +988,7 @@ again_send:
 					break;
 				}
 
-				if (!ret)
-					fe->requests[resp->request_id] =
-					    OMX_XEN_FRONTEND_STATUS_DONE;
-				else
-					fe->requests[resp->request_id] =
-					    OMX_XEN_FRONTEND_STATUS_FAILED;
+				omx_xenfront_request_done(fe, endpoint, resp);
 				dprintk_deb("%s: ret = %d\n", __func__, ret);
 
 				break;
@@ -735,12 +1012,7 @@ again_send:
 				}
 
 				//      dump_xen_send_mediumva(&resp->data.send_mediumva);
-				if (!ret)
-					fe->requests[resp->request_id] =
-					    OMX_XEN_FRONTEND_STATUS_DONE;
-				else
-					fe->requests[resp->request_id] =
-					    OMX_XEN_FRONTEND_STATUS_FAILED;
+				omx_xenfront_request_done(fe, endpoint, resp);
 				dprintk_deb("%s: ret = %d\n", __func__, ret);
 
 				break;
@@ -764,12 +1036,7 @@ again_send:
 				}
 
 				//      dump_xen_send_small(&resp->data.send_small);
-				if (!ret)
-					fe->requests[resp->request_id] =
-					    OMX_XEN_FRONTEND_STATUS_DONE;
-				else
-					fe->requests[resp->request_id] =
-					    OMX_XEN_FRONTEND_STATUS_FAILED;
+				omx_xenfront_request_done(fe, endpoint, resp);
 				dprintk_deb("%s: ret = %d\n", __func__, ret);
 
 				break;
@@ -793,12 +1060,7 @@ again_send:
 					break;
 				}
 				//      dump_xen_send_tiny(&resp->data.send_tiny);
-				if (!ret)
-					fe->requests[resp->request_id] =
-					    OMX_XEN_FRONTEND_STATUS_DONE;
-				else
-					fe->requests[resp->request_id] =
-					    OMX_XEN_FRONTEND_STATUS_FAILED;
+				omx_xenfront_request_done(fe, endpoint, resp);
 				dprintk_deb("%s: ret = %d\n", __func__, ret);
 
 				break;
@@ -827,12 +1089,7 @@ again_send:
 				memcpy(&pull, &resp->data.pull.pull,
 				       sizeof(pull));
 
-				if (!ret)
-					fe->requests[resp->request_id] =
-					    OMX_XEN_FRONTEND_STATUS_DONE;
-				else
-					fe->requests[resp->request_id] =
-					    OMX_XEN_FRONTEND_STATUS_FAILED;
+				omx_xenfront_request_done(fe, endpoint, resp);
 				dprintk_deb("%s: ret = %d\n", __func__, ret);
 
 				break;
@@ -856,12 +1113,7 @@ again_send:
 				}
 
 				//dump_xen_send_notify(&resp->data.send_notify);
-				if (!ret)
-					fe->requests[resp->request_id] =
-					    OMX_XEN_FRONTEND_STATUS_DONE;
-				else
-					fe->requests[resp->request_id] =
-					    OMX_XEN_FRONTEND_STATUS_FAILED;
+				omx_xenfront_request_done(fe, endpoint, resp);
 				dprintk_deb("%s: ret = %d\n", __func__, ret);
 
 				break;
@@ -885,19 +1137,13 @@ again_send:
 				}
 				dump_xen_send_rndv(&resp->data.send_rndv);
 
-				if (!ret)
-					fe->requests[resp->request_id] =
-					    OMX_XEN_FRONTEND_STATUS_DONE;
-				else
-					fe->requests[resp->request_id] =
-					    OMX_XEN_FRONTEND_STATUS_FAILED;
+				omx_xenfront_request_done(fe, endpoint, resp);
 
 				break;
 			}
 		case OMX_CMD_SEND_LIBACK:{
 				struct omx_endpoint *endpoint;
 				int16_t ret = 0;
-				uint32_t request_id = 0;
 				dprintk_deb
 				    ("received backend request: OMX_CMD_SEND_LIBACK, param=%lx\n",
 				     sizeof(struct omx_cmd_xen_send_liback));
@@ -912,14 +1158,46 @@ again_send:
 					break;
 				}
 				dump_xen_send_liback(&resp->data.send_liback);
-				request_id = resp->request_id;
 
-				if (!ret)
-					fe->requests[request_id] =
-					    OMX_XEN_FRONTEND_STATUS_DONE;
-				else
-					fe->requests[request_id] =
-					    OMX_XEN_FRONTEND_STATUS_FAILED;
+				omx_xenfront_request_done(fe, endpoint, resp);
+				break;
+			}
+		case OMX_CMD_XEN_SEND_MEDIUMSQ:{
+				struct omx_endpoint *endpoint;
+				int16_t ret = 0;
+				dprintk_deb
+				    ("received backend request: OMX_CMD_XEN_SEND_MEDIUMSQ, param=%lx\n",
+				     sizeof(struct omx_cmd_send_mediumsq));
+
+				ret = resp->ret;
+				endpoint = omx_xenfront_get_endpoint(fe, resp);
+				if (!endpoint) {
+					printk_err
+					    ("Endpoint is null:S, ret = %d\n",
+					     ret);
+					break;
+				}
+
+				omx_xenfront_request_done(fe, endpoint, resp);
+				break;
+			}
+		case OMX_CMD_XEN_SEND_BATCH:{
+				struct omx_endpoint *endpoint;
+				int16_t ret = 0;
+				dprintk_deb
+				    ("received backend request: OMX_CMD_XEN_SEND_BATCH, param=%lx\n",
+				     sizeof(struct omx_cmd_xen_send_batch));
+
+				ret = resp->ret;
+				endpoint = omx_xenfront_get_endpoint(fe, resp);
+				if (!endpoint) {
+					printk_err
+					    ("Endpoint is null:S, ret = %d\n",
+					     ret);
+					break;
+				}
+
+				omx_xenfront_request_done(fe, endpoint, resp);
 				break;
 			}
 		case OMX_CMD_SEND_CONNECT_REQUEST:{
@@ -941,12 +1219,7 @@ again_send:
 				}
 				dump_xen_send_connect_request(&resp->
 							      data.send_connect_request);
-				if (!ret)
-					fe->requests[resp->request_id] =
-					    OMX_XEN_FRONTEND_STATUS_DONE;
-				else
-					fe->requests[resp->request_id] =
-					    OMX_XEN_FRONTEND_STATUS_FAILED;
+				omx_xenfront_request_done(fe, endpoint, resp);
 
 				break;
 			}
@@ -969,12 +1242,7 @@ again_send:
 				}
 				dump_xen_send_connect_reply(&resp->
 							    data.send_connect_reply);
-				if (!ret)
-					fe->requests[resp->request_id] =
-					    OMX_XEN_FRONTEND_STATUS_DONE;
-				else
-					fe->requests[resp->request_id] =
-					    OMX_XEN_FRONTEND_STATUS_FAILED;
+				omx_xenfront_request_done(fe, endpoint, resp);
 
 				break;
 			}
@@ -1031,6 +1299,20 @@ again_send:
 
 				break;
 			}
+		case OMX_CMD_XEN_FORGET_USER_SEGMENT:{
+				dprintk_deb
+				    ("received backend request: OMX_CMD_XEN_FORGET_USER_SEGMENT, param=%lx\n",
+				     sizeof(struct
+					    omx_ring_msg_forget_user_segment));
+
+				if (!resp->ret)
+					fe->requests[resp->request_id] =
+					    OMX_XEN_FRONTEND_STATUS_DONE;
+				else
+					fe->requests[resp->request_id] =
+					    OMX_XEN_FRONTEND_STATUS_FAILED;
+				break;
+			}
 		case OMX_CMD_XEN_GET_BOARD_COUNT:{
 				int16_t ret = 0;
 				dprintk_deb
@@ -1117,6 +1399,8 @@ again_send:
 			}
 		case OMX_CMD_GET_BOARD_INFO:{
 				//struct omx_endpoint *endpoint;
+				struct omx_cmd_xen_get_board_info *gbi =
+				    &omx_xenfront_slot_payload(queue, resp)->gbi;
 				int16_t ret = 0;
 				dprintk_deb
 				    ("received backend request: OMX_CMD_GET_BOARD_INFO, param=%lx\n",
@@ -1127,12 +1411,12 @@ again_send:
 				ret = resp->ret;
 
 				dprintk_deb("board_addr = %#llx\n",
-					    resp->data.gbi.info.addr);
-				memcpy(&fe->board_info, &resp->data.gbi.info,
+					    gbi->info.addr);
+				memcpy(&fe->board_info, &gbi->info,
 				       sizeof(struct omx_board_info));
 				dprintk_deb("board_addr = %llx\n",
 					    fe->board_info.addr);
-				dump_xen_get_board_info(&resp->data.gbi);
+				dump_xen_get_board_info(gbi);
 				if (!ret)
 					fe->requests[resp->request_id] =
 					    OMX_XEN_FRONTEND_STATUS_DONE;
@@ -1201,6 +1485,8 @@ again_send:
 			{
 				struct omx_endpoint *endpoint;
 				struct omx_user_region *region;
+				struct omx_ring_msg_create_user_region *cur =
+				    &omx_xenfront_slot_payload(queue, resp)->cur;
 				uint32_t eid, id;
 				uint32_t request_id;
 				int status;
@@ -1208,8 +1494,8 @@ again_send:
 				    ("received backend request: OMX_CMD_XEN_CREATE_USER_REGION, param=%lx\n",
 				     sizeof(struct
 					    omx_ring_msg_create_user_region));
-				id = resp->data.cur.id;
-				status = resp->data.cur.status;
+				id = cur->id;
+				status = cur->status;
 				request_id = resp->request_id;
 				endpoint = omx_xenfront_get_endpoint(fe, resp);
 				if (!endpoint) {
@@ -1226,8 +1512,7 @@ again_send:
 				     (unsigned long)endpoint,
 				     (unsigned long)region, region->status);
 				spin_unlock(&endpoint->user_regions_lock);
-				dump_xen_ring_msg_create_user_region
-				    (&resp->data.cur);
+				dump_xen_ring_msg_create_user_region(cur);
 				if (!region) {printk_err("CREATE_region is NULL!\n"); break;}
 				spin_lock(&region->status_lock);
 				if (status) {
@@ -1251,6 +1536,8 @@ again_send:
 			{
 				struct omx_endpoint *endpoint;
 				struct omx_user_region *region;
+				struct omx_ring_msg_destroy_user_region *dur =
+				    &omx_xenfront_slot_payload(queue, resp)->dur;
 				uint32_t eid, id;
 				uint32_t request_id;
 				uint8_t status;
@@ -1259,15 +1546,15 @@ again_send:
 				     sizeof(struct
 					    omx_ring_msg_destroy_user_region));
 				eid = resp->eid;
-				id = resp->data.dur.id;
-				status = resp->data.dur.status;
+				id = dur->id;
+				status = dur->status;
 				request_id = resp->request_id;
 				endpoint = omx_xenfront_get_endpoint(fe, resp);
 				if (!endpoint) {
 					printk_err("endpoint is NULL!!\n");
 					break;
 				}
-				region = (struct omx_user_region *) resp->data.dur.region;
+				region = (struct omx_user_region *) dur->region;
 
 				if (unlikely(!region)) {
 					printk(KERN_ERR "%s: %d\n", __func__,
@@ -1278,7 +1565,7 @@ again_send:
 				}
 				//dprintk_inf("region = %p\n", (void*) region);
 				//spin_unlock(&endpoint->user_regions_lock);
-				//dump_xen_ring_msg_destroy_user_region (&resp->data.dur);
+				//dump_xen_ring_msg_destroy_user_region(dur);
 				spin_lock(&region->status_lock);
 				if (region) {
 					if (!status) {
@@ -1309,8 +1596,8 @@ again_send:
 			printk_err("Unknown event came in, %d\n", resp->func);
 			dprintk_inf
 			    ("resp_consumed=%d, responses_produced= %d, requests_produced = %d\n",
-			     cons, fe->ring.sring->rsp_prod,
-			     fe->ring.sring->req_prod);
+			     cons, queue->ring.sring->rsp_prod,
+			     queue->ring.sring->req_prod);
 			break;
 		}
 	}
@@ -1323,12 +1610,12 @@ again_send:
 		goto again_recv;
 #endif
 
-	RING_FINAL_CHECK_FOR_RESPONSES(&fe->ring, more_to_do);
+	RING_FINAL_CHECK_FOR_RESPONSES(&queue->ring, more_to_do);
 	if (more_to_do)
 		goto again_send;
 
 #ifdef EXTRA_DEBUG_OMX
-	if (RING_HAS_UNCONSUMED_RESPONSES(&fe->ring))
+	if (RING_HAS_UNCONSUMED_RESPONSES(&queue->ring))
 		printk_err
 		    ("exiting, although we have unconsumed responses, are you SURE?\n");
 #endif
@@ -1381,9 +1668,12 @@ int omx_xen_ifaces_get_count(uint32_t * count)
 
 	dprintk_in();
 
-        ring_req = omx_ring_get_request(fe);
-        request_id = (fe->ring.req_prod_pvt - 1) % OMX_MAX_INFLIGHT_REQUESTS;
-        ring_req->request_id = request_id;
+        ring_req = omx_ring_get_request(&fe->queues[0]);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
+        request_id = ring_req->request_id;
 	ring_req->func = OMX_CMD_XEN_GET_BOARD_COUNT;
 	omx_poke_dom0(fe, ring_req);
 
@@ -1417,9 +1707,12 @@ int omx_xen_peer_table_get_state(struct omx_cmd_peer_table_state *state)
 
 	dprintk_in();
 
-        ring_req = omx_ring_get_request(fe);
-        request_id = (fe->ring.req_prod_pvt - 1) % OMX_MAX_INFLIGHT_REQUESTS;
-        ring_req->request_id = request_id;
+        ring_req = omx_ring_get_request(&fe->queues[0]);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
+        request_id = ring_req->request_id;
 	ring_req->func = OMX_CMD_XEN_PEER_TABLE_GET_STATE;
 	ring_req->board_index = 0;
 	omx_poke_dom0(fe, ring_req);
@@ -1452,9 +1745,12 @@ int omx_xen_peer_table_set_state(struct omx_cmd_peer_table_state *state)
 
 	dprintk_in();
 
-        ring_req = omx_ring_get_request(fe);
-        request_id = (fe->ring.req_prod_pvt - 1) % OMX_MAX_INFLIGHT_REQUESTS;
-        ring_req->request_id = request_id;
+        ring_req = omx_ring_get_request(&fe->queues[0]);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
+        request_id = ring_req->request_id;
 	ring_req->func = OMX_CMD_XEN_PEER_TABLE_SET_STATE;
 	ring_req->board_index = 0;
 	memcpy(&ring_req->data.pts.state, &fe->state, sizeof(*state));
@@ -1488,9 +1784,12 @@ int omx_xen_set_hostname(uint32_t board_index, const char *hostname)
 
 	dprintk_in();
 
-        ring_req = omx_ring_get_request(fe);
-        request_id = (fe->ring.req_prod_pvt - 1) % OMX_MAX_INFLIGHT_REQUESTS;
-        ring_req->request_id = request_id;
+        ring_req = omx_ring_get_request(&fe->queues[0]);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
+        request_id = ring_req->request_id;
 	ring_req->func = OMX_CMD_XEN_SET_HOSTNAME;
 	ring_req->board_index = board_index;
 	memcpy(ring_req->data.sh.hostname, hostname, OMX_HOSTNAMELEN_MAX);
@@ -1521,6 +1820,7 @@ int omx_ioctl_xen_get_board_info(struct omx_endpoint *endpoint,
 {
 	struct omx_cmd_get_board_info get_board_info;
 	struct omx_xenfront_info *fe;
+	struct omx_xenfront_queue *queue;
 	struct omx_xenif_request *ring_req;
 	int ret = 0;
 	uint32_t request_id;
@@ -1552,13 +1852,17 @@ int omx_ioctl_xen_get_board_info(struct omx_endpoint *endpoint,
 //      get_board_info.board_index = 0;
 	fe = endpoint->fe;
 
-        ring_req = omx_ring_get_request(fe);
-        request_id = (fe->ring.req_prod_pvt - 1) % OMX_MAX_INFLIGHT_REQUESTS;
-        ring_req->request_id = request_id;
+	queue = omx_xenfront_endpoint_queue(endpoint);
+        ring_req = omx_ring_get_request(queue);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
+        request_id = ring_req->request_id;
 	ring_req->func = OMX_CMD_GET_BOARD_INFO;
 	ring_req->board_index = endpoint->board_index;
 	ring_req->eid = endpoint->endpoint_index;
-	dump_xen_get_board_info(&ring_req->data.gbi);
+	dump_xen_get_board_info(&omx_xenfront_slot_payload(queue, ring_req)->gbi);
 	omx_poke_dom0(endpoint->fe, ring_req);
 	/* dprintk_deb("waiting to become %u\n", OMX_ENDPOINT_STATUS_FREE); */
 	if ((ret = wait_for_backend_response
@@ -1617,9 +1921,12 @@ omx_xen_endpoint_get_info(uint32_t board_index, uint32_t endpoint_index,
 	spin_lock(&endpoint->status_lock);
 	endpoint->info_status = OMX_ENDPOINT_STATUS_DOING;
 	spin_unlock(&endpoint->status_lock);
-        ring_req = omx_ring_get_request(fe);
-        request_id = (fe->ring.req_prod_pvt - 1) % OMX_MAX_INFLIGHT_REQUESTS;
-        ring_req->request_id = request_id;
+        ring_req = omx_ring_get_request(&fe->queues[0]);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
+        request_id = ring_req->request_id;
 	ring_req->func = OMX_CMD_GET_ENDPOINT_INFO;
 	ring_req->board_index = endpoint->board_index;
 	ring_req->eid = endpoint->endpoint_index;
@@ -1662,9 +1969,12 @@ omx_xen_peer_lookup(uint32_t * index,
 
 	dprintk_in();
 	BUG_ON(!fe);
-        ring_req = omx_ring_get_request(fe);
-        request_id = (fe->ring.req_prod_pvt - 1) % OMX_MAX_INFLIGHT_REQUESTS;
-        ring_req->request_id = request_id;
+        ring_req = omx_ring_get_request(&fe->queues[0]);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
+        request_id = ring_req->request_id;
 	ring_req->func = cmd;
 	if (cmd == OMX_CMD_PEER_FROM_INDEX) {
 		if (index)
@@ -32,24 +32,41 @@
 #include "omx_xen.h"
 
 #define OMX_MAX_INFLIGHT_REQUESTS 65536
+/* request ids are split among queues */
+#define OMX_XEN_QUEUE_INFLIGHT_REQUESTS \
+	(OMX_MAX_INFLIGHT_REQUESTS / OMX_XEN_QUEUES_MAX)
 #define OMX_XEN_MAX_GRANT_COUNT 16384
 
 enum frontend_status {
 	OMX_XEN_FRONTEND_STATUS_DONE,
 	OMX_XEN_FRONTEND_STATUS_DOING,
 	OMX_XEN_FRONTEND_STATUS_FAILED,
+	OMX_XEN_FRONTEND_STATUS_ASYNC,	/* nobody waits, failures become events */
 };
+/* a request ring, with its own event channel and lock */
+struct omx_xenfront_queue {
+	struct omx_xenfront_info *fe;
+	unsigned int id;
+	struct omx_xenif_front_ring ring;
+	int ring_ref;
+	void *ring_payload[OMX_XEN_RING_PAYLOAD_PAGES];
+	int ring_payload_ref[OMX_XEN_RING_PAYLOAD_PAGES];
+	spinlock_t lock;
+	struct evtchn_bind_interdomain evtchn;
+	unsigned int irq;
+	struct work_struct msg_workq_task;
+};
+
 struct omx_xenfront_info {
 	struct list_head list;
 	uint16_t handle;
 	struct xenbus_device *xbdev;
-	struct omx_xenif_front_ring ring;
+	struct omx_xenfront_queue queues[OMX_XEN_QUEUES_MAX];
+	unsigned int nr_queues;
 	struct omx_xenif_front_ring recv_ring;
 	grant_ref_t gref;
-	int ring_ref;
 	int recv_ring_ref;
-	struct evtchn_bind_interdomain evtchn;
-	unsigned int evtchn2, irq;
+	unsigned int evtchn2;
 	enum omx_xenif_state connected;
 	uint8_t is_ready;
 	spinlock_t lock;
@@ -70,6 +87,10 @@ struct omx_xenfront_info {
         struct list_head gref_cookies_inuse;
         rwlock_t gref_cookies_inuselock;
 
+	/* pages kept granted to the backend for mediumva payloads */
+	struct list_head pgrants_free;
+	spinlock_t pgrants_lock;
+	unsigned int nr_pgrants;
 
 	struct task_struct *task;
 	struct workqueue_struct *msg_workq;
@@ -111,6 +132,24 @@ int omx_ioctl_xen_user_region_destroy(struct omx_endpoint *endpoint,
 				      void __user * uparam);
 int omx_xen_user_region_release(struct omx_endpoint *endpoint,
 				uint32_t region_id);
+
+struct omx_xenfront_rcache_entry;
+void omx_xenfront_rcache_init(struct omx_endpoint *endpoint);
+void omx_xenfront_rcache_exit(struct omx_endpoint *endpoint);
+struct omx_xenfront_rcache_entry *omx_xenfront_rcache_get(struct omx_endpoint
+							  *endpoint,
+							  struct omx_user_region
+							  *region,
+							  const struct
+							  omx_cmd_user_segment
+							  *useg);
+void omx_xenfront_rcache_abort(struct omx_endpoint *endpoint,
+			       struct omx_xenfront_rcache_entry *entry,
+			       struct omx_user_region *region);
+int omx_xenfront_rcache_keep(struct omx_endpoint *endpoint,
+			     struct omx_user_region *region);
+int omx_xenfront_rcache_put(struct omx_endpoint *endpoint,
+			    struct omx_user_region *region);
 int omx_ioctl_xen_get_board_info(struct omx_endpoint *endpoint,
 				 void __user * uparam);
 
@@ -119,16 +158,36 @@ int omx_poke_dom0(struct omx_xenfront_info *fe, struct omx_xenif_request *ring_r
 int wait_for_backend_response(unsigned int *poll_var, unsigned int status,
 			      spinlock_t * spin);
 
+int omx_xenfront_submit_request(struct omx_xenfront_info *fe,
+				struct omx_xenif_request *ring_req,
+				const char *what);
+
 int omx_xen_endpoint_get_info(uint32_t board_index, uint32_t endpoint_index,
 			      struct omx_endpoint_info *info);
 
 int omx_xen_peer_lookup(uint32_t * index, uint64_t * board_addr, char *hostname,
 			uint32_t cmd);
 
-struct omx_xenif_request *omx_ring_get_request(struct omx_xenfront_info *fe);
+struct omx_xenif_request *omx_ring_get_request(struct omx_xenfront_queue *queue);
+struct omx_xenfront_queue *omx_xenfront_endpoint_queue(struct omx_endpoint
+						       *endpoint);
+
+/* payload of a ring slot of the queue */
+static inline union omx_xenif_payload *
+omx_xenfront_slot_payload(struct omx_xenfront_queue *queue, void *slot)
+{
+	return omx_xenif_slot_payload(queue->ring_payload, queue->ring.sring,
+				      slot);
+}
 
 extern struct omx_xenfront_info *__omx_xen_frontend;
 
+/* defined as module parameters */
+extern int omx_xen_async_send;
+extern int omx_xen_queues;
+extern int omx_xen_direct_recv;
+extern int omx_xen_rcache;
+
 void omx_xenif_interrupt(struct work_struct *work);
 void omx_xenif_interrupt_recv(struct work_struct *work);
 
@@ -147,7 +206,8 @@ extern timers_t t_poke_dom0;
 extern timers_t t_pull;
 extern timers_t t_send_tiny, t_send_small, t_send_mediumva,
     t_send_mediumsq_frag, t_send_connect_request, t_send_notify,
-    t_send_connect_reply, t_send_rndv, t_send_liback;
+    t_send_connect_reply, t_send_rndv, t_send_liback, t_send_batch,
+    t_send_mediumsq;
 extern timers_t t_recv_rndv, t_recv_medsmall, t_recv_tiny, t_recv_connect_request,
     t_recv_connect_reply, t_recv_liback, t_recv_notify, t_pull_request,
     t_pull_done, t_recv_mediumsq;
@@ -71,6 +71,8 @@ static void omx_xen_timers_reset(void)
 	omx_xen_timer_reset(&t_send_connect_reply);
 	omx_xen_timer_reset(&t_send_rndv);
 	omx_xen_timer_reset(&t_send_liback);
+	omx_xen_timer_reset(&t_send_batch);
+	omx_xen_timer_reset(&t_send_mediumsq);
 	omx_xen_timer_reset(&t_create_reg);
 	omx_xen_timer_reset(&t_wait_destroy_reg);
 	omx_xen_timer_reset(&t_wait_create_reg);
@@ -118,6 +120,8 @@ static void printk_timers(void)
 	printk_timer(&t_send_notify, var_name(t_send_notify));
 	printk_timer(&t_send_rndv, var_name(t_send_rndv));
 	printk_timer(&t_send_liback, var_name(t_send_liback));
+	printk_timer(&t_send_batch, var_name(t_send_batch));
+	printk_timer(&t_send_mediumsq, var_name(t_send_mediumsq));
 	printk_timer(&t_create_reg, var_name(t_create_reg));
 	printk_timer(&t_wait_create_reg, var_name(t_wait_create_reg));
 	printk_timer(&t_destroy_reg, var_name(t_destroy_reg));
@@ -159,6 +163,8 @@ int omx_xen_endpoint_grant_resources(struct omx_endpoint *endpoint)
 
 	dprintk_in();
 
+	endpoint->xen_shared = NULL;
+
 	egref_sendq_list =
 	    kmalloc(sendq_gref_size * sizeof(grant_ref_t), GFP_KERNEL);
 	if (!egref_sendq_list) {
@@ -188,9 +194,11 @@ int omx_xen_endpoint_grant_resources(struct omx_endpoint *endpoint)
 	endpoint->egref_sendq_offset = sendq_list_offset;
 	endpoint->egref_recvq_offset = recvq_list_offset;
 
-	/* FIXME: sendq, recvq + 2 for the pages that host the relevant lists, and one more for the endpoint ;-) */
+	/* FIXME: sendq, recvq + 2 for the pages that host the relevant lists, and one more for the endpoint ;-)
+	 * then the unexp eventq and the page that hosts its list */
 	ret =
-	    gnttab_alloc_grant_references(sendq_gref_size + recvq_gref_size + 3,
+	    gnttab_alloc_grant_references(sendq_gref_size + recvq_gref_size + 3
+					  + OMX_XEN_UNEXP_EVENTQ_PAGES + 1,
 					  &endpoint->gref_head);
 	if (ret) {
 		printk_err
@@ -266,6 +274,38 @@ int omx_xen_endpoint_grant_resources(struct omx_endpoint *endpoint)
 		egref_recvq_list[i] = gref;
 	}
 
+	/* Unexp eventq, so that the backend may deliver events without
+	 * going through the recv_ring */
+	if (omx_xen_direct_recv) {
+		struct omx_xen_endpoint_shared *shared;
+
+		shared = (void *)get_zeroed_page(GFP_KERNEL);
+		if (!shared) {
+			printk_err("failed to allocate the shared endpoint page\n");
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		for (i = 0; i < OMX_XEN_UNEXP_EVENTQ_PAGES; i++) {
+			struct page *page =
+			    vmalloc_to_page(endpoint->unexp_eventq +
+					    (i << PAGE_SHIFT));
+			grant_ref_t gref;
+
+			gref = gnttab_claim_grant_reference(&endpoint->gref_head);
+			gnttab_grant_foreign_access_ref(gref, 0,
+							pfn_to_mfn(page_to_pfn
+								   (page)), 0);
+			shared->unexp_eventq_gref[i] = gref;
+		}
+
+		endpoint->xen_shared_gref =
+		    gnttab_claim_grant_reference(&endpoint->gref_head);
+		gnttab_grant_foreign_access_ref(endpoint->xen_shared_gref, 0,
+						virt_to_mfn(shared), 0);
+		endpoint->xen_shared = shared;
+	}
+
 out:
 	dprintk_out();
 	return ret;
@@ -389,6 +429,35 @@ int omx_xen_endpoint_ungrant_resources(struct omx_endpoint *endpoint)
 	gnttab_release_grant_reference(&endpoint->gref_head,
 				       endpoint->endpoint_gref);
 
+	/* Release the unexp eventq and shared page grants */
+	if (endpoint->xen_shared) {
+		struct omx_xen_endpoint_shared *shared = endpoint->xen_shared;
+
+		for (i = 0; i < OMX_XEN_UNEXP_EVENTQ_PAGES; i++) {
+			if (gnttab_query_foreign_access
+			    (shared->unexp_eventq_gref[i]))
+				printk_inf
+				    ("unexp_eventq_gref[%d] = %u is still in use by the backend!\n",
+				     i, shared->unexp_eventq_gref[i]);
+			gnttab_end_foreign_access_ref(shared->unexp_eventq_gref
+						      [i], 0);
+			gnttab_release_grant_reference(&endpoint->gref_head,
+						       shared->
+						       unexp_eventq_gref[i]);
+		}
+
+		if (gnttab_query_foreign_access(endpoint->xen_shared_gref))
+			printk_inf
+			    ("shared_gref = %u is still in use by the backend!\n",
+			     endpoint->xen_shared_gref);
+		gnttab_end_foreign_access_ref(endpoint->xen_shared_gref, 0);
+		gnttab_release_grant_reference(&endpoint->gref_head,
+					       endpoint->xen_shared_gref);
+
+		endpoint->xen_shared = NULL;
+		free_page((unsigned long)shared);
+	}
+
 	gnttab_free_grant_references(endpoint->gref_head);
 
 	kfree(endpoint->egref_sendq_list);
@@ -439,6 +508,7 @@ omx_ioctl_xen_open_endpoint(struct omx_endpoint *endpoint, void __user * uparam)
 	ret = omx_xen_endpoint_alloc_resources(endpoint);
 	if (ret < 0)
 		goto out_with_init;
+	omx_xenfront_rcache_init(endpoint);
 
 	/* grant necessary stuff to the backend (recvq, sendq,
 	 * and the endpoint structure itself needed for internal
@@ -453,10 +523,12 @@ omx_ioctl_xen_open_endpoint(struct omx_endpoint *endpoint, void __user * uparam)
 	/* Prepare the message to the backend */
 
 	/* FIXME: maybe create a static inline function for this stuff ? */
-	ring_req = omx_ring_get_request(fe);
-	request_id = (fe->ring.req_prod_pvt - 1) % OMX_MAX_INFLIGHT_REQUESTS;
-	fe->requests[request_id] = OMX_XEN_FRONTEND_STATUS_DOING;
-	ring_req->request_id = request_id;
+	ring_req = omx_ring_get_request(omx_xenfront_endpoint_queue(endpoint));
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out_with_grant;
+	}
+	request_id = ring_req->request_id;
 
 	ring_req->func = OMX_CMD_XEN_OPEN_ENDPOINT;
 	ring_req->board_index = param.board_index;
@@ -473,6 +545,8 @@ omx_ioctl_xen_open_endpoint(struct omx_endpoint *endpoint, void __user * uparam)
 	ring_req->data.endpoint.recvq_gref_size = endpoint->recvq_gref_size;
 	ring_req->data.endpoint.endpoint_gref = endpoint->endpoint_gref;
 	ring_req->data.endpoint.endpoint_offset = endpoint->endpoint_offset;
+	ring_req->data.endpoint.shared_gref =
+	    endpoint->xen_shared ? endpoint->xen_shared_gref : 0;
 
 	fe->endpoints[param.endpoint_index] = endpoint;
 
@@ -507,6 +581,8 @@ omx_ioctl_xen_open_endpoint(struct omx_endpoint *endpoint, void __user * uparam)
 	ret = 0;
 	goto out;
 
+out_with_grant:
+	omx_xen_endpoint_ungrant_resources(endpoint);
 out_with_alloc:
 	omx_xen_endpoint_free_resources(endpoint);
 out_with_init:
@@ -528,6 +604,7 @@ void omx_xen_endpoint_free_resources(struct omx_endpoint *endpoint)
 	might_sleep();
 	dprintk_in();
 
+	omx_xenfront_rcache_exit(endpoint);
 	omx_endpoint_user_regions_exit(endpoint);
 
 	kfree(endpoint->recvq_pages);
@@ -600,10 +677,12 @@ omx_ioctl_xen_close_endpoint(struct omx_endpoint *endpoint,
 	/* Prepare the message to the backend */
 
 	/* FIXME: maybe create a static inline function for this stuff ? */
-	ring_req = omx_ring_get_request(fe);
-	request_id = (fe->ring.req_prod_pvt - 1) % OMX_MAX_INFLIGHT_REQUESTS;
-	fe->requests[request_id] = OMX_XEN_FRONTEND_STATUS_DOING;
-	ring_req->request_id = request_id;
+	ring_req = omx_ring_get_request(omx_xenfront_endpoint_queue(endpoint));
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
+	request_id = ring_req->request_id;
 	ring_req->func = OMX_CMD_XEN_CLOSE_ENDPOINT;
 	ring_req->board_index = param.board_index;
 	ring_req->eid = param.endpoint_index;
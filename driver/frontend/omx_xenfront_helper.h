@@ -37,7 +37,8 @@
 
 irqreturn_t omx_xenif_fe_int(int irq, void *data)
 {
-	struct omx_xenfront_info *fe = (struct omx_xenfront_info *)data;
+	struct omx_xenfront_queue *queue = (struct omx_xenfront_queue *)data;
+	struct omx_xenfront_info *fe = queue->fe;
 	unsigned long flags;
 
 
@@ -46,11 +47,12 @@ irqreturn_t omx_xenif_fe_int(int irq, void *data)
 	//spin_lock_irqsave(&fe->lock, flags);
 	//queue_work(fe->msg_workq, &fe->msg_workq_task);
 	/* dprintk_deb("ev_id %#lx omxbe=%#lx\n", (unsigned long)data, (unsigned long)fe); */
-	if (RING_HAS_UNCONSUMED_RESPONSES(&fe->recv_ring)) {
+	/* the receive ring is only signalled on the first queue's channel */
+	if (!queue->id && RING_HAS_UNCONSUMED_RESPONSES(&fe->recv_ring)) {
 		omx_xenif_interrupt_recv(&fe->msg_workq_task);
 	}
-	if (RING_HAS_UNCONSUMED_RESPONSES(&fe->ring)) {
-		omx_xenif_interrupt(&fe->msg_workq_task);
+	if (RING_HAS_UNCONSUMED_RESPONSES(&queue->ring)) {
+		omx_xenif_interrupt(&queue->msg_workq_task);
 	}
 
 	//spin_unlock_irqrestore(&fe->lock, flags);
@@ -70,33 +72,133 @@ static void omx_xenif_free(struct omx_xenfront_info *fe, int suspend)
 	return;
 }
 
-static int setup_ring(struct xenbus_device *dev, struct omx_xenfront_info *fe)
+/* allocate and grant the request ring of a queue, with its payload pages */
+static int omx_xenfront_setup_queue(struct xenbus_device *dev,
+				    struct omx_xenfront_info *fe,
+				    unsigned id)
 {
+	struct omx_xenfront_queue *queue = &fe->queues[id];
+	struct omx_xenif_sring *sring;
 	int err = 0;
+	int i;
 
 	dprintk_in();
-	// fe->ring_ref = 0;
 
-	fe->evtchn.remote_dom = 0;	/* DOM0_ID */
-	if ((err =
-	     HYPERVISOR_event_channel_op(EVTCHNOP_bind_interdomain,
-					 &fe->evtchn))) {
-		printk("failed to setup evtchn ! err = %d\n", err);
+	queue->fe = fe;
+	queue->id = id;
+	spin_lock_init(&queue->lock);
+	INIT_WORK(&queue->msg_workq_task, omx_xenif_interrupt);
+
+	sring =
+	    (struct omx_xenif_sring *)get_zeroed_page(GFP_NOIO | __GFP_HIGH);
+	if (!sring) {
+		xenbus_dev_fatal(dev, -ENOMEM, "allocating shared ring");
+		err = -ENOMEM;
 		goto out;
 	}
+	SHARED_RING_INIT(sring);
+	FRONT_RING_INIT(&queue->ring, sring, PAGE_SIZE);
 
-	err = bind_evtchn_to_irqhandler(fe->evtchn.local_port,
-					omx_xenif_fe_int, IRQF_SHARED,
-					"domU", fe);
-
+	err = xenbus_grant_ring(dev, virt_to_mfn(queue->ring.sring));
 	if (err < 0) {
-		dprintk_deb("failed to bind irqhandler! err = %d\n", err);
+		free_page((unsigned long)sring);
+		queue->ring.sring = NULL;
+		printk_err("Failed to grant ring of queue %u\n", id);
 		goto out;
 	}
-	fe->irq = err;
-	dprintk_deb
-	    ("ring-ref = %u, fe->recv_ring_ref = %u, irq = %u, port = %u\n",
-	     fe->ring_ref, fe->recv_ring_ref, fe->irq, fe->evtchn.remote_port);
+	queue->ring_ref = err;
+
+	/* per-slot payloads of the request ring */
+	for (i = 0; i < OMX_XEN_RING_PAYLOAD_PAGES; i++) {
+		queue->ring_payload[i] =
+		    (void *)get_zeroed_page(GFP_NOIO | __GFP_HIGH);
+		if (!queue->ring_payload[i]) {
+			xenbus_dev_fatal(dev, -ENOMEM,
+					 "allocating ring payload");
+			err = -ENOMEM;
+			goto out;
+		}
+
+		err = xenbus_grant_ring(dev,
+					virt_to_mfn(queue->ring_payload[i]));
+		if (err < 0) {
+			free_page((unsigned long)queue->ring_payload[i]);
+			queue->ring_payload[i] = NULL;
+			printk_err("Failed to grant ring payload %d\n", i);
+			goto out;
+		}
+		queue->ring_payload_ref[i] = err;
+	}
+	err = 0;
+
+out:
+	dprintk_out();
+	return err;
+}
+
+static void omx_xenfront_free_queue(struct omx_xenfront_queue *queue)
+{
+	int i;
+
+	dprintk_in();
+
+	if (queue->irq)
+		unbind_from_irqhandler(queue->irq, queue);
+	queue->irq = 0;
+
+	/* This frees the page as a side-effect */
+	if (queue->ring_ref)
+		gnttab_end_foreign_access(queue->ring_ref, 0,
+					  (unsigned long)queue->ring.sring);
+	queue->ring_ref = 0;
+
+	for (i = 0; i < OMX_XEN_RING_PAYLOAD_PAGES; i++) {
+		if (queue->ring_payload_ref[i])
+			gnttab_end_foreign_access(queue->ring_payload_ref[i], 0,
+						  (unsigned long)
+						  queue->ring_payload[i]);
+		queue->ring_payload_ref[i] = 0;
+	}
+
+	dprintk_out();
+}
+
+static int setup_ring(struct xenbus_device *dev, struct omx_xenfront_info *fe)
+{
+	struct omx_xenfront_queue *queue;
+	int err = 0;
+	int i;
+
+	dprintk_in();
+	// fe->ring_ref = 0;
+
+	for (i = 0; i < fe->nr_queues; i++) {
+		queue = &fe->queues[i];
+
+		queue->evtchn.remote_dom = 0;	/* DOM0_ID */
+		if ((err =
+		     HYPERVISOR_event_channel_op(EVTCHNOP_bind_interdomain,
+						 &queue->evtchn))) {
+			printk("failed to setup evtchn ! err = %d\n", err);
+			goto out;
+		}
+
+		err = bind_evtchn_to_irqhandler(queue->evtchn.local_port,
+						omx_xenif_fe_int, IRQF_SHARED,
+						"domU", queue);
+
+		if (err < 0) {
+			dprintk_deb("failed to bind irqhandler! err = %d\n",
+				    err);
+			goto out;
+		}
+		queue->irq = err;
+		dprintk_deb
+		    ("queue %d: ring-ref = %u, irq = %u, port = %u\n",
+		     i, queue->ring_ref, queue->irq,
+		     queue->evtchn.remote_port);
+	}
+	dprintk_deb("fe->recv_ring_ref = %u\n", fe->recv_ring_ref);
 	dprintk_out();
 	return 0;
 out:
@@ -136,11 +238,31 @@ static int talk_to_backend(struct xenbus_device *dev,
 {
 	const char *message = NULL;
 	struct xenbus_transaction xbt;
-	int err;
+	struct omx_xenfront_queue *queue;
+	unsigned int max_queues = 1;
+	char node[32], name[32];
+	int err, i, q;
 
 	dprintk_in();
 
 	dprintk_inf("nodename is %s\n", dev->nodename);
+
+	/* a backend that does not advertise queues drives a single ring */
+	if (xenbus_scanf(XBT_NIL, dev->nodename, "multi-queue-max-queues",
+			 "%u", &max_queues) != 1 || !max_queues)
+		max_queues = 1;
+	fe->nr_queues = omx_xen_queues > 0 ? omx_xen_queues
+					   : num_online_cpus();
+	fe->nr_queues = min_t(unsigned int, fe->nr_queues, max_queues);
+	fe->nr_queues = min_t(unsigned int, fe->nr_queues, OMX_XEN_QUEUES_MAX);
+	dprintk_inf("using %u request queues (backend max %u)\n",
+		    fe->nr_queues, max_queues);
+
+	for (q = 0; q < fe->nr_queues; q++) {
+		err = omx_xenfront_setup_queue(dev, fe, q);
+		if (err)
+			goto destroy_ring;
+	}
 again:
 	err = xenbus_transaction_start(&xbt);
 	if (err) {
@@ -157,18 +279,48 @@ again:
 	dprintk_deb("xenbus handle written: %u\n", fe->handle);
 #endif
 
-	xenbus_scanf(XBT_NIL, dev->nodename, "port", "%d",
-		     &fe->evtchn.remote_port);
-	if (!(fe->evtchn.remote_port)) {
-		printk_err("error, port = 0\n");
-		goto abort_transaction;
-	}
-
-	err = xenbus_printf(xbt, dev->nodename, "ring-ref", "%u", fe->ring_ref);
+	err = xenbus_printf(xbt, dev->nodename, "multi-queue-num-queues", "%u",
+			    fe->nr_queues);
 	if (err) {
-		message = "writing ring-ref";
+		message = "writing multi-queue-num-queues";
 		goto abort_transaction;
 	}
+	for (q = 0; q < fe->nr_queues; q++) {
+		queue = &fe->queues[q];
+
+		omx_xen_queue_node(node, sizeof(node), q, "port");
+		xenbus_scanf(XBT_NIL, dev->nodename, node, "%d",
+			     &queue->evtchn.remote_port);
+		if (!(queue->evtchn.remote_port)) {
+			printk_err("error, %s = 0\n", node);
+			goto abort_transaction;
+		}
+
+		omx_xen_queue_node(node, sizeof(node), q, "ring-ref");
+		err = xenbus_printf(xbt, dev->nodename, node, "%u",
+				    queue->ring_ref);
+		if (err) {
+			message = "writing ring-ref";
+			goto abort_transaction;
+		}
+		for (i = 0; i < OMX_XEN_RING_PAYLOAD_PAGES; i++) {
+			snprintf(name, sizeof(name), "ring-payload-ref-%d", i);
+			omx_xen_queue_node(node, sizeof(node), q, name);
+			err = xenbus_printf(xbt, dev->nodename, node, "%u",
+					    queue->ring_payload_ref[i]);
+			if (err) {
+				message = "writing ring-payload-ref";
+				goto abort_transaction;
+			}
+		}
+		omx_xen_queue_node(node, sizeof(node), q, "event-channel");
+		err = xenbus_printf(xbt, dev->nodename, node, "%u",
+				    queue->evtchn.local_port);
+		if (err) {
+			message = "writing event-channel";
+			goto abort_transaction;
+		}
+	}
 	err =
 	    xenbus_printf(xbt, dev->nodename, "recv-ring-ref", "%u",
 			  fe->recv_ring_ref);
@@ -176,12 +328,6 @@ again:
 		message = "writing recv-ring-ref";
 		goto abort_transaction;
 	}
-	err = xenbus_printf(xbt, dev->nodename,
-			    "event-channel", "%u", fe->evtchn.local_port);
-	if (err) {
-		message = "writing event-channel";
-		goto abort_transaction;
-	}
 #if 0
 	err = xenbus_printf(xbt, dev->nodename, "protocol", "%s",
 			    XEN_IO_PROTO_ABI_NATIVE);
@@ -333,6 +333,7 @@ omx_ioctl_wrapper_user_region_create(struct omx_endpoint *endpoint,
 	struct omx_user_region *region;
 	struct omx_user_region_segment *seg;
 	struct omx_cmd_user_segment *usegs;
+	struct omx_xenfront_rcache_entry *rcache_entry = NULL;
 	int ret, i;
 
 	dprintk_in();
@@ -392,15 +393,23 @@ omx_ioctl_wrapper_user_region_create(struct omx_endpoint *endpoint,
 	/* keep nr_segments exact so that we may call omx_user_region_destroy_segments safely */
 	region->nr_segments = 0;
 
+	/* single-segment regions may reuse a segment that is still granted */
+	if (endpoint->xen_rcache_enabled && cmd.nr_segments == 1
+	    && usegs[0].len)
+		rcache_entry = omx_xenfront_rcache_get(endpoint, region, &usegs[0]);
+
 	/* allocate all segments */
 	for (i = 0, seg = &region->segments[0]; i < cmd.nr_segments; i++) {
 		dprintk(REG, "create region looking at useg %d len %lld\n",
 			i, (unsigned long long)usegs[i].len);
 		if (!usegs[i].len)
 			continue;
-		ret = omx_wrapper_user_region_add_segment(&usegs[i], seg);
-		if (unlikely(ret < 0))
-			goto out_with_region;
+		/* a segment from the registration cache is ready */
+		if (!seg->gref_list) {
+			ret = omx_wrapper_user_region_add_segment(&usegs[i], seg);
+			if (unlikely(ret < 0))
+				goto out_with_region;
+		}
 
 		if (seg->vmalloced)
 			region->nr_vmalloc_segments++;
@@ -418,7 +427,11 @@ omx_ioctl_wrapper_user_region_create(struct omx_endpoint *endpoint,
 	region->status = OMX_USER_REGION_STATUS_NOT_PINNED;
 	region->total_registered_length = 0;
 
-	if (omx_pin_synchronous) {
+	if (region->segments[0].gref_list) {
+		/* pinned since it entered the registration cache */
+		region->status = OMX_USER_REGION_STATUS_PINNED;
+		region->total_registered_length = region->total_length;
+	} else if (omx_pin_synchronous) {
 		/* pin the region */
 		ret = omx_wrapper_user_region_immediate_full_pin(region);
 		if (ret < 0) {
@@ -449,6 +462,8 @@ omx_ioctl_wrapper_user_region_create(struct omx_endpoint *endpoint,
 	goto out;
 
 out_with_region:
+	if (rcache_entry)
+		omx_xenfront_rcache_abort(endpoint, rcache_entry, region);
 	omx_wrapper_user_region_destroy_segments(region);
 	kfree(region);
 out_with_usegs:
@@ -672,6 +687,497 @@ static void omx_gnttab_release_grant_reference(struct omx_xenfront_gref_cookie
 	TIMER_STOP(&t_release);
 }
 
+/*
+ * Registration cache: the library destroys and recreates regions on the
+ * same buffers all the time. Instead of ungranting and unpinning the
+ * segment of a destroyed single-segment region, keep it around so that
+ * registering the same pages again only costs a lookup. An mmu notifier
+ * on the endpoint mm drops the entries whose pages get unmapped.
+ */
+struct omx_xenfront_rcache_entry {
+	struct list_head node;
+	struct omx_user_region *region;	/* while in use */
+	unsigned invalid:1;
+	unsigned backend_mapped:1;	/* the backend keeps it mapped too */
+
+	unsigned long aligned_vaddr;
+	unsigned first_page_offset;
+	unsigned long length;
+	unsigned long nr_pages;
+	int vmalloced;
+	struct page **pages;
+
+	/* only set while the entry owns the grants (idle or dead) */
+	uint32_t *gref_head;
+	void *gref_cookie;
+	uint8_t nr_parts;
+	uint32_t all_gref[OMX_XEN_GRANT_PAGES_MAX];
+	uint32_t *gref_list;
+};
+
+static inline int
+omx_xenfront_rcache_overlaps(const struct omx_xenfront_rcache_entry *entry,
+			     unsigned long start, unsigned long end)
+{
+	return entry->aligned_vaddr < end
+	    && start < entry->aligned_vaddr + (entry->nr_pages << PAGE_SHIFT);
+}
+
+/* whether the segment of a destroyed region may go back to the cache */
+static inline int
+omx_xenfront_rcache_may_keep(const struct omx_xenfront_rcache_entry *entry,
+			     const struct omx_user_region *region)
+{
+	const struct omx_user_region_segment *seg = &region->segments[0];
+
+	return !entry->invalid && omx_xen_rcache
+	    && region->nr_segments == 1 && seg->gref_list
+	    && seg->pinned_pages == seg->nr_pages;
+}
+
+/*
+ * Have the backend unmap a segment it kept mapped for us, it must be done
+ * before ending foreign access. If the message cannot be sent, the grants
+ * look still in use and get leaked, as region destroy does.
+ */
+static void omx_xenfront_rcache_forget(struct omx_endpoint *endpoint,
+				       uint32_t gref)
+{
+	struct omx_xenfront_info *fe = endpoint->fe;
+	struct omx_xenif_request *ring_req;
+	uint32_t request_id;
+
+	dprintk_in();
+
+	ring_req = omx_ring_get_request(omx_xenfront_endpoint_queue(endpoint));
+	if (unlikely(!ring_req))
+		goto out;
+	request_id = ring_req->request_id;
+	ring_req->func = OMX_CMD_XEN_FORGET_USER_SEGMENT;
+	ring_req->board_index = endpoint->board_index;
+	ring_req->eid = endpoint->endpoint_index;
+	ring_req->data.forget_segment.gref = gref;
+	omx_poke_dom0(fe, ring_req);
+
+	if (wait_for_backend_response
+	    (&fe->requests[request_id], OMX_XEN_FRONTEND_STATUS_DOING,
+	     NULL) < 0
+	    || fe->requests[request_id] != OMX_XEN_FRONTEND_STATUS_DONE)
+		printk_err("Backend failed to forget segment gref %u\n", gref);
+
+out:
+	dprintk_out();
+}
+
+/* the entry takes the pinned pages and the grants of the segment */
+static void
+omx_xenfront_rcache_take_segment(struct omx_xenfront_rcache_entry *entry,
+				 struct omx_user_region_segment *seg)
+{
+	entry->vmalloced = seg->vmalloced;
+	entry->pages = seg->pages;
+	entry->gref_head = seg->gref_head;
+	entry->gref_cookie = seg->gref_cookie;
+	entry->nr_parts = seg->nr_parts;
+	memcpy(entry->all_gref, seg->all_gref, sizeof(entry->all_gref));
+	entry->gref_list = seg->gref_list;
+
+	/* so that destroying the region neither unpins nor frees them */
+	seg->pages = NULL;
+	seg->pinned_pages = 0;
+	seg->gref_cookie = NULL;
+	seg->gref_list = NULL;
+}
+
+/* the segment takes the pinned pages and the grants of the entry */
+static void
+omx_xenfront_rcache_give_segment(struct omx_xenfront_rcache_entry *entry,
+				 struct omx_user_region_segment *seg)
+{
+	seg->aligned_vaddr = entry->aligned_vaddr;
+	seg->first_page_offset = entry->first_page_offset;
+	seg->length = entry->length;
+	seg->nr_pages = entry->nr_pages;
+	seg->vmalloced = entry->vmalloced;
+	seg->pages = entry->pages;
+	seg->pinned_pages = entry->nr_pages;
+	seg->gref_head = entry->gref_head;
+	seg->gref_cookie = entry->gref_cookie;
+	seg->nr_parts = entry->nr_parts;
+	memcpy(seg->all_gref, entry->all_gref, sizeof(seg->all_gref));
+	seg->gref_list = entry->gref_list;
+	spin_lock_init(&seg->status_lock);
+
+	entry->pages = NULL;
+	entry->gref_cookie = NULL;
+	entry->gref_list = NULL;
+}
+
+/* ungrant, unpin and free an entry, may sleep */
+static void
+omx_xenfront_rcache_release_entry(struct omx_endpoint *endpoint,
+				  struct omx_xenfront_rcache_entry *entry)
+{
+	struct omx_xenfront_gref_cookie *cookie = entry->gref_cookie;
+	unsigned long j;
+	int k;
+
+	dprintk_in();
+
+	if (!entry->gref_list)
+		goto out;
+
+	dprintk_deb("rcache releasing %#lx, %lu pages\n",
+		    entry->aligned_vaddr, entry->nr_pages);
+
+	if (entry->backend_mapped)
+		omx_xenfront_rcache_forget(endpoint, entry->all_gref[0]);
+
+	for (j = 0; j < entry->nr_pages; j++) {
+		if (gnttab_query_foreign_access(entry->gref_list[j])) {
+			/* leak it, as region destroy does */
+			cookie->count--;
+			continue;
+		}
+		if (!gnttab_end_foreign_access_ref(entry->gref_list[j], 0))
+			continue;
+		omx_gnttab_release_grant_reference(cookie, entry->gref_list[j]);
+	}
+
+	for (k = 0; k < entry->nr_parts; k++) {
+		if (gnttab_query_foreign_access(entry->all_gref[k])) {
+			cookie->count--;
+			continue;
+		}
+		gnttab_end_foreign_access_ref(entry->all_gref[k], 0);
+		omx_gnttab_release_grant_reference(cookie, entry->all_gref[k]);
+	}
+	omx_xen_gnttab_free_grant_references(endpoint->fe, &entry->gref_cookie);
+	free_pages((unsigned long)entry->gref_list,
+		   get_order(entry->nr_parts * PAGE_SIZE));
+
+	for (j = 0; j < entry->nr_pages; j++)
+		put_page(entry->pages[j]);
+	if (entry->vmalloced)
+		vfree(entry->pages);
+	else
+		kfree(entry->pages);
+
+out:
+	kfree(entry);
+	dprintk_out();
+}
+
+/* release the entries moved to the dead list, from process context */
+static void omx_xenfront_rcache_reap(struct omx_endpoint *endpoint)
+{
+	struct omx_xenfront_rcache_entry *entry, *next;
+	LIST_HEAD(dead);
+
+	spin_lock(&endpoint->xen_rcache_lock);
+	list_splice_init(&endpoint->xen_rcache_dead_list, &dead);
+	spin_unlock(&endpoint->xen_rcache_lock);
+
+	list_for_each_entry_safe(entry, next, &dead, node)
+		omx_xenfront_rcache_release_entry(endpoint, entry);
+}
+
+#ifdef CONFIG_MMU_NOTIFIER
+/*
+ * Idle entries covering the range are dropped (but only released on the
+ * next region create/destroy since we may not sleep here), entries in use
+ * are marked so that they do not come back to the cache.
+ */
+static void
+omx_xenfront_rcache_invalidate(struct omx_endpoint *endpoint,
+			       unsigned long start, unsigned long end)
+{
+	struct omx_xenfront_rcache_entry *entry, *next;
+
+	dprintk_in();
+	spin_lock(&endpoint->xen_rcache_lock);
+	list_for_each_entry_safe(entry, next, &endpoint->xen_rcache_list, node) {
+		if (!omx_xenfront_rcache_overlaps(entry, start, end))
+			continue;
+		dprintk_deb("rcache invalidating %#lx within %#lx-%#lx\n",
+			    entry->aligned_vaddr, start, end);
+		list_move_tail(&entry->node, &endpoint->xen_rcache_dead_list);
+		endpoint->xen_rcache_nr--;
+	}
+	list_for_each_entry(entry, &endpoint->xen_rcache_inuse_list, node)
+		if (omx_xenfront_rcache_overlaps(entry, start, end))
+			entry->invalid = 1;
+	spin_unlock(&endpoint->xen_rcache_lock);
+	dprintk_out();
+}
+
+static void
+omx_xenfront_rcache_mmu_invalidate_range_start(struct mmu_notifier *mn,
+					       struct mm_struct *mm,
+					       unsigned long start,
+					       unsigned long end)
+{
+	struct omx_endpoint *endpoint =
+	    container_of(mn, struct omx_endpoint, xen_rcache_mmu_notifier);
+
+	omx_xenfront_rcache_invalidate(endpoint, start, end);
+}
+
+static void
+omx_xenfront_rcache_mmu_invalidate_page(struct mmu_notifier *mn,
+					struct mm_struct *mm,
+					unsigned long address)
+{
+	struct omx_endpoint *endpoint =
+	    container_of(mn, struct omx_endpoint, xen_rcache_mmu_notifier);
+
+	omx_xenfront_rcache_invalidate(endpoint, address & PAGE_MASK,
+				       (address & PAGE_MASK) + PAGE_SIZE);
+}
+
+static void
+omx_xenfront_rcache_mmu_release(struct mmu_notifier *mn, struct mm_struct *mm)
+{
+	struct omx_endpoint *endpoint =
+	    container_of(mn, struct omx_endpoint, xen_rcache_mmu_notifier);
+
+	omx_xenfront_rcache_invalidate(endpoint, 0, ~0UL);
+}
+
+static const struct mmu_notifier_ops omx_xenfront_rcache_mmu_ops = {
+	.invalidate_page = omx_xenfront_rcache_mmu_invalidate_page,
+	.invalidate_range_start = omx_xenfront_rcache_mmu_invalidate_range_start,
+	.release = omx_xenfront_rcache_mmu_release,
+};
+#endif /* CONFIG_MMU_NOTIFIER */
+
+void omx_xenfront_rcache_init(struct omx_endpoint *endpoint)
+{
+	dprintk_in();
+	spin_lock_init(&endpoint->xen_rcache_lock);
+	INIT_LIST_HEAD(&endpoint->xen_rcache_list);
+	INIT_LIST_HEAD(&endpoint->xen_rcache_inuse_list);
+	INIT_LIST_HEAD(&endpoint->xen_rcache_dead_list);
+	endpoint->xen_rcache_nr = 0;
+	endpoint->xen_rcache_enabled = 0;
+
+#ifdef CONFIG_MMU_NOTIFIER
+	/* cached pages stay pinned, so we must hear about their unmapping,
+	 * and with demand-pinning there is nothing worth caching */
+	if (omx_xen_rcache && omx_pin_synchronous) {
+		endpoint->xen_rcache_mmu_notifier.ops =
+		    &omx_xenfront_rcache_mmu_ops;
+		if (!mmu_notifier_register(&endpoint->xen_rcache_mmu_notifier,
+					   endpoint->opener_mm))
+			endpoint->xen_rcache_enabled = 1;
+	}
+#endif
+	dprintk_out();
+}
+
+void omx_xenfront_rcache_exit(struct omx_endpoint *endpoint)
+{
+	struct omx_xenfront_rcache_entry *entry, *next;
+
+	dprintk_in();
+	if (!endpoint->xen_rcache_enabled)
+		goto out;
+
+#ifdef CONFIG_MMU_NOTIFIER
+	mmu_notifier_unregister(&endpoint->xen_rcache_mmu_notifier,
+				endpoint->opener_mm);
+#endif
+
+	spin_lock(&endpoint->xen_rcache_lock);
+	list_splice_init(&endpoint->xen_rcache_list,
+			 &endpoint->xen_rcache_dead_list);
+	endpoint->xen_rcache_nr = 0;
+	/* entries in use do not own anything, their region does */
+	list_for_each_entry_safe(entry, next, &endpoint->xen_rcache_inuse_list,
+				 node) {
+		list_del(&entry->node);
+		kfree(entry);
+	}
+	endpoint->xen_rcache_enabled = 0;
+	spin_unlock(&endpoint->xen_rcache_lock);
+
+	omx_xenfront_rcache_reap(endpoint);
+out:
+	dprintk_out();
+}
+
+/*
+ * Called when creating a single-segment region, before pinning. Returns the
+ * entry tracking the region (NULL if out of memory). On a cache hit, the
+ * first segment of the region is filled with the still pinned and granted
+ * pages, and its gref_list is set.
+ */
+struct omx_xenfront_rcache_entry *omx_xenfront_rcache_get(struct omx_endpoint
+							  *endpoint,
+							  struct omx_user_region
+							  *region,
+							  const struct
+							  omx_cmd_user_segment
+							  *useg)
+{
+	struct omx_xenfront_rcache_entry *entry, *new;
+	unsigned long aligned_vaddr = useg->vaddr & PAGE_MASK;
+	unsigned first_page_offset = useg->vaddr & ~PAGE_MASK;
+
+	dprintk_in();
+
+	omx_xenfront_rcache_reap(endpoint);
+
+	/* allocate the tracker now in case we miss, we cannot under the lock */
+	new = kzalloc(sizeof(*new), GFP_KERNEL);
+
+	spin_lock(&endpoint->xen_rcache_lock);
+	list_for_each_entry(entry, &endpoint->xen_rcache_list, node) {
+		if (entry->aligned_vaddr == aligned_vaddr
+		    && entry->first_page_offset == first_page_offset
+		    && entry->length == useg->len) {
+			list_move_tail(&entry->node,
+				       &endpoint->xen_rcache_inuse_list);
+			endpoint->xen_rcache_nr--;
+			entry->region = region;
+			omx_xenfront_rcache_give_segment(entry,
+							 &region->segments[0]);
+			spin_unlock(&endpoint->xen_rcache_lock);
+			dprintk_deb("rcache hit %#lx, %lu pages\n",
+				    aligned_vaddr, entry->nr_pages);
+			kfree(new);
+			goto out;
+		}
+	}
+
+	entry = new;
+	if (entry) {
+		entry->region = region;
+		entry->aligned_vaddr = aligned_vaddr;
+		entry->first_page_offset = first_page_offset;
+		entry->length = useg->len;
+		entry->nr_pages =
+		    PAGE_ALIGN(first_page_offset + useg->len) >> PAGE_SHIFT;
+		list_add_tail(&entry->node, &endpoint->xen_rcache_inuse_list);
+	}
+	spin_unlock(&endpoint->xen_rcache_lock);
+
+out:
+	dprintk_out();
+	return entry;
+}
+
+/* region creation failed after omx_xenfront_rcache_get() */
+void omx_xenfront_rcache_abort(struct omx_endpoint *endpoint,
+			       struct omx_xenfront_rcache_entry *entry,
+			       struct omx_user_region *region)
+{
+	dprintk_in();
+	spin_lock(&endpoint->xen_rcache_lock);
+	list_del(&entry->node);
+	if (region->segments[0].gref_list) {
+		/* a hit, ungrant it since the region cannot */
+		omx_xenfront_rcache_take_segment(entry, &region->segments[0]);
+		list_add_tail(&entry->node, &endpoint->xen_rcache_dead_list);
+		entry = NULL;
+	}
+	spin_unlock(&endpoint->xen_rcache_lock);
+
+	kfree(entry);
+	omx_xenfront_rcache_reap(endpoint);
+	dprintk_out();
+}
+
+/*
+ * Called before destroying a region. Returns 1 if its segment should go
+ * back to the cache, so that the backend keeps it mapped as well and a
+ * later hit does not map it again.
+ */
+int omx_xenfront_rcache_keep(struct omx_endpoint *endpoint,
+			     struct omx_user_region *region)
+{
+	struct omx_xenfront_rcache_entry *entry;
+	int keep = 0;
+
+	dprintk_in();
+	if (!endpoint->xen_rcache_enabled)
+		goto out;
+
+	spin_lock(&endpoint->xen_rcache_lock);
+	list_for_each_entry(entry, &endpoint->xen_rcache_inuse_list, node) {
+		if (entry->region == region) {
+			keep = omx_xenfront_rcache_may_keep(entry, region);
+			entry->backend_mapped = keep;
+			break;
+		}
+	}
+	spin_unlock(&endpoint->xen_rcache_lock);
+
+out:
+	dprintk_out();
+	return keep;
+}
+
+/*
+ * Called when the backend released a region. Returns 1 if its segment went
+ * back to the cache, still pinned and granted, 0 if the caller must ungrant
+ * it as usual.
+ */
+int omx_xenfront_rcache_put(struct omx_endpoint *endpoint,
+			    struct omx_user_region *region)
+{
+	struct omx_xenfront_rcache_entry *entry, *found = NULL;
+	struct omx_user_region_segment *seg = &region->segments[0];
+	int ret = 0;
+
+	dprintk_in();
+	if (!endpoint->xen_rcache_enabled)
+		goto out;
+
+	spin_lock(&endpoint->xen_rcache_lock);
+	list_for_each_entry(entry, &endpoint->xen_rcache_inuse_list, node) {
+		if (entry->region == region) {
+			found = entry;
+			break;
+		}
+	}
+	if (!found) {
+		spin_unlock(&endpoint->xen_rcache_lock);
+		goto out;
+	}
+
+	list_del(&found->node);
+	if (!omx_xenfront_rcache_may_keep(found, region)) {
+		spin_unlock(&endpoint->xen_rcache_lock);
+		/* invalidated meanwhile, the backend kept it mapped for nothing */
+		if (found->backend_mapped)
+			omx_xenfront_rcache_forget(endpoint, seg->all_gref[0]);
+		kfree(found);
+		goto out;
+	}
+
+	found->region = NULL;
+	omx_xenfront_rcache_take_segment(found, seg);
+	list_add_tail(&found->node, &endpoint->xen_rcache_list);
+	endpoint->xen_rcache_nr++;
+
+	/* evict the least recently used ones */
+	while (endpoint->xen_rcache_nr > omx_xen_rcache) {
+		entry = list_first_entry(&endpoint->xen_rcache_list,
+					 struct omx_xenfront_rcache_entry, node);
+		list_move_tail(&entry->node, &endpoint->xen_rcache_dead_list);
+		endpoint->xen_rcache_nr--;
+	}
+	spin_unlock(&endpoint->xen_rcache_lock);
+
+	omx_xenfront_rcache_reap(endpoint);
+	ret = 1;
+
+out:
+	dprintk_out();
+	return ret;
+}
+
 /* This is where Xen2MX specific functions begin */
 int
 omx_ioctl_xen_user_region_create(struct omx_endpoint *endpoint,
@@ -683,7 +1189,9 @@ omx_ioctl_xen_user_region_create(struct omx_endpoint *endpoint,
 	struct omx_user_region_segment *seg;
 	struct omx_xenfront_info *fe;
 	struct xenbus_device *dev;
+	struct omx_xenfront_queue *queue;
 	struct omx_xenif_request *ring_req;
+	struct omx_ring_msg_create_user_region *cur;
 	struct omx_ring_msg_register_user_segment *ring_seg;
 	uint32_t request_id;
 
@@ -724,19 +1232,24 @@ omx_ioctl_xen_user_region_create(struct omx_endpoint *endpoint,
 	spin_unlock(&endpoint->user_regions_lock);
 
 	/* Prepare the message to the backend */
-	ring_req = omx_ring_get_request(fe);
-	request_id = (fe->ring.req_prod_pvt - 1) % OMX_MAX_INFLIGHT_REQUESTS;
+	queue = omx_xenfront_endpoint_queue(endpoint);
+	ring_req = omx_ring_get_request(queue);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
+	request_id = ring_req->request_id;
 	fe->requests[request_id] = OMX_USER_REGION_STATUS_REGISTERING;
 #ifdef OMX_XEN_FE_SHORTCUT
 	endpoint->special_status_reg = OMX_USER_REGION_STATUS_REGISTERING;
 #endif
-	ring_req->request_id = request_id;
 	ring_req->func = OMX_CMD_XEN_CREATE_USER_REGION;
+	cur = &omx_xenfront_slot_payload(queue, ring_req)->cur;
 	/* Ultra safe */
-	//memset(&ring_req->data.cur, 0, sizeof(ring_req->data.cur));
-	ring_req->data.cur.nr_segments = cmd.nr_segments;
-	ring_req->data.cur.id = cmd.id;
-	ring_req->data.cur.eid = endpoint->endpoint_index;
+	//memset(cur, 0, sizeof(*cur));
+	cur->nr_segments = cmd.nr_segments;
+	cur->id = cmd.id;
+	cur->eid = endpoint->endpoint_index;
 
 	/* Handle each segment separately */
 	for (i = 0, seg = &region->segments[0]; i < cmd.nr_segments; i++) {
@@ -756,6 +1269,12 @@ omx_ioctl_xen_user_region_create(struct omx_endpoint *endpoint,
 			goto out;
 		}
 
+		/* a segment from the registration cache is still granted */
+		if (seg->gref_list) {
+			gref_offset = (unsigned long)seg->gref_list & ~PAGE_MASK;
+			goto segment_granted;
+		}
+
 		gref_size = (seg->nr_pages);
 		/* Use a proper way to calculate the nr_parts we need */
 		nr_parts =
@@ -876,13 +1395,14 @@ omx_ioctl_xen_user_region_create(struct omx_endpoint *endpoint,
 		}
 		/* FIXME: Do we need a barrier here ? */
 		wmb();
+segment_granted:
 		/* Prepare the message to the backend for segment registration */
 		spin_lock(&seg->status_lock);
 		seg->status = OMX_USER_SEGMENT_STATUS_GRANTING;
 		spin_unlock(&seg->status_lock);
 
 		//memset(&ring_req->data.cus, 0, sizeof(ring_req->data.cus));
-		ring_seg = &ring_req->data.cur.segs[i];
+		ring_seg = &cur->segs[i];
 
 		ring_seg->sid = i;
 		ring_seg->rid = cmd.id;
@@ -906,7 +1426,7 @@ omx_ioctl_xen_user_region_create(struct omx_endpoint *endpoint,
 		seg++;
 	}
 
-	//dump_xen_ring_msg_create_user_region(&ring_req->data.cur);
+	//dump_xen_ring_msg_create_user_region(cur);
 	omx_poke_dom0(fe, ring_req);
 	rmb();
 	//ndelay(1000);
@@ -1148,6 +1668,10 @@ void __omx_xen_user_region_last_release(struct omx_user_region *region)
 	struct omx_ring_msg_deregister_user_segment *ring_seg;
 	dprintk_in();
 
+	/* the registration cache may keep the segment granted */
+	if (omx_xenfront_rcache_put(endpoint, region))
+		goto out_from_backend;
+
 	//TIMER_START(&t_destroy_reg);
 	//dprintk_inf("%s: region = %p\n", __func__, (void*) region);
 	/* Loop around segments to release grant references */
@@ -1312,9 +1836,12 @@ omx_ioctl_xen_user_region_destroy(struct omx_endpoint *endpoint,
 	struct omx_user_region *region;
 	struct omx_user_region_segment *seg;
 	struct omx_xenfront_info *fe = endpoint->fe;
+	struct omx_xenfront_queue *queue;
 	struct omx_xenif_request *ring_req;
+	struct omx_ring_msg_destroy_user_region *dur;
 	struct omx_ring_msg_deregister_user_segment *ring_seg;
 	uint32_t request_id;
+	int keep;
 	dprintk_in();
 
 	TIMER_START(&t_destroy_reg);
@@ -1343,36 +1870,45 @@ omx_ioctl_xen_user_region_destroy(struct omx_endpoint *endpoint,
 
 	//dprintk_inf("%s: region = %p\n", __func__, (void*) region);
 
+	/* a segment going back to the registration cache stays mapped in the backend */
+	keep = omx_xenfront_rcache_keep(endpoint, region);
+
 	/* Prepare the message to the backend */
 	/* FIXME: maybe create a static inline function for this stuff ? */
-	ring_req = omx_ring_get_request(fe);
-	request_id = (fe->ring.req_prod_pvt - 1) % OMX_MAX_INFLIGHT_REQUESTS;
+	queue = omx_xenfront_endpoint_queue(endpoint);
+	ring_req = omx_ring_get_request(queue);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
+	request_id = ring_req->request_id;
 	fe->requests[request_id] = OMX_USER_REGION_STATUS_DEREGISTERING;
 #ifdef OMX_XEN_FE_SHORTCUT
 	endpoint->special_status_dereg = OMX_USER_REGION_STATUS_DEREGISTERING;
 #endif
-	ring_req->request_id = request_id;
 	ring_req->func = OMX_CMD_XEN_DESTROY_USER_REGION;
+	dur = &omx_xenfront_slot_payload(queue, ring_req)->dur;
 	/* Ultra safe */
-	//memset(&ring_req->data.dur, 0, sizeof(ring_req->data.dur));
-	ring_req->data.dur.eid = endpoint->endpoint_index;
-	ring_req->data.dur.id = region->id;
-	ring_req->data.dur.nr_segments = region->nr_segments;
-	ring_req->data.dur.region = (uint64_t) region;
+	//memset(dur, 0, sizeof(*dur));
+	dur->eid = endpoint->endpoint_index;
+	dur->id = region->id;
+	dur->nr_segments = region->nr_segments;
+	dur->region = (uint64_t) region;
 	/* Loop around segments to release grant references */
 	for (i = 0, seg = &region->segments[0]; i < region->nr_segments; i++) {
 
 		if (!seg->length)
 			continue;
-		ring_seg = &ring_req->data.dur.segs[i];
+		ring_seg = &dur->segs[i];
 		//memset(&ring_req->data.dus, 0, sizeof(ring_req->data.dus));
 		ring_seg->sid = i;
 		ring_seg->rid = cmd.id;
 		ring_seg->eid = endpoint->endpoint_index;
+		ring_seg->keep_mapped = keep;
 	}
 
 	dprintk_deb("send request to de-register region id=%d\n", cmd.id);
-	//dump_xen_ring_msg_destroy_user_region(&ring_req->data.dur);
+	//dump_xen_ring_msg_destroy_user_region(dur);
 
 	omx_poke_dom0(fe, ring_req);
 
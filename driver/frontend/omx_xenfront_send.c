@@ -40,7 +40,6 @@
 #include "omx_reg.h"
 #include "omx_endpoint.h"
 
-//#define OMX_XEN_NOWAIT
 //#define EXTRA_DEBUG_OMX
 #include "omx_xen_debug.h"
 #include "omx_xen.h"
@@ -54,7 +53,7 @@ timers_t t_pull;
 
 timers_t t_send_tiny, t_send_small, t_send_mediumva, t_send_mediumsq_frag,
     t_send_connect_request, t_send_notify, t_send_connect_reply, t_send_rndv,
-    t_send_liback;
+    t_send_liback, t_send_batch, t_send_mediumsq;
 
 /* In this set of functions, we copy user data directly to the ring structure.
  * FIXME: There's a lot of testing to be done, to make sure that there are no
@@ -72,9 +71,13 @@ int omx_ioctl_xen_send_tiny(struct omx_endpoint *endpoint, void __user * uparam)
 	dprintk_in();
 
 	TIMER_START(&t_send_tiny);
-	ring_req = omx_ring_get_request(fe);
-	request_id = (fe->ring.req_prod_pvt - 1) % OMX_MAX_INFLIGHT_REQUESTS;
-	ring_req->request_id = request_id;
+	ring_req = omx_ring_get_request(omx_xenfront_endpoint_queue(endpoint));
+	if (unlikely(!ring_req)) {
+		/* the library resends later, as for any resource shortage */
+		ret = -ENOMEM;
+		goto out;
+	}
+	request_id = ring_req->request_id;
 	ring_req->func = OMX_CMD_SEND_TINY;
 	cmd = &ring_req->data.send_tiny;
 	ring_req->board_index = endpoint->board_index;
@@ -115,26 +118,181 @@ int omx_ioctl_xen_send_tiny(struct omx_endpoint *endpoint, void __user * uparam)
 	}
 	//dump_xen_send_tiny(cmd);
 	TIMER_START(&endpoint->oneway);
-	omx_poke_dom0(endpoint->fe, ring_req);
-#ifndef OMX_XEN_NOWAIT
+	ret = omx_xenfront_submit_request(fe, ring_req, "send tiny");
+
+out:
+	TIMER_STOP(&t_send_tiny);
+	dprintk_out();
+	return ret;
+}
+
+void omx_xenfront_pgrants_init(struct omx_xenfront_info *fe)
+{
+	INIT_LIST_HEAD(&fe->pgrants_free);
+	spin_lock_init(&fe->pgrants_lock);
+	fe->nr_pgrants = 0;
+}
+
+void omx_xenfront_pgrants_free(struct omx_xenfront_info *fe)
+{
+	struct omx_xenfront_pgrant *pgrant, *next;
+
+	dprintk_in();
+	list_for_each_entry_safe(pgrant, next, &fe->pgrants_free, list) {
+		list_del(&pgrant->list);
+		/* This frees the page as a side-effect */
+		gnttab_end_foreign_access(pgrant->gref, 0,
+					  (unsigned long)
+					  page_address(pgrant->page));
+		kfree(pgrant);
+		fe->nr_pgrants--;
+	}
+	if (fe->nr_pgrants)
+		printk_err("%u persistent grants still in use\n",
+			   fe->nr_pgrants);
+	dprintk_out();
+}
+
+/* get a granted page from the pool, growing it up to its limit */
+static struct omx_xenfront_pgrant *omx_xenfront_pgrant_get(struct
+							  omx_xenfront_info
+							  *fe)
+{
+	struct omx_xenfront_pgrant *pgrant;
+	unsigned long flags;
+	int ret;
+
+	spin_lock_irqsave(&fe->pgrants_lock, flags);
+	if (!list_empty(&fe->pgrants_free)) {
+		pgrant = list_first_entry(&fe->pgrants_free,
+					  struct omx_xenfront_pgrant, list);
+		list_del(&pgrant->list);
+		spin_unlock_irqrestore(&fe->pgrants_lock, flags);
+		return pgrant;
+	}
+	if (fe->nr_pgrants >= OMX_XEN_PERSISTENT_GRANTS_MAX) {
+		spin_unlock_irqrestore(&fe->pgrants_lock, flags);
+		return NULL;
+	}
+	fe->nr_pgrants++;
+	spin_unlock_irqrestore(&fe->pgrants_lock, flags);
+
+	pgrant = kmalloc(sizeof(*pgrant), GFP_KERNEL);
+	if (!pgrant)
+		goto out;
+	pgrant->page = alloc_page(GFP_KERNEL);
+	if (!pgrant->page)
+		goto out_with_pgrant;
+	ret = gnttab_grant_foreign_access(0 /* DOM0_ID */,
+					  pfn_to_mfn(page_to_pfn
+						     (pgrant->page)), 0);
+	if (ret < 0) {
+		printk_err("Cannot grant persistent page, ret = %d\n", ret);
+		goto out_with_page;
+	}
+	pgrant->gref = ret;
+	dprintk_deb("new persistent grant %u, %u in pool\n", pgrant->gref,
+		    fe->nr_pgrants);
+	return pgrant;
+
+out_with_page:
+	__free_page(pgrant->page);
+out_with_pgrant:
+	kfree(pgrant);
+out:
+	spin_lock_irqsave(&fe->pgrants_lock, flags);
+	fe->nr_pgrants--;
+	spin_unlock_irqrestore(&fe->pgrants_lock, flags);
+	return NULL;
+}
+
+static void omx_xenfront_pgrant_put(struct omx_xenfront_info *fe,
+				    struct omx_xenfront_pgrant *pgrant)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&fe->pgrants_lock, flags);
+	list_add(&pgrant->list, &fe->pgrants_free);
+	spin_unlock_irqrestore(&fe->pgrants_lock, flags);
+}
+
+/*
+ * Copy a mediumva payload to persistent grants and send it from there,
+ * without any grant table operation once the pool is warm.
+ * Returns -EBUSY if the pool cannot hold the message right now, the
+ * caller then grants the user pages for this message only.
+ */
+static int omx_xenfront_send_mediumva_persistent(struct omx_endpoint *endpoint,
+						 struct omx_xenif_request
+						 *ring_req,
+						 struct omx_cmd_xen_send_mediumva
+						 *cmd,
+						 struct omx_cmd_user_segment
+						 *useg)
+{
+	struct omx_xenfront_info *fe = endpoint->fe;
+	struct omx_xenfront_pgrant *pgrants[ARRAY_SIZE(cmd->grefs)];
+	uint32_t request_id = ring_req->request_id;
+	uint32_t remaining = cmd->mediumva.length;
+	void __user *udata = (void __user *)(unsigned long)useg->vaddr;
+	int nr_pages, nr_got, i;
+	int ret = 0;
+
+	dprintk_in();
+
+	nr_pages = (remaining + PAGE_SIZE - 1) / PAGE_SIZE;
+	if (nr_pages > ARRAY_SIZE(cmd->grefs)) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	for (nr_got = 0; nr_got < nr_pages; nr_got++) {
+		pgrants[nr_got] = omx_xenfront_pgrant_get(fe);
+		if (!pgrants[nr_got]) {
+			ret = -EBUSY;
+			goto out_put;
+		}
+	}
+
+	for (i = 0; i < nr_pages; i++) {
+		uint32_t chunk = remaining > PAGE_SIZE ? PAGE_SIZE : remaining;
+
+		if (copy_from_user(page_address(pgrants[i]->page), udata,
+				   chunk)) {
+			printk(KERN_ERR
+			       "Open-MX: Failed to read send mediumva cmd data\n");
+			ret = -EFAULT;
+			goto out_put;
+		}
+		cmd->grefs[i] = pgrants[i]->gref;
+		udata += chunk;
+		remaining -= chunk;
+	}
+	cmd->nr_pages = nr_pages;
+	cmd->first_page_offset = 0;
+	cmd->persistent = 1;
+
+	omx_poke_dom0(fe, ring_req);
 	if ((ret = wait_for_backend_response
 	     (&fe->requests[request_id], OMX_XEN_FRONTEND_STATUS_DOING,
 	      NULL)) < 0) {
+		/* the backend may still read them, keep them out of the pool */
 		printk_err("Failed to wait\n");
 		ret = -EINVAL;
 		goto out;
 	}
-	dprintk_deb("ret tiny = %d\n", ret);
 
 	if (fe->requests[request_id] == OMX_XEN_FRONTEND_STATUS_DONE)
 		ret = 0;
 	else {
-		ret = -EINVAL;
-		printk_err("Backend failed to ACK send tiny \n");
+		ret = -EFAULT;
+		printk_err("Backend failed to ACK send mediumva\n");
 	}
-#endif
+
+out_put:
+	while (nr_got--)
+		omx_xenfront_pgrant_put(fe, pgrants[nr_got]);
 out:
-	TIMER_STOP(&t_send_tiny);
 	dprintk_out();
 	return ret;
 }
@@ -163,9 +321,12 @@ int omx_ioctl_xen_send_mediumva(struct omx_endpoint *endpoint,
 	dprintk_in();
 
 	TIMER_START(&t_send_mediumva);
-	ring_req = omx_ring_get_request(fe);
-	request_id = (fe->ring.req_prod_pvt - 1) % OMX_MAX_INFLIGHT_REQUESTS;
-	ring_req->request_id = request_id;
+	ring_req = omx_ring_get_request(omx_xenfront_endpoint_queue(endpoint));
+	if (unlikely(!ring_req)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	request_id = ring_req->request_id;
 	ring_req->func = OMX_CMD_SEND_MEDIUMVA;
 	cmd = &ring_req->data.send_mediumva;
 	ring_req->board_index = endpoint->board_index;
@@ -241,7 +402,16 @@ int omx_ioctl_xen_send_mediumva(struct omx_endpoint *endpoint,
 		goto out;
 	}
 
+	ret = omx_xenfront_send_mediumva_persistent(endpoint, ring_req, cmd,
+						    &usegs[0]);
+	if (ret != -EBUSY) {
+		kfree(usegs);
+		goto out;
+	}
+	ret = 0;
+
 	/* initialize position in segments */
+	cmd->persistent = 0;
 	cur_useg = &usegs[0];
 	cur_useg_remaining = cur_useg->len;
 	cur_udata = (__user void *)(unsigned long)cur_useg->vaddr;
@@ -325,7 +495,7 @@ int omx_ioctl_xen_send_mediumva(struct omx_endpoint *endpoint,
 
 	//dump_xen_send_mediumva(cmd);
 #if 0
-	/* copy the data right after the header */
+	/* copy the data to the slot payload */
 	ret =
 	    copy_from_user(data, (__user void *)(unsigned long)cmd->small.vaddr,
 			   length);
@@ -407,9 +577,12 @@ int omx_ioctl_xen_send_mediumsq_frag(struct omx_endpoint *endpoint,
 	dprintk_in();
 
 	TIMER_START(&t_send_mediumsq_frag);
-	ring_req = omx_ring_get_request(fe);
-	request_id = (fe->ring.req_prod_pvt - 1) % OMX_MAX_INFLIGHT_REQUESTS;
-	ring_req->request_id = request_id;
+	ring_req = omx_ring_get_request(omx_xenfront_endpoint_queue(endpoint));
+	if (unlikely(!ring_req)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	request_id = ring_req->request_id;
 	ring_req->func = OMX_CMD_SEND_MEDIUMSQ_FRAG;
 	cmd = &ring_req->data.send_mediumsq_frag;
 	ring_req->board_index = endpoint->board_index;
@@ -449,26 +622,59 @@ int omx_ioctl_xen_send_mediumsq_frag(struct omx_endpoint *endpoint,
 		cmd->mediumsq_frag.shared = 0;
 	}
 
-	omx_poke_dom0(endpoint->fe, ring_req);
-#ifndef OMX_XEN_NOWAIT
-	if ((ret = wait_for_backend_response
-	     (&fe->requests[request_id], OMX_XEN_FRONTEND_STATUS_DOING,
-	      NULL)) < 0) {
-		printk_err("Failed to wait\n");
-		ret = -EINVAL;
+	ret = omx_xenfront_submit_request(fe, ring_req, "send mediumsq frag");
+
+out:
+	TIMER_STOP(&t_send_mediumsq_frag);
+	dprintk_out();
+	return ret;
+}
+
+/*
+ * Forward a whole mediumsq message in a single ring slot, the backend
+ * queues all its frags and reports a single OMX_EVT_SEND_MEDIUMSQ_DONE.
+ */
+int omx_ioctl_xen_send_mediumsq(struct omx_endpoint *endpoint,
+				void __user * uparam)
+{
+	struct omx_cmd_send_mediumsq mediumsq;
+	struct omx_xenfront_info *fe = endpoint->fe;
+	struct omx_xenfront_queue *queue = omx_xenfront_endpoint_queue(endpoint);
+	struct omx_xenif_request *ring_req;
+	int ret = 0;
+
+	dprintk_in();
+	TIMER_START(&t_send_mediumsq);
+
+	/* read the command before taking a ring slot, the backend checks it */
+	ret = copy_from_user(&mediumsq, uparam, sizeof(mediumsq));
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR
+		       "Open-MX: Failed to read send mediumsq cmd hdr\n");
+		ret = -EFAULT;
 		goto out;
 	}
-	dprintk_deb("ret send_mediumsq = %d\n", ret);
 
-	if (fe->requests[request_id] == OMX_XEN_FRONTEND_STATUS_DONE)
-		ret = 0;
-	else {
-		ret = -EFAULT;
-		printk_err("Backend failed to ACK send mediumsq frag\n");
+	if (mediumsq.shared) {
+		/* FIXME: handle the intra-node/VM case */
+		mediumsq.shared = 0;
 	}
-#endif
+
+	ring_req = omx_ring_get_request(queue);
+	if (unlikely(!ring_req)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	ring_req->func = OMX_CMD_XEN_SEND_MEDIUMSQ;
+	ring_req->board_index = endpoint->board_index;
+	ring_req->eid = endpoint->endpoint_index;
+	memcpy(&omx_xenfront_slot_payload(queue, ring_req)->mediumsq,
+	       &mediumsq, sizeof(mediumsq));
+
+	ret = omx_xenfront_submit_request(fe, ring_req, "send mediumsq");
+
 out:
-	TIMER_STOP(&t_send_mediumsq_frag);
+	TIMER_STOP(&t_send_mediumsq);
 	dprintk_out();
 	return ret;
 }
@@ -478,6 +684,7 @@ int omx_ioctl_xen_send_small(struct omx_endpoint *endpoint,
 {
 	struct omx_cmd_xen_send_small *cmd;
 	struct omx_xenfront_info *fe = endpoint->fe;
+	struct omx_xenfront_queue *queue = omx_xenfront_endpoint_queue(endpoint);
 	struct omx_xenif_request *ring_req;
 	uint32_t length = 0;
 	int ret = 0;
@@ -487,14 +694,17 @@ int omx_ioctl_xen_send_small(struct omx_endpoint *endpoint,
 	dprintk_in();
 
 	TIMER_START(&t_send_small);
-	ring_req = omx_ring_get_request(fe);
-	request_id = (fe->ring.req_prod_pvt - 1) % OMX_MAX_INFLIGHT_REQUESTS;
-	ring_req->request_id = request_id;
+	ring_req = omx_ring_get_request(queue);
+	if (unlikely(!ring_req)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	request_id = ring_req->request_id;
 	ring_req->func = OMX_CMD_SEND_SMALL;
 	cmd = &ring_req->data.send_small;
 	ring_req->board_index = endpoint->board_index;
 	ring_req->eid = endpoint->endpoint_index;
-	data = cmd->data;
+	data = omx_xenfront_slot_payload(queue, ring_req)->small_data;
 
 	ret =
 	    copy_from_user(&cmd->small, uparam,
@@ -519,7 +729,7 @@ int omx_ioctl_xen_send_small(struct omx_endpoint *endpoint,
 		cmd->small.shared = 0;
 	}
 	//dump_xen_send_small(cmd);
-	/* copy the data right after the header */
+	/* copy the data to the slot payload */
 	ret =
 	    copy_from_user(data, (__user void *)(unsigned long)cmd->small.vaddr,
 			   length);
@@ -530,24 +740,8 @@ int omx_ioctl_xen_send_small(struct omx_endpoint *endpoint,
 		goto out;
 	}
 
-	omx_poke_dom0(endpoint->fe, ring_req);
-#ifndef OMX_XEN_NOWAIT
-	if ((ret = wait_for_backend_response
-	     (&fe->requests[request_id], OMX_XEN_FRONTEND_STATUS_DOING,
-	      NULL)) < 0) {
-		printk_err("Failed to wait\n");
-		ret = -EINVAL;
-		goto out;
-	}
-	dprintk_deb("ret send_small= %d\n", ret);
+	ret = omx_xenfront_submit_request(fe, ring_req, "send small");
 
-	if (fe->requests[request_id] == OMX_XEN_FRONTEND_STATUS_DONE)
-		ret = 0;
-	else {
-		ret = -EFAULT;
-		printk_err("Backend failed to ACK send small\n");
-	}
-#endif
 out:
 	TIMER_STOP(&t_send_small);
 	dprintk_out();
@@ -565,9 +759,12 @@ int omx_ioctl_xen_send_notify(struct omx_endpoint *endpoint,
 
 	dprintk_in();
 	TIMER_START(&t_send_notify);
-	ring_req = omx_ring_get_request(fe);
-	request_id = (fe->ring.req_prod_pvt - 1) % OMX_MAX_INFLIGHT_REQUESTS;
-	ring_req->request_id = request_id;
+	ring_req = omx_ring_get_request(omx_xenfront_endpoint_queue(endpoint));
+	if (unlikely(!ring_req)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	request_id = ring_req->request_id;
 	ring_req->func = OMX_CMD_SEND_NOTIFY;
 	cmd = &ring_req->data.send_notify;
 	ring_req->board_index = endpoint->board_index;
@@ -589,21 +786,8 @@ int omx_ioctl_xen_send_notify(struct omx_endpoint *endpoint,
 	}
 
 	dump_xen_send_notify(cmd);
-	omx_poke_dom0(endpoint->fe, ring_req);
-	if ((ret = wait_for_backend_response
-	     (&fe->requests[request_id], OMX_XEN_FRONTEND_STATUS_DOING,
-	      NULL)) < 0) {
-		printk_err("Failed to wait\n");
-		ret = -EINVAL;
-		goto out;
-	}
-
-	dprintk_deb("ret notify = %d\n", ret);
+	ret = omx_xenfront_submit_request(fe, ring_req, "send notify");
 
-	if (fe->requests[request_id] == OMX_XEN_FRONTEND_STATUS_DONE)
-		ret = 0;
-	else
-		ret = -EFAULT;
 out:
 	TIMER_STOP(&t_send_notify);
 	dprintk_out();
@@ -623,9 +807,12 @@ int omx_ioctl_xen_send_connect_request(struct omx_endpoint *endpoint,
 
 	TIMER_START(&t_send_connect_request);
 	/* fill omx header */
-	ring_req = omx_ring_get_request(fe);
-	request_id = (fe->ring.req_prod_pvt - 1) % OMX_MAX_INFLIGHT_REQUESTS;
-	ring_req->request_id = request_id;
+	ring_req = omx_ring_get_request(omx_xenfront_endpoint_queue(endpoint));
+	if (unlikely(!ring_req)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	request_id = ring_req->request_id;
 	ring_req->func = OMX_CMD_SEND_CONNECT_REQUEST;
 	cmd = &ring_req->data.send_connect_request;
 
@@ -647,22 +834,7 @@ int omx_ioctl_xen_send_connect_request(struct omx_endpoint *endpoint,
 	}
 
 	dump_xen_send_connect_request(cmd);
-	omx_poke_dom0(endpoint->fe, ring_req);
-	if ((ret = wait_for_backend_response
-	     (&fe->requests[request_id], OMX_XEN_FRONTEND_STATUS_DOING,
-	      NULL)) < 0) {
-		printk_err("Failed to wait\n");
-		ret = -EINVAL;
-		goto out;
-	}
-	dprintk_deb("ret connect_request = %d\n", ret);
-
-	if (fe->requests[request_id] == OMX_XEN_FRONTEND_STATUS_DONE)
-		ret = 0;
-	else {
-		ret = -EFAULT;
-		printk_err("Backend failed to ACK send connect\n");
-	}
+	ret = omx_xenfront_submit_request(fe, ring_req, "send connect request");
 
 out:
 	TIMER_STOP(&t_send_connect_request);
@@ -682,9 +854,12 @@ int omx_ioctl_xen_send_connect_reply(struct omx_endpoint *endpoint,
 	dprintk_in();
 
 	TIMER_START(&t_send_connect_reply);
-	ring_req = omx_ring_get_request(fe);
-	request_id = (fe->ring.req_prod_pvt - 1) % OMX_MAX_INFLIGHT_REQUESTS;
-	ring_req->request_id = request_id;
+	ring_req = omx_ring_get_request(omx_xenfront_endpoint_queue(endpoint));
+	if (unlikely(!ring_req)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	request_id = ring_req->request_id;
 	ring_req->func = OMX_CMD_SEND_CONNECT_REPLY;
 	cmd = &ring_req->data.send_connect_reply;
 	ring_req->board_index = endpoint->board_index;
@@ -706,22 +881,8 @@ int omx_ioctl_xen_send_connect_reply(struct omx_endpoint *endpoint,
 	}
 
 	dump_xen_send_connect_reply(cmd);
-	omx_poke_dom0(endpoint->fe, ring_req);
-	if ((ret = wait_for_backend_response
-	     (&fe->requests[request_id], OMX_XEN_FRONTEND_STATUS_DOING,
-	      NULL)) < 0) {
-		printk_err("Failed to wait\n");
-		ret = -EINVAL;
-		goto out;
-	}
-	dprintk_deb("ret connect_reply = %d\n", ret);
+	ret = omx_xenfront_submit_request(fe, ring_req, "send connect reply");
 
-	if (fe->requests[request_id] == OMX_XEN_FRONTEND_STATUS_DONE)
-		ret = 0;
-	else {
-		ret = -EFAULT;
-		printk_err("Backend failed to ACK send connect reply\n");
-	}
 out:
 	TIMER_STOP(&t_send_connect_reply);
 	dprintk_out();
@@ -738,9 +899,12 @@ int omx_ioctl_xen_pull(struct omx_endpoint *endpoint, void __user * uparam)
 
 	dprintk_in();
 	TIMER_START(&t_pull);
-	ring_req = omx_ring_get_request(fe);
-	request_id = (fe->ring.req_prod_pvt - 1) % OMX_MAX_INFLIGHT_REQUESTS;
-	ring_req->request_id = request_id;
+	ring_req = omx_ring_get_request(omx_xenfront_endpoint_queue(endpoint));
+	if (unlikely(!ring_req)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	request_id = ring_req->request_id;
 	ring_req->func = OMX_CMD_PULL;
 	cmd = &ring_req->data.pull;
 	ring_req->board_index = endpoint->board_index;
@@ -759,22 +923,7 @@ int omx_ioctl_xen_pull(struct omx_endpoint *endpoint, void __user * uparam)
 	}
 
 	dump_xen_pull(cmd);
-	omx_poke_dom0(endpoint->fe, ring_req);
-#ifndef OMX_XEN_NOWAIT
-	if ((ret = wait_for_backend_response
-	     (&fe->requests[request_id], OMX_XEN_FRONTEND_STATUS_DOING,
-	      NULL)) < 0) {
-		printk_err("Failed to wait\n");
-		ret = -EINVAL;
-		goto out;
-	}
-	dprintk_deb("ret pull = %d\n", ret);
-
-	if (fe->requests[request_id] == OMX_XEN_FRONTEND_STATUS_DONE)
-		ret = 0;
-	else
-		ret = -EFAULT;
-#endif
+	ret = omx_xenfront_submit_request(fe, ring_req, "pull");
 
 out:
 	TIMER_STOP(&t_pull);
@@ -792,9 +941,12 @@ int omx_ioctl_xen_send_rndv(struct omx_endpoint *endpoint, void __user * uparam)
 
 	dprintk_in();
 	TIMER_START(&t_send_rndv);
-	ring_req = omx_ring_get_request(fe);
-	request_id = (fe->ring.req_prod_pvt - 1) % OMX_MAX_INFLIGHT_REQUESTS;
-	ring_req->request_id = request_id;
+	ring_req = omx_ring_get_request(omx_xenfront_endpoint_queue(endpoint));
+	if (unlikely(!ring_req)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	request_id = ring_req->request_id;
 	ring_req->func = OMX_CMD_SEND_RNDV;
 	cmd = &ring_req->data.send_rndv;
 	ring_req->board_index = endpoint->board_index;
@@ -816,24 +968,8 @@ int omx_ioctl_xen_send_rndv(struct omx_endpoint *endpoint, void __user * uparam)
 
 	/* fill omx header */
 	dump_xen_send_rndv(cmd);
-	omx_poke_dom0(endpoint->fe, ring_req);
-#ifndef OMX_XEN_NOWAIT
-	if ((ret = wait_for_backend_response
-	     (&fe->requests[request_id], OMX_XEN_FRONTEND_STATUS_DOING,
-	      NULL)) < 0) {
-		printk_err("Failed to wait\n");
-		ret = -EINVAL;
-		goto out;
-	}
-	dprintk_deb("ret send_rndv = %d\n", ret);
+	ret = omx_xenfront_submit_request(fe, ring_req, "send rndv");
 
-	if (fe->requests[request_id] == OMX_XEN_FRONTEND_STATUS_DONE)
-		ret = 0;
-	else {
-		ret = -EINVAL;
-		printk_err("Backend failed to ACK send rndv \n");
-	}
-#endif
 #if 0
 	printk(KERN_INFO
 	       "%s: delaying on purpose to understand what is going on!\n",
@@ -858,9 +994,12 @@ int omx_ioctl_xen_send_liback(struct omx_endpoint *endpoint,
 
 	dprintk_in();
 	TIMER_START(&t_send_liback);
-	ring_req = omx_ring_get_request(fe);
-	request_id = (fe->ring.req_prod_pvt - 1) % OMX_MAX_INFLIGHT_REQUESTS;
-	ring_req->request_id = request_id;
+	ring_req = omx_ring_get_request(omx_xenfront_endpoint_queue(endpoint));
+	if (unlikely(!ring_req)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	request_id = ring_req->request_id;
 	ring_req->func = OMX_CMD_SEND_LIBACK;
 	cmd = &ring_req->data.send_liback;
 	ring_req->board_index = endpoint->board_index;
@@ -884,24 +1023,151 @@ int omx_ioctl_xen_send_liback(struct omx_endpoint *endpoint,
 	/* fill omx header */
 
 	dump_xen_send_liback(cmd);
-	omx_poke_dom0(endpoint->fe, ring_req);
-	if ((ret = wait_for_backend_response
-	     (&fe->requests[request_id], OMX_XEN_FRONTEND_STATUS_DOING,
-	      NULL)) < 0) {
-		printk_err("Failed to wait\n");
+	ret = omx_xenfront_submit_request(fe, ring_req, "send liback");
+
+out:
+	TIMER_STOP(&t_send_liback);
+	dprintk_out();
+	return ret;
+}
+
+/* check a batch entry copied from user-space, as the single-command ioctls do */
+static int omx_xenfront_check_batch_entry(struct omx_cmd_send_batch_entry *entry)
+{
+	int ret = 0;
+
+	entry->status = 0;
+	switch (entry->cmd) {
+	case OMX_CMD_SEND_TINY:
+		if (unlikely(entry->u.tiny.hdr.length > OMX_TINY_MSG_LENGTH_MAX)) {
+			printk_err("Cannot send more than %d as a tiny (tried %d)\n",
+				   OMX_TINY_MSG_LENGTH_MAX,
+				   entry->u.tiny.hdr.length);
+			ret = -EINVAL;
+		}
+		/* FIXME: handle the intra-node/VM case */
+		entry->u.tiny.hdr.shared = 0;
+		break;
+	case OMX_CMD_SEND_NOTIFY:
+		entry->u.notify.shared = 0;
+		break;
+	case OMX_CMD_SEND_LIBACK:
+		entry->u.liback.shared = 0;
+		break;
+	default:
+		printk_err("Cannot batch command %s (%#x)\n",
+			   omx_strcmd(entry->cmd), entry->cmd);
 		ret = -EINVAL;
-		goto out;
 	}
-	dprintk_deb("ret send_liback = %d\n", ret);
 
-	if (fe->requests[request_id] == OMX_XEN_FRONTEND_STATUS_DONE)
-		ret = 0;
-	else {
+	return ret;
+}
+
+/*
+ * Pack an array of tiny/notify/liback commands in as few ring slots as
+ * possible and push them all with a single event channel notification.
+ */
+int omx_ioctl_xen_send_batch(struct omx_endpoint *endpoint,
+			     void __user * uparam)
+{
+	struct omx_cmd_send_batch batch;
+	struct omx_cmd_xen_send_batch *cmd;
+	struct omx_cmd_send_batch_entry *entries;
+	struct omx_xenfront_info *fe = endpoint->fe;
+	struct omx_xenfront_queue *queue = omx_xenfront_endpoint_queue(endpoint);
+	struct omx_xenif_request *ring_req = NULL, *next_req;
+	uint32_t request_ids[DIV_ROUND_UP(OMX_SEND_BATCH_ENTRY_NR_MAX,
+					  OMX_XEN_SEND_BATCH_SLOT_ENTRIES)];
+	struct omx_cmd_send_batch_entry __user *uentries;
+	uint32_t done = 0, nr;
+	int ret = 0, err = 0, i, nr_slots = 0;
+
+	dprintk_in();
+	TIMER_START(&t_send_batch);
+
+	ret = copy_from_user(&batch, uparam, sizeof(batch));
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read send batch cmd\n");
 		ret = -EFAULT;
-		printk_err("Backend failed to ACK send liback \n");
+		goto out;
+	}
+
+	if (unlikely(!batch.nr_entries
+		     || batch.nr_entries > OMX_SEND_BATCH_ENTRY_NR_MAX)) {
+		printk_err("Cannot batch %d commands (max %d)\n",
+			   batch.nr_entries, OMX_SEND_BATCH_ENTRY_NR_MAX);
+		ret = -EINVAL;
+		goto out;
 	}
+	uentries = (void __user *)(unsigned long)batch.entries;
+
+	while (done < batch.nr_entries) {
+		nr = min_t(uint32_t, batch.nr_entries - done,
+			   OMX_XEN_SEND_BATCH_SLOT_ENTRIES);
+
+		next_req = omx_ring_get_request(queue);
+		if (unlikely(!next_req)) {
+			/* push what is already in the ring */
+			ret = -ENOMEM;
+			break;
+		}
+		ring_req = next_req;
+		request_ids[nr_slots] = ring_req->request_id;
+		ring_req->func = OMX_CMD_XEN_SEND_BATCH;
+		ring_req->board_index = endpoint->board_index;
+		ring_req->eid = endpoint->endpoint_index;
+		cmd = &ring_req->data.send_batch;
+		entries = omx_xenfront_slot_payload(queue, ring_req)->batch;
+		nr_slots++;
+
+		/* the slot is taken, an invalid chunk is pushed empty */
+		cmd->nr_entries = 0;
+		err = copy_from_user(entries, &uentries[done],
+				     nr * sizeof(*uentries));
+		if (unlikely(err != 0)) {
+			printk(KERN_ERR
+			       "Open-MX: Failed to read send batch entries\n");
+			ret = -EFAULT;
+			break;
+		}
+		for (i = 0; i < nr; i++) {
+			err = omx_xenfront_check_batch_entry(&entries[i]);
+			if (unlikely(err))
+				break;
+		}
+		if (unlikely(err)) {
+			ret = err;
+			break;
+		}
+
+		cmd->nr_entries = nr;
+		done += nr;
+	}
+
+	if (unlikely(!nr_slots))
+		goto out;
+
+	/* only the last slot notifies the backend, the others go along */
+	if (omx_xen_async_send)
+		for (i = 0; i < nr_slots - 1; i++)
+			fe->requests[request_ids[i]] =
+			    OMX_XEN_FRONTEND_STATUS_ASYNC;
+	err = omx_xenfront_submit_request(fe, ring_req, "send batch");
+	if (ret)
+		goto out;
+	ret = err;
+	if (ret || omx_xen_async_send)
+		goto out;
+
+	/* slots are processed in order, so the previous ones are done too */
+	for (i = 0; i < nr_slots - 1; i++)
+		if (fe->requests[request_ids[i]] != OMX_XEN_FRONTEND_STATUS_DONE) {
+			printk_err("Backend failed to ACK send batch\n");
+			ret = -EFAULT;
+		}
+
 out:
-	TIMER_STOP(&t_send_liback);
+	TIMER_STOP(&t_send_batch);
 	dprintk_out();
 	return ret;
 }
@@ -59,6 +59,19 @@ int omx_ioctl_xen_send_mediumva(struct omx_endpoint *endpoint,
 				void __user * uparam);
 int omx_ioctl_xen_send_mediumsq_frag(struct omx_endpoint *endpoint,
 			     void __user * uparam);
+int omx_ioctl_xen_send_batch(struct omx_endpoint *endpoint,
+			     void __user * uparam);
+int omx_ioctl_xen_send_mediumsq(struct omx_endpoint *endpoint,
+				void __user * uparam);
+
+struct omx_xenfront_pgrant {
+	struct list_head list;
+	struct page *page;
+	grant_ref_t gref;
+};
+
+void omx_xenfront_pgrants_init(struct omx_xenfront_info *fe);
+void omx_xenfront_pgrants_free(struct omx_xenfront_info *fe);
 
 /*
  * Local variables:
@@ -278,6 +278,24 @@ else
   echo no
 fi
 
+# netdev_start_xmit with its xmit_more argument added in 3.18
+echo -n "  checking (in kernel headers) netdev_start_xmit availability ... "
+if grep netdev_start_xmit ${LINUX_HDR}/include/linux/netdevice.h > /dev/null ; then
+  echo "#define OMX_HAVE_NETDEV_START_XMIT 1" >> ${TMP_CHECKS_NAME}
+  echo yes
+else
+  echo no
+fi
+
+# dev_nit_active added in 5.1
+echo -n "  checking (in kernel headers) dev_nit_active availability ... "
+if grep dev_nit_active ${LINUX_HDR}/include/linux/netdevice.h > /dev/null ; then
+  echo "#define OMX_HAVE_DEV_NIT_ACTIVE 1" >> ${TMP_CHECKS_NAME}
+  echo yes
+else
+  echo no
+fi
+
 # add the footer
 echo "" >> ${TMP_CHECKS_NAME}
 echo "#endif /* __omx_checks_h__ */" >> ${TMP_CHECKS_NAME}
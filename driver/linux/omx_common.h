@@ -40,12 +40,16 @@ extern int omx_endpoint_max;
 extern int omx_peer_max;
 extern int omx_skb_frags;
 extern int omx_skb_copy_max;
+extern int omx_xmit_batch_max;
+extern int omx_skb_pool_max;
 extern int omx_pin_synchronous;
 extern int omx_pin_progressive;
 extern int omx_pin_chunk_pages_min;
 extern int omx_pin_chunk_pages_max;
 extern int omx_pin_invalidate;
 extern unsigned long omx_user_rights;
+extern int omx_sqpoll_cpu;
+extern int omx_sqpoll_idle_us;
 
 /* events */
 extern int omx_event_delivery_check(void);
@@ -56,23 +60,30 @@ extern int omx_prepare_notify_unexp_event_with_recvq(struct omx_endpoint *endpoi
 extern int omx_prepare_notify_unexp_events_with_recvq(struct omx_endpoint *endpoint, int nr, unsigned long *recvq_offset);
 extern void omx_commit_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint, const void *event, int length);
 extern void omx_cancel_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint);
+extern int omx_xen_notify_unexp_event(struct omx_endpoint *endpoint, const void *event, int length);
 extern int omx_ioctl_wait_event(struct omx_endpoint * endpoint, void __user * uparam);
 extern int omx_ioctl_wakeup(struct omx_endpoint * endpoint, void __user * uparam);
 extern int omx_ioctl_release_exp_slots(struct omx_endpoint *endpoint, void __user * uparam);
 extern int omx_ioctl_release_unexp_slots(struct omx_endpoint *endpoint, void __user * uparam);
+extern void omx_endpoint_release_consumed_slots(struct omx_endpoint *endpoint);
 extern void omx_wakeup_endpoint_on_close(struct omx_endpoint * endpoint);
+extern void omx_wakeup_endpoint_on_event(struct omx_endpoint * endpoint);
 
 /* sending */
 extern struct sk_buff * omx_new_skb(unsigned long len);
+extern int omx_send_tiny(struct omx_endpoint * endpoint, const struct omx_cmd_send_tiny * cmd);
 extern int omx_ioctl_send_tiny(struct omx_endpoint * endpoint, void __user * uparam);
 extern int omx_ioctl_send_small(struct omx_endpoint * endpoint, void __user * uparam);
 extern int omx_ioctl_send_mediumsq_frag(struct omx_endpoint * endpoint, void __user * uparam);
+extern int omx_ioctl_send_mediumsq(struct omx_endpoint * endpoint, void __user * uparam);
 extern int omx_ioctl_send_mediumva(struct omx_endpoint * endpoint, void __user * uparam);
 extern int omx_ioctl_send_rndv(struct omx_endpoint * endpoint, void __user * uparam);
 extern int omx_ioctl_pull(struct omx_endpoint * endpoint, void __user * uparam);
+extern int omx_send_notify(struct omx_endpoint * endpoint, const struct omx_cmd_send_notify * cmd);
 extern int omx_ioctl_send_notify(struct omx_endpoint * endpoint, void __user * uparam);
 extern int omx_ioctl_send_connect_request(struct omx_endpoint * endpoint, void __user * uparam);
 extern int omx_ioctl_send_connect_reply(struct omx_endpoint * endpoint, void __user * uparam);
+extern int omx_send_liback(struct omx_endpoint * endpoint, const struct omx_cmd_send_liback * cmd);
 extern int omx_ioctl_send_liback(struct omx_endpoint * endpoint, void __user * uparam);
 extern void omx_send_nack_lib(struct omx_iface * iface, uint32_t peer_index, enum omx_nack_type nack_type, uint8_t src_endpoint, uint8_t dst_endpoint, uint16_t lib_seqnum);
 extern void omx_send_nack_mcp(struct omx_iface * iface, uint32_t peer_index, enum omx_nack_type nack_type, uint8_t src_endpoint, uint32_t src_pull_handle, uint32_t src_magic);
@@ -27,6 +27,8 @@
 #include <linux/random.h>
 #include <linux/ethtool.h>
 #include <linux/hardirq.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
 #include <asm/uaccess.h>
 
 #include "omx_hal.h"
@@ -85,11 +87,18 @@ omx_endpoint_alloc_resources(struct omx_endpoint * endpoint)
 		printk(KERN_ERR "Open-MX: failed to allocate unexp eventq\n");
 		goto out_with_exp_eventq;
 	}
+	endpoint->cmdq = omx_vmalloc_user(OMX_CMDQ_SIZE);
+	if (!endpoint->cmdq) {
+		printk(KERN_ERR "Open-MX: failed to allocate cmdq\n");
+		goto out_with_unexp_eventq;
+	}
+	endpoint->cmdq_next_index = 0;
+	spin_lock_init(&endpoint->cmdq_lock);
 
 	sendq_pages = kmalloc(OMX_SENDQ_SIZE/PAGE_SIZE * sizeof(struct page *), GFP_KERNEL);
 	if (!sendq_pages) {
 		printk(KERN_ERR "Open-MX: failed to allocate sendq pages array\n");
-		goto out_with_unexp_eventq;
+		goto out_with_cmdq;
 	}
 	for(i=0; i<OMX_SENDQ_SIZE/PAGE_SIZE; i++) {
 		struct page * page;
@@ -130,6 +139,8 @@ omx_endpoint_alloc_resources(struct omx_endpoint * endpoint)
 
  out_with_sendq_pages:
 	kfree(endpoint->sendq_pages);
+ out_with_cmdq:
+	vfree(endpoint->cmdq);
  out_with_unexp_eventq:
 	vfree(endpoint->unexp_eventq);
  out_with_exp_eventq:
@@ -156,6 +167,7 @@ omx_endpoint_free_resources(struct omx_endpoint * endpoint)
 
 	kfree(endpoint->recvq_pages);
 	kfree(endpoint->sendq_pages);
+	vfree(endpoint->cmdq);
 	vfree(endpoint->unexp_eventq);
 	vfree(endpoint->exp_eventq);
 	vfree(endpoint->recvq);
@@ -260,6 +272,10 @@ omx_endpoint_open(struct omx_endpoint * endpoint, const void __user * uparam)
 	    && rx_coalesce >= OMX_IFACE_RX_USECS_WARN_MIN)
 		endpoint->userdesc->status |= OMX_ENDPOINT_DESC_STATUS_IFACE_HIGH_INTRCOAL;
 
+	/* the polling thread may be idle, let the first submission ring the doorbell */
+	if (endpoint->iface->sqpoll_task)
+		endpoint->userdesc->cmdq_flags = OMX_ENDPOINT_DESC_CMDQ_POLLED | OMX_ENDPOINT_DESC_CMDQ_NEED_WAKEUP;
+
 	return 0;
 
  out_with_resources:
@@ -376,6 +392,268 @@ omx_endpoint_acquire_by_iface_index(const struct omx_iface * iface, uint8_t inde
 	return ERR_PTR(err);
 }
 
+/******************************
+ * Command queue
+ */
+
+/*
+ * Report a failed cmdq command to user-space when nobody will look at
+ * the doorbell return value. Allocation failures are just like a packet
+ * loss, the library resends later anyway.
+ */
+static void
+omx_endpoint_cmdq_notify_error(struct omx_endpoint * endpoint,
+			       const struct omx_cmd_send_batch_entry * entry, int err)
+{
+	struct omx_evt_send_error evt;
+
+	if (err == -ENOMEM)
+		return;
+
+	memset(&evt, 0, sizeof(evt));
+	evt.type = OMX_EVT_SEND_ERROR;
+	evt.command = entry->cmd;
+	evt.error = err;
+	switch (entry->cmd) {
+	case OMX_CMD_SEND_TINY:
+		evt.peer_index = entry->u.tiny.hdr.peer_index;
+		evt.dest_endpoint = entry->u.tiny.hdr.dest_endpoint;
+		break;
+	case OMX_CMD_SEND_NOTIFY:
+		evt.peer_index = entry->u.notify.peer_index;
+		evt.dest_endpoint = entry->u.notify.dest_endpoint;
+		break;
+	case OMX_CMD_SEND_LIBACK:
+		evt.peer_index = entry->u.liback.peer_index;
+		evt.dest_endpoint = entry->u.liback.dest_endpoint;
+		break;
+	}
+	omx_notify_unexp_event(endpoint, &evt, sizeof(evt));
+}
+
+/*
+ * Process the commands that user-space submitted in the cmdq since last time.
+ * Each entry gets its own status, the first error is returned.
+ * If notify_errors is set, each failed entry is also reported with an event.
+ */
+int
+omx_endpoint_cmdq_drain(struct omx_endpoint * endpoint, int notify_errors)
+{
+	struct omx_endpoint_desc * userdesc = endpoint->userdesc;
+	struct omx_cmd_send_batch_entry entry;
+	uint32_t index, submitted;
+	int ret = 0;
+
+	spin_lock(&endpoint->cmdq_lock);
+
+	index = endpoint->cmdq_next_index;
+	submitted = ACCESS_ONCE(userdesc->cmdq_submitted_index);
+	if (unlikely(submitted - index > OMX_CMDQ_ENTRY_NR)) {
+		printk(KERN_ERR "Open-MX: Cannot process %lu cmdq entries (max %lu)\n",
+		       (unsigned long) (submitted - index), OMX_CMDQ_ENTRY_NR);
+		ret = -EINVAL;
+		goto out;
+	}
+	/* read the entries after the submitted index */
+	rmb();
+
+	/* transmit the resulting packets at once */
+	omx_iface_xmit_batch_begin(endpoint->iface);
+
+	for( ; index != submitted; index++) {
+		struct omx_cmd_send_batch_entry * uentry = endpoint->cmdq
+			+ ((index % OMX_CMDQ_ENTRY_NR) << OMX_CMDQ_ENTRY_SHIFT);
+		int err;
+
+		/* user-space may modify the entry under our feet, work on a copy */
+		memcpy(&entry, uentry, sizeof(entry));
+
+		switch (entry.cmd) {
+		case OMX_CMD_SEND_TINY:
+			err = omx_send_tiny(endpoint, &entry.u.tiny);
+			break;
+		case OMX_CMD_SEND_NOTIFY:
+			err = omx_send_notify(endpoint, &entry.u.notify);
+			break;
+		case OMX_CMD_SEND_LIBACK:
+			err = omx_send_liback(endpoint, &entry.u.liback);
+			break;
+		default:
+			printk(KERN_ERR "Open-MX: Cannot process cmdq command %x\n", entry.cmd);
+			err = -EINVAL;
+		}
+
+		uentry->status = err;
+		if (unlikely(err)) {
+			if (!ret)
+				ret = err;
+			if (notify_errors)
+				omx_endpoint_cmdq_notify_error(endpoint, &entry, err);
+		}
+	}
+
+	omx_iface_xmit_batch_end(endpoint->iface);
+
+	endpoint->cmdq_next_index = index;
+	/* release the entries once their status is written */
+	wmb();
+	userdesc->cmdq_consumed_index = index;
+
+ out:
+	spin_unlock(&endpoint->cmdq_lock);
+	return ret;
+}
+
+static int
+omx_ioctl_cmdq_doorbell(struct omx_endpoint * endpoint, void __user * uparam)
+{
+	struct omx_iface * iface = endpoint->iface;
+	int ret;
+
+	/* the caller gets the first error */
+	ret = omx_endpoint_cmdq_drain(endpoint, 0);
+
+	/* the polling thread went idle, resume polling for the next commands */
+	if (iface->sqpoll_task && iface->sqpoll_idle)
+		wake_up_process(iface->sqpoll_task);
+
+	return ret;
+}
+
+/*
+ * Optional thread polling the cmdq of all endpoints of an iface,
+ * so that user-space does not have to ring the doorbell while it is busy.
+ * After sqpollidle microseconds without any command, it asks user-space
+ * to ring the doorbell again and sleeps until then.
+ */
+
+/*
+ * Drain the non-empty cmdqs, or only count them, return how many there were.
+ * No need to take references on endpoints, they are not released before
+ * a grace period once detached from the iface.
+ */
+static int
+omx_iface_sqpoll_drain(struct omx_iface * iface, int check_only)
+{
+	int busy = 0;
+	int i;
+
+	rcu_read_lock();
+
+	for(i=0; i<omx_endpoint_max; i++) {
+		struct omx_endpoint * endpoint = rcu_dereference(iface->endpoints[i]);
+		uint32_t submitted;
+
+		if (!endpoint || endpoint->status != OMX_ENDPOINT_STATUS_OK)
+			continue;
+
+		submitted = ACCESS_ONCE(endpoint->userdesc->cmdq_submitted_index);
+		/* let the doorbell report invalid indexes */
+		if (submitted != endpoint->cmdq_next_index
+		    && submitted - endpoint->cmdq_next_index <= OMX_CMDQ_ENTRY_NR) {
+			if (!check_only)
+				/* nobody looks at the return value, report errors with events */
+				omx_endpoint_cmdq_drain(endpoint, 1);
+			busy++;
+		}
+	}
+
+	rcu_read_unlock();
+	return busy;
+}
+
+static void
+omx_iface_sqpoll_set_flags(struct omx_iface * iface, uint32_t flags)
+{
+	int i;
+
+	rcu_read_lock();
+
+	for(i=0; i<omx_endpoint_max; i++) {
+		struct omx_endpoint * endpoint = rcu_dereference(iface->endpoints[i]);
+
+		if (endpoint && endpoint->status == OMX_ENDPOINT_STATUS_OK)
+			endpoint->userdesc->cmdq_flags = flags;
+	}
+
+	rcu_read_unlock();
+}
+
+static int
+omx_iface_sqpoll_thread(void * data)
+{
+	struct omx_iface * iface = data;
+	unsigned long idle_jiffies = jiffies + usecs_to_jiffies(omx_sqpoll_idle_us);
+
+	while (!kthread_should_stop()) {
+		if (omx_iface_sqpoll_drain(iface, 0)) {
+			idle_jiffies = jiffies + usecs_to_jiffies(omx_sqpoll_idle_us);
+
+		} else if (time_after_eq(jiffies, idle_jiffies)) {
+			/*
+			 * raise the flag before checking the cmdqs one last time,
+			 * user-space publishes its index before looking at the flag
+			 */
+			iface->sqpoll_idle = 1;
+			omx_iface_sqpoll_set_flags(iface, OMX_ENDPOINT_DESC_CMDQ_POLLED | OMX_ENDPOINT_DESC_CMDQ_NEED_WAKEUP);
+			smp_mb();
+
+			set_current_state(TASK_INTERRUPTIBLE);
+			if (!omx_iface_sqpoll_drain(iface, 1) && !kthread_should_stop())
+				schedule();
+			__set_current_state(TASK_RUNNING);
+
+			iface->sqpoll_idle = 0;
+			omx_iface_sqpoll_set_flags(iface, OMX_ENDPOINT_DESC_CMDQ_POLLED);
+			idle_jiffies = jiffies + usecs_to_jiffies(omx_sqpoll_idle_us);
+		}
+
+		cond_resched();
+	}
+
+	return 0;
+}
+
+void
+omx_iface_sqpoll_start(struct omx_iface * iface)
+{
+	struct task_struct * task;
+	int cpu = omx_sqpoll_cpu;
+
+	iface->sqpoll_task = NULL;
+	iface->sqpoll_idle = 0;
+
+	if (cpu < 0)
+		return;
+
+	if (cpu >= nr_cpu_ids || !cpu_online(cpu)) {
+		printk(KERN_ERR "Open-MX:   Cannot poll interface '%s' command queues on offline cpu %d\n",
+		       iface->eth_ifp->name, cpu);
+		return;
+	}
+
+	task = kthread_create(omx_iface_sqpoll_thread, iface, "omx_sqpoll/%d", iface->index);
+	if (IS_ERR(task)) {
+		printk(KERN_ERR "Open-MX:   Failed to create interface '%s' command queue polling thread, error %ld\n",
+		       iface->eth_ifp->name, PTR_ERR(task));
+		return;
+	}
+
+	kthread_bind(task, cpu);
+	iface->sqpoll_task = task;
+	wake_up_process(task);
+
+	printk(KERN_INFO "Open-MX:   Polling interface '%s' command queues on cpu %d\n",
+	       iface->eth_ifp->name, cpu);
+}
+
+void
+omx_iface_sqpoll_stop(struct omx_iface * iface)
+{
+	if (iface->sqpoll_task)
+		kthread_stop(iface->sqpoll_task);
+}
+
 /******************************
  * File operations
  */
@@ -442,6 +720,8 @@ static int (*omx_ioctl_with_endpoint_handlers[])(struct omx_endpoint * endpoint,
 	[OMX_EPCMD_WAKEUP]			= omx_ioctl_wakeup,
 	[OMX_EPCMD_RELEASE_EXP_SLOTS]		= omx_ioctl_release_exp_slots,
 	[OMX_EPCMD_RELEASE_UNEXP_SLOTS]		= omx_ioctl_release_unexp_slots,
+	[OMX_EPCMD_SEND_MEDIUMSQ]		= omx_ioctl_send_mediumsq,
+	[OMX_EPCMD_CMDQ_DOORBELL]		= omx_ioctl_cmdq_doorbell,
 };
 
 /*
@@ -796,6 +1076,9 @@ omx_miscdev_mmap(struct file * file, struct vm_area_struct * vma)
 			return -EPERM;
 		return omx_remap_vmalloc_range(vma, endpoint->unexp_eventq, 0);
 
+	} else if (offset == OMX_CMDQ_FILE_OFFSET && size == OMX_CMDQ_SIZE) { /* page-alignment enforced at init */
+		return omx_remap_vmalloc_range(vma, endpoint->cmdq, 0);
+
 	} else {
 		printk(KERN_ERR "Open-MX: Cannot mmap 0x%lx at 0x%lx\n", size, offset);
 		return -EINVAL;
@@ -889,6 +1172,10 @@ omx_dev_init(void)
 		printk(KERN_ERR "Open-MX: Cannot use unexp eventq with non-page-aligned size %lx\n", OMX_UNEXP_EVENTQ_SIZE);
 		return -EINVAL;
 	}
+	if (OMX_CMDQ_SIZE & ~PAGE_MASK) {
+		printk(KERN_ERR "Open-MX: Cannot use cmdq with non-page-aligned size %lx\n", OMX_CMDQ_SIZE);
+		return -EINVAL;
+	}
 
 	ret = misc_register(&omx_miscdev);
 	if (ret < 0) {
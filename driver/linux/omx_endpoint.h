@@ -73,6 +73,11 @@ struct omx_endpoint {
 	 */
 	struct omx_endpoint_desc * userdesc;
 
+	/* command queue, filled by user-space and drained on doorbell */
+	void * cmdq;
+	uint32_t cmdq_next_index;
+	spinlock_t cmdq_lock;
+
 	/* common event queues stuff */
 	struct list_head waiters;
 	spinlock_t waiters_lock;
@@ -130,6 +135,7 @@ omx_endpoint_release(struct omx_endpoint * endpoint)
 	kref_put(&endpoint->refcount, __omx_endpoint_last_release);
 }
 
+extern int omx_endpoint_cmdq_drain(struct omx_endpoint * endpoint, int notify_errors);
 extern int omx_ioctl_bench(struct omx_endpoint * endpoint, void __user * uparam);
 
 #endif /* __omx_endpoint_h__ */
@@ -85,6 +85,7 @@ struct omx_event_waiter {
 	struct list_head list_elt;
 	struct task_struct *task;
 	struct rcu_head rcu_head;
+	uint32_t id;
 	uint8_t status;
 };
 
@@ -103,6 +104,45 @@ omx_wakeup_waiter_list(struct omx_endpoint *endpoint,
 	rcu_read_unlock();
 }
 
+/*
+ * Any waiter processes all pending events once back in user-space, and the
+ * library then wakes up the other ones whose requests completed, so only
+ * wake up a single waiter that is not already being woken up.
+ */
+static INLINE void
+omx_wakeup_one_waiter(struct omx_endpoint *endpoint)
+{
+	struct omx_event_waiter *waiter;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(waiter, &endpoint->waiters, list_elt) {
+		if (waiter->status == OMX_CMD_WAIT_EVENT_STATUS_NONE) {
+			waiter->status = OMX_CMD_WAIT_EVENT_STATUS_EVENT;
+			wake_up_process(waiter->task);
+			break;
+		}
+	}
+	rcu_read_unlock();
+}
+
+/* targeted wakeup from the library, the id is chosen by the library */
+static INLINE void
+omx_wakeup_waiter_by_id(struct omx_endpoint *endpoint,
+			uint32_t id, uint32_t status)
+{
+	struct omx_event_waiter *waiter;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(waiter, &endpoint->waiters, list_elt) {
+		if (waiter->id == id) {
+			waiter->status = status;
+			wake_up_process(waiter->task);
+			break;
+		}
+	}
+	rcu_read_unlock();
+}
+
 static void
 omx_wakeup_on_timeout_handler(unsigned long data)
 {
@@ -172,6 +212,62 @@ omx_endpoint_queues_init(struct omx_endpoint *endpoint)
 	spin_lock_init(&endpoint->release_unexp_lock);
 }
 
+/*
+ * User-space does not release event slots with ioctls, it publishes
+ * the index of the next slot it will process in its endpoint descriptor.
+ * The descriptor is writable by user-space, so never release slots that
+ * were not given to it.
+ */
+void
+omx_endpoint_release_consumed_slots(struct omx_endpoint *endpoint)
+{
+	struct omx_endpoint_desc *userdesc = endpoint->userdesc;
+	omx_eventq_index_t index;
+
+	index = ACCESS_ONCE(userdesc->exp_eventq_index);
+	if (index != endpoint->nextreleased_exp_eventq_index) {
+		spin_lock_bh(&endpoint->release_exp_lock);
+		if ((omx_eventq_index_t) (index - endpoint->nextreleased_exp_eventq_index)
+		    <= (omx_eventq_index_t) (endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index))
+			endpoint->nextreleased_exp_eventq_index = index;
+		spin_unlock_bh(&endpoint->release_exp_lock);
+	}
+
+	index = ACCESS_ONCE(userdesc->unexp_eventq_index);
+	if (index != endpoint->nextreleased_unexp_eventq_index) {
+		spin_lock_bh(&endpoint->release_unexp_lock);
+		if ((omx_eventq_index_t) (index - endpoint->nextreleased_unexp_eventq_index)
+		    <= (omx_eventq_index_t) (endpoint->nextreserved_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index))
+			endpoint->nextreleased_unexp_eventq_index = index;
+		spin_unlock_bh(&endpoint->release_unexp_lock);
+	}
+}
+
+/* only look at the slots released by user-space when a queue looks full */
+static INLINE int
+omx_exp_eventq_overflow(struct omx_endpoint *endpoint)
+{
+	if (likely(endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index
+		   <= OMX_EXP_EVENTQ_ENTRY_NR))
+		return 0;
+
+	omx_endpoint_release_consumed_slots(endpoint);
+	return endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index
+		> OMX_EXP_EVENTQ_ENTRY_NR;
+}
+
+static INLINE int
+omx_unexp_eventq_overflow(struct omx_endpoint *endpoint)
+{
+	if (likely(endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
+		   <= OMX_UNEXP_EVENTQ_ENTRY_NR))
+		return 0;
+
+	omx_endpoint_release_consumed_slots(endpoint);
+	return endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
+		> OMX_UNEXP_EVENTQ_ENTRY_NR;
+}
+
 /******************************************
  * Report an expected event to users-space
  */
@@ -185,8 +281,7 @@ omx_notify_exp_event(struct omx_endpoint *endpoint, const void *event, int lengt
 	/* take the next slot and update the queue */
 	index = atomic_inc_return((atomic_t *) &endpoint->nextfree_exp_eventq_index) - 1;
 
-	if (unlikely(endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index
-		     > OMX_EXP_EVENTQ_ENTRY_NR)) {
+	if (unlikely(omx_exp_eventq_overflow(endpoint))) {
 		/* we went too far, rollback */
 		atomic_dec((atomic_t *) &endpoint->nextfree_exp_eventq_index);
 		/* the application sucks, it did not check
@@ -208,9 +303,9 @@ omx_notify_exp_event(struct omx_endpoint *endpoint, const void *event, int lengt
 	((struct omx_evt_generic *) slot)->id = 1 + (index % OMX_EVENT_ID_MAX);
 
 	/* wake up waiters */
-	dprintk(EVENT, "notify_exp waking up everybody\n");
+	dprintk(EVENT, "notify_exp waking up one waiter\n");
 
-	omx_wakeup_waiter_list(endpoint, OMX_CMD_WAIT_EVENT_STATUS_EVENT);
+	omx_wakeup_one_waiter(endpoint);
 
 	return 0;
 }
@@ -232,8 +327,7 @@ omx_notify_unexp_event(struct omx_endpoint *endpoint, const void *event, int len
 	index = endpoint->nextreserved_unexp_eventq_index++;
 	spin_unlock_bh(&endpoint->unexp_lock);
 
-	if (unlikely(endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
-		     > OMX_UNEXP_EVENTQ_ENTRY_NR)) {
+	if (unlikely(omx_unexp_eventq_overflow(endpoint))) {
 		/* we went too far, rollback */
 		spin_lock_bh(&endpoint->unexp_lock);
 		endpoint->nextfree_unexp_eventq_index--;
@@ -256,9 +350,9 @@ omx_notify_unexp_event(struct omx_endpoint *endpoint, const void *event, int len
 	((struct omx_evt_generic *) slot)->id = 1 + (index % OMX_EVENT_ID_MAX);
 
 	/* wake up waiters */
-	dprintk(EVENT, "notify_unexp waking up everybody\n");
+	dprintk(EVENT, "notify_unexp waking up one waiter\n");
 
-	omx_wakeup_waiter_list(endpoint, OMX_CMD_WAIT_EVENT_STATUS_EVENT);
+	omx_wakeup_one_waiter(endpoint);
 
 	return 0;
 }
@@ -289,8 +383,7 @@ omx_prepare_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint,
 	recvq_index = endpoint->next_recvq_index++;
 	spin_unlock_bh(&endpoint->unexp_lock);
 
-	if (unlikely(endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
-		     > OMX_UNEXP_EVENTQ_ENTRY_NR)) {
+	if (unlikely(omx_unexp_eventq_overflow(endpoint))) {
 		/* we went too far, rollback */
 		spin_lock_bh(&endpoint->unexp_lock);
 		endpoint->nextfree_unexp_eventq_index--;
@@ -324,8 +417,7 @@ omx_prepare_notify_unexp_events_with_recvq(struct omx_endpoint *endpoint,
 	endpoint->next_recvq_index += nr;
 	spin_unlock_bh(&endpoint->unexp_lock);
 
-	if (unlikely(endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
-		     > OMX_UNEXP_EVENTQ_ENTRY_NR)) {
+	if (unlikely(omx_unexp_eventq_overflow(endpoint))) {
 		/* we went too far, rollback */
 		spin_lock_bh(&endpoint->unexp_lock);
 		endpoint->nextfree_unexp_eventq_index -= nr;
@@ -376,9 +468,9 @@ omx_commit_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint,
 	((struct omx_evt_generic *) slot)->id = 1 + (index % OMX_EVENT_ID_MAX);
 
 	/* wake up waiters */
-	dprintk(EVENT, "commit_notify_unexp waking up everybody\n");
+	dprintk(EVENT, "commit_notify_unexp waking up one waiter\n");
 
-	omx_wakeup_waiter_list(endpoint, OMX_CMD_WAIT_EVENT_STATUS_EVENT);
+	omx_wakeup_one_waiter(endpoint);
 }
 
 /*
@@ -461,11 +553,10 @@ omx_ioctl_wait_event(struct omx_endpoint * endpoint, void __user * uparam)
 		goto out;
 	}
 
-	/* FIXME: wait on some event type only */
-
 	/* queue ourself on the wait queue first, in case a packet arrives in the meantime */
 	waiter->status = OMX_CMD_WAIT_EVENT_STATUS_NONE;
 	waiter->task = current;
+	waiter->id = cmd.waiter_id;
 	set_current_state(TASK_INTERRUPTIBLE);
 	spin_lock(&endpoint->waiters_lock);
 	list_add_tail_rcu(&waiter->list_elt, &endpoint->waiters);
@@ -573,13 +664,13 @@ int
 omx_ioctl_release_exp_slots(struct omx_endpoint *endpoint, void __user *uparam)
 {
 	int err = 0;
-	spin_lock(&endpoint->release_exp_lock);
+	spin_lock_bh(&endpoint->release_exp_lock);
 	if (endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index
 	    < OMX_EXP_RELEASE_SLOTS_BATCH_NR)
 		err = -EINVAL;
 	else
 		endpoint->nextreleased_exp_eventq_index += OMX_EXP_RELEASE_SLOTS_BATCH_NR;
-	spin_unlock(&endpoint->release_exp_lock);
+	spin_unlock_bh(&endpoint->release_exp_lock);
 	return err;
 }
 
@@ -587,13 +678,13 @@ int
 omx_ioctl_release_unexp_slots(struct omx_endpoint *endpoint, void __user *uparam)
 {
 	int err = 0;
-	spin_lock(&endpoint->release_unexp_lock);
+	spin_lock_bh(&endpoint->release_unexp_lock);
 	if (endpoint->nextreserved_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
 	    < OMX_UNEXP_RELEASE_SLOTS_BATCH_NR)
 		err = -EINVAL;
 	else
 		endpoint->nextreleased_unexp_eventq_index += OMX_UNEXP_RELEASE_SLOTS_BATCH_NR;
-	spin_unlock(&endpoint->release_unexp_lock);
+	spin_unlock_bh(&endpoint->release_unexp_lock);
 	return err;
 }
 
@@ -610,7 +701,10 @@ omx_ioctl_wakeup(struct omx_endpoint * endpoint, void __user * uparam)
 		goto out;
 	}
 
-	omx_wakeup_waiter_list(endpoint, cmd.status);
+	if (cmd.waiter_id)
+		omx_wakeup_waiter_by_id(endpoint, cmd.waiter_id, cmd.status);
+	else
+		omx_wakeup_waiter_list(endpoint, cmd.status);
 
 	return 0;
 
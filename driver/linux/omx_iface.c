@@ -24,6 +24,7 @@
 #include <linux/device.h>
 #include <linux/slab.h>
 #include <linux/pci.h>
+#include <linux/percpu.h>
 #ifdef OMX_HAVE_MUTEX
 #include <linux/mutex.h>
 #endif
@@ -397,6 +398,226 @@ omx_for_each_endpoint_in_mm(struct mm_struct *mm,
 	rcu_read_unlock();
 }
 
+/******************************
+ * Batched transmit
+ */
+
+/*
+ * Start batching the skbs that the current cpu queues for xmit on this iface,
+ * until the matching omx_iface_xmit_batch_end(). Batches may be nested.
+ * Bottom halves remain disabled in the meantime, the caller cannot sleep.
+ */
+void
+omx_iface_xmit_batch_begin(struct omx_iface * iface)
+{
+	if (omx_xmit_batch_max <= 1)
+		return;
+
+	local_bh_disable();
+	per_cpu_ptr(iface->xmit_batches, smp_processor_id())->depth++;
+}
+
+#if (defined OMX_HAVE_NETDEV_START_XMIT) && (defined OMX_HAVE_DEV_NIT_ACTIVE)
+/*
+ * Whether the batch may be given to the driver directly.
+ * Only when the stack would not do anything else with it: no qdisc to keep
+ * ordered with (noqueue), no packet taps, and a single tx queue to select.
+ * Called with bottom halves disabled.
+ */
+static int
+omx_iface_xmit_batch_direct(struct net_device * ifp, struct netdev_queue * txq)
+{
+	return netif_running(ifp)
+		&& ifp->real_num_tx_queues == 1
+		&& !rcu_dereference_bh(txq->qdisc)->enqueue
+		&& !dev_nit_active(ifp);
+}
+#endif /* OMX_HAVE_NETDEV_START_XMIT && OMX_HAVE_DEV_NIT_ACTIVE */
+
+/* Called with bottom halves disabled */
+static void
+omx_iface_xmit_batch_flush(struct omx_iface * iface, struct sk_buff_head * queue)
+{
+	struct sk_buff * skb;
+#if (defined OMX_HAVE_NETDEV_START_XMIT) && (defined OMX_HAVE_DEV_NIT_ACTIVE)
+	struct net_device * ifp = iface->eth_ifp;
+	struct netdev_queue * txq = netdev_get_tx_queue(ifp, 0);
+
+	if (skb_queue_len(queue) > 1
+	    && omx_iface_xmit_batch_direct(ifp, txq)) {
+		int cpu = smp_processor_id();
+
+		/*
+		 * Give the whole batch to the driver under a single tx lock,
+		 * and tell it that more skbs are coming so that it only rings
+		 * its doorbell for the last one.
+		 */
+		__netif_tx_lock(txq, cpu);
+		while ((skb = __skb_dequeue(queue)) != NULL) {
+			if (unlikely(netif_xmit_frozen_or_stopped(txq))) {
+				__skb_queue_head(queue, skb);
+				break;
+			}
+			skb_set_queue_mapping(skb, 0);
+			if (unlikely(!dev_xmit_complete(netdev_start_xmit(skb, ifp, txq,
+									  !skb_queue_empty(queue))))) {
+				__skb_queue_head(queue, skb);
+				break;
+			}
+		}
+		__netif_tx_unlock(txq);
+	}
+#endif /* OMX_HAVE_NETDEV_START_XMIT && OMX_HAVE_DEV_NIT_ACTIVE */
+
+	/*
+	 * Otherwise, go through the qdisc so that packets stay ordered with
+	 * those it already queued, taps see them, and the tx queue is selected
+	 * as usual. Its bulk dequeue gives the driver the xmit_more hint.
+	 */
+	while ((skb = __skb_dequeue(queue)) != NULL)
+		dev_queue_xmit(skb);
+}
+
+/* Transmit the skbs queued since omx_iface_xmit_batch_begin() */
+void
+omx_iface_xmit_batch_end(struct omx_iface * iface)
+{
+	struct omx_xmit_batch * batch;
+
+	if (omx_xmit_batch_max <= 1)
+		return;
+
+	batch = per_cpu_ptr(iface->xmit_batches, smp_processor_id());
+	if (!--batch->depth)
+		omx_iface_xmit_batch_flush(iface, &batch->queue);
+	local_bh_enable();
+}
+
+/* Transmit a skb now, or queue it if the current cpu is batching on this iface */
+void
+omx_iface_queue_xmit(struct omx_iface * iface, struct sk_buff * skb)
+{
+	struct omx_xmit_batch * batch;
+
+	if (omx_xmit_batch_max <= 1) {
+		dev_queue_xmit(skb);
+		return;
+	}
+
+	local_bh_disable();
+	batch = per_cpu_ptr(iface->xmit_batches, smp_processor_id());
+	if (batch->depth) {
+		__skb_queue_tail(&batch->queue, skb);
+		if (skb_queue_len(&batch->queue) >= omx_xmit_batch_max)
+			omx_iface_xmit_batch_flush(iface, &batch->queue);
+	} else {
+		dev_queue_xmit(skb);
+	}
+	local_bh_enable();
+}
+
+/******************************
+ * Pools of header-only skbs
+ *
+ * Medium frag and pull reply skbs only contain the headers, their payload
+ * pages are attached as frags. Instead of allocating one for each packet,
+ * the skb is kept in a per-cpu pool and a clone of it is transmitted. The
+ * clone shares the data (and thus the frags), and its destructor still
+ * runs once the device releases it. The pooled skb becomes reusable when
+ * its data is not shared anymore, it only needs to drop the old frags.
+ */
+
+#define OMX_SKB_POOL_LEN sizeof(struct omx_hdr)
+
+/* drop the frags of the previous send and empty the skb */
+static void
+omx_skb_pool_reset(struct sk_buff * skb)
+{
+	struct skb_shared_info * shinfo = skb_shinfo(skb);
+	int i;
+
+	for(i=0; i<shinfo->nr_frags; i++)
+		put_page(skb_frag_page(&shinfo->frags[i]));
+	shinfo->nr_frags = 0;
+	skb->data_len = 0;
+	__skb_trim(skb, 0);
+}
+
+/*
+ * Get a skb with room for a len-byte header, frags may be attached later.
+ * Once ready, it must be given to omx_iface_pool_skb() to get the skb to transmit.
+ */
+struct sk_buff *
+omx_iface_new_skb(struct omx_iface * iface, unsigned long len)
+{
+	struct sk_buff_head * pool;
+	struct sk_buff * skb;
+
+	if (!omx_skb_pool_max)
+		return omx_new_skb(len);
+
+	BUG_ON(len > OMX_SKB_POOL_LEN);
+
+	/* the oldest skb is the most likely to be released already */
+	pool = per_cpu_ptr(iface->skb_pools, raw_smp_processor_id());
+	spin_lock_bh(&pool->lock);
+	skb = skb_peek(pool);
+	if (skb && !skb_cloned(skb))
+		__skb_unlink(skb, pool);
+	else
+		skb = NULL;
+	spin_unlock_bh(&pool->lock);
+
+	if (likely(skb != NULL)) {
+		omx_counter_inc(iface, SEND_SKB_POOL_HIT);
+		omx_skb_pool_reset(skb);
+	} else {
+		omx_counter_inc(iface, SEND_SKB_POOL_MISS);
+		/* the clone is allocated along with the skb and reused with it */
+		skb = alloc_skb_fclone(OMX_SKB_POOL_LEN, GFP_ATOMIC);
+		if (unlikely(skb == NULL))
+			return NULL;
+	}
+
+	omx_skb_init(skb, len);
+	return skb;
+}
+
+/*
+ * Keep a skb from omx_iface_new_skb() in the pool and return a clone to
+ * transmit instead. The destructor must be set on the returned clone.
+ * Releases the skb and returns NULL if the clone cannot be allocated.
+ */
+struct sk_buff *
+omx_iface_pool_skb(struct omx_iface * iface, struct sk_buff * skb)
+{
+	struct sk_buff_head * pool;
+	struct sk_buff * clone;
+
+	if (!omx_skb_pool_max)
+		return skb;
+
+	clone = skb_clone(skb, GFP_ATOMIC);
+	if (unlikely(clone == NULL)) {
+		kfree_skb(skb);
+		return NULL;
+	}
+
+	pool = per_cpu_ptr(iface->skb_pools, raw_smp_processor_id());
+	spin_lock_bh(&pool->lock);
+	if (skb_queue_len(pool) < omx_skb_pool_max) {
+		__skb_queue_tail(pool, skb);
+		skb = NULL;
+	}
+	spin_unlock_bh(&pool->lock);
+
+	/* the pool is full of skbs still being sent, the clone keeps the data alive */
+	if (skb)
+		kfree_skb(skb);
+
+	return clone;
+}
+
 /******************************
  * Attaching/Detaching interfaces
  */
@@ -415,7 +636,7 @@ omx_iface_attach(struct net_device * ifp)
 	unsigned mtu = ifp->mtu;
 	unsigned rx_coalesce;
 	int ret;
-	int i;
+	int i, cpu;
 
 	if (omx_iface_nr == omx_iface_max) {
 		printk(KERN_ERR "Open-MX: Too many interfaces already attached\n");
@@ -498,6 +719,25 @@ omx_iface_attach(struct net_device * ifp)
 		goto out_with_iface_hostname;
 	}
 
+	iface->xmit_batches = alloc_percpu(struct omx_xmit_batch);
+	if (!iface->xmit_batches) {
+		printk(KERN_ERR "Open-MX:   Failed to allocate interface xmit batches\n");
+		ret = -ENOMEM;
+		goto out_with_endpoints;
+	}
+
+	iface->skb_pools = alloc_percpu(struct sk_buff_head);
+	if (!iface->skb_pools) {
+		printk(KERN_ERR "Open-MX:   Failed to allocate interface skb pools\n");
+		ret = -ENOMEM;
+		goto out_with_xmit_batches;
+	}
+
+	for_each_possible_cpu(cpu) {
+		skb_queue_head_init(&per_cpu_ptr(iface->xmit_batches, cpu)->queue);
+		skb_queue_head_init(per_cpu_ptr(iface->skb_pools, cpu));
+	}
+
 	omx_iface_raw_init(&iface->raw);
 
 	kref_init(&iface->refcount);
@@ -509,6 +749,8 @@ omx_iface_attach(struct net_device * ifp)
 		goto out_with_raw;
 
 	iface->index = i;
+	omx_iface_sqpoll_start(iface);
+
 	rcu_assign_pointer(omx_ifaces[i], iface);
 	omx_iface_nr++;
 
@@ -516,6 +758,10 @@ omx_iface_attach(struct net_device * ifp)
 
  out_with_raw:
 	omx_iface_raw_exit(&iface->raw);
+	free_percpu(iface->skb_pools);
+ out_with_xmit_batches:
+	free_percpu(iface->xmit_batches);
+ out_with_endpoints:
 	kfree(iface->endpoints);
  out_with_iface_hostname:
 	kfree(hostname);
@@ -533,11 +779,19 @@ __omx_iface_last_release(struct kref *kref)
 {
 	struct omx_iface * iface = container_of(kref, struct omx_iface, refcount);
 	struct net_device * ifp = iface->eth_ifp;
+	int cpu;
 
 	dprintk(KREF, "releasing the last reference on %s (interface '%s')\n",
 		iface->peer.hostname, ifp->name);
 
+	/* no endpoint may use the iface anymore, stop polling them */
+	omx_iface_sqpoll_stop(iface);
+
 	omx_iface_raw_exit(&iface->raw);
+	for_each_possible_cpu(cpu)
+		skb_queue_purge(per_cpu_ptr(iface->skb_pools, cpu));
+	free_percpu(iface->skb_pools);
+	free_percpu(iface->xmit_batches);
 	kfree(iface->endpoints);
 	kfree(iface->peer.hostname);
 	kfree(iface->reverse_peer_indexes);
@@ -57,6 +57,12 @@ struct omx_iface_raw {
 	int event_list_length;
 };
 
+/* skbs queued on one cpu during a batch, to be transmitted at once */
+struct omx_xmit_batch {
+	struct sk_buff_head queue;
+	int depth;
+};
+
 struct omx_iface {
 	int index;
 
@@ -71,6 +77,16 @@ struct omx_iface {
 	struct omx_endpoint __rcu ** endpoints;
 	struct omx_iface_raw raw;
 
+	/* optional thread draining the endpoint cmdqs */
+	struct task_struct * sqpoll_task;
+	int sqpoll_idle;
+
+	/* per-cpu batches of skbs to transmit */
+	struct omx_xmit_batch * xmit_batches;
+
+	/* per-cpu header-only skbs kept across transmission, oldest first */
+	struct sk_buff_head * skb_pools;
+
 	uint32_t counters[OMX_COUNTER_INDEX_MAX];
 };
 
@@ -95,6 +111,16 @@ omx_iface_reacquire(struct omx_iface * iface)
 
 extern struct omx_iface * omx_iface_find_by_index_lock(int board_index);
 
+extern void omx_iface_sqpoll_start(struct omx_iface * iface);
+extern void omx_iface_sqpoll_stop(struct omx_iface * iface);
+
+extern void omx_iface_xmit_batch_begin(struct omx_iface * iface);
+extern void omx_iface_xmit_batch_end(struct omx_iface * iface);
+extern void omx_iface_queue_xmit(struct omx_iface * iface, struct sk_buff * skb);
+
+extern struct sk_buff * omx_iface_new_skb(struct omx_iface * iface, unsigned long len);
+extern struct sk_buff * omx_iface_pool_skb(struct omx_iface * iface, struct sk_buff * skb);
+
 extern void omx_for_each_iface(int (*handler)(struct omx_iface *iface, void *data), void *data);
 extern void omx_for_each_endpoint(int (*handler)(struct omx_endpoint *endpoint, void *data), void *data);
 extern void omx_for_each_endpoint_in_mm(struct mm_struct *mm, int (*handler)(struct omx_endpoint *endpoint, void *data), void *data);
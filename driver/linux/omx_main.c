@@ -83,6 +83,14 @@ int omx_skb_copy_max = 0;
 module_param_named(skbcopy, omx_skb_copy_max, uint, S_IRUGO|S_IWUSR);
 MODULE_PARM_DESC(skbcopy, "Maximum length of data to copy in linear skb instead of attaching pages");
 
+int omx_xmit_batch_max = 32;
+module_param_named(xmitbatch, omx_xmit_batch_max, uint, S_IRUGO); /* not writable, batches must begin and end with the same value */
+MODULE_PARM_DESC(xmitbatch, "Maximal number of skbs to transmit at once at the end of a command batch or pull block");
+
+int omx_skb_pool_max = 16;
+module_param_named(skbpool, omx_skb_pool_max, uint, S_IRUGO); /* not writable, pooled skbs must be sent as clones */
+MODULE_PARM_DESC(skbpool, "Number of header-only skbs to keep across transmission for reuse per cpu and interface");
+
 int omx_pin_synchronous = 1;
 module_param_named(pinsync, omx_pin_synchronous, uint, S_IRUGO); /* not writable to simplify things */
 MODULE_PARM_DESC(pinsync, "Pin user regions synchronously on register");
@@ -103,6 +111,14 @@ int omx_pin_invalidate = 0;
 module_param_named(pininvalidate, omx_pin_invalidate, uint, S_IRUGO); /* not writable to simplify things */
 MODULE_PARM_DESC(pininvalidate, "User region pin invalidating when MMU notifiers are supported");
 
+int omx_sqpoll_cpu = -1;
+module_param_named(sqpollcpu, omx_sqpoll_cpu, int, S_IRUGO); /* not writable, threads are created when attaching interfaces */
+MODULE_PARM_DESC(sqpollcpu, "CPU where a thread per interface polls the endpoint command queues, -1 to disable");
+
+int omx_sqpoll_idle_us = 1000;
+module_param_named(sqpollidle, omx_sqpoll_idle_us, uint, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(sqpollidle, "Microseconds without any command before a polling thread sleeps");
+
 unsigned long omx_user_rights = 0;
 module_param_named(userrights, omx_user_rights, ulong, S_IRUGO|S_IWUSR);
 MODULE_PARM_DESC(userrights, "Mask of privileged operation rights that are granted regular users");
@@ -294,8 +310,19 @@ omx_get_driver_string(unsigned int *lenp)
 	buflen += len;
 
 	len = snprintf(tmp, OMX_DRIVER_STRING_LEN-buflen,
-		       " SkBuff: <=%d frags%s, ForcedCopy <=%dB\n",
-		       omx_skb_frags, omx_skb_frags ? "" : " (always linear)", omx_skb_copy_max);
+		       " SkBuff: <=%d frags%s, ForcedCopy <=%dB, XmitBatch <=%d, Pool %d/cpu\n",
+		       omx_skb_frags, omx_skb_frags ? "" : " (always linear)", omx_skb_copy_max,
+		       omx_xmit_batch_max, omx_skb_pool_max);
+	tmp += len;
+	buflen += len;
+
+	if (omx_sqpoll_cpu >= 0)
+		len = snprintf(tmp, OMX_DRIVER_STRING_LEN-buflen,
+			       " CmdqPolling: CPU %d Idle %dus\n",
+			       omx_sqpoll_cpu, omx_sqpoll_idle_us);
+	else
+		len = snprintf(tmp, OMX_DRIVER_STRING_LEN-buflen,
+			       " CmdqPolling: Disabled\n");
 	tmp += len;
 	buflen += len;
 
@@ -26,6 +26,23 @@
 #include "omx_io.h"
 #include "omx_wire.h"
 
+/* initialize a freshly allocated (or reused) skb to contain a OMX packet of len bytes */
+static inline void
+omx_skb_init(struct sk_buff *skb, unsigned long len)
+{
+	omx_skb_reset_mac_header(skb);
+	omx_skb_reset_network_header(skb);
+	skb->protocol = __constant_htons(ETH_P_OMX);
+	skb->priority = 0;
+	skb_put(skb, len);
+	skb->next = skb->prev = NULL;
+
+	/* tell the network layer not to perform IP checksums
+	 * or to get the NIC to do it
+	 */
+	skb->ip_summed = CHECKSUM_NONE;
+}
+
 /* set/get a skb destructor and its data */
 static inline void
 omx_set_skb_destructor(struct sk_buff *skb, void (*callback)(struct sk_buff *skb), const void * data)
@@ -48,12 +65,15 @@ omx_get_skb_destructor_data(const struct sk_buff *skb)
 #endif
 }
 
-/* queue a skb for xmit, account it, and eventually actually drop it for debugging */
+/*
+ * queue a skb for xmit (or in the current xmit batch), account it,
+ * and eventually actually drop it for debugging
+ */
 #define __omx_queue_xmit(iface, skb, type)	\
 do {						\
 	omx_counter_inc(iface, SEND_##type);	\
 	skb->dev = iface->eth_ifp;		\
-	dev_queue_xmit(skb);			\
+	omx_iface_queue_xmit(iface, skb);	\
 } while (0)
 
 #ifdef OMX_DRIVER_DEBUG
@@ -1247,6 +1247,9 @@ omx_recv_pull_request(struct omx_iface * iface,
 		goto out_with_region;
 	}
 
+	/* transmit all replies at once */
+	omx_iface_xmit_batch_begin(iface);
+
 	/* send all replies */
 	for(i=0; i<replies; i++) {
 		struct sk_buff *skb;
@@ -1264,13 +1267,13 @@ omx_recv_pull_request(struct omx_iface * iface,
 			goto linear;
 
 		/* allocate a skb */
-		skb = omx_new_skb(/* only allocate space for the header now, we'll attach pages later */
-				  reply_hdr_len);
+		skb = omx_iface_new_skb(iface, /* only allocate space for the header now, we'll attach pages later */
+					reply_hdr_len);
 		if (unlikely(skb == NULL)) {
 			omx_counter_inc(iface, SEND_NOMEM_SKB);
 			omx_drop_dprintk(pull_eh, "PULL packet due to failure to create pull reply skb");
 			err = -ENOMEM;
-			goto out_with_region;
+			goto out_with_batch;
 		}
 
 		/* append segment pages */
@@ -1278,6 +1281,15 @@ omx_recv_pull_request(struct omx_iface * iface,
 		if (likely(!err)) {
 			/* successfully appended frags */
 
+			/* keep the skb for reuse and send a clone of it */
+			skb = omx_iface_pool_skb(iface, skb);
+			if (unlikely(skb == NULL)) {
+				omx_counter_inc(iface, SEND_NOMEM_SKB);
+				omx_drop_dprintk(pull_eh, "PULL packet due to failure to clone pull reply skb");
+				err = -ENOMEM;
+				goto out_with_batch;
+			}
+
 			/* reacquire the region and keep the reference for the destructor */
 			omx_user_region_reacquire(region);
 			omx_set_skb_destructor(skb, omx_send_pull_reply_skb_destructor, region);
@@ -1304,7 +1316,7 @@ omx_recv_pull_request(struct omx_iface * iface,
 				omx_counter_inc(iface, SEND_NOMEM_SKB);
 				omx_drop_dprintk(pull_eh, "PULL packet due to failure to create pull reply linear skb");
 				err = -ENOMEM;
-				goto out_with_region;
+				goto out_with_batch;
 			}
 
 			/* locate new headers */
@@ -1347,12 +1359,16 @@ omx_recv_pull_request(struct omx_iface * iface,
 		block_remaining_length -= frame_length;
 	}
 
+	omx_iface_xmit_batch_end(iface);
+
 	/* release the main reference on the region */
 	omx_user_region_release(region);
 	omx_endpoint_release(endpoint);
 	dev_kfree_skb(orig_skb);
 	return 0;
 
+ out_with_batch:
+	omx_iface_xmit_batch_end(iface);
  out_with_region:
 	/* release the main reference on the region */
 	omx_user_region_release(region);
@@ -69,19 +69,8 @@ omx_new_skb(unsigned long len)
 	struct sk_buff *skb;
 
 	skb = alloc_skb(len, GFP_ATOMIC);
-	if (likely(skb != NULL)) {
-		omx_skb_reset_mac_header(skb);
-		omx_skb_reset_network_header(skb);
-		skb->protocol = __constant_htons(ETH_P_OMX);
-		skb->priority = 0;
-		skb_put(skb, len);
-		skb->next = skb->prev = NULL;
-
-		/* tell the network layer not to perform IP checksums
-		 * or to get the NIC to do it
-		 */
-		skb->ip_summed = CHECKSUM_NONE;
-	}
+	if (likely(skb != NULL))
+		omx_skb_init(skb, len);
 	return skb;
 }
 
@@ -113,6 +102,40 @@ omx_medium_frag_skb_destructor(struct sk_buff *skb)
 	kfree(defevent);
 }
 
+/*
+ * A whole mediumsq message only notifies a single event once all its frag skbs
+ * have been released. The ioctl keeps one reference until all frags are queued.
+ */
+struct omx_mediumsq_deferred_event {
+	struct omx_endpoint *endpoint;
+	atomic_t refcount;
+	struct omx_evt_send_mediumsq_done evt;
+};
+
+static void
+omx_mediumsq_deferred_event_put(struct omx_mediumsq_deferred_event * defevent)
+{
+	struct omx_endpoint * endpoint = defevent->endpoint;
+
+	if (!atomic_dec_and_test(&defevent->refcount))
+		return;
+
+	/* report the event to user-space */
+	omx_notify_exp_event(endpoint,
+			     &defevent->evt, sizeof(defevent->evt));
+
+	/* release objects now */
+	omx_endpoint_release(endpoint);
+	kfree(defevent);
+}
+
+/* mediumsq skb destructor to release sendq pages */
+static void
+omx_mediumsq_skb_destructor(struct sk_buff *skb)
+{
+	omx_mediumsq_deferred_event_put(omx_get_skb_destructor_data(skb));
+}
+
 /*********************
  * Main send routines
  */
@@ -285,15 +308,14 @@ omx_ioctl_send_connect_reply(struct omx_endpoint * endpoint,
 }
 
 int
-omx_ioctl_send_tiny(struct omx_endpoint * endpoint,
-		    void __user * uparam)
+omx_send_tiny(struct omx_endpoint * endpoint,
+	      const struct omx_cmd_send_tiny * cmd)
 {
 	struct sk_buff *skb;
 	struct omx_hdr *mh;
 	struct omx_pkt_head *ph;
 	struct ethhdr *eh;
 	struct omx_pkt_msg *tiny_n;
-	struct omx_cmd_send_tiny_hdr cmd;
 	struct omx_iface * iface = endpoint->iface;
 	struct net_device * ifp = iface->eth_ifp;
 	size_t hdr_len = sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_msg);
@@ -301,14 +323,7 @@ omx_ioctl_send_tiny(struct omx_endpoint * endpoint,
 	int ret;
 	uint8_t length;
 
-	ret = copy_from_user(&cmd, &((struct omx_cmd_send_tiny __user *) uparam)->hdr, sizeof(cmd));
-	if (unlikely(ret != 0)) {
-		printk(KERN_ERR "Open-MX: Failed to read send tiny cmd hdr\n");
-		ret = -EFAULT;
-		goto out;
-	}
-
-	length = cmd.length;
+	length = cmd->hdr.length;
 	if (unlikely(length > OMX_TINY_MSG_LENGTH_MAX)) {
 		printk(KERN_ERR "Open-MX: Cannot send more than %d as a tiny (tried %d)\n",
 		       OMX_TINY_MSG_LENGTH_MAX, length);
@@ -316,8 +331,8 @@ omx_ioctl_send_tiny(struct omx_endpoint * endpoint,
 		goto out;
 	}
 
-	if (unlikely(cmd.shared))
-		return omx_shared_send_tiny(endpoint, &cmd, &((struct omx_cmd_send_tiny __user *) uparam)->data);
+	if (unlikely(cmd->hdr.shared))
+		return omx_shared_send_tiny(endpoint, &cmd->hdr, cmd->data);
 
 	skb = omx_new_skb(/* pad to ETH_ZLEN */
 			  max_t(unsigned long, hdr_len + length, ETH_ZLEN));
@@ -340,7 +355,7 @@ omx_ioctl_send_tiny(struct omx_endpoint * endpoint,
 	memcpy(eh->h_source, ifp->dev_addr, sizeof (eh->h_source));
 
 	/* set destination peer */
-	ret = omx_set_target_peer(ph, iface, cmd.peer_index);
+	ret = omx_set_target_peer(ph, iface, cmd->hdr.peer_index);
 	if (ret < 0) {
 		printk(KERN_INFO "Open-MX: Failed to fill target peer in tiny header\n");
 		goto out_with_skb;
@@ -348,24 +363,19 @@ omx_ioctl_send_tiny(struct omx_endpoint * endpoint,
 
 	/* fill omx header */
 	OMX_HTON_8(tiny_n->src_endpoint, endpoint->endpoint_index);
-	OMX_HTON_8(tiny_n->dst_endpoint, cmd.dest_endpoint);
+	OMX_HTON_8(tiny_n->dst_endpoint, cmd->hdr.dest_endpoint);
 	OMX_HTON_8(tiny_n->ptype, OMX_PKT_TYPE_TINY);
 	OMX_HTON_16(tiny_n->length, length);
-	OMX_HTON_16(tiny_n->lib_seqnum, cmd.seqnum);
-	OMX_HTON_16(tiny_n->lib_piggyack, cmd.piggyack);
-	OMX_HTON_32(tiny_n->session, cmd.session_id);
-	OMX_HTON_16(tiny_n->checksum, cmd.checksum);
-	OMX_HTON_MATCH_INFO(tiny_n, cmd.match_info);
+	OMX_HTON_16(tiny_n->lib_seqnum, cmd->hdr.seqnum);
+	OMX_HTON_16(tiny_n->lib_piggyack, cmd->hdr.piggyack);
+	OMX_HTON_32(tiny_n->session, cmd->hdr.session_id);
+	OMX_HTON_16(tiny_n->checksum, cmd->hdr.checksum);
+	OMX_HTON_MATCH_INFO(tiny_n, cmd->hdr.match_info);
 
 	omx_send_dprintk(eh, "TINY length %ld", (unsigned long) length);
 
 	/* copy the data right after the header */
-	ret = copy_from_user(data, &((struct omx_cmd_send_tiny __user *) uparam)->data, length);
-	if (unlikely(ret != 0)) {
-		printk(KERN_ERR "Open-MX: Failed to read send tiny cmd data\n");
-		ret = -EFAULT;
-		goto out_with_skb;
-	}
+	memcpy(data, cmd->data, length);
 
 #ifdef OMX_DRIVER_DEBUG
 	omx_set_skb_destructor(skb, omx_tiny_skb_debug_destructor, (void *) 0x666);
@@ -381,6 +391,22 @@ omx_ioctl_send_tiny(struct omx_endpoint * endpoint,
 	return ret;
 }
 
+int
+omx_ioctl_send_tiny(struct omx_endpoint * endpoint,
+		    void __user * uparam)
+{
+	struct omx_cmd_send_tiny cmd;
+	int ret;
+
+	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read send tiny cmd\n");
+		return -EFAULT;
+	}
+
+	return omx_send_tiny(endpoint, &cmd);
+}
+
 int
 omx_ioctl_send_small(struct omx_endpoint * endpoint,
 		     void __user * uparam)
@@ -531,8 +557,8 @@ omx_ioctl_send_mediumsq_frag(struct omx_endpoint * endpoint,
 		struct omx_deferred_event * defevent;
 		unsigned int current_sendq_offset, remaining, desc;
 
-		skb = omx_new_skb(/* only allocate space for the header now, we'll attach pages later */
-				   hdr_len);
+		skb = omx_iface_new_skb(iface, /* only allocate space for the header now, we'll attach pages later */
+					 hdr_len);
 		if (unlikely(skb == NULL)) {
 			omx_counter_inc(iface, SEND_NOMEM_SKB);
 			printk(KERN_INFO "Open-MX: Failed to create mediumsq frag skb\n");
@@ -580,6 +606,16 @@ omx_ioctl_send_mediumsq_frag(struct omx_endpoint * endpoint,
 		skb->len += frag_length;
 		skb->data_len = frag_length;
 
+		/* keep the skb for reuse and send a clone of it */
+		skb = omx_iface_pool_skb(iface, skb);
+		if (unlikely(skb == NULL)) {
+			omx_counter_inc(iface, SEND_NOMEM_SKB);
+			printk(KERN_INFO "Open-MX: Failed to clone mediumsq frag skb\n");
+			kfree(defevent);
+			ret = -ENOMEM;
+			goto out;
+		}
+
 		/* prepare the deferred event now that we cannot fail anymore */
 		omx_endpoint_reacquire(endpoint); /* keep a reference in the defevent */
 		defevent->endpoint = endpoint;
@@ -663,6 +699,256 @@ omx_ioctl_send_mediumsq_frag(struct omx_endpoint * endpoint,
 	return ret;
 }
 
+/* queue one frag of a whole mediumsq message, allocate the deferred event if needed */
+static int
+omx_queue_mediumsq_frag(struct omx_endpoint * endpoint,
+			const struct omx_cmd_send_mediumsq * cmd,
+			unsigned frag_seqnum, uint32_t frag_length,
+			struct omx_mediumsq_deferred_event ** defeventp)
+{
+	struct sk_buff *skb;
+	struct omx_hdr *mh;
+	struct omx_pkt_head *ph;
+	struct ethhdr *eh;
+	struct omx_pkt_medium_frag *medium_n;
+	struct omx_iface * iface = endpoint->iface;
+	struct net_device * ifp = iface->eth_ifp;
+	uint32_t sendq_offset = cmd->sendq_index[frag_seqnum] << OMX_SENDQ_ENTRY_SHIFT;
+	struct page * page;
+	size_t hdr_len = sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_medium_frag);
+	int ret;
+
+	if (unlikely(frag_length > omx_skb_copy_max
+		     && hdr_len + frag_length >= ETH_ZLEN
+		     && omx_skb_frags >= (frag_length >> OMX_SENDQ_ENTRY_SHIFT))) {
+		/* use skb with frags */
+
+		struct omx_mediumsq_deferred_event * defevent = *defeventp;
+		unsigned int current_sendq_offset, remaining, desc;
+
+		skb = omx_iface_new_skb(iface, /* only allocate space for the header now, we'll attach pages later */
+					 hdr_len);
+		if (unlikely(skb == NULL)) {
+			omx_counter_inc(iface, SEND_NOMEM_SKB);
+			printk(KERN_INFO "Open-MX: Failed to create mediumsq frag skb\n");
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		if (!defevent) {
+			/* first frag skb of this message, prepare the deferred event */
+			defevent = kmalloc(sizeof(*defevent), GFP_KERNEL);
+			if (unlikely(!defevent)) {
+				omx_counter_inc(iface, SEND_NOMEM_MEDIUM_DEFEVENT);
+				printk(KERN_INFO "Open-MX: Failed to allocate mediumsq deferred event\n");
+				ret = -ENOMEM;
+				goto out_with_skb;
+			}
+
+			omx_endpoint_reacquire(endpoint); /* keep a reference in the defevent */
+			defevent->endpoint = endpoint;
+			atomic_set(&defevent->refcount, 1); /* for the caller */
+			defevent->evt.id = 0;
+			defevent->evt.type = OMX_EVT_SEND_MEDIUMSQ_DONE;
+			defevent->evt.sendq_offset = cmd->sendq_index[0] << OMX_SENDQ_ENTRY_SHIFT;
+			*defeventp = defevent;
+		}
+
+		/* locate headers */
+		mh = omx_skb_mac_header(skb);
+		ph = &mh->head;
+		eh = &ph->eth;
+		medium_n = (struct omx_pkt_medium_frag *) (ph + 1);
+
+		/* set destination peer */
+		ret = omx_set_target_peer(ph, iface, cmd->peer_index);
+		if (ret < 0) {
+			printk(KERN_INFO "Open-MX: Failed to fill target peer in mediumsq frag header\n");
+			goto out_with_skb;
+		}
+
+		/* attach the sendq page */
+		current_sendq_offset = sendq_offset;
+		remaining = frag_length;
+		desc = 0;
+		while (remaining) {
+			unsigned int chunk = remaining;
+			if (chunk > PAGE_SIZE)
+				chunk = PAGE_SIZE;
+			page = endpoint->sendq_pages[current_sendq_offset >> PAGE_SHIFT];
+			get_page(page);
+			skb_fill_page_desc(skb, desc, page, current_sendq_offset & (~PAGE_MASK), chunk);
+			desc++;
+			remaining -= chunk;
+			current_sendq_offset += chunk;
+		}
+		skb->len += frag_length;
+		skb->data_len = frag_length;
+
+		/* keep the skb for reuse and send a clone of it */
+		skb = omx_iface_pool_skb(iface, skb);
+		if (unlikely(skb == NULL)) {
+			omx_counter_inc(iface, SEND_NOMEM_SKB);
+			printk(KERN_INFO "Open-MX: Failed to clone mediumsq frag skb\n");
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		/* the skb keeps a reference on the deferred event now that we cannot fail anymore */
+		atomic_inc(&defevent->refcount);
+		omx_set_skb_destructor(skb, omx_mediumsq_skb_destructor, defevent);
+
+	} else {
+		/* use a linear skb */
+		void *data;
+
+		omx_counter_inc(iface, MEDIUMSQ_FRAG_SEND_LINEAR);
+
+		skb = omx_new_skb(/* pad to ETH_ZLEN */
+				  max_t(unsigned long, hdr_len + frag_length, ETH_ZLEN));
+		if (unlikely(skb == NULL)) {
+			omx_counter_inc(iface, SEND_NOMEM_SKB);
+			printk(KERN_INFO "Open-MX: Failed to create linear mediumsq frag skb\n");
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		/* locate headers */
+		mh = omx_skb_mac_header(skb);
+		ph = &mh->head;
+		eh = &ph->eth;
+		medium_n = (struct omx_pkt_medium_frag *) (ph + 1);
+		data = (char*) (medium_n + 1);
+
+		/* set destination peer */
+		ret = omx_set_target_peer(ph, iface, cmd->peer_index);
+		if (ret < 0) {
+			printk(KERN_INFO "Open-MX: Failed to fill target peer in mediumsq frag header\n");
+			goto out_with_skb;
+		}
+
+		/* copy the data in the linear skb */
+		memcpy(data, endpoint->sendq + sendq_offset, frag_length);
+	}
+
+	/* fill ethernet header */
+	eh->h_proto = __constant_cpu_to_be16(ETH_P_OMX);
+	memcpy(eh->h_source, ifp->dev_addr, sizeof (eh->h_source));
+
+	/* fill omx header */
+	OMX_HTON_8(medium_n->src_endpoint, endpoint->endpoint_index);
+	OMX_HTON_8(medium_n->dst_endpoint, cmd->dest_endpoint);
+	OMX_HTON_8(medium_n->ptype, OMX_PKT_TYPE_MEDIUM);
+#ifdef OMX_MX_WIRE_COMPAT
+	OMX_HTON_16(medium_n->length, cmd->msg_length);
+	OMX_HTON_8(medium_n->frag_pipeline, cmd->frag_pipeline);
+#else
+	OMX_HTON_32(medium_n->length, cmd->msg_length);
+#endif
+	OMX_HTON_16(medium_n->lib_seqnum, cmd->seqnum);
+	OMX_HTON_16(medium_n->lib_piggyack, cmd->piggyack);
+	OMX_HTON_32(medium_n->session, cmd->session_id);
+	OMX_HTON_MATCH_INFO(medium_n, cmd->match_info);
+	OMX_HTON_16(medium_n->frag_length, frag_length);
+	OMX_HTON_8(medium_n->frag_seqnum, frag_seqnum);
+	OMX_HTON_16(medium_n->checksum, cmd->checksum);
+
+	omx_send_dprintk(eh, "MEDIUMSQ FRAG length %ld", (unsigned long) frag_length);
+
+	_omx_queue_xmit(iface, skb, MEDIUM_FRAG, MEDIUMSQ_FRAG);
+
+	return 0;
+
+ out_with_skb:
+	kfree_skb(skb);
+ out:
+	return ret;
+}
+
+int
+omx_ioctl_send_mediumsq(struct omx_endpoint * endpoint,
+			void __user * uparam)
+{
+	struct omx_cmd_send_mediumsq cmd;
+	struct omx_mediumsq_deferred_event * defevent = NULL;
+	uint32_t msg_length, remaining;
+	unsigned frags_nr;
+	int ret;
+	int i;
+
+	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read send mediumsq cmd hdr\n");
+		ret = -EFAULT;
+		goto out;
+	}
+
+	BUILD_BUG_ON(OMX_MEDIUM_FRAG_LENGTH_MAX > OMX_SENDQ_ENTRY_SIZE);
+	BUILD_BUG_ON(OMX_MEDIUM_FRAG_PACKET_SIZE_OF_PAYLOAD(OMX_MEDIUM_FRAG_LENGTH_MAX) > OMX_MTU);
+
+	/* all frags but the last one are full */
+	frags_nr = cmd.frags_nr;
+	msg_length = cmd.msg_length;
+	if (unlikely(!frags_nr || frags_nr > OMX_SEND_MEDIUMSQ_FRAGS_NR_MAX
+		     || msg_length > frags_nr * OMX_MEDIUM_FRAG_LENGTH_MAX
+		     || msg_length <= (frags_nr-1) * OMX_MEDIUM_FRAG_LENGTH_MAX)) {
+		printk(KERN_ERR "Open-MX: Cannot send mediumsq message of length %ld in %d frags\n",
+		       (unsigned long) msg_length, frags_nr);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	for(i=0; i<frags_nr; i++)
+		if (unlikely(cmd.sendq_index[i] >= OMX_SENDQ_ENTRY_NR)) {
+			printk(KERN_ERR "Open-MX: Cannot send mediumsq fragment from sendq entry %ld (max %ld)\n",
+			       (unsigned long) cmd.sendq_index[i], (unsigned long) OMX_SENDQ_ENTRY_NR);
+			ret = -EINVAL;
+			goto out;
+		}
+
+	if (unlikely(cmd.shared))
+		return omx_shared_send_mediumsq(endpoint, &cmd);
+
+	remaining = msg_length;
+	for(i=0; i<frags_nr; i++) {
+		uint32_t frag_length = remaining > OMX_MEDIUM_FRAG_LENGTH_MAX ? OMX_MEDIUM_FRAG_LENGTH_MAX : remaining;
+
+		ret = omx_queue_mediumsq_frag(endpoint, &cmd, i, frag_length, &defevent);
+		if (unlikely(ret < 0)) {
+			if (!i)
+				goto out_with_defevent;
+			/* some frags are gone, the other ones will look lost and get resent later */
+			break;
+		}
+
+		remaining -= frag_length;
+	}
+
+	if (defevent) {
+		/* the event will be notified once all frag skbs are released */
+		omx_mediumsq_deferred_event_put(defevent);
+	} else {
+		/* all frags were copied in linear skbs, notify the event right now */
+		struct omx_evt_send_mediumsq_done evt;
+
+		evt.id = 0;
+		evt.type = OMX_EVT_SEND_MEDIUMSQ_DONE;
+		evt.sendq_offset = cmd.sendq_index[0] << OMX_SENDQ_ENTRY_SHIFT;
+		omx_notify_exp_event(endpoint,
+				     &evt, sizeof(evt));
+	}
+
+	return 0;
+
+ out_with_defevent:
+	if (defevent) {
+		omx_endpoint_release(endpoint);
+		kfree(defevent);
+	}
+ out:
+	return ret;
+}
+
 int
 omx_ioctl_send_mediumva(struct omx_endpoint * endpoint,
 			void __user * uparam)
@@ -924,29 +1210,21 @@ omx_ioctl_send_rndv(struct omx_endpoint * endpoint,
 }
 
 int
-omx_ioctl_send_notify(struct omx_endpoint * endpoint,
-		      void __user * uparam)
+omx_send_notify(struct omx_endpoint * endpoint,
+		const struct omx_cmd_send_notify * cmd)
 {
 	struct sk_buff *skb;
 	struct omx_hdr *mh;
 	struct omx_pkt_head *ph;
 	struct ethhdr *eh;
 	struct omx_pkt_notify *notify_n;
-	struct omx_cmd_send_notify cmd;
 	struct omx_iface * iface = endpoint->iface;
 	struct net_device * ifp = iface->eth_ifp;
 	size_t hdr_len = sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_notify);
 	int ret;
 
-	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
-	if (unlikely(ret != 0)) {
-		printk(KERN_ERR "Open-MX: Failed to read send notify cmd hdr\n");
-		ret = -EFAULT;
-		goto out;
-	}
-
-	if (unlikely(cmd.shared))
-		return omx_shared_send_notify(endpoint, &cmd);
+	if (unlikely(cmd->shared))
+		return omx_shared_send_notify(endpoint, cmd);
 
 	skb = omx_new_skb(/* pad to ETH_ZLEN */
 			  max_t(unsigned long, hdr_len, ETH_ZLEN));
@@ -967,7 +1245,7 @@ omx_ioctl_send_notify(struct omx_endpoint * endpoint,
 	memcpy(eh->h_source, ifp->dev_addr, sizeof (eh->h_source));
 
 	/* set destination peer */
-	ret = omx_set_target_peer(ph, iface, cmd.peer_index);
+	ret = omx_set_target_peer(ph, iface, cmd->peer_index);
 	if (ret < 0) {
 		printk(KERN_INFO "Open-MX: Failed to fill target peer in notify header\n");
 		goto out_with_skb;
@@ -975,14 +1253,14 @@ omx_ioctl_send_notify(struct omx_endpoint * endpoint,
 
 	/* fill omx header */
 	OMX_HTON_8(notify_n->src_endpoint, endpoint->endpoint_index);
-	OMX_HTON_8(notify_n->dst_endpoint, cmd.dest_endpoint);
+	OMX_HTON_8(notify_n->dst_endpoint, cmd->dest_endpoint);
 	OMX_HTON_8(notify_n->ptype, OMX_PKT_TYPE_NOTIFY);
-	OMX_HTON_32(notify_n->total_length, cmd.total_length);
-	OMX_HTON_16(notify_n->lib_seqnum, cmd.seqnum);
-	OMX_HTON_16(notify_n->lib_piggyack, cmd.piggyack);
-	OMX_HTON_32(notify_n->session, cmd.session_id);
-	OMX_HTON_8(notify_n->pulled_rdma_id, cmd.pulled_rdma_id);
-	OMX_HTON_8(notify_n->pulled_rdma_seqnum, cmd.pulled_rdma_seqnum);
+	OMX_HTON_32(notify_n->total_length, cmd->total_length);
+	OMX_HTON_16(notify_n->lib_seqnum, cmd->seqnum);
+	OMX_HTON_16(notify_n->lib_piggyack, cmd->piggyack);
+	OMX_HTON_32(notify_n->session, cmd->session_id);
+	OMX_HTON_8(notify_n->pulled_rdma_id, cmd->pulled_rdma_id);
+	OMX_HTON_8(notify_n->pulled_rdma_seqnum, cmd->pulled_rdma_seqnum);
 
 	omx_send_dprintk(eh, "NOTIFY");
 
@@ -997,29 +1275,37 @@ omx_ioctl_send_notify(struct omx_endpoint * endpoint,
 }
 
 int
-omx_ioctl_send_liback(struct omx_endpoint * endpoint,
+omx_ioctl_send_notify(struct omx_endpoint * endpoint,
 		      void __user * uparam)
+{
+	struct omx_cmd_send_notify cmd;
+	int ret;
+
+	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read send notify cmd hdr\n");
+		return -EFAULT;
+	}
+
+	return omx_send_notify(endpoint, &cmd);
+}
+
+int
+omx_send_liback(struct omx_endpoint * endpoint,
+		const struct omx_cmd_send_liback * cmd)
 {
 	struct sk_buff *skb;
 	struct omx_hdr *mh;
 	struct omx_pkt_head *ph;
 	struct ethhdr *eh;
 	struct omx_pkt_truc *truc_n;
-	struct omx_cmd_send_liback cmd;
 	struct omx_iface * iface = endpoint->iface;
 	struct net_device * ifp = iface->eth_ifp;
 	size_t hdr_len = sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_truc);
 	int ret;
 
-	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
-	if (unlikely(ret != 0)) {
-		printk(KERN_ERR "Open-MX: Failed to read send truc cmd hdr\n");
-		ret = -EFAULT;
-		goto out;
-	}
-
-	if (unlikely(cmd.shared))
-		return omx_shared_send_liback(endpoint, &cmd);
+	if (unlikely(cmd->shared))
+		return omx_shared_send_liback(endpoint, cmd);
 
 	skb = omx_new_skb(/* pad to ETH_ZLEN */
 			  max_t(unsigned long, hdr_len, ETH_ZLEN));
@@ -1041,7 +1327,7 @@ omx_ioctl_send_liback(struct omx_endpoint * endpoint,
 	memcpy(eh->h_source, ifp->dev_addr, sizeof (eh->h_source));
 
 	/* set destination peer */
-	ret = omx_set_target_peer(ph, iface, cmd.peer_index);
+	ret = omx_set_target_peer(ph, iface, cmd->peer_index);
 	if (ret < 0) {
 		printk(KERN_INFO "Open-MX: Failed to fill target peer in truc header\n");
 		goto out_with_skb;
@@ -1049,16 +1335,16 @@ omx_ioctl_send_liback(struct omx_endpoint * endpoint,
 
 	/* fill omx header */
 	OMX_HTON_8(truc_n->src_endpoint, endpoint->endpoint_index);
-	OMX_HTON_8(truc_n->dst_endpoint, cmd.dest_endpoint);
+	OMX_HTON_8(truc_n->dst_endpoint, cmd->dest_endpoint);
 	OMX_HTON_8(truc_n->ptype, OMX_PKT_TYPE_TRUC);
 	OMX_HTON_8(truc_n->length, OMX_PKT_TRUC_LIBACK_DATA_LENGTH);
-	OMX_HTON_32(truc_n->session, cmd.session_id);
+	OMX_HTON_32(truc_n->session, cmd->session_id);
 	OMX_HTON_8(truc_n->type, OMX_PKT_TRUC_DATA_TYPE_ACK);
-	OMX_HTON_16(truc_n->liback.lib_seqnum, cmd.lib_seqnum);
-	OMX_HTON_32(truc_n->liback.session_id, cmd.session_id);
-	OMX_HTON_32(truc_n->liback.acknum, cmd.acknum);
-	OMX_HTON_16(truc_n->liback.send_seq, cmd.send_seq);
-	OMX_HTON_8(truc_n->liback.resent, cmd.resent);
+	OMX_HTON_16(truc_n->liback.lib_seqnum, cmd->lib_seqnum);
+	OMX_HTON_32(truc_n->liback.session_id, cmd->session_id);
+	OMX_HTON_32(truc_n->liback.acknum, cmd->acknum);
+	OMX_HTON_16(truc_n->liback.send_seq, cmd->send_seq);
+	OMX_HTON_8(truc_n->liback.resent, cmd->resent);
 
 	omx_queue_xmit(iface, skb, LIBACK);
 
@@ -1070,6 +1356,22 @@ omx_ioctl_send_liback(struct omx_endpoint * endpoint,
 	return ret;
 }
 
+int
+omx_ioctl_send_liback(struct omx_endpoint * endpoint,
+		      void __user * uparam)
+{
+	struct omx_cmd_send_liback cmd;
+	int ret;
+
+	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read send truc cmd hdr\n");
+		return -EFAULT;
+	}
+
+	return omx_send_liback(endpoint, &cmd);
+}
+
 void
 omx_send_nack_lib(struct omx_iface * iface, uint32_t peer_index, enum omx_nack_type nack_type,
 		  uint8_t src_endpoint, uint8_t dst_endpoint, uint16_t lib_seqnum)
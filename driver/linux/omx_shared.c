@@ -235,14 +235,14 @@ omx_shared_try_send_connect_reply(struct omx_endpoint *src_endpoint,
 
 int
 omx_shared_send_tiny(struct omx_endpoint *src_endpoint,
-		     const struct omx_cmd_send_tiny_hdr *hdr, const void __user * data)
+		     const struct omx_cmd_send_tiny_hdr *hdr, const void * data)
 {
 	struct omx_endpoint * dst_endpoint;
 	struct omx_evt_recv_msg event;
 	int length = hdr->length;
 	int err;
 
-	BUG_ON(length > OMX_TINY_MSG_LENGTH_MAX); /* required to shutup gcc 4.4 copy_from_user size checks in 2.6.33/x86_32 */
+	BUG_ON(length > OMX_TINY_MSG_LENGTH_MAX);
 
 	dst_endpoint = omx_shared_get_endpoint_or_notify_nack(src_endpoint, hdr->peer_index,
 							      hdr->dest_endpoint, hdr->session_id,
@@ -263,12 +263,7 @@ omx_shared_send_tiny(struct omx_endpoint *src_endpoint,
 
 #ifndef OMX_NORECVCOPY
 	/* copy the data */
-	err = copy_from_user(&event.specific.tiny.data, data, length);
-	if (unlikely(err != 0)) {
-		printk(KERN_ERR "Open-MX: Failed to read shared send tiny cmd data\n");
-		err = -EFAULT;
-		goto out_with_endpoint;
-	}
+	memcpy(&event.specific.tiny.data, data, length);
 #endif
 
 	/* notify the event */
@@ -473,6 +468,83 @@ omx_shared_send_mediumsq_frag(struct omx_endpoint *src_endpoint,
 	return err;
 }
 
+int
+omx_shared_send_mediumsq(struct omx_endpoint *src_endpoint,
+			 const struct omx_cmd_send_mediumsq *hdr)
+{
+	struct omx_endpoint * dst_endpoint;
+	struct omx_evt_recv_msg dst_event;
+	struct omx_evt_send_mediumsq_done src_event;
+	unsigned long recvq_offset[OMX_SEND_MEDIUMSQ_FRAGS_NR_MAX];
+	uint32_t msg_length = hdr->msg_length;
+	uint32_t remaining;
+	int frags_nr = hdr->frags_nr;
+	int err = 0;
+	int i;
+
+	dst_endpoint = omx_shared_get_endpoint_or_notify_nack(src_endpoint, hdr->peer_index,
+							      hdr->dest_endpoint, hdr->session_id,
+							      hdr->seqnum);
+	if (unlikely(!dst_endpoint))
+		goto out;
+
+	/* get the dst eventq slots */
+	err = omx_prepare_notify_unexp_events_with_recvq(dst_endpoint, frags_nr,
+							 recvq_offset);
+	if (unlikely(err < 0)) {
+		/* no more unexpected eventq slot? just drop the message, it will be resent anyway */
+		err = 0;
+		goto out_with_endpoint;
+	}
+
+#ifndef OMX_NORECVCOPY
+	/* copy the data */
+	remaining = msg_length;
+	for(i=0; i<frags_nr; i++) {
+		uint32_t frag_length = remaining > OMX_MEDIUM_FRAG_LENGTH_MAX ? OMX_MEDIUM_FRAG_LENGTH_MAX : remaining;
+		memcpy(dst_endpoint->recvq + recvq_offset[i],
+		       src_endpoint->sendq + (hdr->sendq_index[i] << OMX_SENDQ_ENTRY_SHIFT),
+		       frag_length);
+		remaining -= frag_length;
+	}
+#endif
+
+	/* fill the dst event */
+	dst_event.peer_index = src_endpoint->iface->peer.index;
+	dst_event.src_endpoint = src_endpoint->endpoint_index;
+	dst_event.match_info = hdr->match_info;
+	dst_event.seqnum = hdr->seqnum;
+	dst_event.piggyack = hdr->piggyack;
+	dst_event.specific.medium_frag.msg_length = msg_length;
+	dst_event.specific.medium_frag.frag_pipeline = hdr->frag_pipeline;
+	dst_event.specific.medium_frag.checksum = hdr->checksum;
+
+	remaining = msg_length;
+	for(i=0; i<frags_nr; i++) {
+		uint32_t frag_length = remaining > OMX_MEDIUM_FRAG_LENGTH_MAX ? OMX_MEDIUM_FRAG_LENGTH_MAX : remaining;
+		/* notify the dst event */
+		dst_event.id = 0;
+		dst_event.type = OMX_EVT_RECV_MEDIUM_FRAG;
+		dst_event.specific.medium_frag.frag_length = frag_length;
+		dst_event.specific.medium_frag.frag_seqnum = i;
+		dst_event.specific.medium_frag.recvq_offset = recvq_offset[i];
+		omx_commit_notify_unexp_event_with_recvq(dst_endpoint, &dst_event, sizeof(dst_event));
+		remaining -= frag_length;
+
+		omx_counter_inc(omx_shared_fake_iface, SHARED_MEDIUMSQ_FRAG);
+	}
+
+ out_with_endpoint:
+	omx_endpoint_release(dst_endpoint);
+ out:
+	/* fill and notify the src event in all cases, so that the sender doesn't leak eventq slots */
+	src_event.id = 0;
+	src_event.type = OMX_EVT_SEND_MEDIUMSQ_DONE;
+	src_event.sendq_offset = hdr->sendq_index[0] << OMX_SENDQ_ENTRY_SHIFT;
+	omx_notify_exp_event(src_endpoint, &src_event, sizeof(src_event));
+	return err;
+}
+
 int
 omx_shared_send_mediumva(struct omx_endpoint *src_endpoint,
 			 const struct omx_cmd_send_mediumva *hdr)
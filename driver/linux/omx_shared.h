@@ -29,7 +29,7 @@ omx_shared_try_send_connect_reply(struct omx_endpoint *src_endpoint,
 
 extern int
 omx_shared_send_tiny(struct omx_endpoint *src_endpoint,
-		     const struct omx_cmd_send_tiny_hdr *hdr, const void __user * data);
+		     const struct omx_cmd_send_tiny_hdr *hdr, const void * data);
 
 extern int
 omx_shared_send_small(struct omx_endpoint *src_endpoint,
@@ -39,6 +39,10 @@ extern int
 omx_shared_send_mediumsq_frag(struct omx_endpoint *src_endpoint,
 			      const struct omx_cmd_send_mediumsq_frag *hdr);
 
+extern int
+omx_shared_send_mediumsq(struct omx_endpoint *src_endpoint,
+			 const struct omx_cmd_send_mediumsq *hdr);
+
 extern int
 omx_shared_send_mediumva(struct omx_endpoint *src_endpoint,
 			 const struct omx_cmd_send_mediumva *hdr);
@@ -111,6 +111,31 @@ omx__dump_req_ctxidq(const char * name, const struct list_head *head, int max, i
   printf("%d requests\n", count);
 }
 
+static void
+omx__dump_recv_hash(const char * name, const struct omx_endpoint *ep)
+{
+  union omx_request *req;
+  unsigned i, j;
+  int count;
+
+  printf("  %s: ", name);
+  if (omx__globals.debug_signal_level > 1) printf("\n");
+
+  count = 0;
+  for(i=0; i<ep->ctxid_max; i++) {
+    if (!ep->ctxid[i].recv_hash)
+      continue;
+    for(j=0; j<OMX__RECV_HASH_SIZE; j++)
+      omx__foreach_request(&ep->ctxid[i].recv_hash[j], req) {
+	omx__dump_request("    ", req);
+	count++;
+      }
+  }
+
+  if (omx__globals.debug_signal_level > 1) printf("   Total: ");
+  printf("%d requests\n", count);
+}
+
 static void
 omx__dump_partner_req_q(const char * name, const struct list_head *head)
 {
@@ -156,6 +181,13 @@ omx__dump_endpoint(struct omx_endpoint *ep, void *data)
 
   printf("Endpoint %d on Board %d:\n",
 	 ep->endpoint_index, ep->board_index);
+  printf("  Progression busy in %llu out of %llu calls\n",
+	 (unsigned long long) ep->progress_busy_calls,
+	 (unsigned long long) ep->progress_calls);
+  printf("  Unexpected bytes buffered %llu\n",
+	 (unsigned long long) ep->unexp_bytes);
+  printf("  Unexpected messages held in the recvq %u\n",
+	 ep->unexp_slots_held_nr);
 
   count = 0;
   for(i=0; i<omx__driver_desc->peer_max * omx__driver_desc->endpoint_max; i++) {
@@ -195,6 +227,7 @@ omx__dump_endpoint(struct omx_endpoint *ep, void *data)
     omx__dump_req_q("Unexpected            ", &ep->anyctxid.unexp_req_q); /* ctxid[0].unexp_req_q unused if no ctxids */
     omx__dump_req_q("Done                  ", &ep->anyctxid.done_req_q); /* ctxid[0].done_req_q unused if no ctxids */
   }
+  omx__dump_recv_hash("Recv hashed           ", ep);
   omx__dump_req_q("Missing resources     ", &ep->need_resources_send_req_q);
   omx__dump_req_q("Driver mediumsq sending ", &ep->driver_mediumsq_sending_req_q);
 #ifdef OMX_LIB_DEBUG
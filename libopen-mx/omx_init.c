@@ -502,11 +502,47 @@ omx__init_comms(void)
 			omx__globals.regcache ? "enabled" : "disabled");
   }
 
+  /********************************
+   * Unexpected data buffering limit
+   */
+  omx__globals.unexp_queue_max = 0;
+  env = getenv("OMX_UNEXP_QUEUE_MAX");
+  if (env) {
+    omx__globals.unexp_queue_max = atoi(env);
+    omx__verbose_printf(NULL, "Forcing unexpected queue max to %ld bytes\n",
+			(unsigned long) omx__globals.unexp_queue_max);
+  }
+
+  /****************************************************
+   * Unexpected event slots pinned by data left in the recvq
+   */
+  omx__globals.unexp_slots_max = OMX_UNEXP_EVENTQ_ENTRY_NR/2;
+  env = getenv("OMX_UNEXP_SLOTS_MAX");
+  if (env) {
+    omx__globals.unexp_slots_max = atoi(env);
+    if (omx__globals.unexp_slots_max > OMX_UNEXP_EVENTQ_ENTRY_NR - OMX_UNEXP_RELEASE_SLOTS_BATCH_NR)
+      omx__globals.unexp_slots_max = OMX_UNEXP_EVENTQ_ENTRY_NR - OMX_UNEXP_RELEASE_SLOTS_BATCH_NR;
+    omx__verbose_printf(NULL, "Forcing unexpected slots max to %ld\n",
+			(unsigned long) omx__globals.unexp_slots_max);
+  }
+
   /******************
    * Process binding
    */
   omx__globals.process_binding = getenv("OMX_PROCESS_BINDING");
 
+  /************************************
+   * Asynchronous progression thread
+   */
+  omx__globals.progress_thread = 0;
+  env = getenv("OMX_PROGRESS_THREAD");
+  if (env) {
+    omx__globals.progress_thread = atoi(env);
+    omx__verbose_printf(NULL, "Forcing progress thread to %s\n",
+			omx__globals.progress_thread ? "enabled" : "disabled");
+  }
+  omx__globals.progress_thread_binding = getenv("OMX_PROGRESS_THREAD_BINDING");
+
   /********************
    * Tune medium frags
    */
@@ -518,6 +554,19 @@ omx__init_comms(void)
 			omx__globals.medium_sendq ? "enabled" : "disabled");
   }
 
+  /***********************
+   * Batch small commands
+   */
+  omx__globals.send_batch = OMX_SEND_BATCH_ENTRY_NR_MAX;
+  env = getenv("OMX_SEND_BATCH");
+  if (env) {
+    omx__globals.send_batch = atoi(env);
+    if (omx__globals.send_batch > OMX_CMDQ_ENTRY_NR)
+      omx__globals.send_batch = OMX_CMDQ_ENTRY_NR;
+    omx__verbose_printf(NULL, "Forcing send batches to %d commands\n",
+			omx__globals.send_batch);
+  }
+
   /*********
    * Ctxids
    */
@@ -45,7 +45,12 @@
 #define omx_calloc dlcalloc
 #define omx_free   dlfree
 static inline omx_return_t omx__init_ep_malloc(struct omx_endpoint *ep) {
+#ifdef OMX_LIB_THREAD_SAFETY
+  /* the send and recv domains of the endpoint allocate concurrently */
+  ep->malloc_data = create_mspace(0, 1);
+#else
   ep->malloc_data = create_mspace(0, 0);
+#endif
   return ep->malloc_data != NULL ? OMX_SUCCESS : OMX_NO_RESOURCES;
 }
 #define omx__exit_ep_malloc(ep) destroy_mspace((ep)->malloc_data)
@@ -70,9 +75,18 @@ static inline int omx__init_ep_malloc(struct omx_endpoint *ep) { return OMX_SUCC
 #if defined(__GNUC__) && !defined(__INTEL_COMPILER) && (__GNUC__ > 2 || __GNUC__ == 2 && __GNUC_MINOR__ >= 96)
 #define likely(x)	__builtin_expect(!!(x), 1)
 #define unlikely(x)	__builtin_expect(!!(x), 0)
+#define omx__prefetch(x)	__builtin_prefetch(x)
 #else
 #define likely(x)	(x)
 #define unlikely(x)	(x)
+#define omx__prefetch(x)	do { /* nothing */ } while (0)
+#endif
+
+/* let a SMT sibling run while busy-waiting */
+#if defined(__i386__) || defined(__x86_64__)
+#define omx__cpu_relax()	__asm__ __volatile__("pause" ::: "memory")
+#else
+#define omx__cpu_relax()	__asm__ __volatile__("" ::: "memory")
 #endif
 
 /******************
@@ -436,8 +450,105 @@ omx__process_recv_nack_lib(struct omx_endpoint *ep,
 extern omx_return_t
 omx__progress(struct omx_endpoint * ep);
 
+extern omx_return_t
+omx__try_progress(struct omx_endpoint * ep);
+
+/*
+ * Check without the endpoint lock whether omx__progress() has anything to do.
+ * The answer may be stale, which only causes a useless or slightly delayed
+ * progression.
+ */
+static inline int
+omx__progress_needed(const struct omx_endpoint * ep)
+{
+  omx_eventq_index_t index;
+  const volatile union omx_evt * evt;
+
+  /* timer-driven work, or commands waiting to be submitted */
+  if (omx__driver_desc->jiffies != *(volatile uint64_t *) &ep->last_progress_timers_jiffies
+      || *(volatile unsigned *) &ep->send_batch_nr)
+    return 1;
+
+  index = *(volatile omx_eventq_index_t *) &ep->next_unexp_event_index;
+  evt = ep->unexp_eventq + (index % OMX_UNEXP_EVENTQ_ENTRY_NR) * OMX_EVENTQ_ENTRY_SIZE;
+  if (evt->generic.id == 1 + (index % OMX_EVENT_ID_MAX))
+    return 1;
+
+  index = *(volatile omx_eventq_index_t *) &ep->next_exp_event_index;
+  evt = ep->exp_eventq + (index % OMX_EXP_EVENTQ_ENTRY_NR) * OMX_EVENTQ_ENTRY_SIZE;
+  if (evt->generic.id == 1 + (index % OMX_EVENT_ID_MAX))
+    return 1;
+
+  return 0;
+}
+
+extern void
+omx__wakeup_sleepers(struct omx_endpoint *ep, const union omx_request *req);
+
 extern void
-omx__notify_user_event(struct omx_endpoint *ep);
+omx__progress_thread_start(struct omx_endpoint *ep);
+
+extern void
+omx__progress_thread_stop(struct omx_endpoint *ep);
+
+extern void
+omx__endpoint_bind_process(const struct omx_endpoint *ep, const char *bindstring);
+
+extern void *
+omx__unexp_buffer_alloc(struct omx_endpoint *ep, uint32_t length);
+
+extern void
+omx__unexp_buffer_free(struct omx_endpoint *ep, void *buffer, uint32_t length);
+
+extern void
+omx__unexp_buffers_exit(struct omx_endpoint *ep);
+
+extern void
+omx__release_unexp_slot(struct omx_endpoint *ep, union omx_request *req);
+
+extern void
+omx__release_unexp_slots(struct omx_endpoint *ep);
+
+extern void
+omx__flush_send_batch(struct omx_endpoint *ep);
+
+extern void
+omx__drain_cmdq(struct omx_endpoint *ep);
+
+/*
+ * Return the room for one more command in the cmdq,
+ * submitting the current batch first if it is full.
+ * If the driver polling thread did not consume enough entries yet,
+ * ring the doorbell so that the driver drains the whole cmdq.
+ */
+static inline void *
+omx__send_batch_queue(struct omx_endpoint *ep, uint32_t cmd)
+{
+  struct omx_cmd_send_batch_entry *entry;
+
+  if (ep->send_batch_nr == omx__globals.send_batch)
+    omx__flush_send_batch(ep);
+
+  if (unlikely(ep->cmdq_index + ep->send_batch_nr - *(volatile uint32_t *) &ep->desc->cmdq_consumed_index
+	       == OMX_CMDQ_ENTRY_NR))
+    omx__drain_cmdq(ep);
+
+  entry = &ep->cmdq[(ep->cmdq_index + ep->send_batch_nr++) % OMX_CMDQ_ENTRY_NR];
+  entry->cmd = cmd;
+  return &entry->u;
+}
+
+/*
+ * Make sure the commands queued in the cmdq reached the driver before
+ * a direct send ioctl, otherwise the seqnums of a partner would not
+ * be sent in order. The doorbell waits for the driver polling thread.
+ */
+static inline void
+omx__sync_send_batch(struct omx_endpoint *ep)
+{
+  if (unlikely(ep->cmdq_index + ep->send_batch_nr != *(volatile uint32_t *) &ep->desc->cmdq_consumed_index))
+    omx__drain_cmdq(ep);
+}
 
 extern void
 omx__forget(struct omx_endpoint *ep, union omx_request *req);
@@ -51,6 +51,182 @@ omx__recv_complete(struct omx_endpoint *ep, union omx_request *req,
   omx__notify_request_done(ep, ctxid, req);
 }
 
+/****************************************
+ * Unexpected buffers, recycled per class
+ */
+
+static const uint32_t omx__unexp_buffer_class_length[OMX__UNEXP_BUFFER_CLASS_NR] = {
+  OMX_SMALL_MSG_LENGTH_MAX,
+  4096,
+  OMX__MX_MEDIUM_MSG_LENGTH_MAX,
+};
+
+static INLINE int
+omx__unexp_buffer_class(uint32_t length)
+{
+  int class;
+
+  for(class=0; class<OMX__UNEXP_BUFFER_CLASS_NR; class++)
+    if (length <= omx__unexp_buffer_class_length[class])
+      return class;
+
+  /* larger than the rendezvous threshold, may only happen with self or shared communication */
+  return -1;
+}
+
+void *
+omx__unexp_buffer_alloc(struct omx_endpoint *ep, uint32_t length)
+{
+  int class = omx__unexp_buffer_class(length);
+  void *buffer;
+
+  if (likely(class >= 0)) {
+    buffer = ep->unexp_buffer_free[class];
+    if (likely(buffer)) {
+      ep->unexp_buffer_free[class] = *(void **) buffer;
+      ep->unexp_buffer_free_nr[class]--;
+    } else {
+      buffer = omx_malloc_ep(ep, omx__unexp_buffer_class_length[class]);
+    }
+  } else {
+    buffer = omx_malloc_ep(ep, length);
+  }
+
+  if (likely(buffer))
+    ep->unexp_bytes += length;
+  return buffer;
+}
+
+void
+omx__unexp_buffer_free(struct omx_endpoint *ep, void *buffer, uint32_t length)
+{
+  int class = omx__unexp_buffer_class(length);
+
+  ep->unexp_bytes -= length;
+
+  if (likely(class >= 0 && ep->unexp_buffer_free_nr[class] < OMX__UNEXP_BUFFER_CACHE_MAX)) {
+    *(void **) buffer = ep->unexp_buffer_free[class];
+    ep->unexp_buffer_free[class] = buffer;
+    ep->unexp_buffer_free_nr[class]++;
+  } else {
+    omx_free_ep(ep, buffer);
+  }
+}
+
+void
+omx__unexp_buffers_exit(struct omx_endpoint *ep)
+{
+  int class;
+
+  for(class=0; class<OMX__UNEXP_BUFFER_CLASS_NR; class++)
+    while (ep->unexp_buffer_free[class]) {
+      void *buffer = ep->unexp_buffer_free[class];
+      ep->unexp_buffer_free[class] = *(void **) buffer;
+      omx_free_ep(ep, buffer);
+    }
+}
+
+/*******************************************
+ * Unexpected data left in its recvq slot
+ *
+ * Unexpected small and single-fragment medium messages keep their data
+ * in the recvq until they get matched, so that it is copied only once.
+ * A recvq slot may not be reused by the driver before its unexpected event
+ * slot is released, so the release index published in the endpoint
+ * descriptor stops at the oldest held slot, and the slots that were
+ * released out of order behind it are skipped once it goes away.
+ * When held slots would keep more than unexp_slots_pinned_max slots
+ * from the driver, the oldest held data is moved to an unexpected buffer.
+ */
+
+static INLINE int
+omx__may_hold_unexp_slot(struct omx_endpoint *ep, const struct omx_evt_recv_msg *msg,
+			 const void *data, uint32_t msg_length)
+{
+  /* early fragments were copied out of the recvq already */
+  return ep->unexp_slots_pinned_max
+    && (msg->type == OMX_EVT_RECV_SMALL
+	|| (msg->type == OMX_EVT_RECV_MEDIUM_FRAG && msg->specific.medium_frag.frag_length == msg_length))
+    && (const char *) data >= (const char *) ep->recvq
+    && (const char *) data < (const char *) ep->recvq + OMX_RECVQ_SIZE;
+}
+
+static INLINE void
+omx__hold_unexp_slot(struct omx_endpoint *ep, union omx_request *req,
+		     const void *data, uint32_t msg_length)
+{
+  omx_eventq_index_t slot = ep->unexp_event_index;
+
+  omx__debug_assert(!ep->unexp_slot_req[slot % OMX_UNEXP_EVENTQ_ENTRY_NR]);
+  ep->unexp_slot_req[slot % OMX_UNEXP_EVENTQ_ENTRY_NR] = req;
+  ep->unexp_slots_held_nr++;
+
+  req->recv.unexp_slot = slot;
+  req->generic.state |= OMX_REQUEST_STATE_RECV_UNEXP_SLOT;
+  omx_cache_single_segment(&req->recv.segs, (void *) data, msg_length);
+}
+
+/* the data is not needed in the recvq anymore, omx__release_unexp_slots() must be called later */
+void
+omx__release_unexp_slot(struct omx_endpoint *ep, union omx_request *req)
+{
+  omx__debug_assert(ep->unexp_slot_req[req->recv.unexp_slot % OMX_UNEXP_EVENTQ_ENTRY_NR] == req);
+  ep->unexp_slot_req[req->recv.unexp_slot % OMX_UNEXP_EVENTQ_ENTRY_NR] = NULL;
+  ep->unexp_slots_held_nr--;
+
+  req->generic.state &= ~OMX_REQUEST_STATE_RECV_UNEXP_SLOT;
+}
+
+/* move the data of a held request to an unexpected buffer */
+static int
+omx__evict_unexp_slot(struct omx_endpoint *ep, union omx_request *req)
+{
+  uint32_t msg_length = req->generic.status.msg_length;
+  void *unexp_buffer;
+
+  unexp_buffer = omx__unexp_buffer_alloc(ep, msg_length);
+  if (unlikely(!unexp_buffer))
+    /* keep the slot, the driver will drop incoming messages until it is matched */
+    return -1;
+
+  memcpy(unexp_buffer, OMX_SEG_PTR(&req->recv.segs.single), msg_length);
+  omx_cache_single_segment(&req->recv.segs, unexp_buffer, msg_length);
+  omx__release_unexp_slot(ep, req);
+  return 0;
+}
+
+/*
+ * Release the processed unexpected event slots to the driver,
+ * up to the oldest one whose data is still held.
+ * Called with the whole endpoint locked.
+ */
+void
+omx__release_unexp_slots(struct omx_endpoint *ep)
+{
+  omx_eventq_index_t next = ep->next_unexp_event_index;
+  omx_eventq_index_t index = ep->unexp_released_index;
+
+  if (likely(!ep->unexp_slots_held_nr)) {
+    index = next;
+  } else {
+    while (index != next) {
+      union omx_request *req = ep->unexp_slot_req[index % OMX_UNEXP_EVENTQ_ENTRY_NR];
+      if (req
+	  && ((omx_eventq_index_t) (next - index) <= ep->unexp_slots_pinned_max
+	      || omx__evict_unexp_slot(ep, req) < 0))
+	break;
+      index++;
+    }
+  }
+
+  if (index != ep->unexp_released_index) {
+    ep->unexp_released_index = index;
+    /* make sure our reads of the slots are done before the driver may reuse them */
+    __sync_synchronize();
+    ep->desc->unexp_eventq_index = index;
+  }
+}
+
 /****************
  * Early packets
  */
@@ -257,9 +433,7 @@ omx__process_recv_tiny(struct omx_endpoint *ep, struct omx__partner *partner,
 #endif
 
   if (unlikely(req->generic.state & OMX_REQUEST_STATE_UNEXPECTED_RECV)) {
-    omx__enqueue_request(&ep->anyctxid.unexp_req_q, req);
-    if (unlikely(HAS_CTXIDS(ep)))
-      omx__enqueue_ctxid_request(&ep->ctxid[ctxid].unexp_req_q, req);
+    omx__enqueue_unexp_request(ep, ctxid, req);
   } else {
     omx__recv_complete(ep, req, OMX_SUCCESS);
   }
@@ -288,9 +462,7 @@ omx__process_recv_small(struct omx_endpoint *ep, struct omx__partner *partner,
 #endif
 
   if (unlikely(req->generic.state & OMX_REQUEST_STATE_UNEXPECTED_RECV)) {
-    omx__enqueue_request(&ep->anyctxid.unexp_req_q, req);
-    if (unlikely(HAS_CTXIDS(ep)))
-      omx__enqueue_ctxid_request(&ep->ctxid[ctxid].unexp_req_q, req);
+    omx__enqueue_unexp_request(ep, ctxid, req);
   } else {
     omx__recv_complete(ep, req, OMX_SUCCESS);
   }
@@ -385,9 +557,7 @@ omx__process_recv_medium_frag(struct omx_endpoint *ep, struct omx__partner *part
      * ordered to ensure in-order matching.
      */
     if (unlikely(req->generic.state & OMX_REQUEST_STATE_UNEXPECTED_RECV)) {
-      omx__enqueue_request(&ep->anyctxid.unexp_req_q, req);
-      if (unlikely(HAS_CTXIDS(ep)))
-	omx__enqueue_ctxid_request(&ep->ctxid[ctxid].unexp_req_q, req);
+      omx__enqueue_unexp_request(ep, ctxid, req);
 #ifdef OMX_LIB_DEBUG
     } else {
       omx__enqueue_request(&ep->partial_medium_recv_req_q, req);
@@ -459,9 +629,7 @@ omx__process_recv_rndv(struct omx_endpoint *ep, struct omx__partner *partner,
   req->generic.state |= OMX_REQUEST_STATE_RECV_PARTIAL;
 
   if (unlikely(req->generic.state & OMX_REQUEST_STATE_UNEXPECTED_RECV)) {
-    omx__enqueue_request(&ep->anyctxid.unexp_req_q, req);
-    if (unlikely(HAS_CTXIDS(ep)))
-      omx__enqueue_ctxid_request(&ep->ctxid[ctxid].unexp_req_q, req);
+    omx__enqueue_unexp_request(ep, ctxid, req);
   } else {
     omx__submit_pull(ep, req);
   }
@@ -477,15 +645,65 @@ omx__match_recv(struct omx_endpoint *ep,
 		union omx_request **reqp)
 {
   uint32_t ctxid = CTXID_FROM_MATCHING(ep, match_info);
-  union omx_request * req;
+  union omx_request * req, * hashed = NULL;
+
+  /* find the first posted recv with this exact match info */
+  if (ep->ctxid[ctxid].recv_hash_nr) {
+    struct list_head * head = &ep->ctxid[ctxid].recv_hash[omx__recv_hash(match_info)];
+    omx__foreach_request(head, req)
+      if (likely(req->recv.match_info == match_info)) {
+	hashed = req;
+	break;
+      }
+  }
 
-  omx__foreach_request(&ep->ctxid[ctxid].recv_req_q, req)
+  /* only wildcard recvs posted before it may match instead */
+  omx__foreach_request(&ep->ctxid[ctxid].recv_req_q, req) {
+    if (hashed && omx__recv_posted_before(hashed, req))
+      break;
     if (likely(req->recv.match_info == (req->recv.match_mask & match_info))) {
-      /* matched a posted recv */
+      /* matched a posted wildcard recv */
       omx___dequeue_request(req);
       *reqp = req;
-      break;
+      return;
     }
+  }
+
+  if (hashed) {
+    /* matched a posted hashed recv */
+    omx___dequeue_request(hashed);
+    ep->ctxid[ctxid].recv_hash_nr--;
+    *reqp = hashed;
+  }
+}
+
+static INLINE omx_return_t
+omx__enqueue_posted_recv(struct omx_endpoint *ep, uint32_t ctxid,
+			 union omx_request *req)
+{
+  struct list_head * hash = ep->ctxid[ctxid].recv_hash;
+
+  req->recv.post_stamp = ep->ctxid[ctxid].next_recv_stamp++;
+
+  if (!omx__recv_is_hashed(req)) {
+    omx__enqueue_request(&ep->ctxid[ctxid].recv_req_q, req);
+    return OMX_SUCCESS;
+  }
+
+  if (unlikely(!hash)) {
+    int i;
+
+    hash = omx_malloc_ep(ep, OMX__RECV_HASH_SIZE * sizeof(*hash));
+    if (unlikely(!hash))
+      return omx__error_with_ep(ep, OMX_NO_RESOURCES, "Allocating posted recv hash table");
+    for(i=0; i<OMX__RECV_HASH_SIZE; i++)
+      list_head_init(&hash[i]);
+    ep->ctxid[ctxid].recv_hash = hash;
+  }
+
+  omx__enqueue_request(&hash[omx__recv_hash(req->recv.match_info)], req);
+  ep->ctxid[ctxid].recv_hash_nr++;
+  return OMX_SUCCESS;
 }
 
 static INLINE omx_return_t
@@ -583,6 +801,7 @@ omx__try_match_next_recv(struct omx_endpoint *ep,
 
   } else {
     /* unexpected, even after the handler */
+    int hold = 0;
 
     req = omx__request_alloc(ep);
     if (unlikely(!req))
@@ -599,8 +818,19 @@ omx__try_match_next_recv(struct omx_endpoint *ep,
       /* alloc unexpected buffer, except for rndv since they have no data */
       void *unexp_buffer = NULL;
 
-      if (msg_length) {
-	unexp_buffer = omx_malloc_ep(ep, msg_length);
+      if (msg_length && omx__may_hold_unexp_slot(ep, msg, data, msg_length)) {
+	/* keep the data in the recvq, nothing to copy until matched */
+	hold = 1;
+
+      } else if (msg_length) {
+	if (unlikely(ep->unexp_bytes_max && ep->unexp_bytes + msg_length > ep->unexp_bytes_max)) {
+	  omx__debug_printf(RECV, ep, "Too many unexpected bytes buffered, dropping\n");
+	  omx__request_free(ep, req);
+	  /* let the caller handle the error, the message will be resent */
+	  return OMX_NO_RESOURCES;
+	}
+
+	unexp_buffer = omx__unexp_buffer_alloc(ep, msg_length);
 	if (unlikely(!unexp_buffer)) {
 	  omx__verbose_printf(ep, "Failed to allocate buffer for unexpected messages, dropping\n");
 	  omx__request_free(ep, req);
@@ -609,7 +839,7 @@ omx__try_match_next_recv(struct omx_endpoint *ep,
 	}
       }
 
-      omx_cache_single_segment(&req->recv.segs, unexp_buffer, msg_length);
+      omx_cache_single_segment(&req->recv.segs, unexp_buffer, hold ? 0 : msg_length);
     }
 
     req->generic.partner = partner;
@@ -620,8 +850,11 @@ omx__try_match_next_recv(struct omx_endpoint *ep,
     /* set xfer_length as well since it is used when continue partial medium receive */
     req->generic.status.xfer_length = msg_length;
 
-    (*recv_func)(ep, partner, req, msg, data, msg_length);
+    /* a held message has no buffer yet, let the callback transfer nothing */
+    (*recv_func)(ep, partner, req, msg, data, hold ? 0 : msg_length);
 
+    if (hold)
+      omx__hold_unexp_slot(ep, req, data, msg_length);
   }
 
   return OMX_SUCCESS;
@@ -950,13 +1183,6 @@ omx__process_self_send(struct omx_endpoint *ep,
 
     omx__send_complete(ep, sreq, status_code);
     omx__recv_complete(ep, rreq, status_code);
-
-    /*
-     * need to wakeup some possible send-done or recv-done waiters
-     * since this event does not come from the driver
-     */
-    omx__notify_user_event(ep);
-
   } else {
     /* unexpected, even after the handler */
     void *unexp_buffer = NULL;
@@ -969,7 +1195,7 @@ omx__process_self_send(struct omx_endpoint *ep,
     }
 
     if (msg_length) {
-      unexp_buffer = omx_malloc_ep(ep, msg_length);
+      unexp_buffer = omx__unexp_buffer_alloc(ep, msg_length);
       if (unlikely(!unexp_buffer)) {
 	omx__request_free(ep, rreq);
 	status_code = omx__error_with_ep(ep, OMX_NO_RESOURCES,
@@ -992,9 +1218,7 @@ omx__process_self_send(struct omx_endpoint *ep,
     omx_copy_from_segments(unexp_buffer, &sreq->send.segs, msg_length);
     rreq->recv.checksum = omx_checksum_segments(&rreq->recv.segs, msg_length);
 
-    omx__enqueue_request(&ep->anyctxid.unexp_req_q, rreq);
-    if (unlikely(HAS_CTXIDS(ep)))
-      omx__enqueue_ctxid_request(&ep->ctxid[ctxid].unexp_req_q, rreq);
+    omx__enqueue_unexp_request(ep, ctxid, rreq);
 
     /* self communication are always synchronous,
      * the send will be completed on matching
@@ -1013,12 +1237,6 @@ omx__process_self_send(struct omx_endpoint *ep,
    */
   sreq->generic.state = 0; /* reset the state before completion */
   omx__send_complete(ep, sreq, status_code);
-
-  /*
-   * need to wakeup some possible send-done waiters
-   * since this event does not come from the driver
-   */
-  omx__notify_user_event(ep);
 }
 
 /*************************
@@ -1101,9 +1319,7 @@ omx__complete_unexp_req_as_irecv(struct omx_endpoint *ep,
   uint32_t msg_length;
   uint32_t xfer_length;
 
-  omx___dequeue_request(req);
-  if (unlikely(HAS_CTXIDS(ep)))
-    omx___dequeue_ctxid_request(req);
+  omx___dequeue_unexp_request(ep, req);
 
   /* get the unexp buffer and store the new segments */
   unexp_buffer = OMX_SEG_PTR(&req->recv.segs.single);
@@ -1140,7 +1356,7 @@ omx__complete_unexp_req_as_irecv(struct omx_endpoint *ep,
 #endif
 
     if (msg_length)
-      omx_free_ep(ep, unexp_buffer);
+      omx__unexp_buffer_free(ep, unexp_buffer, msg_length);
     omx__recv_complete(ep, req, status_code);
 
     omx__debug_assert(sreq->generic.state & OMX_REQUEST_STATE_UNEXPECTED_SELF_SEND);
@@ -1148,13 +1364,6 @@ omx__complete_unexp_req_as_irecv(struct omx_endpoint *ep,
     omx__dequeue_request(&ep->unexp_self_send_req_q, sreq);
     sreq->generic.status.xfer_length = xfer_length;
     omx__send_complete(ep, sreq, status_code);
-
-    /*
-     * need to wakeup some possible send-done or recv-done waiters
-     * since this event does not come from the driver
-     */
-    omx__notify_user_event(ep);
-
   } else {
     /* it's a tiny/small/medium, copy the data back to our buffer */
 
@@ -1171,8 +1380,13 @@ omx__complete_unexp_req_as_irecv(struct omx_endpoint *ep,
     }
 #endif
 
-    if (msg_length)
-      omx_free_ep(ep, unexp_buffer);
+    if (req->generic.state & OMX_REQUEST_STATE_RECV_UNEXP_SLOT) {
+      /* the data was copied straight from the recvq, give the slot back */
+      omx__release_unexp_slot(ep, req);
+      omx__release_unexp_slots(ep);
+    } else if (msg_length) {
+      omx__unexp_buffer_free(ep, unexp_buffer, msg_length);
+    }
 
     if (unlikely(req->generic.state)) {
       omx__debug_assert(req->generic.state & OMX_REQUEST_STATE_RECV_PARTIAL);
@@ -1182,49 +1396,41 @@ omx__complete_unexp_req_as_irecv(struct omx_endpoint *ep,
 #endif
     } else {
       omx__recv_complete(ep, req, OMX_SUCCESS);
-
-      /*
-       * need to wakeup some possible recv-done waiters
-       * since this event does not come from the driver
-       */
-      omx__notify_user_event(ep);
     }
   }
 }
 
-static INLINE omx_return_t
-omx__irecv_segs(struct omx_endpoint *ep, const struct omx__req_segs * reqsegs,
-		uint64_t match_info, uint64_t match_mask,
-		void *context, union omx_request **requestp)
+/* the oldest unexpected receive that matches, called with the whole endpoint locked */
+static INLINE union omx_request *
+omx__find_unexp_irecv(struct omx_endpoint *ep, uint64_t match_info, uint64_t match_mask)
 {
   uint32_t ctxid = CTXID_FROM_MATCHING(ep, match_info);
   union omx_request * req;
-  omx_return_t ret;
 
-  if (unlikely(HAS_CTXIDS(ep))) {
-    omx__foreach_ctxid_request(&ep->ctxid[ctxid].unexp_req_q, req) {
-      if (likely((req->generic.status.match_info & match_mask) == match_info)) {
-	/* matched an unexpected in the ctxid queue */
-	omx__complete_unexp_req_as_irecv(ep, req, reqsegs, context);
-	goto ok;
-      }
-    }
+  if (likely(match_mask == OMX__RECV_MATCH_MASK_FULL)) {
+    /* look in the hash */
+    return omx__find_hashed_unexp_request(ep, match_info);
+  } else if (unlikely(HAS_CTXIDS(ep))) {
+    omx__foreach_ctxid_request(&ep->ctxid[ctxid].unexp_req_q, req)
+      if (likely((req->generic.status.match_info & match_mask) == match_info))
+	return req;
   } else {
-    omx__foreach_request(&ep->anyctxid.unexp_req_q, req) {
-      if (likely((req->generic.status.match_info & match_mask) == match_info)) {
-	/* matched an unexpected in the anyctxid queue */
-	omx__complete_unexp_req_as_irecv(ep, req, reqsegs, context);
-	goto ok;
-      }
-    }
+    omx__foreach_request(&ep->anyctxid.unexp_req_q, req)
+      if (likely((req->generic.status.match_info & match_mask) == match_info))
+	return req;
   }
 
-  /* allocate a new recv request */
-  req = omx__request_alloc(ep);
-  if (unlikely(!req)) {
-    ret = omx__error_with_ep(ep, OMX_NO_RESOURCES, "Allocating irecv request");
-    goto out;
-  }
+  return NULL;
+}
+
+/* post a new recv request, only needs the recv lock */
+static INLINE omx_return_t
+omx__post_irecv_segs(struct omx_endpoint *ep, union omx_request *req,
+		     const struct omx__req_segs * reqsegs,
+		     uint64_t match_info, uint64_t match_mask,
+		     void *context)
+{
+  uint32_t ctxid = CTXID_FROM_MATCHING(ep, match_info);
 
   omx_clone_segments(&req->recv.segs, reqsegs);
 
@@ -1234,20 +1440,76 @@ omx__irecv_segs(struct omx_endpoint *ep, const struct omx__req_segs * reqsegs,
   req->recv.match_info = match_info;
   req->recv.match_mask = match_mask;
 
-  omx__enqueue_request(&ep->ctxid[ctxid].recv_req_q, req);
-  omx__progress(ep);
+  return omx__enqueue_posted_recv(ep, ctxid, req);
+}
+
+/*
+ * Called without any endpoint lock, the request is allocated before taking any.
+ * Without any unexpected message to match, posting only needs the recv lock,
+ * forgotten requests need the whole endpoint to become zombies.
+ */
+static INLINE omx_return_t
+omx__irecv(struct omx_endpoint *ep, const struct omx__req_segs * reqsegs,
+	   uint64_t match_info, uint64_t match_mask,
+	   void *context, union omx_request **requestp)
+{
+  union omx_request * req, * unexp;
+  int whole = 0;
+  omx_return_t ret;
+
+  req = omx___request_alloc(ep);
+  if (unlikely(!req))
+    return omx__error_with_ep(ep, OMX_NO_RESOURCES, "Allocating irecv request");
+
+  OMX__ENDPOINT_RECV_LOCK(ep);
 
- ok:
-  if (requestp) {
+  if (unlikely(!requestp || !omx__empty_queue(&ep->anyctxid.unexp_req_q))) {
+    OMX__ENDPOINT_RECV_UNLOCK(ep);
+    OMX__ENDPOINT_LOCK(ep);
+    whole = 1;
+
+    unexp = omx__find_unexp_irecv(ep, match_info, match_mask);
+    if (unexp) {
+      /* matched an unexpected, our new request is useless */
+      omx__complete_unexp_req_as_irecv(ep, unexp, reqsegs, context);
+      if (requestp)
+	*requestp = unexp;
+      else
+	omx__forget(ep, unexp);
+      OMX__ENDPOINT_UNLOCK(ep);
+      omx___request_free(ep, req);
+      return OMX_SUCCESS;
+    }
+  }
+
+  omx__request_alloc_account(ep, 1);
+
+  ret = omx__post_irecv_segs(ep, req, reqsegs, match_info, match_mask, context);
+  if (unlikely(ret != OMX_SUCCESS)) {
+    /* the caller frees the segments */
+    omx__request_alloc_account(ep, -1);
+    if (whole)
+      OMX__ENDPOINT_UNLOCK(ep);
+    else
+      OMX__ENDPOINT_RECV_UNLOCK(ep);
+    omx___request_free(ep, req);
+    return ret;
+  }
+
+  if (requestp)
     *requestp = req;
+
+  if (whole) {
+    if (!requestp)
+      omx__forget(ep, req);
+    omx__progress(ep);
+    OMX__ENDPOINT_UNLOCK(ep);
   } else {
-    omx__forget(ep, req);
+    OMX__ENDPOINT_RECV_UNLOCK(ep);
+    omx__try_progress(ep);
   }
 
   return OMX_SUCCESS;
-
- out:
-  return ret;
 }
 
 /* API omx_irecv */
@@ -1277,17 +1539,13 @@ omx_irecv(struct omx_endpoint *ep,
 
   omx_cache_single_segment(&reqsegs, buffer, length);
 
-  OMX__ENDPOINT_LOCK(ep);
-
-  ret = omx__irecv_segs(ep, &reqsegs, match_info, match_mask, context, requestp);
+  ret = omx__irecv(ep, &reqsegs, match_info, match_mask, context, requestp);
   if (unlikely(ret != OMX_SUCCESS))
-    goto out_with_lock;
+    goto out_with_segs;
 
-  OMX__ENDPOINT_UNLOCK(ep);
   return OMX_SUCCESS;
 
- out_with_lock:
-  OMX__ENDPOINT_UNLOCK(ep);
+ out_with_segs:
   omx_free_segments(ep, &reqsegs);
  out:
   return ret;
@@ -1327,17 +1585,13 @@ omx_irecvv(omx_endpoint_t ep,
     goto out;
   }
 
-  OMX__ENDPOINT_LOCK(ep);
-
-  ret = omx__irecv_segs(ep, &reqsegs, match_info, match_mask, context, requestp);
+  ret = omx__irecv(ep, &reqsegs, match_info, match_mask, context, requestp);
   if (unlikely(ret != OMX_SUCCESS))
-    goto out_with_lock;
+    goto out_with_segs;
 
-  OMX__ENDPOINT_UNLOCK(ep);
   return OMX_SUCCESS;
 
- out_with_lock:
-  OMX__ENDPOINT_UNLOCK(ep);
+ out_with_segs:
   omx_free_segments(ep, &reqsegs);
  out:
   return ret;
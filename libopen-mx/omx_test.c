@@ -17,6 +17,7 @@
  */
 
 #include <stdint.h>
+#include <string.h>
 #include <sys/ioctl.h>
 
 #include "omx_lib.h"
@@ -26,14 +27,75 @@
 struct omx__sleeper {
   struct list_head list_elt;
   int need_wakeup;
+  int in_driver; /* between releasing the lock for the wait ioctl and taking it back */
+  uint32_t id; /* identifies the sleeper for targeted wakeups in the driver */
+  /* what the sleeper waits for, a specific request or any matching one */
+  const union omx_request *req;
+  uint64_t match_info, match_mask;
 };
 
+/* called with the endpoint lock held */
+static INLINE void
+omx__sleeper_add(struct omx_endpoint *ep, struct omx__sleeper *sleeper,
+		 const union omx_request *req, uint64_t match_info, uint64_t match_mask)
+{
+  sleeper->need_wakeup = 0;
+  sleeper->in_driver = 0;
+  sleeper->req = req;
+  sleeper->match_info = match_info;
+  sleeper->match_mask = match_mask;
+  /* 0 means all sleepers in the driver */
+  if (unlikely(!++ep->last_sleeper_id))
+    ep->last_sleeper_id++;
+  sleeper->id = ep->last_sleeper_id;
+  list_add_tail(&sleeper->list_elt, &ep->sleepers);
+}
+
+/**************************
+ * Common spinning routine
+ */
+
+/* number of unlocked busy-wait loops before going to sleep in the driver */
+#define OMX__SPIN_UNLOCKED_LOOPS_MAX (1<<16)
+
+/*
+ * Called with the endpoint lock held, release it and spin until
+ * something may have changed for the caller, so that spinning threads
+ * do not prevent other threads from using the endpoint.
+ * Return 0 if nothing changed for too long, the caller should sleep then.
+ */
+static int
+omx__spin_unlocked(struct omx_endpoint *ep, const struct omx__sleeper *sleeper,
+		   const union omx_request *req, uint32_t ms_timeout, uint64_t jiffies_expire)
+{
+  uint32_t gen = ep->completion_gen;
+  unsigned loops = 0;
+  int changed = 0;
+
+  OMX__ENDPOINT_UNLOCK(ep);
+
+  while (loops++ < OMX__SPIN_UNLOCKED_LOOPS_MAX) {
+    if (*(volatile uint32_t *) &ep->completion_gen != gen
+	|| *(volatile int *) &sleeper->need_wakeup
+	|| (req && (*(volatile uint16_t *) &req->generic.state & OMX_REQUEST_STATE_DONE))
+	|| omx__progress_needed(ep)
+	|| (ms_timeout != OMX_TIMEOUT_INFINITE && omx__driver_desc->jiffies >= jiffies_expire)) {
+      changed = 1;
+      break;
+    }
+    omx__cpu_relax();
+  }
+
+  OMX__ENDPOINT_LOCK(ep);
+  return changed;
+}
+
 /**************************
  * Common sleeping routine
  */
 
 static omx_return_t
-omx__wait(struct omx_endpoint *ep,
+omx__wait(struct omx_endpoint *ep, struct omx__sleeper *sleeper,
 	  struct omx_cmd_wait_event *wait_param,
 	  uint32_t ms_timeout,
 	  const char *caller)
@@ -62,12 +124,15 @@ omx__wait(struct omx_endpoint *ep,
   wait_param->next_exp_event_index = ep->next_exp_event_index;
   wait_param->next_unexp_event_index = ep->next_unexp_event_index;
   wait_param->user_event_index = ep->desc->user_event_index;
+  wait_param->waiter_id = sleeper->id;
   omx__prepare_progress_wakeup(ep);
 
   /* release the lock while sleeping */
+  sleeper->in_driver = 1;
   OMX__ENDPOINT_UNLOCK(ep);
   err = ioctl(ep->fd, OMX_CMD_WAIT_EVENT, wait_param);
   OMX__ENDPOINT_LOCK(ep);
+  sleeper->in_driver = 0;
 
   OMX_VALGRIND_MEMORY_MAKE_READABLE(wait_param, sizeof(*wait_param));
 
@@ -104,7 +169,11 @@ omx__wait(struct omx_endpoint *ep,
  * Test/Wait a single request and complete it
  */
 
-static INLINE void
+/*
+ * Return the request if it is done for real,
+ * the caller frees it with omx___request_free() after releasing the lock.
+ */
+static INLINE union omx_request *
 omx__test_success(struct omx_endpoint *ep, union omx_request *req,
 		  struct omx_status *status)
 {
@@ -116,20 +185,22 @@ omx__test_success(struct omx_endpoint *ep, union omx_request *req,
     req->generic.state &= ~OMX_REQUEST_STATE_DONE;
     req->generic.state |= OMX_REQUEST_STATE_ZOMBIE;
     ep->zombies++;
+    return NULL;
   } else {
     /* the request is done for real, delete it */
-    omx__request_free(ep, req);
+    omx__request_alloc_account(ep, -1);
+    return req;
   }
 }
 
 static INLINE uint32_t
 omx__test_common(struct omx_endpoint *ep, union omx_request **requestp,
-		 struct omx_status *status)
+		 struct omx_status *status, union omx_request **freep)
 {
   union omx_request * req = *requestp;
 
   if (likely(req->generic.state & OMX_REQUEST_STATE_DONE)) {
-    omx__test_success(ep, req, status);
+    *freep = omx__test_success(ep, req, status);
     *requestp = NULL;
     return 1;
   } else {
@@ -143,18 +214,26 @@ omx_test(struct omx_endpoint *ep, union omx_request **requestp,
 	 struct omx_status *status, uint32_t *resultp)
 {
   omx_return_t ret = OMX_SUCCESS;
+  union omx_request *freereq = NULL;
   uint32_t result = 0;
 
-  OMX__ENDPOINT_LOCK(ep);
+  if (omx__progress_needed(ep)) {
+    ret = omx__try_progress(ep);
+    if (unlikely(ret != OMX_SUCCESS))
+      goto out;
+  }
 
-  ret = omx__progress(ep);
-  if (unlikely(ret != OMX_SUCCESS))
-    goto out_with_lock;
+  /* completing only needs the send lock, do not contend on it if nothing happened */
+  if (!(*(volatile uint16_t *) &(*requestp)->generic.state & OMX_REQUEST_STATE_DONE))
+    goto out;
 
-  result = omx__test_common(ep, requestp, status);
+  OMX__ENDPOINT_SEND_LOCK(ep);
+  result = omx__test_common(ep, requestp, status, &freereq);
+  OMX__ENDPOINT_SEND_UNLOCK(ep);
 
- out_with_lock:
-  OMX__ENDPOINT_UNLOCK(ep);
+ out:
+  if (freereq)
+    omx___request_free(ep, freereq);
   *resultp = result;
   return ret;
 }
@@ -169,11 +248,11 @@ omx_wait(struct omx_endpoint *ep, union omx_request **requestp,
   struct omx__sleeper sleeper;
   uint64_t jiffies_expire = omx__timeout_ms_to_absolute_jiffies(ms_timeout);
   omx_return_t ret = OMX_SUCCESS;
+  union omx_request *freereq = NULL;
   uint32_t result = 0;
 
   OMX__ENDPOINT_LOCK(ep);
-  sleeper.need_wakeup = 0;
-  list_add_tail(&sleeper.list_elt, &ep->sleepers);
+  omx__sleeper_add(ep, &sleeper, *requestp, 0, 0);
 
   if (omx__globals.waitspin) {
     /* busy spin instead of sleeping */
@@ -182,18 +261,20 @@ omx_wait(struct omx_endpoint *ep, union omx_request **requestp,
       if (unlikely(ret != OMX_SUCCESS))
 	goto out_with_lock;
 
-      if ((result = omx__test_common(ep, requestp, status)) != 0)
+      if ((result = omx__test_common(ep, requestp, status, &freereq)) != 0)
 	goto out_with_lock;
 
       if (ms_timeout != OMX_TIMEOUT_INFINITE && omx__driver_desc->jiffies >= jiffies_expire)
 	goto out_with_lock;
 
-      /* release the lock a bit */
-      OMX__ENDPOINT_UNLOCK(ep);
-      OMX__ENDPOINT_LOCK(ep);
+      /* release the lock until something may have changed */
+      if (!omx__spin_unlocked(ep, &sleeper, *requestp, ms_timeout, jiffies_expire))
+	break;
     }
 
-    goto out_with_lock;
+    if (sleeper.need_wakeup)
+      goto out_with_lock;
+    /* nothing happened for a while, sleep instead */
   }
 
   wait_param.jiffies_expire = jiffies_expire;
@@ -204,10 +285,10 @@ omx_wait(struct omx_endpoint *ep, union omx_request **requestp,
     if (unlikely(ret != OMX_SUCCESS))
       goto out_with_lock;
 
-    if ((result = omx__test_common(ep, requestp, status)) != 0)
+    if ((result = omx__test_common(ep, requestp, status, &freereq)) != 0)
       goto out_with_lock;
 
-    ret = omx__wait(ep, &wait_param, ms_timeout, "wait");
+    ret = omx__wait(ep, &sleeper, &wait_param, ms_timeout, "wait");
     if (ret != OMX_SUCCESS) {
       if (ret == OMX_TIMEOUT)
 	ret = OMX_SUCCESS;
@@ -218,6 +299,8 @@ omx_wait(struct omx_endpoint *ep, union omx_request **requestp,
  out_with_lock:
   list_del(&sleeper.list_elt);
   OMX__ENDPOINT_UNLOCK(ep);
+  if (freereq)
+    omx___request_free(ep, freereq);
   *resultp = result;
   return ret;
 }
@@ -267,7 +350,7 @@ omx_forget(struct omx_endpoint *ep, union omx_request **requestp)
 static INLINE uint32_t
 omx__test_any_common(struct omx_endpoint *ep,
 		     uint64_t match_info, uint64_t match_mask,
-		     omx_status_t *status)
+		     omx_status_t *status, union omx_request **freep)
 {
   union omx_request * req;
 
@@ -275,7 +358,7 @@ omx__test_any_common(struct omx_endpoint *ep,
     /* no ctxids, or matching across multiple ctxids, so use the anyctxid queue */
     omx__foreach_done_anyctxid_request(ep, req) {
       if (likely((req->generic.status.match_info & match_mask) == match_info)) {
-	omx__test_success(ep, req, status);
+	*freep = omx__test_success(ep, req, status);
 	return 1;
       }
     }
@@ -285,7 +368,7 @@ omx__test_any_common(struct omx_endpoint *ep,
     uint32_t ctxid = CTXID_FROM_MATCHING(ep, match_info);
     omx__foreach_done_ctxid_request(ep, ctxid, req) {
       if (likely((req->generic.status.match_info & match_mask) == match_info)) {
-	omx__test_success(ep, req, status);
+	*freep = omx__test_success(ep, req, status);
 	return 1;
       }
     }
@@ -301,6 +384,7 @@ omx_test_any(struct omx_endpoint *ep,
 	     omx_status_t *status, uint32_t *resultp)
 {
   omx_return_t ret = OMX_SUCCESS;
+  union omx_request *freereq = NULL;
   uint32_t result = 0;
 
   if (unlikely(match_info & ~match_mask)) {
@@ -310,17 +394,23 @@ omx_test_any(struct omx_endpoint *ep,
     goto out;
   }
 
-  OMX__ENDPOINT_LOCK(ep);
+  if (omx__progress_needed(ep)) {
+    ret = omx__try_progress(ep);
+    if (unlikely(ret != OMX_SUCCESS))
+      goto out;
+  }
 
-  ret = omx__progress(ep);
-  if (unlikely(ret != OMX_SUCCESS))
-    goto out_with_lock;
+  /* completing only needs the send lock, do not contend on it if nothing happened */
+  if (omx__empty_done_anyctxid_queue(ep))
+    goto out;
 
-  result = omx__test_any_common(ep, match_info, match_mask, status);
+  OMX__ENDPOINT_SEND_LOCK(ep);
+  result = omx__test_any_common(ep, match_info, match_mask, status, &freereq);
+  OMX__ENDPOINT_SEND_UNLOCK(ep);
 
- out_with_lock:
-  OMX__ENDPOINT_UNLOCK(ep);
  out:
+  if (freereq)
+    omx___request_free(ep, freereq);
   *resultp = result;
   return ret;
 }
@@ -336,6 +426,7 @@ omx_wait_any(struct omx_endpoint *ep,
   struct omx__sleeper sleeper;
   uint64_t jiffies_expire = omx__timeout_ms_to_absolute_jiffies(ms_timeout);
   omx_return_t ret = OMX_SUCCESS;
+  union omx_request *freereq = NULL;
   uint32_t result = 0;
 
   if (unlikely(match_info & ~match_mask)) {
@@ -346,8 +437,7 @@ omx_wait_any(struct omx_endpoint *ep,
   }
 
   OMX__ENDPOINT_LOCK(ep);
-  sleeper.need_wakeup = 0;
-  list_add_tail(&sleeper.list_elt, &ep->sleepers);
+  omx__sleeper_add(ep, &sleeper, NULL, match_info, match_mask);
 
   if (omx__globals.waitspin) {
     /* busy spin instead of sleeping */
@@ -356,18 +446,20 @@ omx_wait_any(struct omx_endpoint *ep,
       if (unlikely(ret != OMX_SUCCESS))
 	goto out_with_lock;
 
-      if ((result = omx__test_any_common(ep, match_info, match_mask, status)) != 0)
+      if ((result = omx__test_any_common(ep, match_info, match_mask, status, &freereq)) != 0)
 	goto out_with_lock;
 
       if (ms_timeout != OMX_TIMEOUT_INFINITE && omx__driver_desc->jiffies >= jiffies_expire)
 	goto out_with_lock;
 
-      /* release the lock a bit */
-      OMX__ENDPOINT_UNLOCK(ep);
-      OMX__ENDPOINT_LOCK(ep);
+      /* release the lock until something may have changed */
+      if (!omx__spin_unlocked(ep, &sleeper, NULL, ms_timeout, jiffies_expire))
+	break;
     }
 
-    goto out_with_lock;
+    if (sleeper.need_wakeup)
+      goto out_with_lock;
+    /* nothing happened for a while, sleep instead */
   }
 
   wait_param.jiffies_expire = jiffies_expire;
@@ -378,10 +470,10 @@ omx_wait_any(struct omx_endpoint *ep,
     if (unlikely(ret != OMX_SUCCESS))
       goto out_with_lock;
 
-    if ((result = omx__test_any_common(ep, match_info, match_mask, status)) != 0)
+    if ((result = omx__test_any_common(ep, match_info, match_mask, status, &freereq)) != 0)
       goto out_with_lock;
 
-    ret = omx__wait(ep, &wait_param, ms_timeout, "wait_any");
+    ret = omx__wait(ep, &sleeper, &wait_param, ms_timeout, "wait_any");
     if (ret != OMX_SUCCESS) {
       if (ret == OMX_TIMEOUT)
 	ret = OMX_SUCCESS;
@@ -392,6 +484,50 @@ omx_wait_any(struct omx_endpoint *ep,
  out_with_lock:
   list_del(&sleeper.list_elt);
   OMX__ENDPOINT_UNLOCK(ep);
+ out:
+  if (freereq)
+    omx___request_free(ep, freereq);
+  *resultp = result;
+  return ret;
+}
+
+/*************************************
+ * Test many requests at once, in order
+ */
+
+/* API omx_test_many */
+omx_return_t
+omx_test_many(struct omx_endpoint *ep,
+	      omx_status_t *statuses, uint32_t count,
+	      uint32_t *resultp)
+{
+  union omx_request *req, *next;
+  struct list_head freereqs;
+  omx_return_t ret = OMX_SUCCESS;
+  uint32_t result = 0;
+
+  /* do not contend on the lock if nothing happened */
+  if (omx__empty_done_anyctxid_queue(ep) && !omx__progress_needed(ep))
+    goto out;
+
+  list_head_init(&freereqs);
+  OMX__ENDPOINT_LOCK(ep);
+
+  ret = omx__progress(ep);
+  if (unlikely(ret != OMX_SUCCESS))
+    goto out_with_lock;
+
+  /* complete as many requests as possible while holding the lock once */
+  while (result < count && !omx__empty_done_anyctxid_queue(ep)) {
+    req = omx__test_success(ep, omx__first_done_anyctxid_request(ep), &statuses[result++]);
+    if (req)
+      omx__enqueue_request(&freereqs, req);
+  }
+
+ out_with_lock:
+  OMX__ENDPOINT_UNLOCK(ep);
+  list_for_each_entry_safe(req, next, &freereqs, generic.queue_elt)
+    omx___request_free(ep, req);
  out:
   *resultp = result;
   return ret;
@@ -420,6 +556,10 @@ omx_ipeek(struct omx_endpoint *ep, union omx_request **requestp,
   omx_return_t ret = OMX_SUCCESS;
   uint32_t result = 0;
 
+  /* do not contend on the lock if nothing happened */
+  if (omx__empty_done_anyctxid_queue(ep) && !omx__progress_needed(ep))
+    goto out;
+
   OMX__ENDPOINT_LOCK(ep);
 
   ret = omx__progress(ep);
@@ -430,6 +570,7 @@ omx_ipeek(struct omx_endpoint *ep, union omx_request **requestp,
 
  out_with_lock:
   OMX__ENDPOINT_UNLOCK(ep);
+ out:
   *resultp = result;
   return ret;
 }
@@ -446,8 +587,8 @@ omx_peek(struct omx_endpoint *ep, union omx_request **requestp,
   uint32_t result = 0;
 
   OMX__ENDPOINT_LOCK(ep);
-  sleeper.need_wakeup = 0;
-  list_add_tail(&sleeper.list_elt, &ep->sleepers);
+  /* any completion */
+  omx__sleeper_add(ep, &sleeper, NULL, 0, 0);
 
   if (omx__globals.waitspin) {
     /* busy spin instead of sleeping */
@@ -462,12 +603,14 @@ omx_peek(struct omx_endpoint *ep, union omx_request **requestp,
       if (ms_timeout != OMX_TIMEOUT_INFINITE && omx__driver_desc->jiffies >= jiffies_expire)
 	goto out_with_lock;
 
-      /* release the lock a bit */
-      OMX__ENDPOINT_UNLOCK(ep);
-      OMX__ENDPOINT_LOCK(ep);
+      /* release the lock until something may have changed */
+      if (!omx__spin_unlocked(ep, &sleeper, NULL, ms_timeout, jiffies_expire))
+	break;
     }
 
-    goto out_with_lock;
+    if (sleeper.need_wakeup)
+      goto out_with_lock;
+    /* nothing happened for a while, sleep instead */
   }
 
   wait_param.jiffies_expire = jiffies_expire;
@@ -481,7 +624,7 @@ omx_peek(struct omx_endpoint *ep, union omx_request **requestp,
     if ((result = omx__ipeek_common(ep, requestp)) != 0)
       goto out_with_lock;
 
-    ret = omx__wait(ep, &wait_param, ms_timeout, "peek");
+    ret = omx__wait(ep, &sleeper, &wait_param, ms_timeout, "peek");
     if (ret != OMX_SUCCESS) {
       if (ret == OMX_TIMEOUT)
 	ret = OMX_SUCCESS;
@@ -568,7 +711,15 @@ omx__iprobe_common(const struct omx_endpoint *ep,
 {
   union omx_request * req;
 
-  if (likely(!HAS_CTXIDS(ep) || MATCHING_CROSS_CTXIDS(ep, match_mask))) {
+  if (likely(match_mask == OMX__RECV_MATCH_MASK_FULL)) {
+    /* no wildcard, use the hash */
+    req = omx__find_hashed_unexp_request(ep, match_info);
+    if (req) {
+      memcpy(status, &req->generic.status, sizeof(*status));
+      return 1;
+    }
+
+  } else if (likely(!HAS_CTXIDS(ep) || MATCHING_CROSS_CTXIDS(ep, match_mask))) {
     /* no ctxids, or matching across multiple ctxids, so use the anyctxid queue */
     omx__foreach_request(&ep->anyctxid.unexp_req_q, req) {
       if (likely((req->generic.status.match_info & match_mask) == match_info)) {
@@ -642,8 +793,7 @@ omx_probe(struct omx_endpoint *ep,
   }
 
   OMX__ENDPOINT_LOCK(ep);
-  sleeper.need_wakeup = 0;
-  list_add_tail(&sleeper.list_elt, &ep->sleepers);
+  omx__sleeper_add(ep, &sleeper, NULL, match_info, match_mask);
 
   if (omx__globals.waitspin) {
     /* busy spin instead of sleeping */
@@ -658,12 +808,14 @@ omx_probe(struct omx_endpoint *ep,
       if (ms_timeout != OMX_TIMEOUT_INFINITE && omx__driver_desc->jiffies >= jiffies_expire)
 	goto out_with_lock;
 
-      /* release the lock a bit */
-      OMX__ENDPOINT_UNLOCK(ep);
-      OMX__ENDPOINT_LOCK(ep);
+      /* release the lock until something may have changed */
+      if (!omx__spin_unlocked(ep, &sleeper, NULL, ms_timeout, jiffies_expire))
+	break;
     }
 
-    goto out_with_lock;
+    if (sleeper.need_wakeup)
+      goto out_with_lock;
+    /* nothing happened for a while, sleep instead */
   }
 
   wait_param.jiffies_expire = jiffies_expire;
@@ -677,7 +829,7 @@ omx_probe(struct omx_endpoint *ep,
     if ((result = omx__iprobe_common(ep, match_info, match_mask, status)) != 0)
       goto out_with_lock;
 
-    ret = omx__wait(ep, &wait_param, ms_timeout, "probe");
+    ret = omx__wait(ep, &sleeper, &wait_param, ms_timeout, "probe");
     if (ret != OMX_SUCCESS) {
       if (ret == OMX_TIMEOUT)
 	ret = OMX_SUCCESS;
@@ -706,8 +858,7 @@ omx__connect_wait(omx_endpoint_t ep, union omx_request * req, uint32_t ms_timeou
   uint64_t jiffies_expire = omx__timeout_ms_to_absolute_jiffies(ms_timeout);
   omx_return_t ret = OMX_SUCCESS;
 
-  sleeper.need_wakeup = 0;
-  list_add_tail(&sleeper.list_elt, &ep->sleepers);
+  omx__sleeper_add(ep, &sleeper, req, 0, 0);
 
   if (omx__globals.connect_pollall) {
     /* busy spin and poll other endpoints instead of sleeping */
@@ -747,14 +898,17 @@ omx__connect_wait(omx_endpoint_t ep, union omx_request * req, uint32_t ms_timeou
 	goto out;
       }
 
-      /* release the lock a bit */
-      OMX__ENDPOINT_UNLOCK(ep);
-      OMX__ENDPOINT_LOCK(ep);
+      /* release the lock until something may have changed */
+      if (!omx__spin_unlocked(ep, &sleeper, req, ms_timeout, jiffies_expire))
+	break;
     }
 
-    /* let the caller handle errors */
-    ret = OMX_TIMEOUT;
-    goto out;
+    if (sleeper.need_wakeup) {
+      /* let the caller handle errors */
+      ret = OMX_TIMEOUT;
+      goto out;
+    }
+    /* nothing happened for a while, sleep instead */
   }
 
   wait_param.jiffies_expire = jiffies_expire;
@@ -768,7 +922,7 @@ omx__connect_wait(omx_endpoint_t ep, union omx_request * req, uint32_t ms_timeou
     if (req->generic.state == (OMX_REQUEST_STATE_DONE|OMX_REQUEST_STATE_INTERNAL))
       goto out;
 
-    ret = omx__wait(ep, &wait_param, ms_timeout, "connect");
+    ret = omx__wait(ep, &sleeper, &wait_param, ms_timeout, "connect");
     if (ret != OMX_SUCCESS) {
       /* keep OMX_TIMEOUT as is and let the caller handle errors */
       goto out;
@@ -780,6 +934,89 @@ omx__connect_wait(omx_endpoint_t ep, union omx_request * req, uint32_t ms_timeou
   return ret;
 }
 
+/*********************************
+ * Asynchronous progression thread
+ */
+
+/*
+ * Sleep in the driver and progress whenever an event arrives or the
+ * library needs to resend or ack, so that large messages and acks keep
+ * going while the application computes.
+ * The thread is not queued on the sleepers list: completions are never
+ * routed to it, but the driver wakes it up on events like any waiter.
+ */
+static void *
+omx__progress_thread_main(void *arg)
+{
+  struct omx_endpoint *ep = arg;
+  struct omx_cmd_wait_event wait_param;
+  struct omx__sleeper sleeper;
+
+  if (omx__globals.progress_thread_binding)
+    omx__endpoint_bind_process(ep, omx__globals.progress_thread_binding);
+
+  sleeper.need_wakeup = 0;
+  sleeper.in_driver = 0;
+  sleeper.id = 0;
+  sleeper.req = NULL;
+
+  OMX__ENDPOINT_LOCK(ep);
+  while (!ep->progress_thread_stop) {
+    omx__progress(ep);
+
+    wait_param.jiffies_expire = OMX_CMD_WAIT_EVENT_TIMEOUT_INFINITE;
+    /* do not let a previous timeout or wakeup status prevent from sleeping */
+    wait_param.status = OMX_CMD_WAIT_EVENT_STATUS_EVENT;
+    omx__wait(ep, &sleeper, &wait_param, OMX_TIMEOUT_INFINITE, "progress thread");
+  }
+  OMX__ENDPOINT_UNLOCK(ep);
+
+  return NULL;
+}
+
+/* called when opening the endpoint */
+void
+omx__progress_thread_start(struct omx_endpoint *ep)
+{
+  int err;
+
+  err = omx__thread_create(&ep->progress_thread, omx__progress_thread_main, ep);
+  if (err) {
+    omx__verbose_printf(ep, "Failed to start the progress thread (%s), progressing in the application only\n",
+			strerror(err));
+    return;
+  }
+
+  ep->progress_thread_running = 1;
+  omx__verbose_printf(ep, "Started the progress thread\n");
+}
+
+/* called with the endpoint lock held when closing the endpoint */
+void
+omx__progress_thread_stop(struct omx_endpoint *ep)
+{
+  struct omx_cmd_wakeup wakeup;
+  int err;
+
+  ep->progress_thread_stop = 1;
+  /* make the wait ioctl return immediately if the thread did not enter the driver yet */
+  ep->desc->user_event_index++;
+
+  wakeup.status = OMX_CMD_WAIT_EVENT_STATUS_WAKEUP;
+  wakeup.waiter_id = 0; /* the thread has no id */
+  err = ioctl(ep->fd, OMX_CMD_WAKEUP, &wakeup);
+  if (unlikely(err < 0))
+    omx__ioctl_errno_to_return_checked(OMX_SUCCESS,
+				       "wakeup the progress thread in the driver");
+
+  /* let the thread finish its last round of progression */
+  OMX__ENDPOINT_UNLOCK(ep);
+  omx__thread_join(&ep->progress_thread);
+  OMX__ENDPOINT_LOCK(ep);
+
+  ep->progress_thread_running = 0;
+}
+
 /*****************
  * Wakeup waiters
  */
@@ -799,6 +1036,7 @@ omx__wakeup(struct omx_endpoint *ep, uint32_t status)
     int err;
 
     wakeup.status = status;
+    wakeup.waiter_id = 0; /* all of them */
 
     err = ioctl(ep->fd, OMX_CMD_WAKEUP, &wakeup);
     if (unlikely(err < 0))
@@ -809,13 +1047,46 @@ omx__wakeup(struct omx_endpoint *ep, uint32_t status)
   return OMX_SUCCESS;
 }
 
-/* add a user-generated event and wakeup in-driver sleepers if necessary */
+/*
+ * a request completed or an unexpected message was queued, only wakeup
+ * the sleepers that wait for it. The driver only wakes up a single
+ * sleeper when an event arrives since it processes all of them,
+ * so completions have to be routed here even if they come from the driver.
+ */
 void
-omx__notify_user_event(struct omx_endpoint *ep)
+omx__wakeup_sleepers(struct omx_endpoint *ep, const union omx_request *req)
 {
-  ep->desc->user_event_index++;
+  struct omx__sleeper *sleeper;
+
+  if (omx__globals.waitspin)
+    /* spinners notice the completion generation change */
+    return;
 
-  omx__wakeup(ep, OMX_CMD_WAIT_EVENT_STATUS_EVENT);
+  list_for_each_entry(sleeper, &ep->sleepers, list_elt) {
+    struct omx_cmd_wakeup wakeup;
+    int err;
+
+    if (!sleeper->in_driver)
+      /* it will check the request queues before going to sleep */
+      continue;
+
+    if (sleeper->req
+	? sleeper->req != req
+	: (req->generic.status.match_info & sleeper->match_mask) != sleeper->match_info)
+      continue;
+
+    /* make the wait ioctl return immediately if the sleeper did not enter the driver yet */
+    ep->desc->user_event_index++;
+    sleeper->in_driver = 0;
+
+    wakeup.status = OMX_CMD_WAIT_EVENT_STATUS_EVENT;
+    wakeup.waiter_id = sleeper->id;
+
+    err = ioctl(ep->fd, OMX_CMD_WAKEUP, &wakeup);
+    if (unlikely(err < 0))
+      omx__ioctl_errno_to_return_checked(OMX_SUCCESS,
+					 "wakeup a sleeper in the driver");
+  }
 }
 
 /* API omx_wakeup */
@@ -221,26 +221,33 @@ omx__handle_nack(struct omx_endpoint *ep,
  */
 
 static omx_return_t
-omx__submit_send_liback(const struct omx_endpoint *ep,
+omx__submit_send_liback(struct omx_endpoint *ep,
 			struct omx__partner * partner)
 {
-  struct omx_cmd_send_liback liback_param;
+  struct omx_cmd_send_liback liback_ioctl_param, *liback_param = &liback_ioctl_param;
   omx__seqnum_t ack_upto = omx__get_partner_needed_ack(ep, partner);
   int err;
 
   partner->last_send_acknum++;
 
-  liback_param.peer_index = partner->peer_index;
-  liback_param.dest_endpoint = partner->endpoint_index;
-  liback_param.shared = omx__partner_localization_shared(partner);
-  liback_param.session_id = partner->back_session_id;
-  liback_param.acknum = partner->last_send_acknum;
-  liback_param.session_id = partner->back_session_id;
-  liback_param.lib_seqnum = ack_upto;
-  liback_param.send_seq = ack_upto; /* FIXME? partner->send_seq */
-  liback_param.resent = 0; /* FIXME? partner->requeued */
-
-  err = ioctl(ep->fd, OMX_CMD_XEN_SEND_LIBACK, &liback_param);
+  if (omx__globals.send_batch > 1)
+    /* fill the batch entry directly, a failed batch will be acked again later */
+    liback_param = omx__send_batch_queue(ep, OMX_CMD_SEND_LIBACK);
+
+  liback_param->peer_index = partner->peer_index;
+  liback_param->dest_endpoint = partner->endpoint_index;
+  liback_param->shared = omx__partner_localization_shared(partner);
+  liback_param->session_id = partner->back_session_id;
+  liback_param->acknum = partner->last_send_acknum;
+  liback_param->session_id = partner->back_session_id;
+  liback_param->lib_seqnum = ack_upto;
+  liback_param->send_seq = ack_upto; /* FIXME? partner->send_seq */
+  liback_param->resent = 0; /* FIXME? partner->requeued */
+
+  if (omx__globals.send_batch > 1)
+    return OMX_SUCCESS;
+
+  err = ioctl(ep->fd, OMX_CMD_XEN_SEND_LIBACK, liback_param);
   if (unlikely(err < 0)) {
     omx_return_t ret = omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
 							  OMX_SUCCESS,
@@ -121,7 +121,8 @@ omx__endpoint_sendq_map_exit(struct omx_endpoint * ep)
  * Binding
  */
 
-static void
+/* bind the calling thread, either the application or its progression thread */
+void
 omx__endpoint_bind_process(const struct omx_endpoint *ep, const char *bindstring)
 {
   cpu_set_t cs;
@@ -333,6 +334,8 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
   uint8_t ctxid_bits;
   uint8_t ctxid_shift;
   omx_error_handler_t error_handler;
+  int progress_thread;
+  uint32_t unexp_queue_max;
   omx_return_t ret = OMX_SUCCESS;
   int err, fd;
   unsigned i;
@@ -358,6 +361,8 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
   error_handler = NULL;
   ctxid_bits = omx__globals.ctxid_bits;
   ctxid_shift = omx__globals.ctxid_shift;
+  progress_thread = omx__globals.progress_thread;
+  unexp_queue_max = omx__globals.unexp_queue_max;
 
   for(i=0; i<param_count; i++) {
     switch (param_array[i].key) {
@@ -366,7 +371,9 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
       break;
     }
     case OMX_ENDPOINT_PARAM_UNEXP_QUEUE_MAX: {
-      omx__verbose_printf(NULL, "setting endpoint unexp queue max ignored for now\n");
+      unexp_queue_max = param_array[i].val.unexp_queue_max;
+      omx__verbose_printf(NULL, "Setting endpoint unexpected queue max to %ld bytes\n",
+			  (unsigned long) unexp_queue_max);
       break;
     }
     case OMX_ENDPOINT_PARAM_CONTEXT_ID: {
@@ -376,6 +383,10 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
 			  ctxid_bits, ctxid_shift);
       break;
     }
+    case OMX_ENDPOINT_PARAM_PROGRESS_THREAD: {
+      progress_thread = param_array[i].val.progress_thread;
+      break;
+    }
     default: {
       ret = omx__error(OMX_ENDPOINT_PARAM_BAD_KEY,
 		       "Reading endpoint parameter key %d", (unsigned) key);
@@ -507,7 +518,7 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
 
   /* init most of the endpoint state */
   ep->avail_exp_events = OMX_EXP_EVENTQ_ENTRY_NR - (OMX_EXP_RELEASE_SLOTS_BATCH_NR - 1); /* up to BATCH_NR-1 event slots may have been
-											  * processed but not released to the kernel yet */
+											  * processed but not released to the driver yet */
   BUILD_BUG_ON(OMX_EXP_EVENTQ_ENTRY_NR - (OMX_EXP_RELEASE_SLOTS_BATCH_NR - 1)
 	       < OMX_MEDIUM_FRAGS_MAX); /* make sure a single request has enough expected event slots in the ring */
   ep->req_resends_max = omx__globals.req_resends_max;
@@ -517,6 +528,10 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
 #ifdef OMX_LIB_DEBUG
   ep->last_progress_jiffies = 0;
 #endif
+  ep->last_progress_timers_jiffies = 0;
+  ep->progress_calls = 0;
+  ep->progress_busy_calls = 0;
+  ep->completion_gen = 0;
   ep->zombie_max = omx__globals.zombie_max;
   ep->zombies = 0;
   ep->error_handler = error_handler;
@@ -525,15 +540,21 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
   omx__unlock(&omx__global_lock);
 
   /* initialize some sub-structures */
-  omx__request_alloc_init(ep);
+  ret = omx__request_alloc_init(ep);
+  if (ret != OMX_SUCCESS) {
+    ret = omx__error(ret, "Initializing new endpoint request cache");
+    goto out_with_message_prefix;
+  }
   omx__lock_init(&ep->lock);
+  omx__lock_init(&ep->recv_lock);
+  omx__lock_init(&ep->send_lock);
   omx__cond_init(&ep->in_handler_cond);
 
   /* prepare the large regions */
   ret = omx__endpoint_large_region_map_init(ep);
   if (ret != OMX_SUCCESS) {
     ret = omx__error(ret, "Initializing new endpoint large region map");
-    goto out_with_message_prefix;
+    goto out_with_request_alloc;
   }
 
   /* allocate partners */
@@ -563,16 +584,40 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
     goto out_with_myself;
   }
 
+  ep->anyctxid.unexp_hash = omx_malloc_ep(ep, OMX__RECV_HASH_SIZE * sizeof(*ep->anyctxid.unexp_hash));
+  if (!ep->anyctxid.unexp_hash) {
+    ret = omx__error(OMX_NO_RESOURCES, "Allocating new endpoint unexpected hash table");
+    goto out_with_ctxid;
+  }
+
   /* init lib specific fieds */
   ep->unexp_handler = NULL;
   ep->progression_disabled = 0;
 
   list_head_init(&ep->anyctxid.done_req_q);
   list_head_init(&ep->anyctxid.unexp_req_q);
+  for(i=0; i<OMX__RECV_HASH_SIZE; i++)
+    list_head_init(&ep->anyctxid.unexp_hash[i]);
+
+  for(i=0; i<OMX__UNEXP_BUFFER_CLASS_NR; i++) {
+    ep->unexp_buffer_free[i] = NULL;
+    ep->unexp_buffer_free_nr[i] = 0;
+  }
+  ep->unexp_bytes = 0;
+  ep->unexp_bytes_max = unexp_queue_max;
+  for(i=0; i<OMX_UNEXP_EVENTQ_ENTRY_NR; i++)
+    ep->unexp_slot_req[i] = NULL;
+  ep->unexp_event_index = 0;
+  ep->unexp_released_index = 0;
+  ep->unexp_slots_held_nr = 0;
+  ep->unexp_slots_pinned_max = omx__globals.unexp_slots_max;
 
   for(i=0; i<ep->ctxid_max; i++) {
     list_head_init(&ep->ctxid[i].unexp_req_q);
     list_head_init(&ep->ctxid[i].recv_req_q);
+    ep->ctxid[i].recv_hash = NULL;
+    ep->ctxid[i].recv_hash_nr = 0;
+    ep->ctxid[i].next_recv_stamp = 0;
     list_head_init(&ep->ctxid[i].done_req_q);
   }
 
@@ -595,25 +640,38 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
   ep->last_partners_acking_jiffies = 0;
   list_head_init(&ep->partners_to_ack_delayed_list);
   list_head_init(&ep->throttling_partners_list);
+  ep->send_batch_nr = 0;
 
   list_head_init(&ep->sleepers);
+  ep->last_sleeper_id = 0;
+  ep->progress_thread_running = 0;
+  ep->progress_thread_stop = 0;
 
   ep->desc->user_event_index = 0;
+  ep->desc->exp_eventq_index = 0;
+  ep->desc->unexp_eventq_index = 0;
 
   omx__add_endpoint_to_list(ep);
 
   omx__progress(ep);
 
+  if (progress_thread)
+    omx__progress_thread_start(ep);
+
   *epp = ep;
 
   return OMX_SUCCESS;
 
+ out_with_ctxid:
+  omx_free_ep(ep, ep->ctxid);
  out_with_myself:
   omx_free_ep(ep, ep->myself);
  out_with_partners:
   omx_free_ep(ep, ep->partners);
  out_with_large_regions:
   omx__endpoint_large_region_map_exit(ep);
+ out_with_request_alloc:
+  omx__request_alloc_exit(ep);
  out_with_message_prefix:
   omx__lock(&omx__global_lock);
   omx_free(ep->message_prefix);
@@ -637,6 +695,8 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
   close(fd);
  out_with_ep:
   omx__lock_destroy(&ep->lock);
+  omx__lock_destroy(&ep->recv_lock);
+  omx__lock_destroy(&ep->send_lock);
   omx__cond_destroy(&ep->in_handler_cond);
   omx__lock(&omx__global_lock);
   omx_free(ep);
@@ -662,6 +722,9 @@ omx_close_endpoint(struct omx_endpoint *ep)
     goto out_with_lock;
   }
 
+  if (ep->progress_thread_running)
+    omx__progress_thread_stop(ep);
+
   ret = omx__remove_endpoint_from_list(ep);
   if (ret != OMX_SUCCESS) {
     ret = omx__error(ret, "Closing endpoint");
@@ -669,11 +732,18 @@ omx_close_endpoint(struct omx_endpoint *ep)
   }
 
   omx__flush_partners_to_ack(ep);
+  omx__flush_send_batch(ep);
+
+  omx__verbose_printf(ep, "Progression did some work in %llu out of %llu calls\n",
+		      (unsigned long long) ep->progress_busy_calls,
+		      (unsigned long long) ep->progress_calls);
 
   omx__destroy_requests_on_close(ep);
   omx__request_alloc_check(ep);
   omx__request_alloc_exit(ep);
+  omx__unexp_buffers_exit(ep);
 
+  omx_free_ep(ep, ep->anyctxid.unexp_hash);
   omx_free_ep(ep, ep->ctxid);
   for(i=0; i<omx__driver_desc->peer_max * omx__driver_desc->endpoint_max; i++)
     if (ep->partners[i])
@@ -695,6 +765,8 @@ omx_close_endpoint(struct omx_endpoint *ep)
   //ioctl(ep->fd, OMX_CMD_CLOSE_ENDPOINT, &close_param);
   close(ep->fd);
   omx__lock_destroy(&ep->lock);
+  omx__lock_destroy(&ep->recv_lock);
+  omx__lock_destroy(&ep->send_lock);
   omx__cond_destroy(&ep->in_handler_cond);
   omx__lock(&omx__global_lock);
   omx_free(ep);
@@ -775,8 +847,9 @@ omx__destroy_unlinked_request_on_close(struct omx_endpoint *ep, union omx_reques
 
   case OMX_REQUEST_TYPE_RECV:
     if (state & OMX_REQUEST_STATE_UNEXPECTED_RECV) {
-      if (req->generic.status.msg_length)
-	omx_free_ep(ep, OMX_SEG_PTR(&req->recv.segs.single));
+      /* data still in the recvq needs nothing, the endpoint is going away */
+      if (req->generic.status.msg_length && !(state & OMX_REQUEST_STATE_RECV_UNEXP_SLOT))
+	omx__unexp_buffer_free(ep, OMX_SEG_PTR(&req->recv.segs.single), req->generic.status.msg_length);
     } else {
       omx_free_segments(ep, &req->send.segs);
     }
@@ -788,7 +861,7 @@ omx__destroy_unlinked_request_on_close(struct omx_endpoint *ep, union omx_reques
 
   case OMX_REQUEST_TYPE_RECV_SELF_UNEXPECTED:
     if (req->generic.status.msg_length)
-      omx_free_ep(ep, OMX_SEG_PTR(&req->recv.segs.single));
+      omx__unexp_buffer_free(ep, OMX_SEG_PTR(&req->recv.segs.single), req->generic.status.msg_length);
     omx_free_segments(ep, &req->send.segs);
     break;
 
@@ -870,13 +943,24 @@ omx__destroy_requests_on_close(struct omx_endpoint *ep)
       /* cannot be done */
       omx__destroy_unlinked_request_on_close(ep, req);
     }
+
+    if (ep->ctxid[i].recv_hash) {
+      unsigned j;
+      for(j=0; j<OMX__RECV_HASH_SIZE; j++)
+	omx__foreach_request_safe(&ep->ctxid[i].recv_hash[j], req, next) {
+	  omx___dequeue_request(req);
+	  /* cannot be done */
+	  omx__destroy_unlinked_request_on_close(ep, req);
+	}
+      omx_free_ep(ep, ep->ctxid[i].recv_hash);
+      ep->ctxid[i].recv_hash = NULL;
+      ep->ctxid[i].recv_hash_nr = 0;
+    }
   }
 
   /* free unexp reqs */
   omx__foreach_request_safe(&ep->anyctxid.unexp_req_q, req, next) {
-    omx___dequeue_request(req);
-    if (unlikely(HAS_CTXIDS(ep)))
-      omx___dequeue_ctxid_request(req);
+    omx___dequeue_unexp_request(ep, req);
     /* cannot be done */
     omx__destroy_unlinked_request_on_close(ep, req);
   }
@@ -945,6 +1029,206 @@ omx__destroy_requests_on_close(struct omx_endpoint *ep)
 #endif
 }
 
+/*********************
+ * Request allocation
+ */
+
+OMX__THREAD_LOCAL struct omx__request_magazine omx__request_magazine;
+
+/* gives the magazine of exiting threads back to its cache */
+static struct omx__thread_key omx__request_magazine_key;
+static int omx__request_magazine_key_created = 0;
+
+/* drop a reference to the cache and release its lock, the last one frees it */
+static void
+omx__request_cache_put_unlock(struct omx__request_cache *cache)
+{
+  unsigned refcount = --cache->refcount;
+
+  omx__unlock(&cache->lock);
+
+  if (!refcount) {
+    omx__lock_destroy(&cache->lock);
+    omx_free(cache);
+  }
+}
+
+/*
+ * Give the magazine contents back to the cache that owns it.
+ * Only the lock of this cache is taken, the caller may hold another
+ * endpoint lock. If the endpoint has been closed, its requests have
+ * been freed already.
+ */
+static void
+omx__request_magazine_release(struct omx__request_magazine *mag)
+{
+  struct omx__request_cache *cache = mag->cache;
+
+  if (!cache)
+    return;
+
+  omx__lock(&cache->lock);
+  if (!cache->closed)
+    while (mag->nr)
+      list_add_after(&mag->reqs[--mag->nr]->generic.queue_elt, &cache->free_q);
+  omx__request_cache_put_unlock(cache);
+
+  mag->cache = NULL;
+  mag->nr = 0;
+}
+
+static void
+omx__request_magazine_destructor(void *data)
+{
+  omx__request_magazine_release(data);
+}
+
+/* switch the (released) magazine of the current thread to this endpoint */
+static void
+omx__request_magazine_attach(struct omx__request_magazine *mag, struct omx_endpoint *ep)
+{
+  struct omx__request_cache *cache = ep->req_cache;
+
+  omx__lock(&cache->lock);
+  cache->refcount++;
+  omx__unlock(&cache->lock);
+
+  mag->cache = cache;
+  if (omx__request_magazine_key_created)
+    omx__thread_key_set(&omx__request_magazine_key, mag);
+}
+
+omx_return_t
+omx__request_alloc_init(struct omx_endpoint *ep)
+{
+  struct omx__request_cache *cache;
+
+  cache = omx_malloc(sizeof(*cache));
+  if (!cache)
+    return OMX_NO_RESOURCES;
+
+  omx__lock_init(&cache->lock);
+  list_head_init(&cache->free_q);
+  list_head_init(&cache->chunks);
+  cache->refcount = 1;
+  cache->closed = 0;
+  ep->req_cache = cache;
+
+  omx__lock(&omx__global_lock);
+  if (!omx__request_magazine_key_created
+      && !omx__thread_key_create(&omx__request_magazine_key, omx__request_magazine_destructor))
+    omx__request_magazine_key_created = 1;
+  omx__unlock(&omx__global_lock);
+
+#ifdef OMX_LIB_DEBUG
+  ep->req_alloc_nr = 0;
+#endif
+  return OMX_SUCCESS;
+}
+
+void
+omx__request_alloc_exit(struct omx_endpoint *ep)
+{
+  struct omx__request_cache *cache = ep->req_cache;
+
+#ifdef OMX_LIB_DEBUG
+  if (ep->req_alloc_nr)
+    omx__verbose_printf(ep, "%d requests were not freed on endpoint close\n", ep->req_alloc_nr);
+#endif
+
+  if (omx__request_magazine.cache == cache)
+    omx__request_magazine_release(&omx__request_magazine);
+
+  /* the magazines of other threads will notice that the cache is closed */
+  omx__lock(&cache->lock);
+  cache->closed = 1;
+  while (!list_empty(&cache->chunks)) {
+    struct list_head *chunk = cache->chunks.nxt;
+    list_del(chunk);
+    omx_free_ep(ep, chunk);
+  }
+  omx__request_cache_put_unlock(cache);
+  ep->req_cache = NULL;
+}
+
+/* called with the cache lock held */
+static int
+omx__request_cache_grow(struct omx_endpoint *ep)
+{
+  struct omx__request_cache *cache = ep->req_cache;
+  size_t stride = (sizeof(union omx_request) + OMX__REQUEST_CACHELINE_SIZE - 1) & ~(OMX__REQUEST_CACHELINE_SIZE - 1);
+  struct list_head *chunk;
+  uintptr_t first;
+  unsigned i;
+
+  /* the chunk list element comes first, then cache-aligned requests */
+  chunk = omx_malloc_ep(ep, sizeof(*chunk) + OMX__REQUEST_CACHELINE_SIZE - 1 + OMX__REQUEST_CHUNK_NR * stride);
+  if (!chunk)
+    return -1;
+  list_add_tail(chunk, &cache->chunks);
+
+  first = ((uintptr_t) (chunk + 1) + OMX__REQUEST_CACHELINE_SIZE - 1) & ~(uintptr_t) (OMX__REQUEST_CACHELINE_SIZE - 1);
+  for(i=0; i<OMX__REQUEST_CHUNK_NR; i++)
+    list_add_tail(&((union omx_request *) (first + i * stride))->generic.queue_elt, &cache->free_q);
+
+  return 0;
+}
+
+union omx_request *
+omx__request_magazine_refill(struct omx_endpoint *ep)
+{
+  struct omx__request_magazine *mag = &omx__request_magazine;
+  struct omx__request_cache *cache = ep->req_cache;
+  union omx_request *req = NULL;
+
+  if (mag->cache != cache) {
+    omx__request_magazine_release(mag);
+    omx__request_magazine_attach(mag, ep);
+  }
+
+  omx__lock(&cache->lock);
+
+  if (list_empty(&cache->free_q)
+      && omx__request_cache_grow(ep) < 0)
+    goto out_with_lock;
+
+  /* take one for the caller, and up to half a magazine for the next allocations */
+  req = list_first_entry(&cache->free_q, union omx_request, generic.queue_elt);
+  list_del(&req->generic.queue_elt);
+  while (mag->nr < OMX__REQUEST_MAGAZINE_SIZE/2 && !list_empty(&cache->free_q)) {
+    union omx_request *cached = list_first_entry(&cache->free_q, union omx_request, generic.queue_elt);
+    list_del(&cached->generic.queue_elt);
+    mag->reqs[mag->nr++] = cached;
+  }
+
+ out_with_lock:
+  omx__unlock(&cache->lock);
+  return req;
+}
+
+void
+omx__request_magazine_flush(struct omx_endpoint *ep, union omx_request * req)
+{
+  struct omx__request_magazine *mag = &omx__request_magazine;
+  struct omx__request_cache *cache = ep->req_cache;
+
+  if (mag->cache != cache && !mag->nr) {
+    /* the magazine is empty, switch it to this endpoint */
+    omx__request_magazine_release(mag);
+    omx__request_magazine_attach(mag, ep);
+    mag->reqs[mag->nr++] = req;
+    return;
+  }
+
+  omx__lock(&cache->lock);
+  list_add_after(&req->generic.queue_elt, &cache->free_q);
+  if (mag->cache == cache)
+    /* the magazine is full, only keep half of it */
+    while (mag->nr > OMX__REQUEST_MAGAZINE_SIZE/2)
+      list_add_after(&mag->reqs[--mag->nr]->generic.queue_elt, &cache->free_q);
+  omx__unlock(&cache->lock);
+}
+
 /***************************
  * Request Allocation Debug
  */
@@ -961,6 +1245,13 @@ omx__request_alloc_check(const struct omx_endpoint *ep)
       if (omx__globals.check_request_alloc > 2)
         omx__verbose_printf(ep, "Found %d requests in recv queue #%d\n", j, i);
     }
+
+    j = ep->ctxid[i].recv_hash_nr;
+    if (j > 0) {
+      nr += j;
+      if (omx__globals.check_request_alloc > 2)
+        omx__verbose_printf(ep, "Found %d requests in recv hash #%d\n", j, i);
+    }
   }
 
   j = omx__queue_count(&ep->anyctxid.unexp_req_q);
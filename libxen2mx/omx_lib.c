@@ -21,6 +21,8 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 
 #include "omx_io.h"
 #include "omx_lib.h"
@@ -89,8 +91,8 @@ omx__process_event(struct omx_endpoint * ep, const union omx_evt * evt)
     break;
   }
 
-  case OMX_EVT_SEND_MEDIUMSQ_FRAG_DONE: {
-    omx_sendq_map_index_t sendq_index = evt->send_mediumsq_frag_done.sendq_offset >> OMX_SENDQ_ENTRY_SHIFT;
+  case OMX_EVT_SEND_MEDIUMSQ_DONE: {
+    omx_sendq_map_index_t sendq_index = evt->send_mediumsq_done.sendq_offset >> OMX_SENDQ_ENTRY_SHIFT;
     union omx_request * req = omx__endpoint_sendq_map_user(ep, sendq_index);
 
     omx__debug_assert(req);
@@ -98,10 +100,6 @@ omx__process_event(struct omx_endpoint * ep, const union omx_evt * evt)
 
     ep->avail_exp_events++;
 
-    /* message is not done */
-    if (unlikely(--req->send.specific.mediumsq.frags_pending_nr))
-      break;
-
     req->generic.state &= ~OMX_REQUEST_STATE_DRIVER_MEDIUMSQ_SENDING;
     omx__dequeue_request(&ep->driver_mediumsq_sending_req_q, req);
 
@@ -120,6 +118,24 @@ omx__process_event(struct omx_endpoint * ep, const union omx_evt * evt)
     break;
   }
 
+  case OMX_EVT_SEND_ERROR: {
+    const struct omx_evt_send_error * error = &evt->send_error;
+
+    if (error->error == -ENOMEM) {
+      /* same as a synchronous failure, let the retransmission try again later */
+      omx__debug_printf(SEND, ep, "driver failed to %s to peer index %d endpoint %d, will resend\n",
+			omx_strcmd(error->command),
+			(unsigned) error->peer_index, (unsigned) error->dest_endpoint);
+      break;
+    }
+
+    omx__abort(ep, "Failed to %s to peer index %d endpoint %d, driver replied %s\n",
+	       omx_strcmd(error->command),
+	       (unsigned) error->peer_index, (unsigned) error->dest_endpoint,
+	       strerror(-error->error));
+    break;
+  }
+
   case OMX_EVT_RECV_LIBACK: {
     omx__process_recv_liback(ep, &evt->recv_liback);
     break;
@@ -208,11 +224,74 @@ omx__check_enough_progression(struct omx_endpoint * ep)
 #endif
 }
 
+static INLINE void
+omx__prefetch_event_payload(struct omx_endpoint * ep, const volatile union omx_evt * evt)
+{
+  switch (evt->generic.type) {
+  case OMX_EVT_RECV_SMALL:
+    omx__prefetch(ep->recvq + evt->recv_msg.specific.small.recvq_offset);
+    break;
+  case OMX_EVT_RECV_MEDIUM_FRAG:
+    omx__prefetch(ep->recvq + evt->recv_msg.specific.medium_frag.recvq_offset);
+    break;
+  }
+}
+
+/*
+ * Process the ready events of an event queue, per batch of consecutive slots.
+ * The slots and recvq payloads of a batch are prefetched while looking for
+ * its end, and the batch is released to the driver at once by publishing
+ * the next slot index in the endpoint descriptor.
+ * Unexpected slots whose recvq data is still used by unexpected receives
+ * are not released, see omx__release_unexp_slots().
+ */
+static INLINE omx_eventq_index_t
+omx__process_eventq(struct omx_endpoint * ep, const void * eventq, unsigned long entry_nr,
+		    omx_eventq_index_t index, unsigned batch_max, int unexp)
+{
+  while (1) {
+    unsigned nr, i;
+
+    for(nr=0; nr<batch_max; nr++) {
+      const volatile union omx_evt * evt = eventq + ((index + nr) % entry_nr) * OMX_EVENTQ_ENTRY_SIZE;
+      int id = 1 + ((index + nr) % OMX_EVENT_ID_MAX);
+
+      if (evt->generic.id != id)
+	break;
+
+      omx__prefetch_event_payload(ep, evt);
+      omx__prefetch(eventq + ((index + nr + 1) % entry_nr) * OMX_EVENTQ_ENTRY_SIZE);
+    }
+    if (!nr)
+      break;
+
+    for(i=0; i<nr; i++) {
+      if (unexp)
+	ep->unexp_event_index = index + i;
+      omx__process_event(ep, eventq + ((index + i) % entry_nr) * OMX_EVENTQ_ENTRY_SIZE);
+    }
+
+    /* no need to read these slots anymore, the driver may reuse them once all reads are done */
+    index += nr;
+    if (unexp) {
+      ep->next_unexp_event_index = index;
+      omx__release_unexp_slots(ep);
+    } else {
+      __sync_synchronize();
+      ep->desc->exp_eventq_index = index;
+    }
+  }
+
+  return index;
+}
+
 omx_return_t
 omx__progress(struct omx_endpoint * ep)
 {
   omx_eventq_index_t index;
-  int err;
+  uint64_t now;
+  int timers_expired;
+  int busy = 0;
 
   if (unlikely(ep->progression_disabled))
     return OMX_SUCCESS;
@@ -223,63 +302,54 @@ omx__progress(struct omx_endpoint * ep)
    * to release the pressure coming from the network
    */
   index = ep->next_unexp_event_index;
-  while (1) {
-    const volatile union omx_evt * evt = ep->unexp_eventq + (index % OMX_UNEXP_EVENTQ_ENTRY_NR) * OMX_EVENTQ_ENTRY_SIZE;
-    int id = 1 + (index % OMX_EVENT_ID_MAX);
-
-    if (unlikely(evt->generic.id != id))
-      break;
-
-    omx__process_event(ep, (union omx_evt *) evt);
-
-    /* next event */
-    index++;
-
-    /* Acknowledgement per batch of event slots */
-    BUILD_BUG_ON(OMX_UNEXP_RELEASE_SLOTS_BATCH_NR < 1); /* make sure we release something */
-    if (unlikely(index % OMX_UNEXP_RELEASE_SLOTS_BATCH_NR == 0)) {
-      err = ioctl(ep->fd, OMX_CMD_RELEASE_UNEXP_SLOTS);
-      if (err < 0)
-	omx__abort(ep, "Failed to release a batch of unexpected slots\n");
-    }
-  }
-  ep->next_unexp_event_index = index;
+  busy |= (omx__process_eventq(ep, ep->unexp_eventq, OMX_UNEXP_EVENTQ_ENTRY_NR,
+			       index, OMX_UNEXP_RELEASE_SLOTS_BATCH_NR, 1) != index);
 
   /* process expected events then */
-  index = ep->next_exp_event_index;
-  while (1) {
-    const volatile union omx_evt * evt = ep->exp_eventq + (index % OMX_EXP_EVENTQ_ENTRY_NR) * OMX_EVENTQ_ENTRY_SIZE;
-    int id = 1 + (index % OMX_EVENT_ID_MAX);
-
-    if (unlikely(evt->generic.id != id))
-      break;
-
-    omx__process_event(ep, (union omx_evt *) evt);
+  index = omx__process_eventq(ep, ep->exp_eventq, OMX_EXP_EVENTQ_ENTRY_NR,
+			      ep->next_exp_event_index, OMX_EXP_RELEASE_SLOTS_BATCH_NR, 0);
+  busy |= (index != ep->next_exp_event_index);
+  ep->next_exp_event_index = index;
 
-    /* next event */
-    index++;
+  /* timer-driven work may only change when jiffies do */
+  now = omx__driver_desc->jiffies;
+  timers_expired = (now != ep->last_progress_timers_jiffies);
+  ep->last_progress_timers_jiffies = now;
 
-    /* Acknowledgement per batch of event slots */
-    BUILD_BUG_ON(OMX_EXP_RELEASE_SLOTS_BATCH_NR < 1); /* make sure we release something */
-    if (unlikely(index % OMX_EXP_RELEASE_SLOTS_BATCH_NR == 0)) {
-      err = ioctl(ep->fd, OMX_CMD_RELEASE_EXP_SLOTS);
-      if (err < 0)
-	omx__abort(ep, "Failed to release a batch of expected slots\n");
-    }
+  /* resend requests that didn't get acked/replied */
+  if (timers_expired
+      && (!omx__empty_queue(&ep->non_acked_req_q) || !omx__empty_queue(&ep->connect_req_q))) {
+    omx__process_resend_requests(ep);
+    busy = 1;
   }
-  ep->next_exp_event_index = index;
 
-  /* resend requests that didn't get acked/replied */
-  omx__process_resend_requests(ep);
+  /* post delayed requests, their resources may only have been released by events,
+   * otherwise retry once per jiffy
+   */
+  if (!omx__empty_queue(&ep->need_resources_send_req_q) && (busy || timers_expired)) {
+    omx__process_delayed_requests(ep);
+    busy = 1;
+  }
 
-  /* post delayed requests */
-  omx__process_delayed_requests(ep);
+  /* ack partners that didn't get acked recently,
+   * the delayed list is only looked at when jiffies changed
+   */
+  if (!list_empty(&ep->partners_to_ack_immediate_list)
+      || (timers_expired && !list_empty(&ep->partners_to_ack_delayed_list))) {
+    omx__process_partners_to_ack(ep);
+    busy = 1;
+  }
 
-  /* ack partners that didn't get acked recently */
-  omx__process_partners_to_ack(ep);
+  /* submit the commands that were queued during this round */
+  omx__flush_send_batch(ep);
 
   /* check the endpoint descriptor */
-  omx__check_endpoint_desc(ep);
+  if (timers_expired)
+    omx__check_endpoint_desc(ep);
+
+  ep->progress_calls++;
+  if (busy)
+    ep->progress_busy_calls++;
 
 #ifdef OMX_LIB_DEBUG
   /* check if we leaked some requests */
@@ -290,6 +360,29 @@ omx__progress(struct omx_endpoint * ep)
   return OMX_SUCCESS;
 }
 
+void
+omx__flush_send_batch(struct omx_endpoint *ep)
+{
+  struct omx_cmd_send_batch batch_param;
+  int err;
+
+  if (likely(!ep->send_batch_nr))
+    return;
+
+  batch_param.nr_entries = ep->send_batch_nr;
+  batch_param.pad = 0;
+  batch_param.entries = (uintptr_t) ep->send_batch;
+  ep->send_batch_nr = 0;
+
+  err = ioctl(ep->fd, OMX_CMD_XEN_SEND_BATCH, &batch_param);
+  if (unlikely(err < 0)) {
+    omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
+				       OMX_SUCCESS,
+				       "send a batch of %d commands", batch_param.nr_entries);
+    /* if OMX_NO_SYSTEM_RESOURCES, let the retransmission and acking try again later */
+  }
+}
+
 /* API omx_register_unexp_handler */
 omx_return_t
 omx_register_unexp_handler(omx_endpoint_t ep,
@@ -305,12 +398,46 @@ omx_register_unexp_handler(omx_endpoint_t ep,
   return OMX_SUCCESS;
 }
 
+/*
+ * Called without any endpoint lock after only taking the lock of a domain.
+ * Progress unless another thread holds ep->lock, it will progress by itself
+ * if needed, but submit the commands we queued anyway.
+ */
+omx_return_t
+omx__try_progress(struct omx_endpoint *ep)
+{
+  omx_return_t ret;
+
+  if (omx__trylock(&ep->lock)) {
+    if (*(volatile unsigned *) &ep->send_batch_nr) {
+      OMX__ENDPOINT_SEND_LOCK(ep);
+      omx__flush_send_batch(ep);
+      OMX__ENDPOINT_SEND_UNLOCK(ep);
+    }
+    return OMX_SUCCESS;
+  }
+
+  OMX__ENDPOINT_RECV_LOCK(ep);
+  OMX__ENDPOINT_SEND_LOCK(ep);
+
+  ret = omx__progress(ep);
+  /* submit a queued command even if progression is disabled */
+  omx__flush_send_batch(ep);
+
+  OMX__ENDPOINT_UNLOCK(ep);
+  return ret;
+}
+
 /* API omx_progress */
 omx_return_t
 omx_progress(omx_endpoint_t ep)
 {
   omx_return_t ret = OMX_SUCCESS;
 
+  /* do not contend on the lock if nothing happened */
+  if (!omx__progress_needed(ep))
+    return OMX_SUCCESS;
+
   OMX__ENDPOINT_LOCK(ep);
 
   ret = omx__progress(ep);
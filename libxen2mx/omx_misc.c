@@ -147,6 +147,8 @@ omx__sprintf_reqstate(uint16_t state, char *str)
     str += sprintf(str, "Zombie ");
   if (state & OMX_REQUEST_STATE_INTERNAL)
       str += sprintf(str, "Internal ");
+  if (state & OMX_REQUEST_STATE_RECV_UNEXP_SLOT)
+    str += sprintf(str, "RecvUnexpSlot ");
 }
 
 /* API omx_strerror */
@@ -277,7 +279,7 @@ omx__cancel_common(omx_endpoint_t ep,
     if (req->generic.state & OMX_REQUEST_STATE_RECV_NEED_MATCHING) {
       /* not matched, still in the recv queue */
       uint32_t ctxid = CTXID_FROM_MATCHING(ep, req->recv.match_info);
-      omx__dequeue_request(&ep->ctxid[ctxid].recv_req_q, req);
+      omx__dequeue_posted_recv(ep, ctxid, req);
       omx_free_segments(ep, &req->send.segs);
       req->generic.state &= ~OMX_REQUEST_STATE_RECV_NEED_MATCHING;
       *result = 1;
@@ -356,12 +356,6 @@ omx__connect_common(omx_endpoint_t ep,
     omx__enqueue_partner_request(&partner->connect_req_q, req);
     omx__connect_complete(ep, req, OMX_SUCCESS, ep->desc->session_id);
 
-    /*
-     * need to wakeup some possible connect-done waiters
-     * since this event does not come from the driver
-     */
-    omx__notify_user_event(ep);
-
     return OMX_SUCCESS;
   }
 
@@ -864,18 +858,21 @@ omx__partner_cleanup(struct omx_endpoint *ep, struct omx__partner *partner, int
 
     omx__debug_printf(CONNECT, ep, "Dropping partial medium recv %p\n", req);
 
-    /* dequeue and complete with status error */
     omx___dequeue_partner_request(req);
     if(unlikely(req->generic.state & OMX_REQUEST_STATE_UNEXPECTED_RECV)) {
-      omx__dequeue_request(&ep->anyctxid.unexp_req_q, req);
-      if (unlikely(HAS_CTXIDS(ep)))
-	omx__dequeue_ctxid_request(&ep->ctxid[ctxid].unexp_req_q, req);
+      /* nobody will ever complete it, release its unexpected buffer and drop it */
+      omx__dequeue_unexp_request(ep, ctxid, req);
+      if (req->generic.status.msg_length)
+	omx__unexp_buffer_free(ep, OMX_SEG_PTR(&req->recv.segs.single), req->generic.status.msg_length);
+      omx__request_free(ep, req);
+      count++;
+      continue;
+    }
 #ifdef OMX_LIB_DEBUG
-    } else {
-      omx__dequeue_request(&ep->partial_medium_recv_req_q, req);
+    omx__dequeue_request(&ep->partial_medium_recv_req_q, req);
 #endif
-    }
 
+    /* complete with status error */
     req->generic.state &= ~OMX_REQUEST_STATE_RECV_PARTIAL;
     omx__recv_complete(ep, req, OMX_REMOTE_ENDPOINT_UNREACHABLE);
     count++;
@@ -910,17 +907,22 @@ omx__partner_cleanup(struct omx_endpoint *ep, struct omx__partner *partner, int
     omx__debug_printf(CONNECT, ep, "Dropping unexpected recv %p\n", req);
 
     /* drop it and that's it */
-    omx___dequeue_request(req);
-    if (req->generic.type != OMX_REQUEST_TYPE_RECV_LARGE
+    omx___dequeue_unexp_request(ep, req);
+    if (req->generic.state & OMX_REQUEST_STATE_RECV_UNEXP_SLOT)
+      /* release the recvq slot that contains the data */
+      omx__release_unexp_slot(ep, req);
+    else if (req->generic.type != OMX_REQUEST_TYPE_RECV_LARGE
 	&& req->generic.status.msg_length > 0)
       /* release the single segment used for unexp buffer */
-      omx_free_ep(ep, OMX_SEG_PTR(&req->recv.segs.single));
+      omx__unexp_buffer_free(ep, OMX_SEG_PTR(&req->recv.segs.single), req->generic.status.msg_length);
     omx__request_free(ep, req);
 
     count++;
   }
-  if (count)
+  if (count) {
+    omx__release_unexp_slots(ep);
     omx__verbose_printf(ep, "Dropped %d unexpected message from partner\n", count);
+  }
 
   /*
    * Reset everything else to zero
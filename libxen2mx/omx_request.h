@@ -20,6 +20,7 @@
 #define __omx_request_h__
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "omx_lib.h"
 #include "omx_list.h"
@@ -28,52 +29,90 @@
  * Request allocation
  */
 
-static inline void
-omx__request_alloc_init(struct omx_endpoint *ep)
+/*
+ * Requests come from per-endpoint chunks. Each thread keeps a magazine
+ * of free requests of the last endpoint it used, so that allocating and
+ * freeing only touches the shared free queue when the magazine runs empty
+ * or full.
+ */
+
+extern OMX__THREAD_LOCAL struct omx__request_magazine omx__request_magazine;
+
+extern omx_return_t
+omx__request_alloc_init(struct omx_endpoint *ep);
+
+extern void
+omx__request_alloc_exit(struct omx_endpoint *ep);
+
+extern union omx_request *
+omx__request_magazine_refill(struct omx_endpoint *ep);
+
+extern void
+omx__request_magazine_flush(struct omx_endpoint *ep, union omx_request * req);
+
+/*
+ * The magazine only belongs to the current thread, so requests may be
+ * allocated before taking any endpoint lock and freed after releasing it.
+ * These ones are accounted with omx__request_alloc_account() under the lock.
+ */
+static inline __malloc union omx_request *
+omx___request_alloc(struct omx_endpoint *ep)
 {
+  struct omx__request_magazine *mag = &omx__request_magazine;
+  union omx_request * req;
+
+  if (likely(mag->cache == ep->req_cache && mag->nr))
+    req = mag->reqs[--mag->nr];
+  else
+    req = omx__request_magazine_refill(ep);
+  if (unlikely(!req))
+    return NULL;
+
 #ifdef OMX_LIB_DEBUG
-  ep->req_alloc_nr = 0;
+  memset(req, 0, sizeof(*req));
 #endif
+
+  req->generic.state = 0;
+  req->generic.status.code = OMX_SUCCESS;
+  return req;
 }
 
 static inline void
-omx__request_alloc_exit(struct omx_endpoint *ep)
+omx___request_free(struct omx_endpoint *ep, union omx_request * req)
+{
+  struct omx__request_magazine *mag = &omx__request_magazine;
+
+  if (likely(mag->cache == ep->req_cache && mag->nr < OMX__REQUEST_MAGAZINE_SIZE))
+    mag->reqs[mag->nr++] = req;
+  else
+    omx__request_magazine_flush(ep, req);
+}
+
+/* let the leak check know about requests entering or leaving the endpoint queues */
+static inline void
+omx__request_alloc_account(struct omx_endpoint *ep, int nr)
 {
 #ifdef OMX_LIB_DEBUG
-  if (ep->req_alloc_nr)
-    omx__verbose_printf(ep, "%d requests were not freed on endpoint close\n", ep->req_alloc_nr);
+  /* the send and recv domains account concurrently */
+  __sync_fetch_and_add(&ep->req_alloc_nr, nr);
 #endif
 }
 
 static inline __malloc union omx_request *
 omx__request_alloc(struct omx_endpoint *ep)
 {
-  union omx_request * req;
-
-#ifdef OMX_LIB_DEBUG
-  req = omx_calloc_ep(ep, 1, sizeof(*req));
-#else
-  req = omx_malloc_ep(ep, sizeof(*req));
-#endif
-  if (unlikely(!req))
-    return NULL;
+  union omx_request * req = omx___request_alloc(ep);
 
-  req->generic.state = 0;
-  req->generic.status.code = OMX_SUCCESS;
-
-#ifdef OMX_LIB_DEBUG
-  ep->req_alloc_nr++;
-#endif
+  if (likely(req))
+    omx__request_alloc_account(ep, 1);
   return req;
 }
 
 static inline void
 omx__request_free(struct omx_endpoint *ep, union omx_request * req)
 {
-  omx_free_ep(ep, req);
-#ifdef OMX_LIB_DEBUG
-  ep->req_alloc_nr--;
-#endif
+  omx__request_alloc_account(ep, -1);
+  omx___request_free(ep, req);
 }
 
 extern void
@@ -167,6 +206,126 @@ omx__dequeue_ctxid_request(struct list_head *head,
 #define omx__foreach_ctxid_request(head, req)	\
 list_for_each_entry(req, head, generic.ctxid_elt)
 
+/**********************************
+ * Posted receive queue management
+ */
+
+/*
+ * Posted receives without any wildcard in their match mask are hashed
+ * by match info so that incoming messages do not have to walk all of them.
+ * The other ones stay in the ordered recv_req_q. Both are stamped when
+ * posted so that matching still picks the first posted candidate.
+ */
+
+#define OMX__RECV_MATCH_MASK_FULL (~(uint64_t) 0)
+#define OMX__RECV_HASH_BITS 8
+#define OMX__RECV_HASH_SIZE (1 << OMX__RECV_HASH_BITS)
+
+static inline unsigned
+omx__recv_hash(uint64_t match_info)
+{
+  /* multiplicative hashing, MPI match infos mostly differ in a few bits */
+  return (unsigned) ((match_info * 0x9e3779b97f4a7c15ULL) >> (64 - OMX__RECV_HASH_BITS));
+}
+
+static inline int
+omx__recv_posted_before(const union omx_request *req1, const union omx_request *req2)
+{
+  return (int32_t) (req1->recv.post_stamp - req2->recv.post_stamp) < 0;
+}
+
+static inline int
+omx__recv_is_hashed(const union omx_request *req)
+{
+  return req->recv.match_mask == OMX__RECV_MATCH_MASK_FULL;
+}
+
+static inline void
+omx__dequeue_posted_recv(struct omx_endpoint *ep, uint32_t ctxid,
+			 union omx_request *req)
+{
+  if (omx__recv_is_hashed(req)) {
+    omx__dequeue_request(&ep->ctxid[ctxid].recv_hash[omx__recv_hash(req->recv.match_info)], req);
+    ep->ctxid[ctxid].recv_hash_nr--;
+  } else {
+    omx__dequeue_request(&ep->ctxid[ctxid].recv_req_q, req);
+  }
+}
+
+/**************************************
+ * Unexpected receive queue management
+ */
+
+/*
+ * Unexpected receives are queued in arrival order in the anyctxid queue
+ * (and in their ctxid queue), and also hashed by match info so that
+ * receives and probes without any wildcard find the oldest matching one
+ * without walking the whole backlog. Masked lookups still walk the queues.
+ */
+
+/*
+ * a request completed or an unexpected message was queued,
+ * let spinners notice it and wakeup the sleepers that wait for it
+ */
+static inline void
+omx__signal_completion(struct omx_endpoint *ep, const union omx_request *req)
+{
+  ep->completion_gen++;
+  if (unlikely(!list_empty(&ep->sleepers)))
+    omx__wakeup_sleepers(ep, req);
+}
+
+static inline void
+omx__enqueue_unexp_request(struct omx_endpoint *ep, uint32_t ctxid,
+			   union omx_request *req)
+{
+  omx__enqueue_request(&ep->anyctxid.unexp_req_q, req);
+  if (unlikely(HAS_CTXIDS(ep)))
+    omx__enqueue_ctxid_request(&ep->ctxid[ctxid].unexp_req_q, req);
+  list_add_tail(&req->recv.unexp_hash_elt,
+		&ep->anyctxid.unexp_hash[omx__recv_hash(req->generic.status.match_info)]);
+  omx__signal_completion(ep, req);
+}
+
+static inline void
+omx___dequeue_unexp_request(struct omx_endpoint *ep,
+			    union omx_request *req)
+{
+  omx___dequeue_request(req);
+  if (unlikely(HAS_CTXIDS(ep)))
+    omx___dequeue_ctxid_request(req);
+  list_del(&req->recv.unexp_hash_elt);
+}
+
+static inline void
+omx__dequeue_unexp_request(struct omx_endpoint *ep, uint32_t ctxid,
+			   union omx_request *req)
+{
+  list_check_elt(&ep->anyctxid.unexp_req_q, &req->generic.queue_elt,
+		 ep, "Failed to find request in unexpected queue for dequeueing\n");
+  if (unlikely(HAS_CTXIDS(ep)))
+    list_check_elt(&ep->ctxid[ctxid].unexp_req_q, &req->generic.ctxid_elt,
+		   ep, "Failed to find request in ctxid unexpected queue for dequeueing\n");
+  list_check_elt(&ep->anyctxid.unexp_hash[omx__recv_hash(req->generic.status.match_info)],
+		 &req->recv.unexp_hash_elt,
+		 ep, "Failed to find request in unexpected hash for dequeueing\n");
+
+  omx___dequeue_unexp_request(ep, req);
+}
+
+/* the oldest unexpected receive with exactly this match info */
+static inline union omx_request *
+omx__find_hashed_unexp_request(const struct omx_endpoint *ep, uint64_t match_info)
+{
+  union omx_request *req;
+
+  list_for_each_entry(req, &ep->anyctxid.unexp_hash[omx__recv_hash(match_info)], recv.unexp_hash_elt)
+    if (likely(req->generic.status.match_info == match_info))
+      return req;
+
+  return NULL;
+}
+
 /********************************
  * Done request queue management
  */
@@ -191,17 +350,16 @@ omx__notify_request_done_early(struct omx_endpoint *ep, uint32_t ctxid,
       list_add_tail(&req->generic.ctxid_elt, &ep->ctxid[ctxid].done_req_q);
   }
 
-  /*
-   * need to wakeup some possible send-done waiters (or recv-done for notify)
-   * since this event does not come from the driver
-   */
-  omx__notify_user_event(ep);
+  omx__signal_completion(ep, req);
 }
 
 static inline void
 omx__notify_request_done(struct omx_endpoint *ep, uint32_t ctxid,
 			 union omx_request *req)
 {
+  /* before a zombie gets freed below */
+  omx__signal_completion(ep, req);
+
   if (unlikely(req->generic.state & OMX_REQUEST_STATE_INTERNAL)) {
     /* no need to queue the request, just set the DONE status */
     omx__debug_assert(!(req->generic.state & OMX_REQUEST_STATE_DONE));
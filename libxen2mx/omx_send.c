@@ -57,7 +57,8 @@ omx__send_complete(struct omx_endpoint *ep, union omx_request *req,
     omx_free_ep(ep, req->send.specific.small.copy);
     break;
   case OMX_REQUEST_TYPE_SEND_MEDIUMSQ:
-    omx__endpoint_sendq_map_put(ep, req->send.specific.mediumsq.frags_nr, req->send.specific.mediumsq.sendq_map_index);
+    omx__endpoint_sendq_map_put(ep, req->send.specific.mediumsq.frags_nr,
+				req->send.specific.mediumsq.send_mediumsq_ioctl_param.sendq_index);
     break;
   default:
     break;
@@ -90,12 +91,18 @@ omx__post_isend_tiny(struct omx_endpoint *ep,
 		    (unsigned long long) omx__driver_desc->jiffies);
   tiny_param->hdr.piggyack = ack_upto;
 
-  err = ioctl(ep->fd, OMX_CMD_XEN_SEND_TINY, tiny_param);
-  if (unlikely(err < 0)) {
-    omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
-				       OMX_SUCCESS,
-				       "send tiny message");
-    /* if OMX_NO_SYSTEM_RESOURCES, let the retransmission try again later */
+  if (omx__globals.send_batch > 1) {
+    /* submitted with the other commands of this round, a failed batch looks like a packet loss */
+    memcpy(omx__send_batch_queue(ep, OMX_CMD_SEND_TINY), tiny_param, sizeof(*tiny_param));
+    err = 0;
+  } else {
+    err = ioctl(ep->fd, OMX_CMD_XEN_SEND_TINY, tiny_param);
+    if (unlikely(err < 0)) {
+      omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
+					 OMX_SUCCESS,
+					 "send tiny message");
+      /* if OMX_NO_SYSTEM_RESOURCES, let the retransmission try again later */
+    }
   }
 
   req->generic.resends++;
@@ -211,6 +218,7 @@ omx__post_isend_small(struct omx_endpoint *ep,
 		    (unsigned long long) omx__driver_desc->jiffies);
   small_param->piggyack = ack_upto;
 
+  omx__sync_send_batch(ep);
   err = ioctl(ep->fd, OMX_CMD_XEN_SEND_SMALL, small_param);
   if (unlikely(err < 0)) {
     omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
@@ -354,6 +362,7 @@ omx__post_isend_mediumva(struct omx_endpoint *ep,
 		    (unsigned long long) omx__driver_desc->jiffies);
   medium_param->piggyack = ack_upto;
 
+  omx__sync_send_batch(ep);
   err = ioctl(ep->fd, OMX_CMD_XEN_SEND_MEDIUMVA, medium_param);
   if (unlikely(err < 0)) {
     omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
@@ -441,14 +450,11 @@ omx__post_isend_mediumsq(struct omx_endpoint *ep,
 			 struct omx__partner *partner,
 			 union omx_request *req)
 {
-  struct omx_cmd_send_mediumsq_frag * medium_param = &req->send.specific.mediumsq.send_mediumsq_frag_ioctl_param;
+  struct omx_cmd_send_mediumsq * medium_param = &req->send.specific.mediumsq.send_mediumsq_ioctl_param;
   omx__seqnum_t ack_upto = omx__get_partner_needed_ack(ep, partner);
   uint32_t length = req->generic.status.msg_length;
-  uint32_t remaining = length;
-  omx_sendq_map_index_t * sendq_index = req->send.specific.mediumsq.sendq_map_index;
+  omx_sendq_map_index_t * sendq_index = medium_param->sendq_index;
   uint32_t frags_nr = req->send.specific.mediumsq.frags_nr;
-  uint32_t frag_max = OMX_MEDIUM_FRAG_LENGTH_MAX;
-  unsigned i;
   int err;
 
   omx__debug_printf(ACK, ep, "piggy acking back to partner up to %d (#%d) at jiffies %lld\n",
@@ -457,112 +463,60 @@ omx__post_isend_mediumsq(struct omx_endpoint *ep,
 		    (unsigned long long) omx__driver_desc->jiffies);
   medium_param->piggyack = ack_upto;
 
-  if (likely(req->send.segs.nseg == 1)) {
-    /* optimize the contigous send medium */
-    char * data = OMX_SEG_PTR(&req->send.segs.single);
-    uint32_t offset = 0;
-
-    for(i=0; i<frags_nr; i++) {
-      unsigned chunk = remaining > frag_max ? frag_max : remaining;
-      medium_param->frag_length = chunk;
-      medium_param->frag_seqnum = i;
-      medium_param->sendq_offset = sendq_index[i] << OMX_SENDQ_ENTRY_SHIFT;
-      omx__debug_printf(MEDIUM, ep, "sending mediumsq seqnum %d length %d of total %ld\n",
-			i, chunk, (unsigned long) length);
-
-      /* copy the data in the sendq only once */
-      if (likely(!req->generic.resends))
-	memcpy(ep->sendq + (sendq_index[i] << OMX_SENDQ_ENTRY_SHIFT), data + offset, chunk);
-
-      err = ioctl(ep->fd, OMX_CMD_XEN_SEND_MEDIUMSQ_FRAG, medium_param);
-      if (unlikely(err < 0)) {
-	/* finish copying frags if not done already */
-	if (likely(!req->generic.resends)) {
-	  unsigned j;
-	  for(j=i+1; j<frags_nr; i++) {
-	    unsigned chunk = remaining > frag_max ? frag_max : remaining;
-	    memcpy(ep->sendq + (sendq_index[j] << OMX_SENDQ_ENTRY_SHIFT), data + offset, chunk);
-	    remaining -= chunk;
-	    offset += chunk;
-	  }
-	}
-	goto err;
+  /* copy the data in the sendq only once */
+  if (likely(!req->generic.resends)) {
+    uint32_t remaining = length;
+    uint32_t frag_max = OMX_MEDIUM_FRAG_LENGTH_MAX;
+    unsigned i;
+
+    if (likely(req->send.segs.nseg == 1)) {
+      /* optimize the contigous send medium */
+      char * data = OMX_SEG_PTR(&req->send.segs.single);
+
+      for(i=0; i<frags_nr; i++) {
+	unsigned chunk = remaining > frag_max ? frag_max : remaining;
+	memcpy(ep->sendq + (sendq_index[i] << OMX_SENDQ_ENTRY_SHIFT), data, chunk);
+	remaining -= chunk;
+	data += chunk;
       }
 
-      remaining -= chunk;
-      offset += chunk;
-    }
+    } else {
+      /* initialize the state to the beginning */
+      struct omx_segscan_state state = { .seg = &req->send.segs.segs[0], .offset = 0 };
 
-  } else {
-    /* initialize the state to the beginning */
-    struct omx_segscan_state state = { .seg = &req->send.segs.segs[0], .offset = 0 };
-
-    for(i=0; i<frags_nr; i++) {
-      unsigned chunk = remaining > frag_max ? frag_max : remaining;
-      medium_param->frag_length = chunk;
-      medium_param->frag_seqnum = i;
-      medium_param->sendq_offset = sendq_index[i] << OMX_SENDQ_ENTRY_SHIFT;
-      omx__debug_printf(MEDIUM, ep, "sending mediumsq seqnum %d length %d of total %ld\n",
-			i, chunk, (unsigned long) length);
-
-      /* copy the data in the sendq only once */
-      if (likely(!req->generic.resends))
+      for(i=0; i<frags_nr; i++) {
+	unsigned chunk = remaining > frag_max ? frag_max : remaining;
 	omx_continue_partial_copy_from_segments(ep, ep->sendq + (sendq_index[i] << OMX_SENDQ_ENTRY_SHIFT),
 						&req->send.segs, chunk,
 						&state);
-
-      err = ioctl(ep->fd, OMX_CMD_XEN_SEND_MEDIUMSQ_FRAG, medium_param);
-      if (unlikely(err < 0)) {
-	/* finish copying frags if not done already */
-	if (likely(!req->generic.resends)) {
-	  unsigned j;
-	  for(j=i+1; j<frags_nr; i++) {
-	    unsigned chunk = remaining > frag_max ? frag_max : remaining;
-	    omx_continue_partial_copy_from_segments(ep, ep->sendq + (sendq_index[j] << OMX_SENDQ_ENTRY_SHIFT),
-						    &req->send.segs, chunk,
-						    &state);
-	    remaining -= chunk;
-	  }
-	}
-	goto err;
+	remaining -= chunk;
       }
-
-      remaining -= chunk;
     }
   }
 
-  req->send.specific.mediumsq.frags_pending_nr = frags_nr;
+  omx__debug_printf(MEDIUM, ep, "sending mediumsq length %ld in %d frags\n",
+		    (unsigned long) length, (unsigned) frags_nr);
+
+  /* post all frags at once, the driver will report a single event once they are all gone */
+  omx__sync_send_batch(ep);
+  err = ioctl(ep->fd, OMX_CMD_XEN_SEND_MEDIUMSQ, medium_param);
+  if (unlikely(err < 0)) {
+    /* assume the message got lost and let retransmission take care of it later */
+    omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
+				       OMX_SUCCESS,
+				       "send mediumsq message");
+
+    /* no event will be reported, keep the request as NEED_ACK */
+    ep->avail_exp_events++;
+    return;
+  }
 
- ok:
   req->generic.resends++;
   req->generic.last_send_jiffies = omx__driver_desc->jiffies;
   req->generic.state |= OMX_REQUEST_STATE_DRIVER_MEDIUMSQ_SENDING;
 
-  /* at least one frag was posted, the ack has been sent for sure */
+  /* the message was posted, the ack has been sent for sure */
   omx__mark_partner_ack_sent(ep, partner);
-
-  return;
-
- err:
-  /* assume some frags got lost and let retransmission take care of it later */
-  omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
-				     OMX_SUCCESS,
-				     "send mediumsq message fragment");
-
-  /* update the number of fragment that we actually submitted */
-  req->send.specific.mediumsq.frags_pending_nr = i;
-  ep->avail_exp_events += frags_nr - i;
-  if (i)
-    /*
-     * some frags were posted, mark the request as DRIVER_MEDIUM_SENDING
-     * and let retransmission wait for send done events first
-     */
-    goto ok;
-
-  /*
-   * no frags were posted, keep the request as NEED_ACK
-   * and let retransmission occur later
-   */
 }
 
 static INLINE void
@@ -570,7 +524,7 @@ omx__setup_isend_mediumsq(struct omx_endpoint *ep,
 			  struct omx__partner * partner,
 			  union omx_request *req)
 {
-  struct omx_cmd_send_mediumsq_frag * medium_param = &req->send.specific.mediumsq.send_mediumsq_frag_ioctl_param;
+  struct omx_cmd_send_mediumsq * medium_param = &req->send.specific.mediumsq.send_mediumsq_ioctl_param;
   uint64_t match_info = req->generic.status.match_info;
   uint32_t ctxid = CTXID_FROM_MATCHING(ep, match_info);
   omx__seqnum_t seqnum;
@@ -601,9 +555,9 @@ omx__alloc_setup_isend_mediumsq(struct omx_endpoint *ep,
 				struct omx__partner *partner,
 				union omx_request *req)
 {
-  struct omx_cmd_send_mediumsq_frag * medium_param = &req->send.specific.mediumsq.send_mediumsq_frag_ioctl_param;
+  struct omx_cmd_send_mediumsq * medium_param = &req->send.specific.mediumsq.send_mediumsq_ioctl_param;
   uint32_t length = req->generic.status.msg_length;
-  omx_sendq_map_index_t * sendq_index = req->send.specific.mediumsq.sendq_map_index;
+  omx_sendq_map_index_t * sendq_index = medium_param->sendq_index;
   int res = req->generic.missing_resources;
   uint32_t frags_nr = req->send.specific.mediumsq.frags_nr;
 
@@ -614,13 +568,14 @@ omx__alloc_setup_isend_mediumsq(struct omx_endpoint *ep,
   omx__abort(ep, "Unexpected missing resources %x for mediumsq send request\n", res);
 
  need_exp_events:
-  if (unlikely(ep->avail_exp_events < frags_nr))
+  /* a single event is reported for the whole message */
+  if (unlikely(!ep->avail_exp_events))
     return OMX_INTERNAL_MISSING_RESOURCES;
-  ep->avail_exp_events -= frags_nr;
+  ep->avail_exp_events--;
   req->generic.missing_resources &= ~OMX_REQUEST_RESOURCE_EXP_EVENT;
 
  need_sendq_map_slot:
-  if (unlikely(omx__endpoint_sendq_map_get(ep, req->send.specific.mediumsq.frags_nr, req, sendq_index) < 0))
+  if (unlikely(omx__endpoint_sendq_map_get(ep, frags_nr, req, sendq_index) < 0))
     return OMX_INTERNAL_MISSING_RESOURCES;
   req->generic.missing_resources &= ~OMX_REQUEST_RESOURCE_SENDQ_SLOT;
   omx__debug_assert(!req->generic.missing_resources);
@@ -633,6 +588,7 @@ omx__alloc_setup_isend_mediumsq(struct omx_endpoint *ep,
   medium_param->frag_pipeline = req->send.specific.mediumsq.frag_pipeline;
 #endif
   medium_param->msg_length = length;
+  medium_param->frags_nr = frags_nr;
   medium_param->session_id = partner->true_session_id;
 
 #ifdef OMX_LIB_DEBUG
@@ -670,6 +626,9 @@ omx__submit_isend_medium(struct omx_endpoint *ep,
   /* the default max medium length should fit in the maximal number of frags */
   BUILD_BUG_ON(OMX__MX_MEDIUM_MSG_LENGTH_MAX > OMX_MEDIUM_FRAG_LENGTH_MAX * OMX_MEDIUM_FRAGS_MAX);
 
+  /* all frags are posted to the driver at once */
+  BUILD_BUG_ON(OMX_MEDIUM_FRAGS_MAX > OMX_SEND_MEDIUMSQ_FRAGS_NR_MAX);
+
   if (use_sendq) {
     int frag_max = OMX_MEDIUM_FRAG_LENGTH_MAX;
     int frags_nr;
@@ -728,6 +687,7 @@ omx__post_isend_rndv(struct omx_endpoint *ep,
 		    (unsigned long long) omx__driver_desc->jiffies);
   rndv_param->piggyack = ack_upto;
 
+  omx__sync_send_batch(ep);
   err = ioctl(ep->fd, OMX_CMD_XEN_SEND_RNDV, rndv_param);
   if (unlikely(err < 0)) {
     omx_return_t ret;
@@ -883,12 +843,18 @@ omx__post_notify(struct omx_endpoint *ep,
 		    (unsigned long long) omx__driver_desc->jiffies);
   notify_param->piggyack = ack_upto;
 
-  err = ioctl(ep->fd, OMX_CMD_XEN_SEND_NOTIFY, notify_param);
-  if (unlikely(err < 0)) {
-    omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
-				       OMX_SUCCESS,
-				       "send notify message");
-    /* if OMX_NO_SYSTEM_RESOURCES, let the retransmission try again later */
+  if (omx__globals.send_batch > 1) {
+    /* submitted with the other commands of this round, a failed batch looks like a packet loss */
+    memcpy(omx__send_batch_queue(ep, OMX_CMD_SEND_NOTIFY), notify_param, sizeof(*notify_param));
+    err = 0;
+  } else {
+    err = ioctl(ep->fd, OMX_CMD_XEN_SEND_NOTIFY, notify_param);
+    if (unlikely(err < 0)) {
+      omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
+					 OMX_SUCCESS,
+					 "send notify message");
+      /* if OMX_NO_SYSTEM_RESOURCES, let the retransmission try again later */
+    }
   }
 
   req->generic.resends++;
@@ -896,6 +862,9 @@ omx__post_notify(struct omx_endpoint *ep,
 
   if (!err)
     omx__mark_partner_ack_sent(ep, partner);
+
+  /* do not wait for the end of a progression round, it may be disabled */
+  omx__flush_send_batch(ep);
 }
 
 static INLINE void
@@ -974,6 +943,47 @@ omx__submit_notify(struct omx_endpoint *ep,
  * ISEND Submission Routines
  */
 
+/*
+ * Sends to self match the posted receives, they need the whole endpoint.
+ * Other sends only need the send lock.
+ * Return 1 if the whole endpoint was locked.
+ */
+static INLINE int
+omx__isend_lock(struct omx_endpoint *ep, struct omx__partner *partner)
+{
+  if (unlikely(omx__globals.selfcomms && partner == ep->myself)) {
+    OMX__ENDPOINT_LOCK(ep);
+    return 1;
+  }
+
+  OMX__ENDPOINT_SEND_LOCK(ep);
+  return 0;
+}
+
+static INLINE void
+omx__isend_unlock(struct omx_endpoint *ep, int whole)
+{
+  if (unlikely(whole))
+    OMX__ENDPOINT_UNLOCK(ep);
+  else
+    OMX__ENDPOINT_SEND_UNLOCK(ep);
+}
+
+/* release the lock after submitting and progress a little bit */
+static INLINE void
+omx__isend_unlock_progress(struct omx_endpoint *ep, int whole)
+{
+  if (unlikely(whole)) {
+    omx__progress(ep);
+    /* submit a queued tiny even if progression is disabled */
+    omx__flush_send_batch(ep);
+    OMX__ENDPOINT_UNLOCK(ep);
+  } else {
+    OMX__ENDPOINT_SEND_UNLOCK(ep);
+    omx__try_progress(ep);
+  }
+}
+
 static INLINE omx_return_t
 omx__isend_req(struct omx_endpoint *ep, struct omx__partner *partner,
 	       union omx_request *req, union omx_request **requestp)
@@ -1010,9 +1020,6 @@ omx__isend_req(struct omx_endpoint *ep, struct omx__partner *partner,
     omx__forget(ep, req);
   }
 
-  /* progress a little bit */
-  omx__progress(ep);
-
  return OMX_SUCCESS;
 }
 
@@ -1024,34 +1031,37 @@ omx_isend(struct omx_endpoint *ep,
 	  uint64_t match_info,
 	  void *context, union omx_request **requestp)
 {
-  struct omx__partner *partner;
+  struct omx__partner *partner = omx__partner_from_addr(&dest_endpoint);
   union omx_request *req;
-  omx_return_t ret = OMX_SUCCESS;
-
-  OMX__ENDPOINT_LOCK(ep);
+  int whole;
+  omx_return_t ret;
 
-  req = omx__request_alloc(ep);
-  if (unlikely(!req)) {
-    ret = omx__error_with_ep(ep, OMX_NO_RESOURCES, "Allocating isend request");
-    goto out_with_lock;
-  }
+  /* setup the request before taking any lock */
+  req = omx___request_alloc(ep);
+  if (unlikely(!req))
+    return omx__error_with_ep(ep, OMX_NO_RESOURCES, "Allocating isend request");
 
   omx_cache_single_segment(&req->send.segs, buffer, length);
 
-  req->generic.partner = partner = omx__partner_from_addr(&dest_endpoint);
+  req->generic.partner = partner;
   req->generic.status.addr = dest_endpoint;
   req->generic.status.match_info = match_info;
   req->generic.status.context = context;
 
+  whole = omx__isend_lock(ep, partner);
+  omx__request_alloc_account(ep, 1);
+
   ret = omx__isend_req(ep, partner, req, requestp);
-  if (likely(ret != OMX_SUCCESS)) {
+  if (unlikely(ret != OMX_SUCCESS)) {
+    omx__request_alloc_account(ep, -1);
+    omx__isend_unlock(ep, whole);
     omx_free_segments(ep, &req->send.segs);
-    omx__request_free(ep, req);
+    omx___request_free(ep, req);
+    return ret;
   }
 
- out_with_lock:
-  OMX__ENDPOINT_UNLOCK(ep);
-  return ret;
+  omx__isend_unlock_progress(ep, whole);
+  return OMX_SUCCESS;
 }
 
 /* API omx_isendv */
@@ -1062,42 +1072,44 @@ omx_isendv(omx_endpoint_t ep,
 	   uint64_t match_info,
 	   void * context, omx_request_t * requestp)
 {
-  struct omx__partner *partner;
+  struct omx__partner *partner = omx__partner_from_addr(&dest_endpoint);
   union omx_request *req;
+  int whole;
   omx_return_t ret;
 
-  OMX__ENDPOINT_LOCK(ep);
-
-  req = omx__request_alloc(ep);
-  if (unlikely(!req)) {
-    ret = omx__error_with_ep(ep, OMX_NO_RESOURCES, "Allocating vectorial isend request");
-    goto out_with_lock;
-  }
+  /* setup the request before taking any lock */
+  req = omx___request_alloc(ep);
+  if (unlikely(!req))
+    return omx__error_with_ep(ep, OMX_NO_RESOURCES, "Allocating vectorial isend request");
 
   ret = omx_cache_segments(ep, &req->send.segs, segs, nseg);
   if (unlikely(ret != OMX_SUCCESS)) {
+    omx___request_free(ep, req);
     /* the callee let us check errors */
-    ret = omx__error_with_ep(ep, ret,
-			     "Allocating %ld-vectorial isend request segment array",
-			     (unsigned long long) nseg);
-    omx__request_free(ep, req);
-    goto out_with_lock;
+    return omx__error_with_ep(ep, ret,
+			      "Allocating %ld-vectorial isend request segment array",
+			      (unsigned long long) nseg);
   }
 
-  req->generic.partner = partner = omx__partner_from_addr(&dest_endpoint);
+  req->generic.partner = partner;
   req->generic.status.addr = dest_endpoint;
   req->generic.status.match_info = match_info;
   req->generic.status.context = context;
 
+  whole = omx__isend_lock(ep, partner);
+  omx__request_alloc_account(ep, 1);
+
   ret = omx__isend_req(ep, partner, req, requestp);
-  if (likely(ret != OMX_SUCCESS)) {
+  if (unlikely(ret != OMX_SUCCESS)) {
+    omx__request_alloc_account(ep, -1);
+    omx__isend_unlock(ep, whole);
     omx_free_segments(ep, &req->send.segs);
-    omx__request_free(ep, req);
+    omx___request_free(ep, req);
+    return ret;
   }
 
- out_with_lock:
-  OMX__ENDPOINT_UNLOCK(ep);
-  return ret;
+  omx__isend_unlock_progress(ep, whole);
+  return OMX_SUCCESS;
 }
 
 /*****************************
@@ -1123,9 +1135,6 @@ omx__issend_req(struct omx_endpoint *ep, struct omx__partner *partner,
   } else {
     omx__forget(ep, req);
   }
-
-  /* progress a little bit */
-  omx__progress(ep);
 }
 
 /* API omx_issend */
@@ -1136,30 +1145,29 @@ omx_issend(struct omx_endpoint *ep,
 	   uint64_t match_info,
 	   void *context, union omx_request **requestp)
 {
-  struct omx__partner *partner;
+  struct omx__partner *partner = omx__partner_from_addr(&dest_endpoint);
   union omx_request *req;
-  omx_return_t ret = OMX_SUCCESS;
-
-  OMX__ENDPOINT_LOCK(ep);
+  int whole;
 
-  req = omx__request_alloc(ep);
-  if (unlikely(!req)) {
-    ret = omx__error_with_ep(ep, OMX_NO_RESOURCES, "Allocating issend request");
-    goto out_with_lock;
-  }
+  /* setup the request before taking any lock */
+  req = omx___request_alloc(ep);
+  if (unlikely(!req))
+    return omx__error_with_ep(ep, OMX_NO_RESOURCES, "Allocating issend request");
 
   omx_cache_single_segment(&req->send.segs, buffer, length);
 
-  req->generic.partner = partner = omx__partner_from_addr(&dest_endpoint);
+  req->generic.partner = partner;
   req->generic.status.addr = dest_endpoint;
   req->generic.status.match_info = match_info;
   req->generic.status.context = context;
 
+  whole = omx__isend_lock(ep, partner);
+  omx__request_alloc_account(ep, 1);
+
   omx__issend_req(ep, partner, req, requestp);
 
- out_with_lock:
-  OMX__ENDPOINT_UNLOCK(ep);
-  return ret;
+  omx__isend_unlock_progress(ep, whole);
+  return OMX_SUCCESS;
 }
 
 /* API omx_issendv */
@@ -1170,38 +1178,37 @@ omx_issendv(omx_endpoint_t ep,
 	    uint64_t match_info,
 	    void * context, omx_request_t * requestp)
 {
-  struct omx__partner *partner;
+  struct omx__partner *partner = omx__partner_from_addr(&dest_endpoint);
   union omx_request *req;
+  int whole;
   omx_return_t ret;
 
-  OMX__ENDPOINT_LOCK(ep);
-
-  req = omx__request_alloc(ep);
-  if (unlikely(!req)) {
-    ret = omx__error_with_ep(ep, OMX_NO_RESOURCES, "Allocating vectorial issend request");
-    goto out_with_lock;
-  }
+  /* setup the request before taking any lock */
+  req = omx___request_alloc(ep);
+  if (unlikely(!req))
+    return omx__error_with_ep(ep, OMX_NO_RESOURCES, "Allocating vectorial issend request");
 
   ret = omx_cache_segments(ep, &req->send.segs, segs, nseg);
   if (unlikely(ret != OMX_SUCCESS)) {
+    omx___request_free(ep, req);
     /* the callee let us check errors */
-    ret = omx__error_with_ep(ep, ret,
-			     "Allocating %ld-vectorial issend request segment array",
-			     (unsigned long long) nseg);
-    omx__request_free(ep, req);
-    goto out_with_lock;
+    return omx__error_with_ep(ep, ret,
+			      "Allocating %ld-vectorial issend request segment array",
+			      (unsigned long long) nseg);
   }
 
-  req->generic.partner = partner = omx__partner_from_addr(&dest_endpoint);
+  req->generic.partner = partner;
   req->generic.status.addr = dest_endpoint;
   req->generic.status.match_info = match_info;
   req->generic.status.context = context;
 
+  whole = omx__isend_lock(ep, partner);
+  omx__request_alloc_account(ep, 1);
+
   omx__issend_req(ep, partner, req, requestp);
 
- out_with_lock:
-  OMX__ENDPOINT_UNLOCK(ep);
-  return ret;
+  omx__isend_unlock_progress(ep, whole);
+  return OMX_SUCCESS;
 }
 
 /*******************
@@ -1337,7 +1344,7 @@ omx__release_unsent_send_resources(struct omx_endpoint *ep, union omx_request *r
 
   case OMX_REQUEST_TYPE_SEND_MEDIUMSQ:
     if (!(res & OMX_REQUEST_RESOURCE_EXP_EVENT))
-      ep->avail_exp_events += req->send.specific.mediumsq.frags_nr;
+      ep->avail_exp_events++;
 
     /* make sure we don't release garbage sendq map slots */
     if (res & OMX_REQUEST_RESOURCE_SENDQ_SLOT)
@@ -1463,14 +1470,13 @@ omx__process_resend_requests(struct omx_endpoint *ep)
       omx__debug_printf(SEND, ep, "reposting resend mediumsq request %p seqnum %d (#%d)\n", req,
 			(unsigned) OMX__SEQNUM(req->generic.send_seqnum),
 			(unsigned) OMX__SESNUM_SHIFTED(req->generic.send_seqnum));
-      if (ep->avail_exp_events < req->send.specific.mediumsq.frags_nr) {
-	/* not enough expected events available, stop resending for now, and try again later */
-	omx__debug_printf(SEND, ep, "stopping resending for now, only %d exp events available to resend %d mediumsq frags\n",
-			  ep->avail_exp_events, req->send.specific.mediumsq.frags_nr);
+      if (!ep->avail_exp_events) {
+	/* no expected event available, stop resending for now, and try again later */
+	omx__debug_printf(SEND, ep, "stopping resending for now, no exp events available to resend mediumsq\n");
 	omx__requeue_request(&ep->non_acked_req_q, req);
 	goto done_resending;
       }
-      ep->avail_exp_events -= req->send.specific.mediumsq.frags_nr;
+      ep->avail_exp_events--;
       omx__post_isend_mediumsq(ep, req->generic.partner, req);
       break;
     case OMX_REQUEST_TYPE_SEND_MEDIUMVA:
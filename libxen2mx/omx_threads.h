@@ -19,6 +19,8 @@
 #ifndef __omx_threads_h__
 #define __omx_threads_h__
 
+#include <errno.h>
+
 #ifdef OMX_LIB_THREAD_SAFETY
 
 #include <pthread.h>
@@ -31,10 +33,19 @@ struct omx__cond {
   pthread_cond_t _cond;
 };
 
+struct omx__thread {
+  pthread_t _thread;
+};
+
+struct omx__thread_key {
+  pthread_key_t _key;
+};
+
 #define OMX__LOCK_INITIALIZER { PTHREAD_MUTEX_INITIALIZER }
 #define omx__lock_init(lock) pthread_mutex_init(&(lock)->_mutex, NULL)
 #define omx__lock_destroy(lock) pthread_mutex_destroy(&(lock)->_mutex)
 #define omx__lock(lock) pthread_mutex_lock(&(lock)->_mutex)
+#define omx__trylock(lock) pthread_mutex_trylock(&(lock)->_mutex)
 #define omx__unlock(lock) pthread_mutex_unlock(&(lock)->_mutex)
 
 #define omx__cond_init(cond) pthread_cond_init(&(cond)->_cond, NULL)
@@ -42,9 +53,21 @@ struct omx__cond {
 #define omx__cond_signal(cond) pthread_cond_signal(&(cond)->_cond)
 #define omx__cond_wait(cond, lock) pthread_cond_wait(&(cond)->_cond, &(lock)->_mutex)
 
+/* the application may not be linked with the pthread library */
+#define omx__thread_create(thread, func, arg) \
+  (pthread_create ? pthread_create(&(thread)->_thread, NULL, func, arg) : ENOSYS)
+#define omx__thread_join(thread) pthread_join((thread)->_thread, NULL)
+
+#define omx__thread_key_create(key, destructor) \
+  (pthread_key_create ? pthread_key_create(&(key)->_key, destructor) : ENOSYS)
+#define omx__thread_key_set(key, value) pthread_setspecific((key)->_key, value)
+
+#define OMX__THREAD_LOCAL __thread
+
 #pragma weak pthread_mutex_init
 #pragma weak pthread_mutex_destroy
 #pragma weak pthread_mutex_lock
+#pragma weak pthread_mutex_trylock
 #pragma weak pthread_mutex_unlock
 
 #pragma weak pthread_cond_init
@@ -52,14 +75,23 @@ struct omx__cond {
 #pragma weak pthread_cond_signal
 #pragma weak pthread_cond_wait
 
+#pragma weak pthread_create
+#pragma weak pthread_join
+
+#pragma weak pthread_key_create
+#pragma weak pthread_setspecific
+
 #else /* !OMX_LIB_THREAD_SAFETY */
 
 struct omx__lock { /* nothing */ };
 struct omx__cond { /* nothing */ };
+struct omx__thread { /* nothing */ };
+struct omx__thread_key { /* nothing */ };
 
 #define omx__lock_init(lock) do { /* nothing */ } while (0)
 #define omx__lock_destroy(lock) do { /* nothing */ } while (0)
 #define omx__lock(lock) do { /* nothing */ } while (0)
+#define omx__trylock(lock) 0
 #define omx__unlock(lock) do { /* nothing */ } while (0)
 
 #define omx__cond_init(cond) do { /* nothing */ } while (0)
@@ -67,6 +99,14 @@ struct omx__cond { /* nothing */ };
 #define omx__cond_signal(cond) do { /* nothing */ } while (0)
 #define omx__cond_wait(cond, lock) do { /* nothing */ } while (0)
 
+#define omx__thread_create(thread, func, arg) ENOSYS
+#define omx__thread_join(thread) do { /* nothing */ } while (0)
+
+#define omx__thread_key_create(key, destructor) ENOSYS
+#define omx__thread_key_set(key, value) do { /* nothing */ } while (0)
+
+#define OMX__THREAD_LOCAL /* nothing */
+
 #endif /* !OMX_LIB_THREAD_SAFETY */
 
 #endif /* __omx_threads__ */
@@ -237,6 +237,38 @@ enum omx__request_resource {
 #define OMX_REQUEST_SEND_LARGE_RESOURCES (OMX_REQUEST_RESOURCE_SEND_LARGE_REGION | OMX_REQUEST_RESOURCE_LARGE_REGION)
 #define OMX_REQUEST_PULL_RESOURCES (OMX_REQUEST_RESOURCE_EXP_EVENT | OMX_REQUEST_RESOURCE_LARGE_REGION | OMX_REQUEST_RESOURCE_PULL_HANDLE)
 
+/* requests are allocated per chunk, each of them in its own cache lines */
+#define OMX__REQUEST_CACHELINE_SIZE 64
+#define OMX__REQUEST_CHUNK_NR 64
+
+/* per-thread cache of free requests of a single endpoint */
+#define OMX__REQUEST_MAGAZINE_SIZE 32
+
+/*
+ * unexpected message buffers are recycled per size class, small messages,
+ * single-page mediums, and mediums up to the default rendezvous threshold
+ */
+#define OMX__UNEXP_BUFFER_CLASS_NR 3
+#define OMX__UNEXP_BUFFER_CACHE_MAX 64
+
+/*
+ * the request cache outlives its endpoint while some thread magazines still
+ * point to it, its requests are freed with the endpoint
+ */
+struct omx__request_cache {
+  struct omx__lock lock;
+  struct list_head free_q; /* free requests that are not in any thread magazine, queued by their queue_elt */
+  struct list_head chunks;
+  unsigned refcount; /* the endpoint and each magazine using it */
+  int closed;
+};
+
+struct omx__request_magazine {
+  struct omx__request_cache *cache; /* cache of the owning endpoint, NULL if none */
+  unsigned nr;
+  union omx_request * reqs[OMX__REQUEST_MAGAZINE_SIZE];
+};
+
 struct omx_endpoint {
   int fd;
   unsigned endpoint_index, board_index;
@@ -244,6 +276,7 @@ struct omx_endpoint {
   char board_addr_str[OMX_BOARD_ADDR_STRLEN];
   uint32_t app_key;
   struct omx__lock lock;
+  struct omx__lock recv_lock, send_lock;
 #if OMX_LIB_DLMALLOC
   void * malloc_data;
 #endif
@@ -257,6 +290,10 @@ struct omx_endpoint {
 #ifdef OMX_LIB_DEBUG
   uint64_t last_progress_jiffies;
 #endif
+  uint64_t last_progress_timers_jiffies;
+  uint64_t progress_calls, progress_busy_calls; /* busy ones processed events or pending queues */
+  uint32_t completion_gen; /* bumped when a request completes or an unexpected message is queued,
+			    * lets threads spin without the endpoint lock */
   void * sendq;
   const void * recvq;
   const void * exp_eventq, * unexp_eventq;
@@ -278,15 +315,36 @@ struct omx_endpoint {
     struct list_head done_req_q;
     /* unexpected receive, may be partial (queued by their queue_elt) */
     struct list_head unexp_req_q;
+    /* same unexpected receives, hashed by match info with omx__recv_hash() (queued by their recv.unexp_hash_elt) */
+    struct list_head * unexp_hash;
   } anyctxid;
 
+  /* free unexpected buffers, chained through their first bytes */
+  void * unexp_buffer_free[OMX__UNEXP_BUFFER_CLASS_NR];
+  unsigned unexp_buffer_free_nr[OMX__UNEXP_BUFFER_CLASS_NR];
+  /* bytes of unexpected data currently buffered, and their limit (0 if none) */
+  uint64_t unexp_bytes, unexp_bytes_max;
+  /* unexpected receives whose data still lives in the recvq, indexed by unexpected event slot (NULL once released),
+   * the release index published in the endpoint descriptor stops at the oldest of them */
+  union omx_request * unexp_slot_req[OMX_UNEXP_EVENTQ_ENTRY_NR];
+  omx_eventq_index_t unexp_event_index; /* slot of the unexpected event being processed */
+  omx_eventq_index_t unexp_released_index; /* release index published in the endpoint descriptor */
+  unsigned unexp_slots_held_nr;
+  uint32_t unexp_slots_pinned_max; /* slots that held receives may keep from the driver, 0 disables holding */
+
   /* context id array for multiplexed queues */
   struct {
     /* unexpected receive, may be partial (queued by their ctxid_elt, only if there are multiple ctxids) */
     struct list_head unexp_req_q;
-    /* posted non-matched receive (queued by their queue_elt) */
+    /* posted non-matched receive with a wildcard match mask (queued by their queue_elt) */
     /* (we could queue by the ctxid_elt but we would need another recv_req_q to ensure conservation of matter) */
     struct list_head recv_req_q;
+    /* posted non-matched receive with a full match mask, hashed by match info (queued by their queue_elt) */
+    /* (OMX__RECV_HASH_SIZE buckets, allocated when the first one is posted) */
+    struct list_head * recv_hash;
+    unsigned recv_hash_nr;
+    /* stamp of the next posted receive, to match the oldest of the recv_req_q and recv_hash candidates */
+    uint32_t next_recv_stamp;
 
     /* done requests (queued by their ctxid_elt, only if there are multiple ctxids) */
     struct list_head done_req_q;
@@ -330,7 +388,17 @@ struct omx_endpoint {
   struct list_head partners_to_ack_delayed_list;
   struct list_head throttling_partners_list;
 
+  /* tiny/notify/liback commands waiting to be submitted together (Xen only) */
+  struct omx_cmd_send_batch_entry send_batch[OMX_SEND_BATCH_ENTRY_NR_MAX];
+  unsigned send_batch_nr;
+
   struct list_head sleepers;
+  uint32_t last_sleeper_id; /* identifies sleepers in the driver for targeted wakeups */
+
+  /* optional asynchronous progression thread */
+  int progress_thread_running;
+  int progress_thread_stop;
+  struct omx__thread progress_thread;
 
   struct list_head reg_list; /* registered single-segment windows */
   struct list_head reg_unused_list; /* unused registered single-segment windows, LRU in front */
@@ -342,15 +410,59 @@ struct omx_endpoint {
 
   struct list_head omx_endpoints_list_elt;
 
+  struct omx__request_cache *req_cache;
+
 #ifdef OMX_LIB_DEBUG
   unsigned int req_alloc_nr;
 #endif
   char *message_prefix;
 };
 
-#define OMX__ENDPOINT_LOCK(ep) omx__lock(&(ep)->lock)
-#define OMX__ENDPOINT_UNLOCK(ep) omx__unlock(&(ep)->lock)
-#define OMX__ENDPOINT_HANDLER_DONE_WAIT(ep) omx__cond_wait(&(ep)->in_handler_cond, &(ep)->lock)
+/*
+ * Locking order:
+ * + omx__global_lock protects the endpoint list and message prefixes
+ * + ep->lock protects progression: event queues, timers and resends,
+ *   connections and handlers
+ * + ep->recv_lock protects matching: posted and unexpected receive queues
+ *   and unexpected buffers
+ * + ep->send_lock protects send submission: the send and ack side of
+ *   partners, delayed requests, sendq and large region maps, the cmdq batch,
+ *   and also request states, completion queues and the sleepers waiting for
+ *   them since sends complete early while being submitted
+ * + ep->req_cache->lock protects the request chunks, free queue and
+ *   cache refcount, it may be taken without any endpoint lock for the
+ *   cache of another endpoint (the per-thread request magazines need no lock)
+ * OMX__ENDPOINT_LOCK takes the three endpoint locks since the progression engine
+ * and most API routines walk all domains. omx_isend, omx_irecv and
+ * omx_test only take their own lock when they do not need another domain,
+ * and then progress only if no other thread holds ep->lock. Anything that
+ * is only modified under OMX__ENDPOINT_LOCK, such as the receive side of
+ * partners, may be read under any of the three locks.
+ * The event queue slots, request states and completion_gen may be read
+ * without any lock to decide whether taking a lock is worth it.
+ */
+#define OMX__ENDPOINT_LOCK(ep) do {		\
+  omx__lock(&(ep)->lock);			\
+  omx__lock(&(ep)->recv_lock);			\
+  omx__lock(&(ep)->send_lock);			\
+} while (0)
+#define OMX__ENDPOINT_UNLOCK(ep) do {		\
+  omx__unlock(&(ep)->send_lock);		\
+  omx__unlock(&(ep)->recv_lock);		\
+  omx__unlock(&(ep)->lock);			\
+} while (0)
+#define OMX__ENDPOINT_RECV_LOCK(ep) omx__lock(&(ep)->recv_lock)
+#define OMX__ENDPOINT_RECV_UNLOCK(ep) omx__unlock(&(ep)->recv_lock)
+#define OMX__ENDPOINT_SEND_LOCK(ep) omx__lock(&(ep)->send_lock)
+#define OMX__ENDPOINT_SEND_UNLOCK(ep) omx__unlock(&(ep)->send_lock)
+/* let the handler thread take the whole endpoint back */
+#define OMX__ENDPOINT_HANDLER_DONE_WAIT(ep) do {		\
+  omx__unlock(&(ep)->send_lock);				\
+  omx__unlock(&(ep)->recv_lock);				\
+  omx__cond_wait(&(ep)->in_handler_cond, &(ep)->lock);		\
+  omx__lock(&(ep)->recv_lock);					\
+  omx__lock(&(ep)->send_lock);					\
+} while (0)
 #define OMX__ENDPOINT_HANDLER_DONE_SIGNAL(ep) omx__cond_signal(&(ep)->in_handler_cond)
 
 enum omx__request_type {
@@ -389,8 +501,8 @@ enum omx__request_type {
  *   NEED_REPLY: ep->large_send_req_q
  *   NEED_ACK (unlikely): ep->non_acked_req_q + partner->non_acked_req_q
  * RECV (not RECV_LARGE):
- *   UNEXPECTED_RECV: ep->unexp_req_q
- *   UNEXPECTED_RECV | RECV_PARTIAL: ep->unexp_req_q + partner->partial_medium_recv_req_q
+ *   UNEXPECTED_RECV: ep->unexp_req_q + ep->unexp_hash
+ *   UNEXPECTED_RECV | RECV_PARTIAL: ep->unexp_req_q + ep->unexp_hash + partner->partial_medium_recv_req_q
  *   RECV_PARTIAL: ep->partial_medium_recv_req_q(DBG) + partner->partial_medium_recv_req_q
  * RECV_LARGE:
  *   DRIVER_PULLING: ep->driver_pulling_req_q
@@ -438,7 +550,9 @@ enum omx__request_state {
   /* request has been completed by the application and should not be notified when done for real (including acked) */
   OMX_REQUEST_STATE_ZOMBIE = (1<<11),
   /* request is internal, should not be queued in the doneq for peek/test_any */
-  OMX_REQUEST_STATE_INTERNAL = (1<<12)
+  OMX_REQUEST_STATE_INTERNAL = (1<<12),
+  /* unexpected receive whose data is still in its recvq slot */
+  OMX_REQUEST_STATE_RECV_UNEXP_SLOT = (1<<13)
 };
 
 struct omx__generic_request {
@@ -487,13 +601,11 @@ union omx_request {
 	void *copy; /* buffered data attached the request */
       } small;
       struct {
-	struct omx_cmd_send_mediumsq_frag send_mediumsq_frag_ioctl_param;
+	struct omx_cmd_send_mediumsq send_mediumsq_ioctl_param; /* also stores the sendq map index of each frag */
 	uint32_t frags_nr;
-	uint32_t frags_pending_nr;
 #ifdef OMX_MX_WIRE_COMPAT
 	unsigned frag_pipeline;
 #endif
-	omx_sendq_map_index_t sendq_map_index[OMX_MEDIUM_FRAGS_MAX];
       } mediumsq;
       struct {
 	struct omx_cmd_send_mediumva send_mediumva_ioctl_param;
@@ -511,8 +623,11 @@ union omx_request {
     struct omx__req_segs segs;
     uint64_t match_info;
     uint64_t match_mask;
+    uint32_t post_stamp; /* posting order among the ctxid posted receives */
+    struct list_head unexp_hash_elt; /* queued in ep->anyctxid.unexp_hash while unexpected */
     uint16_t checksum; /* checksum given by sender in incoming send */
     omx__seqnum_t seqnum; /* seqnum of the incoming matched send */
+    omx_eventq_index_t unexp_slot; /* unexpected event slot of the data, if RECV_UNEXP_SLOT */
     union {
       struct {
 	uint32_t frags_received_mask;
@@ -572,6 +687,7 @@ struct omx__globals {
   int debug_checksum;
   int check_request_alloc;
   int medium_sendq;
+  unsigned send_batch;
   uint32_t any_endpoint_id;
   int selfcomms;
   int sharedcomms;
@@ -584,6 +700,10 @@ struct omx__globals {
   unsigned ctxid_bits;
   unsigned ctxid_shift;
   char *process_binding;
+  uint32_t unexp_queue_max;
+  uint32_t unexp_slots_max;
+  int progress_thread;
+  char *progress_thread_binding;
   char *message_prefix;
   char *message_prefix_format;
   unsigned abort_sleeps;
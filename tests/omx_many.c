@@ -43,6 +43,7 @@ usage(int argc, char *argv[])
   fprintf(stderr, "Common options:\n");
   fprintf(stderr, " -b <n>\tchange local board id [%d]\n", BID);
   fprintf(stderr, " -e <n>\tchange local endpoint id [%d]\n", EID);
+  fprintf(stderr, " -B <n>\treap completions by batches of <n> with omx_test_many\n");
   fprintf(stderr, "Sender options:\n");
   fprintf(stderr, " -d <hostname>\tset remote peer name and switch to sender mode\n");
   fprintf(stderr, " -r <n>\tchange remote endpoint id [%d]\n", RID);
@@ -61,6 +62,8 @@ int main(int argc, char *argv[])
   int eid = EID;
   int rid = RID;
   int iter = ITER;
+  int batch = 0;
+  omx_status_t *statuses = NULL;
   char my_hostname[OMX_HOSTNAMELEN_MAX];
   char my_ifacename[OMX_BOARD_ADDR_STRLEN];
   char *dest_hostname = NULL;
@@ -72,7 +75,7 @@ int main(int argc, char *argv[])
   int length[NLEN] = { LEN1, LEN2, LEN3, LEN4, LEN5, LEN6 };
   int maxlen = LEN6;
 
-  while ((c = getopt(argc, argv, "b:e:d:r:l:N:h")) != -1)
+  while ((c = getopt(argc, argv, "b:e:B:d:r:l:N:h")) != -1)
     switch (c) {
     case 'b':
       bid = atoi(optarg);
@@ -80,6 +83,9 @@ int main(int argc, char *argv[])
     case 'e':
       eid = atoi(optarg);
       break;
+    case 'B':
+      batch = atoi(optarg);
+      break;
     case 'd':
       dest_hostname = strdup(optarg);
       sender = 1;
@@ -149,6 +155,14 @@ int main(int argc, char *argv[])
     goto out_with_ep;
   }
 
+  if (batch > 0) {
+    statuses = malloc(batch * sizeof(*statuses));
+    if (!statuses) {
+      fprintf(stderr, "Failed to allocate %d statuses\n", batch);
+      goto out_with_ep_and_buffer;
+    }
+  }
+
   printf("Successfully open endpoint %d for hostname '%s' iface '%s'\n",
          eid, my_hostname, my_ifacename);
 
@@ -181,10 +195,13 @@ int main(int argc, char *argv[])
 	}
       }
     }
-    for(i=0; i<iter*nlen; i++) {
-      omx_wait_any(ep, 0, 0, &status, &result, OMX_TIMEOUT_INFINITE);
-      if (ret != OMX_SUCCESS || !result) {
-	fprintf(stderr, "Failed to post wait any, %s\n", omx_strerror(ret));
+    for(i=0; i<iter*nlen; i += result) {
+      if (batch > 0)
+	ret = omx_test_many(ep, statuses, batch, &result);
+      else
+	ret = omx_wait_any(ep, 0, 0, &status, &result, OMX_TIMEOUT_INFINITE);
+      if (ret != OMX_SUCCESS || (!batch && !result)) {
+	fprintf(stderr, "Failed to reap completions, %s\n", omx_strerror(ret));
 	goto out_with_ep_and_buffer;
       }
     }
@@ -205,10 +222,13 @@ int main(int argc, char *argv[])
 	goto out_with_ep_and_buffer;
       }
     }
-    for(i=0; i<iter*nlen; i++) {
-      omx_wait_any(ep, 0, 0, &status, &result, OMX_TIMEOUT_INFINITE);
-      if (ret != OMX_SUCCESS || !result) {
-	fprintf(stderr, "Failed to post wait any, %s\n", omx_strerror(ret));
+    for(i=0; i<iter*nlen; i += result) {
+      if (batch > 0)
+	ret = omx_test_many(ep, statuses, batch, &result);
+      else
+	ret = omx_wait_any(ep, 0, 0, &status, &result, OMX_TIMEOUT_INFINITE);
+      if (ret != OMX_SUCCESS || (!batch && !result)) {
+	fprintf(stderr, "Failed to reap completions, %s\n", omx_strerror(ret));
 	goto out_with_ep_and_buffer;
       }
     }
@@ -216,10 +236,12 @@ int main(int argc, char *argv[])
 
   omx_close_endpoint(ep);
   free(dest_hostname);
+  free(statuses);
   free(buffer);
   return 0;
 
  out_with_ep_and_buffer:
+  free(statuses);
   free(buffer);
 
  out_with_ep:
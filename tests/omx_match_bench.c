@@ -0,0 +1,193 @@
+/*
+ * Xen2MX
+ * Copyright © Anastassios Nanos 2012
+ * (see AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License in COPYING.GPL for more details.
+ */
+
+/*
+ * Measure the cost of matching an incoming message against a growing
+ * number of posted receives that it does not match, or of posting a
+ * receive in front of a growing unexpected backlog (-u). Messages are
+ * sent to self so that only the library matching is involved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <assert.h>
+#include <sys/time.h>
+
+#include "open-mx.h"
+
+#define BID 0
+#define EID OMX_ANY_ENDPOINT
+#define ITER 10000
+#define DEPTH_MAX 4096
+#define MATCH_INFO 0x1ULL
+#define POSTED_MATCH_INFO 0x100000000ULL
+
+static void
+usage(int argc, char *argv[])
+{
+  fprintf(stderr, "%s [options]\n", argv[0]);
+  fprintf(stderr, " -b <n>\tchange local board id [%d]\n", BID);
+  fprintf(stderr, " -e <n>\tchange local endpoint id [%d]\n", EID);
+  fprintf(stderr, " -D <n>\tmaximal number of non-matching posted receives or unexpected messages [%d]\n", DEPTH_MAX);
+  fprintf(stderr, " -N <n>\tchange number of iterations [%d]\n", ITER);
+  fprintf(stderr, " -u\tqueue non-matching unexpected messages instead of posted receives\n");
+  fprintf(stderr, " -w\tuse a wildcard mask for the non-matching receives, or for the benchmark ones with -u\n");
+}
+
+int main(int argc, char *argv[])
+{
+  omx_endpoint_t ep;
+  omx_endpoint_addr_t addr;
+  omx_request_t *posted, *unexp;
+  omx_request_t sreq, rreq;
+  omx_status_t status;
+  omx_return_t ret;
+  uint32_t result;
+  uint64_t posted_mask = -1ULL;
+  uint64_t mask = -1ULL;
+  int unexpected = 0;
+  int board_index = BID;
+  int endpoint_index = EID;
+  int depth_max = DEPTH_MAX;
+  int iter = ITER;
+  int depth, i, c;
+
+  while ((c = getopt(argc, argv, "e:b:D:N:uwh")) != -1)
+    switch (c) {
+    case 'b':
+      board_index = atoi(optarg);
+      break;
+    case 'e':
+      endpoint_index = atoi(optarg);
+      break;
+    case 'D':
+      depth_max = atoi(optarg);
+      break;
+    case 'N':
+      iter = atoi(optarg);
+      break;
+    case 'u':
+      unexpected = 1;
+      break;
+    case 'w':
+      /* only the low bits are wildcards, still never matching MATCH_INFO */
+      posted_mask = mask = ~0xffULL;
+      break;
+    default:
+      fprintf(stderr, "Unknown option -%c\n", c);
+    case 'h':
+      usage(argc, argv);
+      exit(-1);
+      break;
+    }
+
+  if (unexpected)
+    posted_mask = -1ULL;
+  else
+    mask = -1ULL;
+
+  posted = malloc(depth_max * sizeof(*posted));
+  unexp = malloc(depth_max * sizeof(*unexp));
+  if (!posted || !unexp)
+    goto out;
+
+  ret = omx_init();
+  if (ret != OMX_SUCCESS) {
+    fprintf(stderr, "Failed to initialize (%s)\n",
+	    omx_strerror(ret));
+    goto out;
+  }
+
+  ret = omx_open_endpoint(board_index, endpoint_index, 0x12345678, NULL, 0, &ep);
+  if (ret != OMX_SUCCESS) {
+    fprintf(stderr, "Failed to open endpoint (%s)\n",
+	    omx_strerror(ret));
+    goto out;
+  }
+
+  ret = omx_get_endpoint_addr(ep, &addr);
+  if (ret != OMX_SUCCESS) {
+    fprintf(stderr, "Failed to get local endpoint address (%s)\n",
+	    omx_strerror(ret));
+    goto out_with_ep;
+  }
+
+  printf("%8s %12s\n", "depth", "us/msg");
+
+  for(depth=0; depth<=depth_max; depth = depth ? depth*4 : 1) {
+    struct timeval tv1, tv2;
+    unsigned long long total;
+
+    for(i=0; i<depth; i++) {
+      if (unexpected)
+	/* queue unexpected messages that the benchmark receives never match */
+	ret = omx_isend(ep, NULL, 0, addr, POSTED_MATCH_INFO * (i+1), NULL, &unexp[i]);
+      else
+	/* post receives that the benchmark messages never match */
+	ret = omx_irecv(ep, NULL, 0, (POSTED_MATCH_INFO * (i+1)) & posted_mask, posted_mask,
+			NULL, &posted[i]);
+      assert(ret == OMX_SUCCESS);
+    }
+
+    gettimeofday(&tv1, NULL);
+    for(i=0; i<iter; i++) {
+      if (unexpected) {
+	ret = omx_isend(ep, NULL, 0, addr, MATCH_INFO, NULL, &sreq);
+	assert(ret == OMX_SUCCESS);
+	ret = omx_irecv(ep, NULL, 0, MATCH_INFO & mask, mask, NULL, &rreq);
+	assert(ret == OMX_SUCCESS);
+      } else {
+	ret = omx_irecv(ep, NULL, 0, MATCH_INFO, -1ULL, NULL, &rreq);
+	assert(ret == OMX_SUCCESS);
+	ret = omx_isend(ep, NULL, 0, addr, MATCH_INFO, NULL, &sreq);
+	assert(ret == OMX_SUCCESS);
+      }
+      ret = omx_wait(ep, &rreq, &status, &result, OMX_TIMEOUT_INFINITE);
+      assert(ret == OMX_SUCCESS && result && status.code == OMX_SUCCESS);
+      ret = omx_wait(ep, &sreq, &status, &result, OMX_TIMEOUT_INFINITE);
+      assert(ret == OMX_SUCCESS && result && status.code == OMX_SUCCESS);
+    }
+    gettimeofday(&tv2, NULL);
+
+    total = (tv2.tv_sec-tv1.tv_sec)*1000000ULL+(tv2.tv_usec-tv1.tv_usec);
+    printf("%8d %12.3f\n", depth, (double) total / iter);
+
+    for(i=0; i<depth; i++) {
+      if (unexpected) {
+	/* drain the unexpected messages */
+	ret = omx_irecv(ep, NULL, 0, POSTED_MATCH_INFO * (i+1), -1ULL, NULL, &rreq);
+	assert(ret == OMX_SUCCESS);
+	ret = omx_wait(ep, &rreq, &status, &result, OMX_TIMEOUT_INFINITE);
+	assert(ret == OMX_SUCCESS && result);
+	ret = omx_wait(ep, &unexp[i], &status, &result, OMX_TIMEOUT_INFINITE);
+	assert(ret == OMX_SUCCESS && result);
+      } else {
+	ret = omx_cancel(ep, &posted[i], &result);
+	assert(ret == OMX_SUCCESS && result);
+      }
+    }
+  }
+
+ out_with_ep:
+  omx_close_endpoint(ep);
+ out:
+  free(posted);
+  free(unexp);
+  return 0;
+}
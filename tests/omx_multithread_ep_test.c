@@ -29,14 +29,23 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <arpa/inet.h>
+#include <sys/time.h>
 #include <pthread.h>
 
 #include "open-mx.h"
 
+#define RATE_ITER 10000
+#define RATE_LEN 8
+
+static int rate_iter = RATE_ITER;
+static int rate_len = RATE_LEN;
+
 static void
 usage(int argc, char *argv[])
 {
     fprintf(stderr, "%s [options]\n", argv[0]);
+    fprintf(stderr, " -N <n>\tchange number of iterations per thread in the shared endpoint rate test [%d]\n", RATE_ITER);
+    fprintf(stderr, " -s <n>\tchange message length in the shared endpoint rate test [%d]\n", RATE_LEN);
 }
 
 #ifdef OMX_HAVE_HWLOC
@@ -118,6 +127,103 @@ static void *threadfunc(void *_barriers)
   return 0;
 }
 
+/* all threads send to self through the same endpoint, each with its own buffers and match info */
+struct rate_thread_args {
+  omx_endpoint_t ep;
+  omx_endpoint_addr_t addr;
+  pthread_barrier_t *barrier;
+  uint64_t match_info;
+};
+
+static void *rate_threadfunc(void *_args)
+{
+  struct rate_thread_args *args = _args;
+  char *sbuf, *rbuf;
+  omx_request_t sreq, rreq;
+  omx_status_t status;
+  omx_return_t ret;
+  uint32_t result;
+  int i;
+
+  sbuf = malloc(rate_len);
+  rbuf = malloc(rate_len);
+  assert(sbuf && rbuf);
+
+  /* wait for all threads to be ready */
+  pthread_barrier_wait(args->barrier);
+
+  for(i=0; i<rate_iter; i++) {
+    ret = omx_irecv(args->ep, rbuf, rate_len, args->match_info, -1ULL, NULL, &rreq);
+    assert(ret == OMX_SUCCESS);
+    ret = omx_isend(args->ep, sbuf, rate_len, args->addr, args->match_info, NULL, &sreq);
+    assert(ret == OMX_SUCCESS);
+    ret = omx_wait(args->ep, &rreq, &status, &result, OMX_TIMEOUT_INFINITE);
+    assert(ret == OMX_SUCCESS && result && status.code == OMX_SUCCESS);
+    ret = omx_wait(args->ep, &sreq, &status, &result, OMX_TIMEOUT_INFINITE);
+    assert(ret == OMX_SUCCESS && result && status.code == OMX_SUCCESS);
+  }
+
+  free(sbuf);
+  free(rbuf);
+  return NULL;
+}
+
+/* report the message rate of 1, 2, 4... threads sharing a single endpoint */
+static void
+rate_test(pthread_t *th, unsigned nbthreads_max)
+{
+  struct rate_thread_args *args;
+  pthread_barrier_t barrier;
+  omx_endpoint_t ep;
+  omx_endpoint_addr_t addr;
+  omx_return_t ret;
+  unsigned nbthreads;
+  int i;
+
+  ret = omx_open_endpoint(OMX_ANY_NIC, OMX_ANY_ENDPOINT, 0, NULL, 0, &ep);
+  if (ret != OMX_SUCCESS)
+    return;
+  ret = omx_get_endpoint_addr(ep, &addr);
+  if (ret != OMX_SUCCESS)
+    goto out_with_ep;
+
+  args = malloc(nbthreads_max*sizeof(*args));
+  if (!args)
+    goto out_with_ep;
+
+  printf("%8s %12s %12s\n", "threads", "msg/s", "msg/s/thread");
+
+  for(nbthreads=1; nbthreads<=nbthreads_max; nbthreads *= 2) {
+    struct timeval tv1, tv2;
+    unsigned long long us;
+    double rate;
+
+    pthread_barrier_init(&barrier, NULL, nbthreads+1);
+    for(i=0; i<nbthreads; i++) {
+      args[i].ep = ep;
+      args[i].addr = addr;
+      args[i].barrier = &barrier;
+      args[i].match_info = i;
+      pthread_create(&th[i], NULL, rate_threadfunc, &args[i]);
+    }
+
+    pthread_barrier_wait(&barrier);
+    gettimeofday(&tv1, NULL);
+    for(i=0; i<nbthreads; i++)
+      pthread_join(th[i], NULL);
+    gettimeofday(&tv2, NULL);
+    pthread_barrier_destroy(&barrier);
+
+    us = (tv2.tv_sec-tv1.tv_sec)*1000000ULL+(tv2.tv_usec-tv1.tv_usec);
+    rate = (double) nbthreads * rate_iter * 1000000. / us;
+    printf("%8d %12.0f %12.0f\n", nbthreads, rate, rate / nbthreads);
+  }
+
+  free(args);
+ out_with_ep:
+  omx_close_endpoint(ep);
+}
+
 int main (int argc, char *argv[])
 {
   pthread_t *th;
@@ -126,8 +232,14 @@ int main (int argc, char *argv[])
   omx_return_t ret;
   int i, c;
 
-  while ((c = getopt (argc, argv, "h")) != -1)
+  while ((c = getopt (argc, argv, "N:s:h")) != -1)
     switch (c) {
+    case 'N':
+      rate_iter = atoi(optarg);
+      break;
+    case 's':
+      rate_len = atoi(optarg);
+      break;
     default:
       fprintf (stderr, "Unknown option -%c\n", c);
     case 'h':
@@ -152,6 +264,9 @@ int main (int argc, char *argv[])
   pthread_barrier_destroy(&barrier[0]);
   pthread_barrier_destroy(&barrier[1]);
 
+  /* now let the threads share a single endpoint */
+  rate_test(th, nbthreads);
+
   omx_finalize ();
   topology_exit();
   return 0;